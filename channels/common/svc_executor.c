@@ -0,0 +1,455 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shared executor for static virtual channel work
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/thread.h>
+
+#include <freerdp/channels/log.h>
+
+#include "svc_executor.h"
+
+#define TAG CHANNELS_TAG("svc.executor")
+
+/* Intrusive multi producer / single consumer queue (Vyukov). Producers only swap the head, the
+ * strand currently owning the queue is the single consumer. */
+typedef struct s_mpsc_node
+{
+	struct s_mpsc_node* volatile next;
+} MpscNode;
+
+typedef struct
+{
+	MpscNode* volatile head;
+	MpscNode* tail;
+	MpscNode stub;
+} MpscQueue;
+
+typedef struct
+{
+	MpscNode node;
+	svc_task_fn fn;
+	void* arg;
+} SvcTask;
+
+typedef struct s_svc_executor SvcExecutor;
+
+struct s_svc_strand
+{
+	SvcExecutor* executor;
+	MpscQueue tasks;
+	void* context;
+	volatile LONG scheduled; /* queued on or running in the executor */
+	BOOL closing;            /* only touched by the worker running the strand */
+	volatile LONG discard;   /* drop the tasks still queued instead of running them */
+	volatile LONG detached;  /* freed by the worker that runs the close, nobody waits */
+	HANDLE closed;
+	SvcStrand* readyNext;
+};
+
+struct s_svc_executor
+{
+	CRITICAL_SECTION lock;
+	SvcStrand* readyHead;
+	SvcStrand* readyTail;
+	HANDLE ready; /* semaphore, one count per ready strand */
+	volatile LONG stop;
+	HANDLE threads[SVC_EXECUTOR_MAX_THREADS];
+	DWORD threadCount;
+	size_t strands;
+};
+
+static INIT_ONCE executor_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION executor_lock;
+static SvcExecutor* executor = NULL;
+static DWORD executor_tls = TLS_OUT_OF_INDEXES; /* the strand a worker is running tasks of */
+
+static void strand_close_task(void* context, void* arg);
+static void strand_destroy(SvcStrand* strand);
+static void executor_release(SvcExecutor* exec, BOOL onWorker);
+
+static void mpsc_init(MpscQueue* queue)
+{
+	queue->stub.next = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
+
+static void mpsc_push(MpscQueue* queue, MpscNode* node)
+{
+	node->next = NULL;
+	MpscNode* prev = InterlockedExchangePointer((PVOID volatile*)&queue->head, node);
+	/* publishes the node, the consumer may see it from here on */
+	(void)InterlockedExchangePointer((PVOID volatile*)&prev->next, node);
+}
+
+/* Returns NULL if the queue is empty or a producer is between swapping the head and linking
+ * its node, mpsc_empty tells the two apart. */
+static MpscNode* mpsc_pop(MpscQueue* queue)
+{
+	MpscNode* tail = queue->tail;
+	MpscNode* next = tail->next;
+
+	if (tail == &queue->stub)
+	{
+		if (!next)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = next->next;
+	}
+
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+
+	if (tail != queue->head)
+		return NULL;
+
+	mpsc_push(queue, &queue->stub);
+	next = tail->next;
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+static BOOL mpsc_empty(MpscQueue* queue)
+{
+	MemoryBarrier();
+	return (queue->tail == &queue->stub) && (queue->stub.next == NULL) &&
+	       (queue->head == &queue->stub);
+}
+
+static void executor_enqueue(SvcExecutor* exec, SvcStrand* strand)
+{
+	WINPR_ASSERT(exec);
+	WINPR_ASSERT(strand);
+
+	strand->readyNext = NULL;
+	EnterCriticalSection(&exec->lock);
+	if (exec->readyTail)
+		exec->readyTail->readyNext = strand;
+	else
+		exec->readyHead = strand;
+	exec->readyTail = strand;
+	LeaveCriticalSection(&exec->lock);
+
+	(void)ReleaseSemaphore(exec->ready, 1, NULL);
+}
+
+static SvcStrand* executor_dequeue(SvcExecutor* exec)
+{
+	EnterCriticalSection(&exec->lock);
+	SvcStrand* strand = exec->readyHead;
+	if (strand)
+	{
+		exec->readyHead = strand->readyNext;
+		if (!exec->readyHead)
+			exec->readyTail = NULL;
+		strand->readyNext = NULL;
+	}
+	LeaveCriticalSection(&exec->lock);
+	return strand;
+}
+
+static void strand_run(SvcExecutor* exec, SvcStrand* strand)
+{
+	(void)TlsSetValue(executor_tls, strand);
+	for (size_t x = 0; x < SVC_STRAND_BATCH; x++)
+	{
+		SvcTask* task = (SvcTask*)mpsc_pop(&strand->tasks);
+		if (!task)
+			break;
+
+		if ((task->fn == strand_close_task) ||
+		    (InterlockedCompareExchange(&strand->discard, 0, 0) == 0))
+			task->fn(strand->context, task->arg);
+		free(task);
+	}
+	(void)TlsSetValue(executor_tls, NULL);
+
+	if (strand->closing && mpsc_empty(&strand->tasks))
+	{
+		if (InterlockedCompareExchange(&strand->detached, 0, 0) != 0)
+		{
+			strand_destroy(strand);
+			executor_release(exec, TRUE);
+			return;
+		}
+
+		/* svc_strand_free frees the strand once signaled, do not touch it afterwards */
+		(void)SetEvent(strand->closed);
+		return;
+	}
+
+	/* Producers only schedule the strand if they see scheduled == 0, so check for tasks
+	 * pushed in the meantime after clearing it. */
+	(void)InterlockedExchange(&strand->scheduled, 0);
+	if (mpsc_empty(&strand->tasks))
+		return;
+	if (InterlockedCompareExchange(&strand->scheduled, 1, 0) == 0)
+		executor_enqueue(exec, strand);
+}
+
+static DWORD WINAPI executor_thread(LPVOID arg)
+{
+	SvcExecutor* exec = arg;
+	WINPR_ASSERT(exec);
+
+	while (WaitForSingleObject(exec->ready, INFINITE) == WAIT_OBJECT_0)
+	{
+		if (InterlockedCompareExchange(&exec->stop, 0, 0) != 0)
+			break;
+
+		SvcStrand* strand = executor_dequeue(exec);
+		if (strand)
+			strand_run(exec, strand);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static void executor_free(SvcExecutor* exec)
+{
+	if (!exec)
+		return;
+
+	(void)InterlockedExchange(&exec->stop, 1);
+	if (exec->ready)
+		(void)ReleaseSemaphore(exec->ready, (LONG)exec->threadCount, NULL);
+
+	for (DWORD x = 0; x < exec->threadCount; x++)
+	{
+		(void)WaitForSingleObject(exec->threads[x], INFINITE);
+		(void)CloseHandle(exec->threads[x]);
+	}
+
+	if (exec->ready)
+		(void)CloseHandle(exec->ready);
+	DeleteCriticalSection(&exec->lock);
+	free(exec);
+}
+
+static SvcExecutor* executor_new(void)
+{
+	SYSTEM_INFO sysinfo = { 0 };
+	SvcExecutor* exec = calloc(1, sizeof(SvcExecutor));
+	if (!exec)
+		return NULL;
+
+	InitializeCriticalSection(&exec->lock);
+	exec->ready = CreateSemaphore(NULL, 0, INT32_MAX, NULL);
+	if (!exec->ready)
+		goto fail;
+
+	GetSystemInfo(&sysinfo);
+	const DWORD count = MAX(1, MIN(sysinfo.dwNumberOfProcessors, SVC_EXECUTOR_MAX_THREADS));
+	for (DWORD x = 0; x < count; x++)
+	{
+		exec->threads[x] = CreateThread(NULL, 0, executor_thread, exec, 0, NULL);
+		if (!exec->threads[x])
+		{
+			WLog_ERR(TAG, "CreateThread failed");
+			goto fail;
+		}
+		exec->threadCount++;
+	}
+
+	WLog_DBG(TAG, "started channel executor with %" PRIu32 " threads", exec->threadCount);
+	return exec;
+
+fail:
+	executor_free(exec);
+	return NULL;
+}
+
+static BOOL CALLBACK executor_init_once(WINPR_ATTR_UNUSED PINIT_ONCE once,
+                                        WINPR_ATTR_UNUSED PVOID param,
+                                        WINPR_ATTR_UNUSED PVOID* context)
+{
+	executor_tls = TlsAlloc();
+	if (executor_tls == TLS_OUT_OF_INDEXES)
+		return FALSE;
+	InitializeCriticalSection(&executor_lock);
+	return TRUE;
+}
+
+static SvcExecutor* executor_acquire(void)
+{
+	if (!InitOnceExecuteOnce(&executor_once, executor_init_once, NULL, NULL))
+		return NULL;
+
+	EnterCriticalSection(&executor_lock);
+	if (!executor)
+		executor = executor_new();
+	SvcExecutor* exec = executor;
+	if (exec)
+		exec->strands++;
+	LeaveCriticalSection(&executor_lock);
+	return exec;
+}
+
+/* Stops the executor the last strand was freed from on one of its own workers, which must not
+ * wait for itself */
+static DWORD WINAPI executor_reaper_thread(LPVOID arg)
+{
+	executor_free(arg);
+	return 0;
+}
+
+static void executor_free_async(SvcExecutor* exec)
+{
+	HANDLE thread = CreateThread(NULL, 0, executor_reaper_thread, exec, 0, NULL);
+	if (thread)
+	{
+		(void)CloseHandle(thread);
+		return;
+	}
+
+	/* the workers still exit, the executor itself is leaked */
+	WLog_ERR(TAG, "CreateThread failed, leaking the channel executor");
+	(void)InterlockedExchange(&exec->stop, 1);
+	(void)ReleaseSemaphore(exec->ready, (LONG)exec->threadCount, NULL);
+}
+
+static void executor_release(SvcExecutor* exec, BOOL onWorker)
+{
+	SvcExecutor* last = NULL;
+
+	WINPR_ASSERT(exec);
+
+	EnterCriticalSection(&executor_lock);
+	WINPR_ASSERT(exec == executor);
+	WINPR_ASSERT(exec->strands > 0);
+	if (--exec->strands == 0)
+	{
+		last = exec;
+		executor = NULL;
+	}
+	LeaveCriticalSection(&executor_lock);
+
+	if (last && onWorker)
+		executor_free_async(last);
+	else
+		executor_free(last);
+}
+
+SvcStrand* svc_strand_new(void* context)
+{
+	SvcStrand* strand = calloc(1, sizeof(SvcStrand));
+	if (!strand)
+		return NULL;
+
+	mpsc_init(&strand->tasks);
+	strand->context = context;
+	strand->closed = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!strand->closed)
+		goto fail;
+
+	strand->executor = executor_acquire();
+	if (!strand->executor)
+	{
+		WLog_ERR(TAG, "failed to start channel executor");
+		goto fail;
+	}
+
+	return strand;
+
+fail:
+	if (strand->closed)
+		(void)CloseHandle(strand->closed);
+	free(strand);
+	return NULL;
+}
+
+static void strand_close_task(WINPR_ATTR_UNUSED void* context, void* arg)
+{
+	SvcStrand* strand = arg;
+	WINPR_ASSERT(strand);
+	strand->closing = TRUE;
+}
+
+static void strand_destroy(SvcStrand* strand)
+{
+	/* either drained or never going to run again */
+	SvcTask* task = NULL;
+	while ((task = (SvcTask*)mpsc_pop(&strand->tasks)))
+		free(task);
+
+	(void)CloseHandle(strand->closed);
+	free(strand);
+}
+
+void svc_strand_free(SvcStrand* strand)
+{
+	if (!strand)
+		return;
+
+	SvcExecutor* exec = strand->executor;
+	WINPR_ASSERT(exec);
+
+	/* On a worker waiting for the strand may wait for the worker itself, the strand is closed
+	 * by the worker running it instead. Its queued tasks are dropped, they must not run after
+	 * the caller returned. */
+	SvcStrand* current = TlsGetValue(executor_tls);
+	if (current)
+	{
+		if (current != strand)
+			WLog_ERR(TAG, "strand freed from a task of another strand, its tasks are dropped");
+		WINPR_ASSERT(current == strand);
+
+		(void)InterlockedExchange(&strand->discard, 1);
+		(void)InterlockedExchange(&strand->detached, 1);
+		if (!svc_strand_post(strand, strand_close_task, strand))
+			WLog_ERR(TAG, "failed to close strand, leaking it");
+		return;
+	}
+
+	if (svc_strand_post(strand, strand_close_task, strand))
+		(void)WaitForSingleObject(strand->closed, INFINITE);
+	else
+		WLog_ERR(TAG, "failed to drain strand, tasks still queued are dropped");
+
+	strand_destroy(strand);
+	executor_release(exec, FALSE);
+}
+
+BOOL svc_strand_post(SvcStrand* strand, svc_task_fn fn, void* arg)
+{
+	WINPR_ASSERT(strand);
+	WINPR_ASSERT(fn);
+
+	SvcTask* task = calloc(1, sizeof(SvcTask));
+	if (!task)
+		return FALSE;
+
+	task->fn = fn;
+	task->arg = arg;
+	mpsc_push(&strand->tasks, &task->node);
+
+	if (InterlockedCompareExchange(&strand->scheduled, 1, 0) == 0)
+		executor_enqueue(strand->executor, strand);
+	return TRUE;
+}
@@ -0,0 +1,50 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shared executor for static virtual channel work
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/api.h>
+
+/* Upper bound for the process wide worker pool, independent of the number of sessions */
+#define SVC_EXECUTOR_MAX_THREADS 4
+
+/* Tasks a worker runs from one strand before it moves on to the next ready strand */
+#define SVC_STRAND_BATCH 32
+
+/* Tasks of one strand run one at a time and in the order they were posted */
+typedef struct s_svc_strand SvcStrand;
+
+typedef void (*svc_task_fn)(void* context, void* arg);
+
+/**
+ * Creates a strand on the process wide channel executor, which is started with the first strand
+ * and stopped with the last one. context is passed to every task of the strand.
+ */
+FREERDP_LOCAL SvcStrand* svc_strand_new(void* context);
+
+/**
+ * Runs the tasks still queued, waits for them to finish and frees the strand.
+ * Called from one of the strand's own tasks it does not wait: the tasks still queued are dropped
+ * and the strand is freed once the calling task returned. Freeing a strand from a task of another
+ * strand is not supported, the worker could end up waiting for itself.
+ */
+FREERDP_LOCAL void svc_strand_free(SvcStrand* strand);
+
+/* Queues fn(context, arg). Lock free, may be called from any thread. */
+FREERDP_LOCAL BOOL svc_strand_post(SvcStrand* strand, svc_task_fn fn, void* arg);
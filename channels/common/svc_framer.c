@@ -0,0 +1,162 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Incremental PDU framer for virtual channel byte streams
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+
+#include <freerdp/channels/log.h>
+
+#include "svc_framer.h"
+
+#define TAG CHANNELS_TAG("svc.framer")
+
+struct s_svc_framer
+{
+	BYTE* buffer;
+	size_t capacity;
+	size_t head; /* first unconsumed byte */
+	size_t tail; /* end of the buffered data */
+
+	size_t headerLength;
+	size_t maxFrameLength;
+	svc_frame_length_fn frameLength;
+};
+
+SvcFramer* svc_framer_new(size_t initialSize, size_t headerLength, size_t maxFrameLength,
+                          svc_frame_length_fn fn)
+{
+	WINPR_ASSERT(headerLength > 0);
+	WINPR_ASSERT(maxFrameLength >= headerLength);
+	WINPR_ASSERT(fn);
+
+	SvcFramer* framer = calloc(1, sizeof(SvcFramer));
+	if (!framer)
+		return NULL;
+
+	framer->capacity = MAX(initialSize, headerLength);
+	framer->buffer = malloc(framer->capacity);
+	if (!framer->buffer)
+	{
+		free(framer);
+		return NULL;
+	}
+
+	framer->headerLength = headerLength;
+	framer->maxFrameLength = maxFrameLength;
+	framer->frameLength = fn;
+	return framer;
+}
+
+void svc_framer_free(SvcFramer* framer)
+{
+	if (!framer)
+		return;
+
+	free(framer->buffer);
+	free(framer);
+}
+
+void svc_framer_reset(SvcFramer* framer)
+{
+	WINPR_ASSERT(framer);
+	framer->head = 0;
+	framer->tail = 0;
+}
+
+BYTE* svc_framer_reserve(SvcFramer* framer, size_t length, size_t* available)
+{
+	WINPR_ASSERT(framer);
+	WINPR_ASSERT(available);
+
+	*available = 0;
+
+	/* everything consumed, start over at the front for free */
+	if (framer->head == framer->tail)
+		svc_framer_reset(framer);
+
+	if (framer->capacity - framer->tail < length)
+	{
+		const size_t buffered = framer->tail - framer->head;
+
+		if (framer->capacity - buffered >= length)
+		{
+			/* wrap: only the unconsumed tail moves */
+			memmove(framer->buffer, &framer->buffer[framer->head], buffered);
+		}
+		else
+		{
+			if (length > SIZE_MAX - buffered)
+				return NULL;
+
+			size_t capacity = framer->capacity;
+			while (capacity < buffered + length)
+			{
+				if (capacity > SIZE_MAX / 2)
+					return NULL;
+				capacity *= 2;
+			}
+
+			BYTE* buffer = malloc(capacity);
+			if (!buffer)
+			{
+				WLog_ERR(TAG, "failed to grow the framer to %" PRIuz " bytes", capacity);
+				return NULL;
+			}
+			memcpy(buffer, &framer->buffer[framer->head], buffered);
+			free(framer->buffer);
+			framer->buffer = buffer;
+			framer->capacity = capacity;
+		}
+
+		framer->head = 0;
+		framer->tail = buffered;
+	}
+
+	*available = framer->capacity - framer->tail;
+	return &framer->buffer[framer->tail];
+}
+
+void svc_framer_commit(SvcFramer* framer, size_t length)
+{
+	WINPR_ASSERT(framer);
+	WINPR_ASSERT(length <= framer->capacity - framer->tail);
+	framer->tail += length;
+}
+
+UINT svc_framer_next(SvcFramer* framer, wStream* frame)
+{
+	WINPR_ASSERT(framer);
+	WINPR_ASSERT(frame);
+
+	const size_t buffered = framer->tail - framer->head;
+	if (buffered < framer->headerLength)
+		return ERROR_NO_MORE_ITEMS;
+
+	const BYTE* start = &framer->buffer[framer->head];
+	const size_t length = framer->frameLength(start);
+	if ((length < framer->headerLength) || (length > framer->maxFrameLength))
+	{
+		WLog_ERR(TAG, "invalid PDU length %" PRIuz, length);
+		return ERROR_INVALID_DATA;
+	}
+
+	if (buffered < length)
+		return ERROR_NO_MORE_ITEMS;
+
+	Stream_StaticConstInit(frame, start, length);
+	framer->head += length;
+	return CHANNEL_RC_OK;
+}
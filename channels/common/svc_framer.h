@@ -0,0 +1,60 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Incremental PDU framer for virtual channel byte streams
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+#include <winpr/stream.h>
+
+#include <freerdp/api.h>
+
+/* Splits a byte stream into PDUs. Data is read straight into the framer's buffer, complete PDUs
+ * are handed out in place and partial tails are kept for the next read. Consumed bytes are never
+ * copied, the unconsumed tail is only moved to the front when the free space behind it is too
+ * small for the PDU in progress. */
+typedef struct s_svc_framer SvcFramer;
+
+/**
+ * Returns the total length of the PDU starting with header (headerLength bytes), or 0 if the
+ * header is invalid.
+ */
+typedef size_t (*svc_frame_length_fn)(const BYTE* header);
+
+FREERDP_LOCAL SvcFramer* svc_framer_new(size_t initialSize, size_t headerLength,
+                                        size_t maxFrameLength, svc_frame_length_fn fn);
+FREERDP_LOCAL void svc_framer_free(SvcFramer* framer);
+
+/**
+ * Makes room for at least length contiguous bytes behind the buffered data and returns where
+ * to write them, NULL if the buffer can not grow. *available is set to the contiguous space.
+ */
+FREERDP_LOCAL BYTE* svc_framer_reserve(SvcFramer* framer, size_t length, size_t* available);
+
+/* Marks length bytes written to the pointer returned by svc_framer_reserve as buffered */
+FREERDP_LOCAL void svc_framer_commit(SvcFramer* framer, size_t length);
+
+/**
+ * Takes the next complete PDU. frame is set up as a read only view of it, which stays valid
+ * until the next call to any svc_framer function.
+ *
+ * @return 0 if a PDU was taken, ERROR_NO_MORE_ITEMS if more data is needed, otherwise a Win32
+ * error code (the stream is corrupt and the framer must be reset)
+ */
+FREERDP_LOCAL UINT svc_framer_next(SvcFramer* framer, wStream* frame);
+
+/* Drops all buffered data */
+FREERDP_LOCAL void svc_framer_reset(SvcFramer* framer);
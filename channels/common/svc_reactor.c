@@ -0,0 +1,314 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shared readiness reactor for virtual channel handles
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#include <freerdp/channels/log.h>
+
+#include "svc_reactor.h"
+
+#define TAG CHANNELS_TAG("svc.reactor")
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+typedef struct s_svc_reactor SvcReactor;
+
+struct s_svc_reactor_source
+{
+	SvcReactor* reactor;
+	int fd;
+	SvcStrand* strand;
+	svc_task_fn fn;
+	void* arg;
+	BOOL removed;          /* guarded by the reactor lock */
+	SvcReactorSource* next; /* removed sources waiting to be freed */
+};
+
+struct s_svc_reactor
+{
+	CRITICAL_SECTION lock;
+	int epfd;
+	int wakefd; /* registered with a NULL source */
+	HANDLE thread;
+	volatile LONG stop;
+	size_t sources;
+	SvcReactorSource* removed;
+};
+
+static INIT_ONCE reactor_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION reactor_lock;
+static SvcReactor* reactor = NULL;
+
+static void reactor_wake(SvcReactor* r)
+{
+	const uint64_t one = 1;
+	(void)write(r->wakefd, &one, sizeof(one));
+}
+
+/* Sources removed while the reactor thread may still hold them from epoll_wait, freed once
+ * the batch they could be part of was handled. Called with the lock held. */
+static void reactor_free_removed(SvcReactor* r)
+{
+	while (r->removed)
+	{
+		SvcReactorSource* source = r->removed;
+		r->removed = source->next;
+		free(source);
+	}
+}
+
+static DWORD WINAPI reactor_thread(LPVOID arg)
+{
+	struct epoll_event events[SVC_REACTOR_EVENTS] = { 0 };
+	SvcReactor* r = arg;
+	WINPR_ASSERT(r);
+
+	while (InterlockedCompareExchange(&r->stop, 0, 0) == 0)
+	{
+		const int count = epoll_wait(r->epfd, events, ARRAYSIZE(events), -1);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			WLog_ERR(TAG, "epoll_wait failed with %s", strerror(errno));
+			break;
+		}
+
+		EnterCriticalSection(&r->lock);
+		for (int x = 0; x < count; x++)
+		{
+			SvcReactorSource* source = events[x].data.ptr;
+			if (!source)
+			{
+				uint64_t value = 0;
+				(void)read(r->wakefd, &value, sizeof(value));
+				continue;
+			}
+
+			if (source->removed)
+				continue;
+
+			/* the source stays disarmed, the channel stalls but the reactor goes on */
+			if (!svc_strand_post(source->strand, source->fn, source->arg))
+				WLog_ERR(TAG, "svc_strand_post failed for fd %d", source->fd);
+		}
+		reactor_free_removed(r);
+		LeaveCriticalSection(&r->lock);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static void reactor_free(SvcReactor* r)
+{
+	if (!r)
+		return;
+
+	if (r->thread)
+	{
+		(void)InterlockedExchange(&r->stop, 1);
+		reactor_wake(r);
+		(void)WaitForSingleObject(r->thread, INFINITE);
+		(void)CloseHandle(r->thread);
+	}
+
+	reactor_free_removed(r);
+	if (r->wakefd >= 0)
+		close(r->wakefd);
+	if (r->epfd >= 0)
+		close(r->epfd);
+	DeleteCriticalSection(&r->lock);
+	free(r);
+}
+
+static SvcReactor* reactor_new(void)
+{
+	struct epoll_event event = { 0 };
+	SvcReactor* r = calloc(1, sizeof(SvcReactor));
+	if (!r)
+		return NULL;
+
+	InitializeCriticalSection(&r->lock);
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	r->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ((r->epfd < 0) || (r->wakefd < 0))
+	{
+		WLog_ERR(TAG, "failed to create the epoll instance: %s", strerror(errno));
+		goto fail;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &event) < 0)
+		goto fail;
+
+	r->thread = CreateThread(NULL, 0, reactor_thread, r, 0, NULL);
+	if (!r->thread)
+	{
+		WLog_ERR(TAG, "CreateThread failed");
+		goto fail;
+	}
+
+	WLog_DBG(TAG, "started channel reactor");
+	return r;
+
+fail:
+	reactor_free(r);
+	return NULL;
+}
+
+static BOOL CALLBACK reactor_init_once(WINPR_ATTR_UNUSED PINIT_ONCE once,
+                                       WINPR_ATTR_UNUSED PVOID param,
+                                       WINPR_ATTR_UNUSED PVOID* context)
+{
+	InitializeCriticalSection(&reactor_lock);
+	return TRUE;
+}
+
+static SvcReactor* reactor_acquire(void)
+{
+	if (!InitOnceExecuteOnce(&reactor_once, reactor_init_once, NULL, NULL))
+		return NULL;
+
+	EnterCriticalSection(&reactor_lock);
+	if (!reactor)
+		reactor = reactor_new();
+	SvcReactor* r = reactor;
+	if (r)
+		r->sources++;
+	LeaveCriticalSection(&reactor_lock);
+	return r;
+}
+
+static void reactor_release(SvcReactor* r)
+{
+	SvcReactor* last = NULL;
+
+	WINPR_ASSERT(r);
+
+	EnterCriticalSection(&reactor_lock);
+	WINPR_ASSERT(r == reactor);
+	WINPR_ASSERT(r->sources > 0);
+	if (--r->sources == 0)
+	{
+		last = r;
+		reactor = NULL;
+	}
+	LeaveCriticalSection(&reactor_lock);
+
+	reactor_free(last);
+}
+
+SvcReactorSource* svc_reactor_add(int fd, SvcStrand* strand, svc_task_fn fn, void* arg)
+{
+	struct epoll_event event = { 0 };
+
+	WINPR_ASSERT(fd >= 0);
+	WINPR_ASSERT(strand);
+	WINPR_ASSERT(fn);
+
+	SvcReactorSource* source = calloc(1, sizeof(SvcReactorSource));
+	if (!source)
+		return NULL;
+
+	source->fd = fd;
+	source->strand = strand;
+	source->fn = fn;
+	source->arg = arg;
+	source->reactor = reactor_acquire();
+	if (!source->reactor)
+	{
+		free(source);
+		return NULL;
+	}
+
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = source;
+	if (epoll_ctl(source->reactor->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl(ADD, %d) failed with %s", fd, strerror(errno));
+		reactor_release(source->reactor);
+		free(source);
+		return NULL;
+	}
+
+	return source;
+}
+
+BOOL svc_reactor_rearm(SvcReactorSource* source)
+{
+	struct epoll_event event = { 0 };
+
+	WINPR_ASSERT(source);
+
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.ptr = source;
+	if (epoll_ctl(source->reactor->epfd, EPOLL_CTL_MOD, source->fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl(MOD, %d) failed with %s", source->fd, strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void svc_reactor_remove(SvcReactorSource* source)
+{
+	if (!source)
+		return;
+
+	SvcReactor* r = source->reactor;
+	WINPR_ASSERT(r);
+
+	EnterCriticalSection(&r->lock);
+	(void)epoll_ctl(r->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+	source->removed = TRUE;
+	source->next = r->removed;
+	r->removed = source;
+	LeaveCriticalSection(&r->lock);
+
+	reactor_wake(r);
+	reactor_release(r);
+}
+
+#else
+
+SvcReactorSource* svc_reactor_add(WINPR_ATTR_UNUSED int fd, WINPR_ATTR_UNUSED SvcStrand* strand,
+                                  WINPR_ATTR_UNUSED svc_task_fn fn, WINPR_ATTR_UNUSED void* arg)
+{
+	WLog_WARN(TAG, "no channel reactor on this platform");
+	return NULL;
+}
+
+BOOL svc_reactor_rearm(WINPR_ATTR_UNUSED SvcReactorSource* source)
+{
+	return FALSE;
+}
+
+void svc_reactor_remove(WINPR_ATTR_UNUSED SvcReactorSource* source)
+{
+}
+
+#endif
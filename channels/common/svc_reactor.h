@@ -0,0 +1,51 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shared readiness reactor for virtual channel handles
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/api.h>
+
+#include "svc_executor.h"
+
+/* Events fetched per epoll_wait */
+#define SVC_REACTOR_EVENTS 64
+
+/* One thread watching the file descriptors of any number of channels (epoll, Linux only). Ready
+ * sources are not handled on the reactor thread, their task is posted to the channel's strand
+ * on the shared executor. */
+typedef struct s_svc_reactor_source SvcReactorSource;
+
+/**
+ * Watches fd for input. The reactor is started with the first source and stopped with the last
+ * one. When fd becomes readable fn(context, arg) is posted to strand, once: the task drains the
+ * input and calls svc_reactor_rearm for the next notification.
+ *
+ * @return the source, NULL on error or if the platform has no reactor
+ */
+FREERDP_LOCAL SvcReactorSource* svc_reactor_add(int fd, SvcStrand* strand, svc_task_fn fn,
+                                                void* arg);
+
+/* Asks for the next notification, call from the source's task */
+FREERDP_LOCAL BOOL svc_reactor_rearm(SvcReactorSource* source);
+
+/**
+ * Stops watching and frees the source. No task is posted for it afterwards, tasks already posted
+ * still run. Call it from a task of the source's strand, so it can not race with a rearm.
+ */
+FREERDP_LOCAL void svc_reactor_remove(SvcReactorSource* source);
@@ -0,0 +1,128 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Static virtual channel chunk reassembly
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+#include <winpr/collections.h>
+
+#include <freerdp/channels/log.h>
+
+#include "svc_reassembly.h"
+
+#define TAG CHANNELS_TAG("svc.reassembly")
+
+struct s_svc_reassembly
+{
+	wStreamPool* pool;
+	wStream* current;
+	UINT32 totalLength;
+};
+
+SvcReassembly* svc_reassembly_new(size_t defaultSize)
+{
+	SvcReassembly* reassembly = calloc(1, sizeof(SvcReassembly));
+	if (!reassembly)
+		return NULL;
+
+	/* synchronized, messages are usually released on a worker thread */
+	reassembly->pool = StreamPool_New(TRUE, defaultSize);
+	if (!reassembly->pool)
+	{
+		free(reassembly);
+		return NULL;
+	}
+
+	return reassembly;
+}
+
+void svc_reassembly_free(SvcReassembly* reassembly)
+{
+	if (!reassembly)
+		return;
+
+	svc_reassembly_reset(reassembly);
+	StreamPool_Free(reassembly->pool);
+	free(reassembly);
+}
+
+void svc_reassembly_reset(SvcReassembly* reassembly)
+{
+	WINPR_ASSERT(reassembly);
+
+	if (reassembly->current)
+		Stream_Release(reassembly->current);
+	reassembly->current = NULL;
+	reassembly->totalLength = 0;
+}
+
+UINT svc_reassembly_push(SvcReassembly* reassembly, const void* data, UINT32 dataLength,
+                         UINT32 totalLength, UINT32 dataFlags, wStream** message)
+{
+	WINPR_ASSERT(reassembly);
+	WINPR_ASSERT(data || (dataLength == 0));
+	WINPR_ASSERT(message);
+
+	*message = NULL;
+
+	if (dataFlags & CHANNEL_FLAG_FIRST)
+	{
+		svc_reassembly_reset(reassembly);
+
+		reassembly->current = StreamPool_Take(reassembly->pool, totalLength);
+		if (!reassembly->current)
+		{
+			WLog_ERR(TAG, "StreamPool_Take failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
+		reassembly->totalLength = totalLength;
+	}
+
+	wStream* s = reassembly->current;
+	if (!s)
+	{
+		WLog_ERR(TAG, "chunk received without CHANNEL_FLAG_FIRST");
+		return ERROR_INVALID_DATA;
+	}
+
+	if (dataLength > reassembly->totalLength - Stream_GetPosition(s))
+	{
+		WLog_ERR(TAG, "chunk exceeds total message length %" PRIu32, reassembly->totalLength);
+		svc_reassembly_reset(reassembly);
+		return ERROR_INVALID_DATA;
+	}
+
+	/* pooled streams may be larger than requested but never smaller */
+	WINPR_ASSERT(Stream_GetRemainingCapacity(s) >= dataLength);
+	Stream_Write(s, data, dataLength);
+
+	if (dataFlags & CHANNEL_FLAG_LAST)
+	{
+		if (Stream_GetPosition(s) != reassembly->totalLength)
+		{
+			WLog_ERR(TAG, "read error");
+			svc_reassembly_reset(reassembly);
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		reassembly->current = NULL;
+		reassembly->totalLength = 0;
+		Stream_SealLength(s);
+		Stream_SetPosition(s, 0);
+		*message = s;
+	}
+
+	return CHANNEL_RC_OK;
+}
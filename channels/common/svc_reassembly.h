@@ -0,0 +1,54 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Static virtual channel chunk reassembly
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+#include <winpr/stream.h>
+
+#include <freerdp/api.h>
+#include <freerdp/svc.h>
+
+typedef struct s_svc_reassembly SvcReassembly;
+
+/* Reassembles CHANNEL_EVENT_DATA_RECEIVED chunks into complete messages. The message streams
+ * come from a stream pool and are recycled with Stream_Release, which may be called from any
+ * thread. defaultSize is the initial capacity of a pooled stream. */
+FREERDP_LOCAL SvcReassembly* svc_reassembly_new(size_t defaultSize);
+FREERDP_LOCAL void svc_reassembly_free(SvcReassembly* reassembly);
+
+/* Drops a partially received message */
+FREERDP_LOCAL void svc_reassembly_reset(SvcReassembly* reassembly);
+
+/**
+ * Appends a chunk to the current message.
+ *
+ * @return 0 on success, otherwise a Win32 error code. If the chunk completed a message, *message
+ * is set to a sealed stream positioned at 0 which the caller releases with Stream_Release,
+ * otherwise it is set to NULL.
+ */
+FREERDP_LOCAL UINT svc_reassembly_push(SvcReassembly* reassembly, const void* data,
+                                       UINT32 dataLength, UINT32 totalLength, UINT32 dataFlags,
+                                       wStream** message);
+
+/* TRUE if the chunk is a complete message by itself and can be parsed from the channel buffer
+ * without going through svc_reassembly_push */
+static inline BOOL svc_reassembly_is_single_chunk(UINT32 dataLength, UINT32 totalLength,
+                                                  UINT32 dataFlags)
+{
+	return ((dataFlags & CHANNEL_FLAG_ONLY) == CHANNEL_FLAG_ONLY) && (dataLength == totalLength);
+}
@@ -0,0 +1,123 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Static virtual channel executor - unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+
+#include "svc_executor.h"
+#include "test_check.h"
+
+#define TEST_STRANDS 4
+#define TEST_TASKS 1000
+#define TEST_ROUNDS 20
+
+typedef struct
+{
+	LONG next;
+	volatile LONG running;
+	volatile LONG errors;
+	SvcStrand* strand;
+	HANDLE done;
+} TestStrand;
+
+static void test_sequence_task(void* context, void* arg)
+{
+	TestStrand* test = context;
+
+	/* tasks of one strand never overlap and run in the order they were posted */
+	if (InterlockedIncrement(&test->running) != 1)
+		(void)InterlockedIncrement(&test->errors);
+	if ((LONG)(intptr_t)arg != test->next)
+		(void)InterlockedIncrement(&test->errors);
+	test->next++;
+	(void)InterlockedDecrement(&test->running);
+}
+
+static void test_self_free_task(void* context, void* arg)
+{
+	TestStrand* test = context;
+	svc_strand_free(test->strand);
+	(void)SetEvent(test->done);
+}
+
+static void test_dropped_task(void* context, void* arg)
+{
+	TestStrand* test = context;
+	(void)InterlockedIncrement(&test->errors);
+}
+
+static BOOL test_strand_order(void)
+{
+	TestStrand tests[TEST_STRANDS] = { 0 };
+
+	for (size_t x = 0; x < TEST_STRANDS; x++)
+	{
+		tests[x].strand = svc_strand_new(&tests[x]);
+		CHECK(tests[x].strand);
+	}
+
+	/* interleaved, so the strands' tasks are spread over all workers */
+	for (intptr_t n = 0; n < TEST_TASKS; n++)
+	{
+		for (size_t x = 0; x < TEST_STRANDS; x++)
+			CHECK(svc_strand_post(tests[x].strand, test_sequence_task, (void*)n));
+	}
+
+	/* free waits for the queued tasks */
+	for (size_t x = 0; x < TEST_STRANDS; x++)
+		svc_strand_free(tests[x].strand);
+
+	for (size_t x = 0; x < TEST_STRANDS; x++)
+	{
+		CHECK(tests[x].next == TEST_TASKS);
+		CHECK(tests[x].errors == 0);
+	}
+	return TRUE;
+}
+
+static BOOL test_strand_self_free(void)
+{
+	TestStrand test = { 0 };
+
+	test.done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	CHECK(test.done);
+
+	/* the only strand, its free from a worker also stops the executor */
+	test.strand = svc_strand_new(&test);
+	CHECK(test.strand);
+	CHECK(svc_strand_post(test.strand, test_self_free_task, NULL));
+	CHECK(svc_strand_post(test.strand, test_dropped_task, NULL));
+
+	const DWORD status = WaitForSingleObject(test.done, 10000);
+	(void)CloseHandle(test.done);
+	CHECK(status == WAIT_OBJECT_0);
+	CHECK(test.errors == 0);
+	return TRUE;
+}
+
+int main(void)
+{
+	/* the executor starts and stops with its strands, every round goes through both */
+	for (size_t round = 0; round < TEST_ROUNDS; round++)
+	{
+		if (!test_strand_order() || !test_strand_self_free())
+			return 1;
+	}
+	return 0;
+}
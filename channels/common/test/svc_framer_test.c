@@ -0,0 +1,151 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Static virtual channel framer - unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/stream.h>
+
+#include "svc_framer.h"
+#include "test_check.h"
+
+/* Frames of the test start with their total length, two bytes little endian */
+#define TEST_HEADER_LENGTH 2
+#define TEST_MAX_FRAME_LENGTH 1024
+#define TEST_FRAMES 64
+
+static size_t test_frame_length(const BYTE* header)
+{
+	return (size_t)header[0] | ((size_t)header[1] << 8);
+}
+
+/* Frame n is n + TEST_HEADER_LENGTH bytes long, its payload bytes are all (BYTE)n */
+static size_t test_write_frames(BYTE* buffer, size_t count)
+{
+	size_t offset = 0;
+	for (size_t n = 0; n < count; n++)
+	{
+		const size_t length = n + TEST_HEADER_LENGTH;
+		buffer[offset] = (BYTE)(length & 0xFF);
+		buffer[offset + 1] = (BYTE)(length >> 8);
+		memset(&buffer[offset + TEST_HEADER_LENGTH], (BYTE)n, n);
+		offset += length;
+	}
+	return offset;
+}
+
+static BOOL test_check_frame(const wStream* frame, size_t n)
+{
+	const BYTE* data = Stream_ConstBuffer(frame);
+
+	CHECK(Stream_Length(frame) == n + TEST_HEADER_LENGTH);
+	CHECK(test_frame_length(data) == n + TEST_HEADER_LENGTH);
+	for (size_t x = 0; x < n; x++)
+		CHECK(data[TEST_HEADER_LENGTH + x] == (BYTE)n);
+	return TRUE;
+}
+
+/* Feeds the frames step bytes at a time and checks each one comes out whole and in order */
+static BOOL test_framer_feed(size_t step)
+{
+	static BYTE input[TEST_FRAMES * (TEST_FRAMES + TEST_HEADER_LENGTH)];
+	const size_t length = test_write_frames(input, TEST_FRAMES);
+	wStream frame = { 0 };
+	size_t next = 0;
+
+	/* smaller than most frames, so the buffer wraps and grows */
+	SvcFramer* framer =
+	    svc_framer_new(16, TEST_HEADER_LENGTH, TEST_MAX_FRAME_LENGTH, test_frame_length);
+	CHECK(framer);
+
+	for (size_t offset = 0; offset < length;)
+	{
+		const size_t chunk = MIN(step, length - offset);
+		size_t available = 0;
+		BYTE* buffer = svc_framer_reserve(framer, chunk, &available);
+		CHECK(buffer);
+		CHECK(available >= chunk);
+		memcpy(buffer, &input[offset], chunk);
+		svc_framer_commit(framer, chunk);
+		offset += chunk;
+
+		UINT status = 0;
+		while ((status = svc_framer_next(framer, &frame)) == CHANNEL_RC_OK)
+		{
+			CHECK(next < TEST_FRAMES);
+			CHECK(test_check_frame(&frame, next));
+			next++;
+		}
+		CHECK(status == ERROR_NO_MORE_ITEMS);
+	}
+
+	svc_framer_free(framer);
+	CHECK(next == TEST_FRAMES);
+	return TRUE;
+}
+
+static BOOL test_framer_invalid(void)
+{
+	const BYTE tooShort[] = { 1, 0 };
+	const BYTE tooLong[] = { 0xFF, 0xFF };
+	wStream frame = { 0 };
+	size_t available = 0;
+
+	SvcFramer* framer =
+	    svc_framer_new(16, TEST_HEADER_LENGTH, TEST_MAX_FRAME_LENGTH, test_frame_length);
+	CHECK(framer);
+
+	/* a partial header is no frame yet */
+	BYTE* buffer = svc_framer_reserve(framer, 1, &available);
+	CHECK(buffer);
+	memcpy(buffer, tooShort, 1);
+	svc_framer_commit(framer, 1);
+	CHECK(svc_framer_next(framer, &frame) == ERROR_NO_MORE_ITEMS);
+
+	/* a length below the header's */
+	buffer = svc_framer_reserve(framer, 1, &available);
+	CHECK(buffer);
+	memcpy(buffer, &tooShort[1], 1);
+	svc_framer_commit(framer, 1);
+	CHECK(svc_framer_next(framer, &frame) == ERROR_INVALID_DATA);
+
+	/* and one above the maximum */
+	svc_framer_reset(framer);
+	buffer = svc_framer_reserve(framer, sizeof(tooLong), &available);
+	CHECK(buffer);
+	memcpy(buffer, tooLong, sizeof(tooLong));
+	svc_framer_commit(framer, sizeof(tooLong));
+	CHECK(svc_framer_next(framer, &frame) == ERROR_INVALID_DATA);
+
+	svc_framer_free(framer);
+	return TRUE;
+}
+
+int main(void)
+{
+	const size_t steps[] = { 1, 3, 7, 64, 1000, TEST_FRAMES * (TEST_FRAMES + TEST_HEADER_LENGTH) };
+
+	for (size_t x = 0; x < ARRAYSIZE(steps); x++)
+	{
+		if (!test_framer_feed(steps[x]))
+			return 1;
+	}
+
+	if (!test_framer_invalid())
+		return 1;
+	return 0;
+}
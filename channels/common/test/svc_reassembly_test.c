@@ -0,0 +1,115 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Static virtual channel reassembly - unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/stream.h>
+
+#include <freerdp/svc.h>
+
+#include "svc_reassembly.h"
+#include "test_check.h"
+
+#define TEST_MESSAGE_LENGTH 4000
+
+static BYTE test_message[TEST_MESSAGE_LENGTH];
+
+/* Pushes the test message in chunks of chunkLength and checks it comes out once, whole */
+static BOOL test_reassembly_chunks(SvcReassembly* reassembly, UINT32 chunkLength)
+{
+	wStream* message = NULL;
+
+	for (UINT32 offset = 0; offset < TEST_MESSAGE_LENGTH; offset += chunkLength)
+	{
+		const UINT32 length = MIN(chunkLength, TEST_MESSAGE_LENGTH - offset);
+		UINT32 flags = 0;
+		if (offset == 0)
+			flags |= CHANNEL_FLAG_FIRST;
+		if (offset + length == TEST_MESSAGE_LENGTH)
+			flags |= CHANNEL_FLAG_LAST;
+
+		CHECK(!message);
+		CHECK(svc_reassembly_push(reassembly, &test_message[offset], length,
+		                          TEST_MESSAGE_LENGTH, flags, &message) == CHANNEL_RC_OK);
+	}
+
+	CHECK(message);
+	CHECK(Stream_GetPosition(message) == 0);
+	CHECK(Stream_Length(message) == TEST_MESSAGE_LENGTH);
+	const BOOL equal =
+	    memcmp(Stream_ConstBuffer(message), test_message, TEST_MESSAGE_LENGTH) == 0;
+	Stream_Release(message);
+	CHECK(equal);
+	return TRUE;
+}
+
+static BOOL test_reassembly_invalid(SvcReassembly* reassembly)
+{
+	wStream* message = NULL;
+
+	/* a chunk without a first one */
+	CHECK(svc_reassembly_push(reassembly, test_message, 16, TEST_MESSAGE_LENGTH,
+	                          CHANNEL_FLAG_LAST, &message) == ERROR_INVALID_DATA);
+	CHECK(!message);
+
+	/* more data than announced */
+	CHECK(svc_reassembly_push(reassembly, test_message, 16, 32, CHANNEL_FLAG_FIRST, &message) ==
+	      CHANNEL_RC_OK);
+	CHECK(svc_reassembly_push(reassembly, test_message, 17, 32, 0, &message) ==
+	      ERROR_INVALID_DATA);
+	CHECK(!message);
+
+	/* the message ends before the announced length */
+	CHECK(svc_reassembly_push(reassembly, test_message, 16, 32, CHANNEL_FLAG_FIRST, &message) ==
+	      CHANNEL_RC_OK);
+	CHECK(svc_reassembly_push(reassembly, test_message, 8, 32, CHANNEL_FLAG_LAST, &message) ==
+	      ERROR_INTERNAL_ERROR);
+	CHECK(!message);
+
+	/* a new first chunk drops the message in progress */
+	CHECK(svc_reassembly_push(reassembly, test_message, 16, 32, CHANNEL_FLAG_FIRST, &message) ==
+	      CHANNEL_RC_OK);
+	return test_reassembly_chunks(reassembly, 1600);
+}
+
+int main(void)
+{
+	const UINT32 chunks[] = { 1, 100, 1600, TEST_MESSAGE_LENGTH - 1, TEST_MESSAGE_LENGTH };
+	int rc = 1;
+
+	for (size_t x = 0; x < TEST_MESSAGE_LENGTH; x++)
+		test_message[x] = (BYTE)(x * 7);
+
+	SvcReassembly* reassembly = svc_reassembly_new(TEST_MESSAGE_LENGTH);
+	if (!reassembly)
+		return 1;
+
+	for (size_t x = 0; x < ARRAYSIZE(chunks); x++)
+	{
+		if (!test_reassembly_chunks(reassembly, chunks[x]))
+			goto fail;
+	}
+
+	if (!test_reassembly_invalid(reassembly))
+		goto fail;
+
+	rc = 0;
+fail:
+	svc_reassembly_free(reassembly);
+	return rc;
+}
@@ -0,0 +1,34 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Unit test helpers
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include <winpr/wtypes.h>
+
+/* Reports the failed condition with its location and makes the test function return FALSE */
+#define CHECK(cond)                                                              \
+	do                                                                           \
+	{                                                                            \
+		if (!(cond))                                                             \
+		{                                                                        \
+			(void)fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+			              #cond);                                                \
+			return FALSE;                                                        \
+		}                                                                        \
+	} while (0)
@@ -24,6 +24,7 @@
 #include <winpr/crt.h>
 #include <winpr/assert.h>
 #include <winpr/print.h>
+#include <winpr/endian.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/assistance.h>
@@ -34,33 +35,71 @@
 #include "remdesk_main.h"
 #include "remdesk_common.h"
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT remdesk_virtual_channel_write(remdeskPlugin* remdesk, wStream* s)
+/* initial capacity of pooled reassembly streams, larger messages grow the pool on demand */
+#define REMDESK_REASSEMBLY_DEFAULT_SIZE 4096
+
+/* initial capacity of a handshake batch, the expert blob and RA ticket grow it as needed */
+#define REMDESK_HANDSHAKE_DEFAULT_SIZE 1024
+
+/* What the expert blob is generated from, copied from the settings on the calling thread */
+typedef struct
 {
-	UINT32 status = 0;
+	char* name;
+	char* password;
+	char* passStub;
+} remdeskExpertSettings;
 
-	if (!remdesk)
-	{
-		WLog_ERR(TAG, "remdesk was null!");
-		Stream_Free(s, TRUE);
-		return CHANNEL_RC_INVALID_INSTANCE;
-	}
+static void remdesk_expert_settings_free(remdeskExpertSettings* expert)
+{
+	if (!expert)
+		return;
 
-	WINPR_ASSERT(remdesk->channelEntryPoints.pVirtualChannelWriteEx);
-	status = remdesk->channelEntryPoints.pVirtualChannelWriteEx(
-	    remdesk->InitHandle, remdesk->OpenHandle, Stream_Buffer(s), (UINT32)Stream_Length(s), s);
+	free(expert->name);
+	free(expert->password);
+	free(expert->passStub);
+	free(expert);
+}
 
-	if (status != CHANNEL_RC_OK)
+static char* remdesk_strdup_setting(const rdpSettings* settings, FreeRDP_Settings_Keys_String id,
+                                    BOOL* failed)
+{
+	const char* value = freerdp_settings_get_string(settings, id);
+	if (!value)
+		return NULL;
+
+	char* copy = _strdup(value);
+	if (!copy)
+		*failed = TRUE;
+	return copy;
+}
+
+static remdeskExpertSettings* remdesk_expert_settings_new(remdeskPlugin* remdesk)
+{
+	BOOL failed = FALSE;
+
+	WINPR_ASSERT(remdesk);
+	WINPR_ASSERT(remdesk->rdpcontext);
+	const rdpSettings* settings = remdesk->rdpcontext->settings;
+	WINPR_ASSERT(settings);
+
+	remdeskExpertSettings* expert = calloc(1, sizeof(remdeskExpertSettings));
+	if (!expert)
+		return NULL;
+
+	expert->name = remdesk_strdup_setting(settings, FreeRDP_Username, &failed);
+	expert->password =
+	    remdesk_strdup_setting(settings, FreeRDP_RemoteAssistancePassword, &failed);
+	if (!expert->password)
+		expert->password = remdesk_strdup_setting(settings, FreeRDP_Password, &failed);
+	expert->passStub =
+	    remdesk_strdup_setting(settings, FreeRDP_RemoteAssistancePassStub, &failed);
+
+	if (failed)
 	{
-		Stream_Free(s, TRUE);
-		WLog_ERR(TAG, "pVirtualChannelWriteEx failed with %s [%08" PRIX32 "]",
-		         WTSErrorToString(status), status);
+		remdesk_expert_settings_free(expert);
+		return NULL;
 	}
-	return status;
+	return expert;
 }
 
 /**
@@ -68,40 +107,29 @@ static UINT remdesk_virtual_channel_write(remdeskPlugin* remdesk, wStream* s)
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_generate_expert_blob(remdeskPlugin* remdesk)
+static UINT remdesk_generate_expert_blob(remdeskPlugin* remdesk,
+                                         const remdeskExpertSettings* expert)
 {
-	const char* name = NULL;
 	char* pass = NULL;
-	const char* password = NULL;
-	rdpSettings* settings = NULL;
 
 	WINPR_ASSERT(remdesk);
-
-	WINPR_ASSERT(remdesk->rdpcontext);
-	settings = remdesk->rdpcontext->settings;
-	WINPR_ASSERT(settings);
+	WINPR_ASSERT(expert);
 
 	if (remdesk->ExpertBlob)
 		return CHANNEL_RC_OK;
 
-	password = freerdp_settings_get_string(settings, FreeRDP_RemoteAssistancePassword);
-	if (!password)
-		password = freerdp_settings_get_string(settings, FreeRDP_Password);
-
-	if (!password)
+	if (!expert->password)
 	{
 		WLog_ERR(TAG, "password was not set!");
 		return ERROR_INTERNAL_ERROR;
 	}
 
-	name = freerdp_settings_get_string(settings, FreeRDP_Username);
-
-	if (!name)
-		name = "Expert";
+	const char* name = expert->name ? expert->name : "Expert";
 
-	const char* stub = freerdp_settings_get_string(settings, FreeRDP_RemoteAssistancePassStub);
-	remdesk->EncryptedPassStub =
-	    freerdp_assistance_encrypt_pass_stub(password, stub, &(remdesk->EncryptedPassStubSize));
+	/* left over if an earlier attempt failed further down */
+	free(remdesk->EncryptedPassStub);
+	remdesk->EncryptedPassStub = freerdp_assistance_encrypt_pass_stub(
+	    expert->password, expert->passStub, &(remdesk->EncryptedPassStubSize));
 
 	if (!remdesk->EncryptedPassStub)
 	{
@@ -130,6 +158,121 @@ static UINT remdesk_generate_expert_blob(remdeskPlugin* remdesk)
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Function description
+ *
+ * Generates the expert blob from the settings as they are now, on the calling thread.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_generate_expert_blob_now(remdeskPlugin* remdesk)
+{
+	remdeskExpertSettings* expert = remdesk_expert_settings_new(remdesk);
+	if (!expert)
+		return CHANNEL_RC_NO_MEMORY;
+
+	const UINT error = remdesk_generate_expert_blob(remdesk, expert);
+	remdesk_expert_settings_free(expert);
+	return error;
+}
+
+/* Runs on the precompute strand, keeps the crypto off the handshake. arg is the settings copy */
+static void remdesk_precompute_task(void* context, void* arg)
+{
+	remdeskPlugin* remdesk = (remdeskPlugin*)context;
+	remdeskExpertSettings* expert = arg;
+	WINPR_ASSERT(remdesk);
+
+	remdesk->ExpertBlobStatus = remdesk_generate_expert_blob(remdesk, expert);
+	remdesk_expert_settings_free(expert);
+	(void)InterlockedExchange(&remdesk->ExpertBlobReady, 1);
+	(void)SetEvent(remdesk->ExpertBlobEvent);
+}
+
+static void remdesk_stop_precompute(remdeskPlugin* remdesk)
+{
+	WINPR_ASSERT(remdesk);
+
+	/* waits for the generation if it is still running */
+	svc_strand_free(remdesk->precompute);
+	remdesk->precompute = NULL;
+	if (remdesk->ExpertBlobEvent)
+		(void)CloseHandle(remdesk->ExpertBlobEvent);
+	remdesk->ExpertBlobEvent = NULL;
+}
+
+/**
+ * Starts generating the expert blob and encrypted pass stub when the channel connects, after
+ * authentication, so the password the user entered is used. The settings are copied here, the
+ * worker never reads them. If that is not possible the handshake generates them itself.
+ */
+static void remdesk_start_precompute(remdeskPlugin* remdesk)
+{
+	remdeskExpertSettings* expert = NULL;
+
+	WINPR_ASSERT(remdesk);
+	WINPR_ASSERT(!remdesk->precompute);
+
+	/* kept from an earlier connection */
+	if (!remdesk->rdpcontext || remdesk->ExpertBlob)
+		return;
+
+	remdesk->ExpertBlobReady = 0;
+	remdesk->ExpertBlobStatus = CHANNEL_RC_OK;
+	remdesk->ExpertBlobEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!remdesk->ExpertBlobEvent)
+		goto fail;
+
+	expert = remdesk_expert_settings_new(remdesk);
+	if (!expert)
+		goto fail;
+
+	remdesk->precompute = svc_strand_new(remdesk);
+	if (!remdesk->precompute)
+		goto fail;
+
+	if (!svc_strand_post(remdesk->precompute, remdesk_precompute_task, expert))
+		goto fail;
+	return;
+
+fail:
+	WLog_WARN(TAG, "failed to start the expert blob generation, doing it on demand");
+	remdesk_expert_settings_free(expert);
+	remdesk_stop_precompute(remdesk);
+}
+
+/**
+ * Function description
+ *
+ * Picks up the expert blob and encrypted pass stub. The precompute task is queued on the
+ * executor before any session task, so a worker waiting here never blocks it. If the background
+ * generation failed it is tried again here with the current settings.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_get_expert_blob(remdeskPlugin* remdesk)
+{
+	WINPR_ASSERT(remdesk);
+
+	if (!remdesk->precompute)
+		return remdesk_generate_expert_blob_now(remdesk);
+
+	if (InterlockedCompareExchange(&remdesk->ExpertBlobReady, 0, 0) == 0)
+	{
+		WLog_DBG(TAG, "waiting for the expert blob");
+		if (WaitForSingleObject(remdesk->ExpertBlobEvent, INFINITE) != WAIT_OBJECT_0)
+			return ERROR_INTERNAL_ERROR;
+	}
+
+	if (remdesk->ExpertBlobStatus != CHANNEL_RC_OK)
+	{
+		WLog_DBG(TAG, "background generation failed with error %" PRIu32 ", retrying",
+		         remdesk->ExpertBlobStatus);
+		return remdesk_generate_expert_blob_now(remdesk);
+	}
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -183,40 +326,16 @@ static UINT remdesk_recv_ctl_version_info_pdu(remdeskPlugin* remdesk, wStream* s
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_version_info_pdu(remdeskPlugin* remdesk)
+static UINT remdesk_append_ctl_version_info_pdu(wStream** pbatch)
 {
-	REMDESK_CTL_VERSION_INFO_PDU pdu = { 0 };
+	BYTE body[8] = { 0 };
 
-	WINPR_ASSERT(remdesk);
+	winpr_Data_Write_UINT32(&body[0], 1); /* versionMajor (4 bytes) */
+	winpr_Data_Write_UINT32(&body[4], 2); /* versionMinor (4 bytes) */
 
-	UINT error = remdesk_prepare_ctl_header(&(pdu.ctlHeader), REMDESK_CTL_VERSIONINFO, 8);
-	if (error)
-		return error;
-
-	pdu.versionMajor = 1;
-	pdu.versionMinor = 2;
-	wStream* s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + pdu.ctlHeader.ch.DataLength);
-
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
-
-	error = remdesk_write_ctl_header(s, &(pdu.ctlHeader));
-	if (error)
-	{
-		Stream_Free(s, TRUE);
-		return error;
-	}
-	Stream_Write_UINT32(s, pdu.versionMajor); /* versionMajor (4 bytes) */
-	Stream_Write_UINT32(s, pdu.versionMinor); /* versionMinor (4 bytes) */
-	Stream_SealLength(s);
-
-	if ((error = remdesk_virtual_channel_write(remdesk, s)))
-		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
-
-	return error;
+	const REMDESK_PDU_SEGMENT segments[] = { { body, sizeof(body) } };
+	return remdesk_build_ctl_pdu(NULL, REMDESK_CTL_VERSIONINFO, segments, ARRAYSIZE(segments),
+	                             pbatch);
 }
 
 /**
@@ -257,78 +376,90 @@ static UINT remdesk_recv_ctl_result_pdu(WINPR_ATTR_UNUSED remdeskPlugin* remdesk
 /**
  * Function description
  *
+ * Converts the RA connection string to UTF-16 once per session.
+ *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_authenticate_pdu(remdeskPlugin* remdesk)
+static UINT remdesk_prepare_ra_connection_string(remdeskPlugin* remdesk)
 {
-	UINT error = ERROR_INTERNAL_ERROR;
-	size_t cbExpertBlobW = 0;
-	WCHAR* expertBlobW = NULL;
-	size_t cbRaConnectionStringW = 0;
-	REMDESK_CTL_HEADER ctlHeader = { 0 };
+	size_t length = 0;
 
 	WINPR_ASSERT(remdesk);
 
-	if ((error = remdesk_generate_expert_blob(remdesk)))
-	{
-		WLog_ERR(TAG, "remdesk_generate_expert_blob failed with error %" PRIu32 "", error);
-		return error;
-	}
+	if (remdesk->RaConnectionStringW)
+		return CHANNEL_RC_OK;
 
-	const char* expertBlob = remdesk->ExpertBlob;
 	WINPR_ASSERT(remdesk->rdpcontext);
 	rdpSettings* settings = remdesk->rdpcontext->settings;
 	WINPR_ASSERT(settings);
 
 	const char* raConnectionString =
 	    freerdp_settings_get_string(settings, FreeRDP_RemoteAssistanceRCTicket);
-	WCHAR* raConnectionStringW =
-	    ConvertUtf8ToWCharAlloc(raConnectionString, &cbRaConnectionStringW);
-
-	if (!raConnectionStringW || (cbRaConnectionStringW > UINT32_MAX / sizeof(WCHAR)))
-		goto out;
+	WCHAR* raConnectionStringW = ConvertUtf8ToWCharAlloc(raConnectionString, &length);
 
-	cbRaConnectionStringW = cbRaConnectionStringW * sizeof(WCHAR);
+	if (!raConnectionStringW || (length > UINT32_MAX / sizeof(WCHAR)))
+	{
+		free(raConnectionStringW);
+		return ERROR_INTERNAL_ERROR;
+	}
 
-	expertBlobW = ConvertUtf8ToWCharAlloc(expertBlob, &cbExpertBlobW);
+	remdesk->RaConnectionStringW = raConnectionStringW;
+	remdesk->cbRaConnectionStringW = length * sizeof(WCHAR);
+	return CHANNEL_RC_OK;
+}
 
-	if (!expertBlobW)
-		goto out;
+/**
+ * Function description
+ *
+ * Generates the expert blob and converts it to UTF-16 once per session.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_prepare_expert_blob(remdeskPlugin* remdesk)
+{
+	size_t length = 0;
 
-	cbExpertBlobW = cbExpertBlobW * sizeof(WCHAR);
-	error = remdesk_prepare_ctl_header(&(ctlHeader), REMDESK_CTL_AUTHENTICATE,
-	                                   cbRaConnectionStringW + cbExpertBlobW);
-	if (error)
-		goto out;
+	WINPR_ASSERT(remdesk);
 
-	wStream* s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + ctlHeader.ch.DataLength);
+	if (remdesk->ExpertBlobW)
+		return CHANNEL_RC_OK;
 
-	if (!s)
+	const UINT error = remdesk_get_expert_blob(remdesk);
+	if (error)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		error = CHANNEL_RC_NO_MEMORY;
-		goto out;
+		WLog_ERR(TAG, "remdesk_get_expert_blob failed with error %" PRIu32 "!", error);
+		return error;
 	}
 
-	error = remdesk_write_ctl_header(s, &ctlHeader);
-	if (error)
+	WCHAR* expertBlobW = ConvertUtf8ToWCharAlloc(remdesk->ExpertBlob, &length);
+
+	if (!expertBlobW || (length > UINT32_MAX / sizeof(WCHAR)))
 	{
-		Stream_Free(s, TRUE);
-		goto out;
+		free(expertBlobW);
+		return ERROR_INTERNAL_ERROR;
 	}
-	Stream_Write(s, raConnectionStringW, cbRaConnectionStringW);
-	Stream_Write(s, expertBlobW, cbExpertBlobW);
-	Stream_SealLength(s);
 
-	error = remdesk_virtual_channel_write(remdesk, s);
-	if (error)
-		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
+	remdesk->ExpertBlobW = expertBlobW;
+	remdesk->cbExpertBlobW = length * sizeof(WCHAR);
+	return CHANNEL_RC_OK;
+}
 
-out:
-	free(raConnectionStringW);
-	free(expertBlobW);
+static void remdesk_free_handshake_cache(remdeskPlugin* remdesk)
+{
+	WINPR_ASSERT(remdesk);
 
-	return error;
+	for (size_t x = 0; x < ARRAYSIZE(remdesk->HandshakePdu); x++)
+	{
+		Stream_Free(remdesk->HandshakePdu[x], TRUE);
+		remdesk->HandshakePdu[x] = NULL;
+	}
+	free(remdesk->RaConnectionStringW);
+	free(remdesk->ExpertBlobW);
+
+	remdesk->RaConnectionStringW = NULL;
+	remdesk->cbRaConnectionStringW = 0;
+	remdesk->ExpertBlobW = NULL;
+	remdesk->cbExpertBlobW = 0;
 }
 
 /**
@@ -336,55 +467,61 @@ out:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_remote_control_desktop_pdu(remdeskPlugin* remdesk)
+static UINT remdesk_append_ctl_authenticate_pdu(remdeskPlugin* remdesk, wStream** pbatch)
 {
-	UINT error = 0;
-	size_t length = 0;
-
 	WINPR_ASSERT(remdesk);
-	WINPR_ASSERT(remdesk->rdpcontext);
-	rdpSettings* settings = remdesk->rdpcontext->settings;
-	WINPR_ASSERT(settings);
 
-	const char* raConnectionString =
-	    freerdp_settings_get_string(settings, FreeRDP_RemoteAssistanceRCTicket);
-	WCHAR* raConnectionStringW = ConvertUtf8ToWCharAlloc(raConnectionString, &length);
-	size_t cbRaConnectionStringW = length * sizeof(WCHAR);
-
-	if (!raConnectionStringW)
-		return ERROR_INTERNAL_ERROR;
-
-	REMDESK_CTL_HEADER ctlHeader = { 0 };
-	error = remdesk_prepare_ctl_header(&ctlHeader, REMDESK_CTL_REMOTE_CONTROL_DESKTOP,
-	                                   cbRaConnectionStringW);
-	if (error != CHANNEL_RC_OK)
-		goto out;
+	UINT error = remdesk_prepare_expert_blob(remdesk);
+	if (!error)
+		error = remdesk_prepare_ra_connection_string(remdesk);
+	if (error)
+		return error;
 
-	wStream* s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + ctlHeader.ch.DataLength);
+	const REMDESK_PDU_SEGMENT segments[] = {
+		{ remdesk->RaConnectionStringW, remdesk->cbRaConnectionStringW },
+		{ remdesk->ExpertBlobW, remdesk->cbExpertBlobW }
+	};
+	return remdesk_build_ctl_pdu(NULL, REMDESK_CTL_AUTHENTICATE, segments, ARRAYSIZE(segments),
+	                             pbatch);
+}
 
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		error = CHANNEL_RC_NO_MEMORY;
-		goto out;
-	}
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_append_ctl_remote_control_desktop_pdu(remdeskPlugin* remdesk,
+                                                          wStream** pbatch)
+{
+	WINPR_ASSERT(remdesk);
 
-	error = remdesk_write_ctl_header(s, &ctlHeader);
+	const UINT error = remdesk_prepare_ra_connection_string(remdesk);
 	if (error)
-	{
-		Stream_Free(s, TRUE);
-		goto out;
-	}
-	Stream_Write(s, raConnectionStringW, cbRaConnectionStringW);
-	Stream_SealLength(s);
+		return error;
 
-	if ((error = remdesk_virtual_channel_write(remdesk, s)))
-		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
+	const REMDESK_PDU_SEGMENT segments[] = {
+		{ remdesk->RaConnectionStringW, remdesk->cbRaConnectionStringW }
+	};
+	return remdesk_build_ctl_pdu(NULL, REMDESK_CTL_REMOTE_CONTROL_DESKTOP, segments,
+	                             ARRAYSIZE(segments), pbatch);
+}
 
-out:
-	free(raConnectionStringW);
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_append_ctl_verify_password_pdu(remdeskPlugin* remdesk, wStream** pbatch)
+{
+	WINPR_ASSERT(remdesk);
 
-	return error;
+	const UINT error = remdesk_prepare_expert_blob(remdesk);
+	if (error)
+		return error;
+
+	const REMDESK_PDU_SEGMENT segments[] = { { remdesk->ExpertBlobW, remdesk->cbExpertBlobW } };
+	return remdesk_build_ctl_pdu(NULL, REMDESK_CTL_VERIFY_PASSWORD, segments, ARRAYSIZE(segments),
+	                             pbatch);
 }
 
 /**
@@ -392,106 +529,202 @@ out:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_verify_password_pdu(remdeskPlugin* remdesk)
+static UINT remdesk_append_ctl_expert_on_vista_pdu(remdeskPlugin* remdesk, wStream** pbatch)
 {
-	size_t cbExpertBlobW = 0;
-	REMDESK_CTL_VERIFY_PASSWORD_PDU pdu = { 0 };
-
 	WINPR_ASSERT(remdesk);
 
-	UINT error = remdesk_generate_expert_blob(remdesk);
+	const UINT error = remdesk_get_expert_blob(remdesk);
 	if (error)
 	{
-		WLog_ERR(TAG, "remdesk_generate_expert_blob failed with error %" PRIu32 "!", error);
+		WLog_ERR(TAG, "remdesk_get_expert_blob failed with error %" PRIu32 "!", error);
 		return error;
 	}
+	if (remdesk->EncryptedPassStubSize > UINT32_MAX)
+		return ERROR_INTERNAL_ERROR;
 
-	pdu.expertBlob = remdesk->ExpertBlob;
-	WCHAR* expertBlobW = ConvertUtf8ToWCharAlloc(pdu.expertBlob, &cbExpertBlobW);
+	const REMDESK_PDU_SEGMENT segments[] = { { remdesk->EncryptedPassStub,
+		                                       remdesk->EncryptedPassStubSize } };
+	return remdesk_build_ctl_pdu(NULL, REMDESK_CTL_EXPERT_ON_VISTA, segments, ARRAYSIZE(segments),
+	                             pbatch);
+}
 
-	if (!expertBlobW)
-		goto out;
+/**
+ * Function description
+ *
+ * Builds the handshake answering a protocol version as one batch: version info, authenticate
+ * and remote control desktop for version 1, expert on vista and verify password for version 2.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_build_handshake(remdeskPlugin* remdesk, UINT32 version, wStream** ps)
+{
+	UINT error = CHANNEL_RC_OK;
 
-	cbExpertBlobW = cbExpertBlobW * sizeof(WCHAR);
-	error =
-	    remdesk_prepare_ctl_header(&(pdu.ctlHeader), REMDESK_CTL_VERIFY_PASSWORD, cbExpertBlobW);
-	if (error)
-		goto out;
+	WINPR_ASSERT(remdesk);
+	WINPR_ASSERT(ps);
 
-	wStream* s = Stream_New(NULL, 1ULL * REMDESK_CHANNEL_CTL_SIZE + pdu.ctlHeader.ch.DataLength);
+	wStream* batch = Stream_New(NULL, REMDESK_HANDSHAKE_DEFAULT_SIZE);
+	if (!batch)
+		return CHANNEL_RC_NO_MEMORY;
 
-	if (!s)
+	if (version == 1)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		error = CHANNEL_RC_NO_MEMORY;
-		goto out;
-	}
+		if ((error = remdesk_append_ctl_version_info_pdu(&batch)))
+		{
+			WLog_ERR(TAG, "remdesk_append_ctl_version_info_pdu failed with error %" PRIu32 "",
+			         error);
+			goto fail;
+		}
 
-	error = remdesk_write_ctl_header(s, &(pdu.ctlHeader));
-	if (error)
-	{
-		Stream_Free(s, TRUE);
-		goto out;
+		if ((error = remdesk_append_ctl_authenticate_pdu(remdesk, &batch)))
+		{
+			WLog_ERR(TAG, "remdesk_append_ctl_authenticate_pdu failed with error %" PRIu32 "",
+			         error);
+			goto fail;
+		}
+
+		if ((error = remdesk_append_ctl_remote_control_desktop_pdu(remdesk, &batch)))
+		{
+			WLog_ERR(TAG,
+			         "remdesk_append_ctl_remote_control_desktop_pdu failed with error %" PRIu32
+			         "",
+			         error);
+			goto fail;
+		}
 	}
-	Stream_Write(s, expertBlobW, cbExpertBlobW);
-	Stream_SealLength(s);
+	else
+	{
+		if ((error = remdesk_append_ctl_expert_on_vista_pdu(remdesk, &batch)))
+		{
+			WLog_ERR(TAG, "remdesk_append_ctl_expert_on_vista_pdu failed with error %" PRIu32 "",
+			         error);
+			goto fail;
+		}
 
-	error = remdesk_virtual_channel_write(remdesk, s);
-	if (error)
-		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
+		if ((error = remdesk_append_ctl_verify_password_pdu(remdesk, &batch)))
+		{
+			WLog_ERR(TAG, "remdesk_append_ctl_verify_password_pdu failed with error %" PRIu32 "",
+			         error);
+			goto fail;
+		}
+	}
 
-out:
-	free(expertBlobW);
+	*ps = batch;
+	return CHANNEL_RC_OK;
 
+fail:
+	Stream_Free(batch, TRUE);
 	return error;
 }
 
 /**
  * Function description
  *
+ * Sends the handshake for the negotiated version in a single channel write. The batch is built
+ * once per session and stays owned by the cache, which outlives every pending write, so no user
+ * data is passed and nothing is freed on completion.
+ *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_expert_on_vista_pdu(remdeskPlugin* remdesk)
+static UINT remdesk_send_handshake(remdeskPlugin* remdesk)
 {
-	REMDESK_CTL_EXPERT_ON_VISTA_PDU pdu = { 0 };
-
 	WINPR_ASSERT(remdesk);
 
-	UINT error = remdesk_generate_expert_blob(remdesk);
-	if (error)
+	if ((remdesk->Version != 1) && (remdesk->Version != 2))
+		return CHANNEL_RC_OK;
+
+	wStream** pbatch = &remdesk->HandshakePdu[remdesk->Version - 1];
+	if (!*pbatch)
 	{
-		WLog_ERR(TAG, "remdesk_generate_expert_blob failed with error %" PRIu32 "!", error);
-		return error;
+		const UINT error = remdesk_build_handshake(remdesk, remdesk->Version, pbatch);
+		if (error)
+			return error;
 	}
-	if (remdesk->EncryptedPassStubSize > UINT32_MAX)
-		return ERROR_INTERNAL_ERROR;
 
-	pdu.EncryptedPasswordLength = (UINT32)remdesk->EncryptedPassStubSize;
-	pdu.EncryptedPassword = remdesk->EncryptedPassStub;
-	error = remdesk_prepare_ctl_header(&(pdu.ctlHeader), REMDESK_CTL_EXPERT_ON_VISTA,
-	                                   pdu.EncryptedPasswordLength);
-	if (error)
-		return error;
+	wStream* batch = *pbatch;
+	WINPR_ASSERT(remdesk->channelEntryPoints.pVirtualChannelWriteEx);
+	const UINT status = remdesk->channelEntryPoints.pVirtualChannelWriteEx(
+	    remdesk->InitHandle, remdesk->OpenHandle, Stream_Buffer(batch),
+	    (UINT32)Stream_Length(batch), NULL);
 
-	wStream* s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + pdu.ctlHeader.ch.DataLength);
+	if (status != CHANNEL_RC_OK)
+		WLog_ERR(TAG, "pVirtualChannelWriteEx failed with %s [%08" PRIX32 "]",
+		         WTSErrorToString(status), status);
+	return status;
+}
 
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_recv_ctl_ignore(WINPR_ATTR_UNUSED remdeskPlugin* remdesk,
+                                    WINPR_ATTR_UNUSED wStream* s,
+                                    WINPR_ATTR_UNUSED REMDESK_CHANNEL_HEADER* header)
+{
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_recv_ctl_result(remdeskPlugin* remdesk, wStream* s,
+                                    REMDESK_CHANNEL_HEADER* header)
+{
+	UINT32 result = 0;
+	return remdesk_recv_ctl_result_pdu(remdesk, s, header, &result);
+}
 
-	error = remdesk_write_ctl_header(s, &(pdu.ctlHeader));
+/**
+ * Function description
+ *
+ * Answers the server version with the handshake matching it.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_recv_ctl_version_info(remdeskPlugin* remdesk, wStream* s,
+                                          REMDESK_CHANNEL_HEADER* header)
+{
+	UINT error = remdesk_recv_ctl_version_info_pdu(remdesk, s, header);
 	if (error)
 	{
-		Stream_Free(s, TRUE);
+		WLog_ERR(TAG, "remdesk_recv_ctl_version_info_pdu failed with error %" PRIu32 "", error);
 		return error;
 	}
-	Stream_Write(s, pdu.EncryptedPassword, pdu.EncryptedPasswordLength);
-	Stream_SealLength(s);
-	return remdesk_virtual_channel_write(remdesk, s);
+
+	if ((error = remdesk_send_handshake(remdesk)))
+		WLog_ERR(TAG, "remdesk_send_handshake failed with error %" PRIu32 "", error);
+
+	return error;
 }
 
+typedef UINT (*remdesk_ctl_handler_fn)(remdeskPlugin* remdesk, wStream* s,
+                                       REMDESK_CHANNEL_HEADER* header);
+
+typedef struct
+{
+	const char* name;
+	remdesk_ctl_handler_fn fkt;
+} REMDESK_CTL_HANDLER;
+
+/* Indexed by msgType, entries without a handler are unknown message types */
+static const REMDESK_CTL_HANDLER remdesk_ctl_handlers[] = {
+	[REMDESK_CTL_REMOTE_CONTROL_DESKTOP] = { "REMOTE_CONTROL_DESKTOP", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_RESULT] = { "RESULT", remdesk_recv_ctl_result },
+	[REMDESK_CTL_AUTHENTICATE] = { "AUTHENTICATE", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_SERVER_ANNOUNCE] = { "SERVER_ANNOUNCE", remdesk_recv_ctl_server_announce_pdu },
+	[REMDESK_CTL_DISCONNECT] = { "DISCONNECT", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_VERSIONINFO] = { "VERSIONINFO", remdesk_recv_ctl_version_info },
+	[REMDESK_CTL_ISCONNECTED] = { "ISCONNECTED", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_VERIFY_PASSWORD] = { "VERIFY_PASSWORD", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_EXPERT_ON_VISTA] = { "EXPERT_ON_VISTA", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_RANOVICE_NAME] = { "RANOVICE_NAME", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_RAEXPERT_NAME] = { "RAEXPERT_NAME", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_TOKEN] = { "TOKEN", remdesk_recv_ctl_ignore }
+};
+
 /**
  * Function description
  *
@@ -499,9 +732,7 @@ static UINT remdesk_send_ctl_expert_on_vista_pdu(remdeskPlugin* remdesk)
  */
 static UINT remdesk_recv_ctl_pdu(remdeskPlugin* remdesk, wStream* s, REMDESK_CHANNEL_HEADER* header)
 {
-	UINT error = CHANNEL_RC_OK;
 	UINT32 msgType = 0;
-	UINT32 result = 0;
 
 	WINPR_ASSERT(remdesk);
 	WINPR_ASSERT(s);
@@ -512,162 +743,138 @@ static UINT remdesk_recv_ctl_pdu(remdeskPlugin* remdesk, wStream* s, REMDESK_CHA
 
 	Stream_Read_UINT32(s, msgType); /* msgType (4 bytes) */
 
-	// WLog_DBG(TAG, "msgType: %"PRIu32"", msgType);
+	const REMDESK_CTL_HANDLER* handler =
+	    (msgType < ARRAYSIZE(remdesk_ctl_handlers)) ? &remdesk_ctl_handlers[msgType] : NULL;
 
-	switch (msgType)
+	if (!handler || !handler->fkt)
 	{
-		case REMDESK_CTL_REMOTE_CONTROL_DESKTOP:
-			break;
+		WLog_ERR(TAG, "unknown msgType: %" PRIu32 "", msgType);
+		return ERROR_INVALID_DATA;
+	}
 
-		case REMDESK_CTL_RESULT:
-			if ((error = remdesk_recv_ctl_result_pdu(remdesk, s, header, &result)))
-				WLog_ERR(TAG, "remdesk_recv_ctl_result_pdu failed with error %" PRIu32 "", error);
+	const UINT error = handler->fkt(remdesk, s, header);
+	if (error)
+		WLog_ERR(TAG, "REMDESK_CTL_%s failed with error %" PRIu32 "", handler->name, error);
 
-			break;
+	return error;
+}
 
-		case REMDESK_CTL_AUTHENTICATE:
-			break;
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_process_receive(remdeskPlugin* remdesk, wStream* s)
+{
+	UINT status = 0;
 
-		case REMDESK_CTL_SERVER_ANNOUNCE:
-			if ((error = remdesk_recv_ctl_server_announce_pdu(remdesk, s, header)))
-				WLog_ERR(TAG, "remdesk_recv_ctl_server_announce_pdu failed with error %" PRIu32 "",
-				         error);
+	WINPR_ASSERT(remdesk);
+	WINPR_ASSERT(s);
 
-			break;
+	/* a message may carry several PDUs back to back */
+	do
+	{
+		wStream pdu = { 0 };
+		REMDESK_CHANNEL_HEADER header;
+		REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
 
-		case REMDESK_CTL_DISCONNECT:
-			break;
+		if ((status = remdesk_read_pdu(s, &header, &id, &pdu)))
+		{
+			WLog_ERR(TAG, "remdesk_read_pdu failed with error %" PRIu32 "", status);
+			return status;
+		}
 
-		case REMDESK_CTL_VERSIONINFO:
-			if ((error = remdesk_recv_ctl_version_info_pdu(remdesk, s, header)))
-			{
-				WLog_ERR(TAG, "remdesk_recv_ctl_version_info_pdu failed with error %" PRIu32 "",
-				         error);
+		switch (id)
+		{
+			case REMDESK_CHANNEL_CTL:
+				status = remdesk_recv_ctl_pdu(remdesk, &pdu, &header);
 				break;
-			}
 
-			if (remdesk->Version == 1)
-			{
-				if ((error = remdesk_send_ctl_version_info_pdu(remdesk)))
-				{
-					WLog_ERR(TAG, "remdesk_send_ctl_version_info_pdu failed with error %" PRIu32 "",
-					         error);
-					break;
-				}
-
-				if ((error = remdesk_send_ctl_authenticate_pdu(remdesk)))
-				{
-					WLog_ERR(TAG, "remdesk_send_ctl_authenticate_pdu failed with error %" PRIu32 "",
-					         error);
-					break;
-				}
-
-				if ((error = remdesk_send_ctl_remote_control_desktop_pdu(remdesk)))
-				{
-					WLog_ERR(
-					    TAG,
-					    "remdesk_send_ctl_remote_control_desktop_pdu failed with error %" PRIu32 "",
-					    error);
-					break;
-				}
-			}
-			else if (remdesk->Version == 2)
-			{
-				if ((error = remdesk_send_ctl_expert_on_vista_pdu(remdesk)))
-				{
-					WLog_ERR(TAG,
-					         "remdesk_send_ctl_expert_on_vista_pdu failed with error %" PRIu32 "",
-					         error);
-					break;
-				}
-
-				if ((error = remdesk_send_ctl_verify_password_pdu(remdesk)))
-				{
-					WLog_ERR(TAG,
-					         "remdesk_send_ctl_verify_password_pdu failed with error %" PRIu32 "",
-					         error);
-					break;
-				}
-			}
+			case REMDESK_CHANNEL_RA_FX:
+				status = remdesk_fx_receive(remdesk->fx, &pdu);
+				break;
 
-			break;
+			case REMDESK_CHANNEL_70:
+			case REMDESK_CHANNEL_71:
+			case REMDESK_CHANNEL_DOT:
+			case REMDESK_CHANNEL_1000DOT:
+			case REMDESK_CHANNEL_UNKNOWN:
+			default:
+				break;
+		}
+	} while (!status && (Stream_GetRemainingLength(s) > 0));
 
-		case REMDESK_CTL_ISCONNECTED:
-			break;
+	return status;
+}
 
-		case REMDESK_CTL_VERIFY_PASSWORD:
-			break;
+static void remdesk_process_connect(WINPR_ATTR_UNUSED remdeskPlugin* remdesk)
+{
+	WINPR_ASSERT(remdesk);
+	WLog_ERR("TODO", "TODO: implement");
+}
 
-		case REMDESK_CTL_EXPERT_ON_VISTA:
-			break;
+static void remdesk_connect_task(void* context, WINPR_ATTR_UNUSED void* arg)
+{
+	remdeskPlugin* remdesk = (remdeskPlugin*)context;
 
-		case REMDESK_CTL_RANOVICE_NAME:
-			break;
+	remdesk_process_connect(remdesk);
+}
 
-		case REMDESK_CTL_RAEXPERT_NAME:
-			break;
+/**
+ * Returns TRUE if the message carries a VERSIONINFO PDU. Answering it sends the handshake, which
+ * may wait for the expert blob, so such messages are always processed on the strand.
+ */
+static BOOL remdesk_has_version_info(wStream* s)
+{
+	BOOL found = FALSE;
+	const size_t pos = Stream_GetPosition(s);
 
-		case REMDESK_CTL_TOKEN:
-			break;
+	while (!found && (Stream_GetRemainingLength(s) > 0))
+	{
+		wStream pdu = { 0 };
+		REMDESK_CHANNEL_HEADER header = { 0 };
+		REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+		UINT32 msgType = 0;
 
-		default:
-			WLog_ERR(TAG, "unknown msgType: %" PRIu32 "", msgType);
-			error = ERROR_INVALID_DATA;
+		/* a malformed message is left to remdesk_process_receive to report */
+		if (remdesk_read_pdu(s, &header, &id, &pdu) != CHANNEL_RC_OK)
 			break;
+		if ((id != REMDESK_CHANNEL_CTL) || (Stream_GetRemainingLength(&pdu) < 4))
+			continue;
+
+		Stream_Read_UINT32(&pdu, msgType);
+		found = (msgType == REMDESK_CTL_VERSIONINFO);
 	}
 
-	return error;
+	Stream_SetPosition(s, pos);
+	return found;
 }
 
-/**
- * Function description
- *
- * @return 0 on success, otherwise a Win32 error code
- */
-static UINT remdesk_process_receive(remdeskPlugin* remdesk, wStream* s)
+/* Runs on the channel strand, processes one reassembled message */
+static void remdesk_receive_task(void* context, void* arg)
 {
-	UINT status = 0;
-	REMDESK_CHANNEL_HEADER header;
+	remdeskPlugin* remdesk = (remdeskPlugin*)context;
+	wStream* data = (wStream*)arg;
 
 	WINPR_ASSERT(remdesk);
-	WINPR_ASSERT(s);
-
-	if ((status = remdesk_read_channel_header(s, &header)))
-	{
-		WLog_ERR(TAG, "remdesk_read_channel_header failed with error %" PRIu32 "", status);
-		return status;
-	}
+	WINPR_ASSERT(data);
 
-	if (strcmp(header.ChannelName, "RC_CTL") == 0)
-	{
-		status = remdesk_recv_ctl_pdu(remdesk, s, &header);
-	}
-	else if (strcmp(header.ChannelName, "70") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "71") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, ".") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "1000.") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "RA_FX") == 0)
-	{
-	}
-	else
+	/* the channel state is undefined after an error, drop everything that follows */
+	if (!remdesk->failed)
 	{
+		const UINT error = remdesk_process_receive(remdesk, data);
+		if (error)
+		{
+			WLog_ERR(TAG, "remdesk_process_receive failed with error %" PRIu32 "!", error);
+			remdesk->failed = TRUE;
+			if (remdesk->rdpcontext)
+				setChannelError(remdesk->rdpcontext, error,
+				                "remdesk_receive_task reported an error");
+		}
 	}
 
-	return status;
-}
-
-static void remdesk_process_connect(WINPR_ATTR_UNUSED remdeskPlugin* remdesk)
-{
-	WINPR_ASSERT(remdesk);
-	WLog_ERR("TODO", "TODO: implement");
+	Stream_Release(data);
+	(void)InterlockedDecrement(&remdesk->queued);
 }
 
 /**
@@ -688,45 +895,48 @@ static UINT remdesk_virtual_channel_event_data_received(remdeskPlugin* remdesk,
 		return CHANNEL_RC_OK;
 	}
 
-	if (dataFlags & CHANNEL_FLAG_FIRST)
+	/* A message in a single chunk is parsed straight from the channel buffer, unless the strand
+	 * still has messages queued which must be processed first or the message may wait for the
+	 * expert blob. This thread is the only producer, so the strand is idle once the count
+	 * dropped to 0. */
+	if (svc_reassembly_is_single_chunk(dataLength, totalLength, dataFlags) &&
+	    (InterlockedCompareExchange(&remdesk->queued, 0, 0) == 0))
 	{
-		if (remdesk->data_in)
-			Stream_Free(remdesk->data_in, TRUE);
+		wStream sbuffer = { 0 };
+		wStream* s = Stream_StaticConstInit(&sbuffer, pData, dataLength);
 
-		remdesk->data_in = Stream_New(NULL, totalLength);
+		/* like on the strand, everything following an error is dropped */
+		if (remdesk->failed)
+			return CHANNEL_RC_OK;
 
-		if (!remdesk->data_in)
+		if (!remdesk_has_version_info(s))
 		{
-			WLog_ERR(TAG, "Stream_New failed!");
-			return CHANNEL_RC_NO_MEMORY;
+			const UINT error = remdesk_process_receive(remdesk, s);
+			if (error)
+			{
+				WLog_ERR(TAG, "remdesk_process_receive failed with error %" PRIu32 "!", error);
+				remdesk->failed = TRUE;
+			}
+			return error;
 		}
 	}
 
-	data_in = remdesk->data_in;
-
-	if (!Stream_EnsureRemainingCapacity(data_in, dataLength))
+	UINT error = svc_reassembly_push(remdesk->reassembly, pData, dataLength, totalLength,
+	                                 dataFlags, &data_in);
+	if (error)
 	{
-		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
-		return CHANNEL_RC_NO_MEMORY;
+		WLog_ERR(TAG, "svc_reassembly_push failed with error %" PRIu32 "!", error);
+		return error;
 	}
 
-	Stream_Write(data_in, pData, dataLength);
-
-	if (dataFlags & CHANNEL_FLAG_LAST)
+	if (data_in)
 	{
-		if (Stream_Capacity(data_in) != Stream_GetPosition(data_in))
+		(void)InterlockedIncrement(&remdesk->queued);
+		if (!svc_strand_post(remdesk->strand, remdesk_receive_task, data_in))
 		{
-			WLog_ERR(TAG, "read error");
-			return ERROR_INTERNAL_ERROR;
-		}
-
-		remdesk->data_in = NULL;
-		Stream_SealLength(data_in);
-		Stream_SetPosition(data_in, 0);
-
-		if (!MessageQueue_Post(remdesk->queue, NULL, 0, (void*)data_in, NULL))
-		{
-			WLog_ERR(TAG, "MessageQueue_Post failed!");
+			WLog_ERR(TAG, "svc_strand_post failed!");
+			(void)InterlockedDecrement(&remdesk->queued);
+			Stream_Release(data_in);
 			return ERROR_INTERNAL_ERROR;
 		}
 	}
@@ -764,11 +974,10 @@ static VOID VCAPITYPE remdesk_virtual_channel_open_event_ex(LPVOID lpUserParam,
 
 		case CHANNEL_EVENT_WRITE_CANCELLED:
 		case CHANNEL_EVENT_WRITE_COMPLETE:
-		{
-			wStream* s = (wStream*)pData;
-			Stream_Free(s, TRUE);
-		}
-		break;
+			/* RA_FX PDUs pass their stream, cached handshake batches no user data */
+			if (pData)
+				Stream_Release((wStream*)pData);
+			break;
 
 		case CHANNEL_EVENT_USER:
 			break;
@@ -784,57 +993,29 @@ static VOID VCAPITYPE remdesk_virtual_channel_open_event_ex(LPVOID lpUserParam,
 		                "remdesk_virtual_channel_open_event_ex reported an error");
 }
 
-static DWORD WINAPI remdesk_virtual_channel_client_thread(LPVOID arg)
+/**
+ * Function description
+ *
+ * Writes an RA_FX PDU, the stream is released once the write completed or was cancelled.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_send_pdu(void* custom, wStream* s)
 {
-	wStream* data = NULL;
-	wMessage message = { 0 };
-	remdeskPlugin* remdesk = (remdeskPlugin*)arg;
-	UINT error = CHANNEL_RC_OK;
+	remdeskPlugin* remdesk = (remdeskPlugin*)custom;
 
 	WINPR_ASSERT(remdesk);
+	WINPR_ASSERT(remdesk->channelEntryPoints.pVirtualChannelWriteEx);
 
-	remdesk_process_connect(remdesk);
-
-	while (1)
+	const UINT status = remdesk->channelEntryPoints.pVirtualChannelWriteEx(
+	    remdesk->InitHandle, remdesk->OpenHandle, Stream_Buffer(s), (UINT32)Stream_Length(s), s);
+	if (status != CHANNEL_RC_OK)
 	{
-		if (!MessageQueue_Wait(remdesk->queue))
-		{
-			WLog_ERR(TAG, "MessageQueue_Wait failed!");
-			error = ERROR_INTERNAL_ERROR;
-			break;
-		}
-
-		if (!MessageQueue_Peek(remdesk->queue, &message, TRUE))
-		{
-			WLog_ERR(TAG, "MessageQueue_Peek failed!");
-			error = ERROR_INTERNAL_ERROR;
-			break;
-		}
-
-		if (message.id == WMQ_QUIT)
-			break;
-
-		if (message.id == 0)
-		{
-			data = (wStream*)message.wParam;
-
-			if ((error = remdesk_process_receive(remdesk, data)))
-			{
-				WLog_ERR(TAG, "remdesk_process_receive failed with error %" PRIu32 "!", error);
-				Stream_Free(data, TRUE);
-				break;
-			}
-
-			Stream_Free(data, TRUE);
-		}
+		WLog_ERR(TAG, "pVirtualChannelWriteEx failed with %s [%08" PRIX32 "]",
+		         WTSErrorToString(status), status);
+		Stream_Release(s);
 	}
-
-	if (error && remdesk->rdpcontext)
-		setChannelError(remdesk->rdpcontext, error,
-		                "remdesk_virtual_channel_client_thread reported an error");
-
-	ExitThread(error);
-	return error;
+	return status;
 }
 
 /**
@@ -850,22 +1031,42 @@ static UINT remdesk_virtual_channel_event_connected(remdeskPlugin* remdesk,
 
 	WINPR_ASSERT(remdesk);
 
-	remdesk->queue = MessageQueue_New(NULL);
+	remdesk->reassembly = svc_reassembly_new(REMDESK_REASSEMBLY_DEFAULT_SIZE);
 
-	if (!remdesk->queue)
+	if (!remdesk->reassembly)
 	{
-		WLog_ERR(TAG, "MessageQueue_New failed!");
+		WLog_ERR(TAG, "svc_reassembly_new failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	/* offers are refused unless a download directory is configured */
+	remdesk->fx = remdesk_fx_new(getenv("REMDESK_FX_DIR"), remdesk_fx_send_pdu, NULL, remdesk);
+
+	if (!remdesk->fx)
+	{
+		WLog_ERR(TAG, "remdesk_fx_new failed!");
 		error = CHANNEL_RC_NO_MEMORY;
 		goto error_out;
 	}
 
-	remdesk->thread =
-	    CreateThread(NULL, 0, remdesk_virtual_channel_client_thread, (void*)remdesk, 0, NULL);
+	/* queued ahead of the session's tasks */
+	remdesk_start_precompute(remdesk);
 
-	if (!remdesk->thread)
+	remdesk->queued = 0;
+	remdesk->failed = FALSE;
+	remdesk->strand = svc_strand_new(remdesk);
+
+	if (!remdesk->strand)
 	{
-		WLog_ERR(TAG, "CreateThread failed");
-		error = ERROR_INTERNAL_ERROR;
+		WLog_ERR(TAG, "svc_strand_new failed!");
+		error = CHANNEL_RC_NO_MEMORY;
+		goto error_out;
+	}
+
+	if (!svc_strand_post(remdesk->strand, remdesk_connect_task, NULL))
+	{
+		WLog_ERR(TAG, "svc_strand_post failed!");
+		error = CHANNEL_RC_NO_MEMORY;
 		goto error_out;
 	}
 
@@ -873,8 +1074,13 @@ static UINT remdesk_virtual_channel_event_connected(remdeskPlugin* remdesk,
 	    remdesk->InitHandle, &remdesk->OpenHandle, remdesk->channelDef.name,
 	    remdesk_virtual_channel_open_event_ex);
 error_out:
-	MessageQueue_Free(remdesk->queue);
-	remdesk->queue = NULL;
+	svc_strand_free(remdesk->strand);
+	remdesk->strand = NULL;
+	remdesk_stop_precompute(remdesk);
+	remdesk_fx_free(remdesk->fx);
+	remdesk->fx = NULL;
+	svc_reassembly_free(remdesk->reassembly);
+	remdesk->reassembly = NULL;
 	return error;
 }
 
@@ -889,16 +1095,10 @@ static UINT remdesk_virtual_channel_event_disconnected(remdeskPlugin* remdesk)
 
 	WINPR_ASSERT(remdesk);
 
-	if (remdesk->queue && remdesk->thread)
-	{
-		if (MessageQueue_PostQuit(remdesk->queue, 0) &&
-		    (WaitForSingleObject(remdesk->thread, INFINITE) == WAIT_FAILED))
-		{
-			rc = GetLastError();
-			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", rc);
-			return rc;
-		}
-	}
+	/* processes the messages still queued and waits for them */
+	svc_strand_free(remdesk->strand);
+	remdesk->strand = NULL;
+	remdesk_stop_precompute(remdesk);
 
 	if (remdesk->OpenHandle != 0)
 	{
@@ -914,12 +1114,13 @@ static UINT remdesk_virtual_channel_event_disconnected(remdeskPlugin* remdesk)
 
 		remdesk->OpenHandle = 0;
 	}
-	MessageQueue_Free(remdesk->queue);
-	(void)CloseHandle(remdesk->thread);
-	Stream_Free(remdesk->data_in, TRUE);
-	remdesk->data_in = NULL;
-	remdesk->queue = NULL;
-	remdesk->thread = NULL;
+	/* pending writes of cached PDUs completed or were cancelled by the close, writes of the
+	 * transfers still running fail from here on */
+	remdesk_fx_free(remdesk->fx);
+	remdesk->fx = NULL;
+	remdesk_free_handshake_cache(remdesk);
+	svc_reassembly_free(remdesk->reassembly);
+	remdesk->reassembly = NULL;
 	return rc;
 }
 
@@ -927,7 +1128,10 @@ static void remdesk_virtual_channel_event_terminated(remdeskPlugin* remdesk)
 {
 	WINPR_ASSERT(remdesk);
 
+	remdesk_stop_precompute(remdesk);
 	remdesk->InitHandle = 0;
+	free(remdesk->ExpertBlob);
+	free(remdesk->EncryptedPassStub);
 	free(remdesk->context);
 	free(remdesk);
 }
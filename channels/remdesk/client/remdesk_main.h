@@ -35,6 +35,11 @@
 
 #include <freerdp/client/remdesk.h>
 
+#include "svc_executor.h"
+#include "svc_reassembly.h"
+
+#include "remdesk_fx.h"
+
 #include <freerdp/channels/log.h>
 #define TAG CHANNELS_TAG("remdesk.client")
 
@@ -45,16 +50,31 @@ typedef struct
 
 	RemdeskClientContext* context;
 
-	HANDLE thread;
-	wStream* data_in;
+	SvcStrand* strand;
+	SvcReassembly* reassembly;
+	volatile LONG queued; /* messages posted to the strand and not yet processed */
+	BOOL failed;          /* on the strand, or on the channel thread while it is idle */
+	RemdeskFx* fx;        /* RA_FX downloads into REMDESK_FX_DIR */
 	void* InitHandle;
 	DWORD OpenHandle;
-	wMessageQueue* queue;
 
 	UINT32 Version;
 	char* ExpertBlob;
 	BYTE* EncryptedPassStub;
 	size_t EncryptedPassStubSize;
+
+	/* background generation of the above, started when the channel connects */
+	SvcStrand* precompute;
+	HANDLE ExpertBlobEvent; /* set once the generation finished */
+	volatile LONG ExpertBlobReady;
+	UINT ExpertBlobStatus;
+
+	/* per session handshake cache, see remdesk_free_handshake_cache */
+	WCHAR* RaConnectionStringW;
+	size_t cbRaConnectionStringW;
+	WCHAR* ExpertBlobW;
+	size_t cbExpertBlobW;
+	wStream* HandshakePdu[2]; /* batched handshake, indexed by protocol version - 1 */
 	rdpContext* rdpcontext;
 } remdeskPlugin;
 
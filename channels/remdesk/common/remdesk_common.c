@@ -18,11 +18,57 @@
  * limitations under the License.
  */
 
+#include <winpr/endian.h>
+
 #include "remdesk_common.h"
 
 #include <freerdp/channels/log.h>
 #define TAG CHANNELS_TAG("remdesk.common")
 
+/* UTF-16LE code unit of an ASCII character */
+#define REMDESK_U16(c) (BYTE)(c), 0
+
+typedef struct
+{
+	REMDESK_CHANNEL_ID id;
+	const char* name;
+	const BYTE* nameW; /* UTF-16LE, not terminated */
+	size_t cbNameW;
+} REMDESK_CHANNEL_NAME;
+
+static const BYTE remdesk_name_ctl[] = { REMDESK_U16('R'), REMDESK_U16('C'), REMDESK_U16('_'),
+	                                     REMDESK_U16('C'), REMDESK_U16('T'), REMDESK_U16('L') };
+static const BYTE remdesk_name_70[] = { REMDESK_U16('7'), REMDESK_U16('0') };
+static const BYTE remdesk_name_71[] = { REMDESK_U16('7'), REMDESK_U16('1') };
+static const BYTE remdesk_name_dot[] = { REMDESK_U16('.') };
+static const BYTE remdesk_name_1000dot[] = { REMDESK_U16('1'), REMDESK_U16('0'), REMDESK_U16('0'),
+	                                         REMDESK_U16('0'), REMDESK_U16('.') };
+static const BYTE remdesk_name_ra_fx[] = { REMDESK_U16('R'), REMDESK_U16('A'), REMDESK_U16('_'),
+	                                       REMDESK_U16('F'), REMDESK_U16('X') };
+
+/* Compared length first, RC_CTL carries nearly all traffic and comes first */
+static const REMDESK_CHANNEL_NAME remdesk_channel_names[] = {
+	{ REMDESK_CHANNEL_CTL, REMDESK_CHANNEL_CTL_NAME, remdesk_name_ctl, sizeof(remdesk_name_ctl) },
+	{ REMDESK_CHANNEL_70, "70", remdesk_name_70, sizeof(remdesk_name_70) },
+	{ REMDESK_CHANNEL_71, "71", remdesk_name_71, sizeof(remdesk_name_71) },
+	{ REMDESK_CHANNEL_DOT, ".", remdesk_name_dot, sizeof(remdesk_name_dot) },
+	{ REMDESK_CHANNEL_1000DOT, "1000.", remdesk_name_1000dot, sizeof(remdesk_name_1000dot) },
+	{ REMDESK_CHANNEL_RA_FX, "RA_FX", remdesk_name_ra_fx, sizeof(remdesk_name_ra_fx) }
+};
+
+size_t remdesk_pdu_length(const BYTE* header)
+{
+	WINPR_ASSERT(header);
+
+	const UINT32 ChannelNameLen = winpr_Data_Get_UINT32(&header[0]);
+	const UINT32 DataLength = winpr_Data_Get_UINT32(&header[4]);
+
+	if ((ChannelNameLen > 64) || ((ChannelNameLen % 2) != 0))
+		return 0;
+
+	return 1ULL * REMDESK_CHANNEL_HEADER_LENGTH + ChannelNameLen + DataLength;
+}
+
 UINT remdesk_write_channel_header(wStream* s, const REMDESK_CHANNEL_HEADER* header)
 {
 	WCHAR ChannelNameW[32] = { 0 };
@@ -60,10 +106,17 @@ UINT remdesk_write_ctl_header(wStream* s, const REMDESK_CTL_HEADER* ctlHeader)
 	return CHANNEL_RC_OK;
 }
 
-UINT remdesk_read_channel_header(wStream* s, REMDESK_CHANNEL_HEADER* header)
+UINT remdesk_read_channel_header(wStream* s, REMDESK_CHANNEL_HEADER* header,
+                                 REMDESK_CHANNEL_ID* id)
 {
 	UINT32 ChannelNameLen = 0;
 
+	WINPR_ASSERT(header);
+	WINPR_ASSERT(id);
+
+	*id = REMDESK_CHANNEL_UNKNOWN;
+	header->ChannelName[0] = '\0';
+
 	if (!Stream_CheckAndLogRequiredLength(TAG, s, 8))
 		return CHANNEL_RC_NO_MEMORY;
 
@@ -82,11 +135,29 @@ UINT remdesk_read_channel_header(wStream* s, REMDESK_CHANNEL_HEADER* header)
 		return ERROR_INVALID_DATA;
 	}
 
-	if (Stream_Read_UTF16_String_As_UTF8_Buffer(s, ChannelNameLen / sizeof(WCHAR),
-	                                            header->ChannelName,
-	                                            ARRAYSIZE(header->ChannelName)) < 0)
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, ChannelNameLen))
 		return ERROR_INVALID_DATA;
 
+	const BYTE* name = Stream_ConstPointer(s);
+	Stream_Seek(s, ChannelNameLen);
+
+	/* the name ends at the first null character, if any */
+	size_t cbName = 0;
+	while ((cbName < ChannelNameLen) && ((name[cbName] != 0) || (name[cbName + 1] != 0)))
+		cbName += sizeof(WCHAR);
+
+	for (size_t x = 0; x < ARRAYSIZE(remdesk_channel_names); x++)
+	{
+		const REMDESK_CHANNEL_NAME* entry = &remdesk_channel_names[x];
+
+		if ((entry->cbNameW != cbName) || (memcmp(entry->nameW, name, cbName) != 0))
+			continue;
+
+		*id = entry->id;
+		(void)strncpy(header->ChannelName, entry->name, ARRAYSIZE(header->ChannelName) - 1);
+		break;
+	}
+
 	return CHANNEL_RC_OK;
 }
 
@@ -103,3 +174,109 @@ UINT remdesk_prepare_ctl_header(REMDESK_CTL_HEADER* ctlHeader, UINT32 msgType, s
 	ctlHeader->ch.DataLength = (UINT32)(4UL + msgSize);
 	return CHANNEL_RC_OK;
 }
+
+UINT remdesk_read_pdu(wStream* s, REMDESK_CHANNEL_HEADER* header, REMDESK_CHANNEL_ID* id,
+                      wStream* pdu)
+{
+	WINPR_ASSERT(s);
+	WINPR_ASSERT(pdu);
+
+	const UINT error = remdesk_read_channel_header(s, header, id);
+	if (error)
+		return error;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, header->DataLength))
+		return ERROR_INVALID_DATA;
+
+	Stream_StaticConstInit(pdu, Stream_ConstPointer(s), header->DataLength);
+	Stream_Seek(s, header->DataLength);
+	return CHANNEL_RC_OK;
+}
+
+static UINT remdesk_prepare_ctl_pdu(REMDESK_CTL_HEADER* ctlHeader, UINT32 msgType,
+                                    const REMDESK_PDU_SEGMENT* segments, size_t count)
+{
+	size_t msgSize = 0;
+
+	WINPR_ASSERT(segments || (count == 0));
+
+	for (size_t x = 0; x < count; x++)
+	{
+		WINPR_ASSERT(segments[x].data || (segments[x].length == 0));
+		if (segments[x].length > UINT32_MAX - msgSize)
+			return ERROR_INVALID_PARAMETER;
+		msgSize += segments[x].length;
+	}
+
+	const UINT error = remdesk_prepare_ctl_header(ctlHeader, msgType, msgSize);
+	if (error)
+		WLog_ERR(TAG, "remdesk_prepare_ctl_header failed with error %" PRIu32 "!", error);
+	return error;
+}
+
+static UINT remdesk_write_ctl_pdu(wStream* s, const REMDESK_CTL_HEADER* ctlHeader,
+                                  const REMDESK_PDU_SEGMENT* segments, size_t count)
+{
+	const UINT error = remdesk_write_ctl_header(s, ctlHeader);
+	if (error)
+		return error;
+
+	for (size_t x = 0; x < count; x++)
+	{
+		if (segments[x].length > 0)
+			Stream_Write(s, segments[x].data, segments[x].length);
+	}
+	return CHANNEL_RC_OK;
+}
+
+UINT remdesk_build_ctl_pdu(wStreamPool* pool, UINT32 msgType, const REMDESK_PDU_SEGMENT* segments,
+                           size_t count, wStream** ps)
+{
+	REMDESK_CTL_HEADER ctlHeader = { 0 };
+
+	WINPR_ASSERT(ps);
+
+	UINT error = remdesk_prepare_ctl_pdu(&ctlHeader, msgType, segments, count);
+	if (error)
+		return error;
+
+	const size_t size = 1ULL * REMDESK_CHANNEL_CTL_SIZE + ctlHeader.ch.DataLength;
+	wStream* s = *ps;
+	if (s)
+	{
+		if (!Stream_EnsureRemainingCapacity(s, size))
+		{
+			WLog_ERR(TAG, "failed to grow the batch by %" PRIuz " bytes for msgType %" PRIu32,
+			         size, msgType);
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+	else
+	{
+		s = pool ? StreamPool_Take(pool, size) : Stream_New(NULL, size);
+		if (!s)
+		{
+			WLog_ERR(TAG, "failed to allocate %" PRIuz " bytes for msgType %" PRIu32, size,
+			         msgType);
+			return CHANNEL_RC_NO_MEMORY;
+		}
+	}
+
+	error = remdesk_write_ctl_pdu(s, &ctlHeader, segments, count);
+	if (error)
+	{
+		/* a batch stays with the caller */
+		if (s != *ps)
+		{
+			if (pool)
+				Stream_Release(s);
+			else
+				Stream_Free(s, TRUE);
+		}
+		return error;
+	}
+	Stream_SealLength(s);
+
+	*ps = s;
+	return CHANNEL_RC_OK;
+}
@@ -25,8 +25,63 @@
 
 #include <freerdp/channels/remdesk.h>
 
+/* Remote assistance sub channels known to this implementation */
+typedef enum
+{
+	REMDESK_CHANNEL_UNKNOWN = 0,
+	REMDESK_CHANNEL_CTL,     /* "RC_CTL" */
+	REMDESK_CHANNEL_70,      /* "70" */
+	REMDESK_CHANNEL_71,      /* "71" */
+	REMDESK_CHANNEL_DOT,     /* "." */
+	REMDESK_CHANNEL_1000DOT, /* "1000." */
+	REMDESK_CHANNEL_RA_FX    /* "RA_FX" */
+} REMDESK_CHANNEL_ID;
+
+/* ChannelNameLen and DataLen, the fixed part of every PDU */
+#define REMDESK_CHANNEL_HEADER_LENGTH 8
+
+/* Total length of the PDU starting with header (REMDESK_CHANNEL_HEADER_LENGTH bytes), 0 if the
+ * header is invalid */
+FREERDP_LOCAL size_t remdesk_pdu_length(const BYTE* header);
+
 FREERDP_LOCAL UINT remdesk_write_channel_header(wStream* s, const REMDESK_CHANNEL_HEADER* header);
 FREERDP_LOCAL UINT remdesk_write_ctl_header(wStream* s, const REMDESK_CTL_HEADER* ctlHeader);
-FREERDP_LOCAL UINT remdesk_read_channel_header(wStream* s, REMDESK_CHANNEL_HEADER* header);
+
+/* Matches the UTF-16 channel name on the wire against the known sub channels, no conversion is
+ * done. header->ChannelName is set for known channels and left empty otherwise. */
+FREERDP_LOCAL UINT remdesk_read_channel_header(wStream* s, REMDESK_CHANNEL_HEADER* header,
+                                               REMDESK_CHANNEL_ID* id);
 FREERDP_LOCAL UINT remdesk_prepare_ctl_header(REMDESK_CTL_HEADER* ctlHeader, UINT32 msgType,
                                               size_t msgSize);
+
+/**
+ * Reads the next PDU of a channel message, which may carry several back to back. pdu is set up
+ * as a read only view of the DataLen bytes of PDU data and s is advanced past it. A PDU longer
+ * than what is left of the message is rejected.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_LOCAL UINT remdesk_read_pdu(wStream* s, REMDESK_CHANNEL_HEADER* header,
+                                    REMDESK_CHANNEL_ID* id, wStream* pdu);
+
+/* One piece of a PDU body, already in wire format */
+typedef struct
+{
+	const void* data;
+	size_t length;
+} REMDESK_PDU_SEGMENT;
+
+/**
+ * Builds a control PDU, client and server alike: channel header, msgType and the body segments
+ * in order, sealed and ready to send.
+ *
+ * If *ps is NULL the PDU gets a buffer of its own, sized up front. With a pool the stream is
+ * taken from it and given back with Stream_Release, without one it is allocated and freed with
+ * Stream_Free. Otherwise the PDU is appended to *ps, which grows as needed, to batch several
+ * PDUs into one channel write; on failure the batch is left to the caller.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_LOCAL UINT remdesk_build_ctl_pdu(wStreamPool* pool, UINT32 msgType,
+                                         const REMDESK_PDU_SEGMENT* segments, size_t count,
+                                         wStream** ps);
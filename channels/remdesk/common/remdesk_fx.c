@@ -0,0 +1,843 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - RA_FX file transfer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <winpr/assert.h>
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include "remdesk_fx.h"
+#include "remdesk_common.h"
+#include "svc_executor.h"
+
+#include <freerdp/channels/log.h>
+#define TAG CHANNELS_TAG("remdesk.fx")
+
+/* msgType and transferId */
+#define REMDESK_FX_HEADER_LENGTH 8
+
+/* channel header with the UTF-16 name "RA_FX" and its terminator */
+#define REMDESK_FX_CHANNEL_LENGTH (REMDESK_CHANNEL_HEADER_LENGTH + 12)
+
+/* received PDUs waiting for the strand, a peer exceeding this ignores the window */
+#define REMDESK_FX_MAX_QUEUED (64 * 1024 * 1024)
+
+#define REMDESK_FX_MAX_NAME_LENGTH 255
+
+typedef struct s_remdesk_fx_transfer
+{
+	struct s_remdesk_fx_transfer* next;
+	UINT32 id;
+	BOOL sender;
+	FILE* fp;
+	char* path;     /* sender: the file read, receiver: the final name */
+	char* partPath; /* receiver: the file written */
+	char* name;     /* sender: the name offered */
+
+	UINT64 fileSize;
+	UINT32 chunkSize;
+	UINT32 window;
+	UINT32 chunks;  /* in the whole file */
+	UINT32 nextSeq; /* sender: next chunk to read, receiver: next chunk expected */
+	UINT32 acked;   /* sender: chunks the receiver wrote */
+	UINT64* sentNs; /* sender: send time of the chunks in flight, indexed by sequence % window */
+
+	UINT64 startNs;
+	RemdeskFxStats stats;
+} RemdeskFxTransfer;
+
+struct s_remdesk_fx
+{
+	SvcStrand* strand;
+	wStreamPool* pool;
+	char* directory;
+	pcRemdeskFxSend send;
+	pcRemdeskFxDone done;
+	void* custom;
+	volatile LONG nextId;
+	volatile LONG queued; /* bytes of received PDUs posted to the strand */
+
+	RemdeskFxTransfer* transfers; /* only touched on the strand */
+};
+
+static void remdesk_fx_transfer_free(RemdeskFxTransfer* transfer)
+{
+	if (!transfer)
+		return;
+
+	if (transfer->fp)
+		(void)fclose(transfer->fp);
+	free(transfer->path);
+	free(transfer->partPath);
+	free(transfer->name);
+	free(transfer->sentNs);
+	free(transfer);
+}
+
+static RemdeskFxTransfer* remdesk_fx_find(RemdeskFx* fx, UINT32 id, BOOL sender)
+{
+	for (RemdeskFxTransfer* transfer = fx->transfers; transfer; transfer = transfer->next)
+	{
+		if ((transfer->id == id) && (transfer->sender == sender))
+			return transfer;
+	}
+	return NULL;
+}
+
+static void remdesk_fx_unlink(RemdeskFx* fx, RemdeskFxTransfer* transfer)
+{
+	for (RemdeskFxTransfer** ptransfer = &fx->transfers; *ptransfer;
+	     ptransfer = &(*ptransfer)->next)
+	{
+		if (*ptransfer == transfer)
+		{
+			*ptransfer = transfer->next;
+			break;
+		}
+	}
+}
+
+static UINT32 remdesk_fx_chunk_length(const RemdeskFxTransfer* transfer, UINT32 sequence)
+{
+	const UINT64 offset = 1ULL * sequence * transfer->chunkSize;
+	return (UINT32)MIN(transfer->chunkSize, transfer->fileSize - offset);
+}
+
+static void remdesk_fx_add_latency(RemdeskFxTransfer* transfer, UINT64 latencyNs)
+{
+	transfer->stats.chunks++;
+	transfer->stats.latencySumNs += latencyNs;
+	transfer->stats.latencyMaxNs = MAX(transfer->stats.latencyMaxNs, latencyNs);
+}
+
+/**
+ * Function description
+ *
+ * Gives the finished download its final name. A file created under that name meanwhile is
+ * never replaced, the download fails instead.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_rename_noreplace(const char* from, const char* to)
+{
+#if !defined(_WIN32)
+#if defined(RENAME_NOREPLACE)
+	if (renameat2(AT_FDCWD, from, AT_FDCWD, to, RENAME_NOREPLACE) == 0)
+		return CHANNEL_RC_OK;
+	if (errno == EEXIST)
+		return ERROR_FILE_EXISTS;
+	/* the kernel or the file system may not have it, link fails the same way */
+	if ((errno != ENOSYS) && (errno != EINVAL))
+		return ERROR_ACCESS_DENIED;
+#endif
+	if (link(from, to) != 0)
+		return (errno == EEXIST) ? ERROR_FILE_EXISTS : ERROR_ACCESS_DENIED;
+	if (unlink(from) != 0)
+		WLog_WARN(TAG, "failed to remove %s after linking it to %s", from, to);
+	return CHANNEL_RC_OK;
+#else
+	/* MoveFile fails if the new name exists */
+	return winpr_MoveFile(from, to) ? CHANNEL_RC_OK : ERROR_FILE_EXISTS;
+#endif
+}
+
+/* Unlinks and frees the transfer, after reporting it */
+static void remdesk_fx_finish(RemdeskFx* fx, RemdeskFxTransfer* transfer, UINT error)
+{
+	RemdeskFxStats* stats = &transfer->stats;
+
+	remdesk_fx_unlink(fx, transfer);
+	if (transfer->fp)
+	{
+		if ((fclose(transfer->fp) != 0) && !error)
+			error = ERROR_WRITE_FAULT;
+		transfer->fp = NULL;
+	}
+
+	if (!transfer->sender && transfer->partPath)
+	{
+		if (!error)
+			error = remdesk_fx_rename_noreplace(transfer->partPath, transfer->path);
+		if (error)
+			(void)winpr_DeleteFile(transfer->partPath);
+	}
+
+	stats->error = error;
+	stats->durationNs = transfer->startNs ? winpr_GetTickCount64NS() - transfer->startNs : 0;
+
+	if (error)
+		WLog_WARN(TAG, "RA_FX %s %" PRIu32 " failed with error %" PRIu32 " after %" PRIu64
+		               " of %" PRIu64 " bytes",
+		          transfer->sender ? "upload" : "download", transfer->id, error, stats->bytes,
+		          stats->fileSize);
+	else
+	{
+		const double ms = (double)stats->durationNs / 1000000.0;
+		const double avgUs = stats->chunks ? (double)stats->latencySumNs /
+		                                         (double)stats->chunks / 1000.0
+		                                   : 0.0;
+		WLog_INFO(TAG,
+		          "RA_FX %s %" PRIu32 ": %" PRIu64 " bytes in %.1f ms, %.1f MB/s, chunk latency "
+		          "avg %.1f us max %.1f us",
+		          transfer->sender ? "upload" : "download", transfer->id, stats->bytes, ms,
+		          (ms > 0.0) ? (double)stats->bytes / ms / 1000.0 : 0.0, avgUs,
+		          (double)stats->latencyMaxNs / 1000.0);
+	}
+
+	if (fx->done)
+		fx->done(fx->custom, stats);
+	remdesk_fx_transfer_free(transfer);
+}
+
+/**
+ * Function description
+ *
+ * Takes a pooled stream with the channel header, msgType and transferId written, the caller
+ * appends bodyLength bytes and passes it to remdesk_fx_write.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_begin_pdu(RemdeskFx* fx, UINT32 msgType, UINT32 id, size_t bodyLength,
+                                 wStream** ps)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+
+	WINPR_ASSERT(ps);
+
+	if (bodyLength > UINT32_MAX - REMDESK_FX_HEADER_LENGTH)
+		return ERROR_INVALID_PARAMETER;
+
+	(void)sprintf_s(header.ChannelName, ARRAYSIZE(header.ChannelName), "RA_FX");
+	header.DataLength = (UINT32)(REMDESK_FX_HEADER_LENGTH + bodyLength);
+
+	wStream* s = StreamPool_Take(fx->pool, REMDESK_FX_CHANNEL_LENGTH + header.DataLength);
+	if (!s)
+		return CHANNEL_RC_NO_MEMORY;
+
+	const UINT error = remdesk_write_channel_header(s, &header);
+	if (error)
+	{
+		Stream_Release(s);
+		return error;
+	}
+	Stream_Write_UINT32(s, msgType); /* msgType (4 bytes) */
+	Stream_Write_UINT32(s, id);      /* transferId (4 bytes) */
+
+	*ps = s;
+	return CHANNEL_RC_OK;
+}
+
+static UINT remdesk_fx_write(RemdeskFx* fx, wStream* s)
+{
+	Stream_SealLength(s);
+	const UINT error = fx->send(fx->custom, s);
+	if (error)
+		WLog_ERR(TAG, "sending an RA_FX PDU failed with error %" PRIu32 "!", error);
+	return error;
+}
+
+/* ACK, CANCEL and REJECT, which carry one UINT32 */
+static UINT remdesk_fx_send_value(RemdeskFx* fx, UINT32 msgType, UINT32 id, UINT32 value)
+{
+	wStream* s = NULL;
+
+	const UINT error = remdesk_fx_begin_pdu(fx, msgType, id, 4, &s);
+	if (error)
+		return error;
+
+	Stream_Write_UINT32(s, value);
+	return remdesk_fx_write(fx, s);
+}
+
+static UINT remdesk_fx_send_offer(RemdeskFx* fx, const RemdeskFxTransfer* transfer)
+{
+	wStream* s = NULL;
+	const size_t cbName = strlen(transfer->name);
+
+	const UINT error =
+	    remdesk_fx_begin_pdu(fx, REMDESK_FX_MSG_OFFER, transfer->id, 20 + cbName, &s);
+	if (error)
+		return error;
+
+	Stream_Write_UINT64(s, transfer->fileSize);  /* fileSize (8 bytes) */
+	Stream_Write_UINT32(s, transfer->chunkSize); /* chunkSize (4 bytes) */
+	Stream_Write_UINT32(s, transfer->window);    /* window (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)cbName);      /* cbName (4 bytes) */
+	Stream_Write(s, transfer->name, cbName);     /* name (variable) */
+	return remdesk_fx_write(fx, s);
+}
+
+/**
+ * Function description
+ *
+ * Reads and sends chunks until the window is full. The chunk is read straight into the PDU.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_pump(RemdeskFx* fx, RemdeskFxTransfer* transfer)
+{
+	while ((transfer->nextSeq < transfer->chunks) &&
+	       (transfer->nextSeq - transfer->acked < transfer->window))
+	{
+		wStream* s = NULL;
+		const UINT32 sequence = transfer->nextSeq;
+		const UINT32 length = remdesk_fx_chunk_length(transfer, sequence);
+
+		UINT error = remdesk_fx_begin_pdu(fx, REMDESK_FX_MSG_DATA, transfer->id, 4ULL + length, &s);
+		if (error)
+			return error;
+
+		Stream_Write_UINT32(s, sequence); /* sequence (4 bytes) */
+		if (fread(Stream_Pointer(s), 1, length, transfer->fp) != length)
+		{
+			WLog_ERR(TAG, "reading chunk %" PRIu32 " of %s failed", sequence, transfer->path);
+			Stream_Release(s);
+			return ERROR_READ_FAULT;
+		}
+		Stream_Seek(s, length);
+
+		transfer->sentNs[sequence % transfer->window] = winpr_GetTickCount64NS();
+		transfer->nextSeq++;
+		if ((error = remdesk_fx_write(fx, s)))
+			return error;
+	}
+	return CHANNEL_RC_OK;
+}
+
+/* Runs on the strand, links a transfer set up by remdesk_fx_send_file and offers it */
+static void remdesk_fx_start_task(void* context, void* arg)
+{
+	RemdeskFx* fx = context;
+	RemdeskFxTransfer* transfer = arg;
+
+	WINPR_ASSERT(fx);
+	WINPR_ASSERT(transfer);
+
+	transfer->next = fx->transfers;
+	fx->transfers = transfer;
+	transfer->startNs = winpr_GetTickCount64NS();
+
+	const UINT error = remdesk_fx_send_offer(fx, transfer);
+	if (error)
+		remdesk_fx_finish(fx, transfer, error);
+}
+
+/* A name for the download directory: no path, no control characters */
+static BOOL remdesk_fx_name_valid(const char* name)
+{
+	if ((strcmp(name, "") == 0) || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+		return FALSE;
+
+	for (const char* c = name; *c; c++)
+	{
+		if ((*c == '/') || (*c == '\\') || (*c == ':') || ((BYTE)*c < 0x20))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Function description
+ *
+ * Opens "<name>.part" in the download directory for an offer, the final name must not exist.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_open_download(RemdeskFx* fx, RemdeskFxTransfer* transfer, const char* name)
+{
+	char partName[REMDESK_FX_MAX_NAME_LENGTH + 8] = { 0 };
+
+	if (!fx->directory)
+		return ERROR_ACCESS_DENIED;
+	if (!remdesk_fx_name_valid(name))
+		return ERROR_INVALID_NAME;
+
+	(void)_snprintf(partName, sizeof(partName), "%s.part", name);
+	transfer->path = GetCombinedPath(fx->directory, name);
+	char* partPath = GetCombinedPath(fx->directory, partName);
+	if (!transfer->path || !partPath)
+	{
+		free(partPath);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	/* an existing partial file belongs to another transfer, it is not ours to remove */
+	if (!winpr_PathFileExists(transfer->path))
+		transfer->fp = winpr_fopen(partPath, "wbx");
+	if (!transfer->fp)
+	{
+		free(partPath);
+		return ERROR_FILE_EXISTS;
+	}
+
+	transfer->partPath = partPath;
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_recv_offer(RemdeskFx* fx, UINT32 id, wStream* s)
+{
+	UINT64 fileSize = 0;
+	UINT32 chunkSize = 0;
+	UINT32 window = 0;
+	UINT32 cbName = 0;
+	char name[REMDESK_FX_MAX_NAME_LENGTH + 1] = { 0 };
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 20))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT64(s, fileSize);  /* fileSize (8 bytes) */
+	Stream_Read_UINT32(s, chunkSize); /* chunkSize (4 bytes) */
+	Stream_Read_UINT32(s, window);    /* window (4 bytes) */
+	Stream_Read_UINT32(s, cbName);    /* cbName (4 bytes) */
+
+	if ((cbName > REMDESK_FX_MAX_NAME_LENGTH) ||
+	    !Stream_CheckAndLogRequiredLength(TAG, s, cbName))
+		return ERROR_INVALID_DATA;
+	Stream_Read(s, name, cbName); /* name (variable) */
+
+	if (remdesk_fx_find(fx, id, FALSE))
+	{
+		WLog_ERR(TAG, "RA_FX transfer %" PRIu32 " offered twice", id);
+		return ERROR_INVALID_DATA;
+	}
+
+	RemdeskFxTransfer* transfer = calloc(1, sizeof(RemdeskFxTransfer));
+	if (!transfer)
+		return CHANNEL_RC_NO_MEMORY;
+
+	transfer->id = id;
+	transfer->fileSize = fileSize;
+	transfer->chunkSize = chunkSize;
+	transfer->window = window;
+	transfer->stats.transferId = id;
+	transfer->stats.fileSize = fileSize;
+	transfer->startNs = winpr_GetTickCount64NS();
+
+	UINT status = CHANNEL_RC_OK;
+	if ((chunkSize < REMDESK_FX_MIN_CHUNK_SIZE) || (chunkSize > REMDESK_FX_MAX_CHUNK_SIZE) ||
+	    (window == 0) || (window > REMDESK_FX_MAX_WINDOW) ||
+	    (1ULL * chunkSize * window > REMDESK_FX_MAX_IN_FLIGHT) ||
+	    (fileSize > 1ULL * UINT32_MAX * chunkSize))
+		status = ERROR_INVALID_PARAMETER;
+	else
+	{
+		transfer->chunks = (UINT32)((fileSize + chunkSize - 1) / chunkSize);
+		status = remdesk_fx_open_download(fx, transfer, name);
+	}
+
+	transfer->next = fx->transfers;
+	fx->transfers = transfer;
+
+	/* a refused offer is a result for the peer, not an error of the channel */
+	if (status)
+	{
+		WLog_WARN(TAG, "RA_FX offer %" PRIu32 " of %s refused with error %" PRIu32, id, name,
+		          status);
+		remdesk_fx_finish(fx, transfer, status);
+		return remdesk_fx_send_value(fx, REMDESK_FX_MSG_REJECT, id, status);
+	}
+
+	wStream* pdu = NULL;
+	UINT error = remdesk_fx_begin_pdu(fx, REMDESK_FX_MSG_ACCEPT, id, 0, &pdu);
+	if (!error)
+		error = remdesk_fx_write(fx, pdu);
+
+	if (error || (transfer->chunks == 0))
+		remdesk_fx_finish(fx, transfer, error);
+	return error;
+}
+
+/**
+ * Function description
+ *
+ * Appends the chunk to the partial file and acknowledges it once written.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_recv_data(RemdeskFx* fx, UINT32 id, wStream* s, UINT64 arrivalNs)
+{
+	UINT32 sequence = 0;
+
+	RemdeskFxTransfer* transfer = remdesk_fx_find(fx, id, FALSE);
+	if (!transfer)
+	{
+		/* the rest of a transfer that was refused or failed */
+		WLog_DBG(TAG, "RA_FX data for unknown transfer %" PRIu32, id);
+		return CHANNEL_RC_OK;
+	}
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
+		return ERROR_INVALID_DATA;
+	Stream_Read_UINT32(s, sequence); /* sequence (4 bytes) */
+
+	UINT status = CHANNEL_RC_OK;
+	if ((sequence != transfer->nextSeq) || (sequence >= transfer->chunks) ||
+	    (Stream_GetRemainingLength(s) != remdesk_fx_chunk_length(transfer, sequence)))
+	{
+		WLog_ERR(TAG, "RA_FX transfer %" PRIu32 ": unexpected chunk %" PRIu32, id, sequence);
+		status = ERROR_INVALID_DATA;
+	}
+	else if (fwrite(Stream_ConstPointer(s), 1, Stream_GetRemainingLength(s), transfer->fp) !=
+	         Stream_GetRemainingLength(s))
+	{
+		WLog_ERR(TAG, "writing chunk %" PRIu32 " of %s failed", sequence, transfer->partPath);
+		status = ERROR_WRITE_FAULT;
+	}
+
+	if (status)
+	{
+		remdesk_fx_finish(fx, transfer, status);
+		return remdesk_fx_send_value(fx, REMDESK_FX_MSG_REJECT, id, status);
+	}
+
+	transfer->nextSeq++;
+	transfer->stats.bytes += Stream_GetRemainingLength(s);
+	remdesk_fx_add_latency(transfer, winpr_GetTickCount64NS() - arrivalNs);
+
+	const UINT error = remdesk_fx_send_value(fx, REMDESK_FX_MSG_ACK, id, transfer->nextSeq);
+	if (error || (transfer->nextSeq == transfer->chunks))
+		remdesk_fx_finish(fx, transfer, error);
+	return error;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_recv_accept(RemdeskFx* fx, UINT32 id)
+{
+	RemdeskFxTransfer* transfer = remdesk_fx_find(fx, id, TRUE);
+	if (!transfer)
+		return CHANNEL_RC_OK;
+
+	const UINT error = remdesk_fx_pump(fx, transfer);
+	if (error)
+	{
+		remdesk_fx_finish(fx, transfer, error);
+		return remdesk_fx_send_value(fx, REMDESK_FX_MSG_CANCEL, id, error);
+	}
+
+	/* an empty file is complete once accepted */
+	if (transfer->chunks == 0)
+		remdesk_fx_finish(fx, transfer, CHANNEL_RC_OK);
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * The acknowledgement is cumulative, it completes every chunk before sequence.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_recv_ack(RemdeskFx* fx, UINT32 id, wStream* s)
+{
+	UINT32 sequence = 0;
+
+	RemdeskFxTransfer* transfer = remdesk_fx_find(fx, id, TRUE);
+	if (!transfer)
+		return CHANNEL_RC_OK;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
+		return ERROR_INVALID_DATA;
+	Stream_Read_UINT32(s, sequence); /* sequence (4 bytes) */
+
+	if ((sequence <= transfer->acked) || (sequence > transfer->nextSeq))
+	{
+		WLog_ERR(TAG, "RA_FX transfer %" PRIu32 ": unexpected ack %" PRIu32, id, sequence);
+		return ERROR_INVALID_DATA;
+	}
+
+	const UINT64 now = winpr_GetTickCount64NS();
+	for (UINT32 x = transfer->acked; x < sequence; x++)
+		remdesk_fx_add_latency(transfer, now - transfer->sentNs[x % transfer->window]);
+	transfer->acked = sequence;
+	transfer->stats.bytes = MIN(1ULL * sequence * transfer->chunkSize, transfer->fileSize);
+
+	if (transfer->acked == transfer->chunks)
+	{
+		remdesk_fx_finish(fx, transfer, CHANNEL_RC_OK);
+		return CHANNEL_RC_OK;
+	}
+
+	const UINT error = remdesk_fx_pump(fx, transfer);
+	if (error)
+	{
+		remdesk_fx_finish(fx, transfer, error);
+		return remdesk_fx_send_value(fx, REMDESK_FX_MSG_CANCEL, id, error);
+	}
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * CANCEL from the sender ends a download, REJECT from the receiver an upload.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_recv_abort(RemdeskFx* fx, UINT32 id, BOOL sender, wStream* s)
+{
+	UINT32 status = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
+		return ERROR_INVALID_DATA;
+	Stream_Read_UINT32(s, status); /* error (4 bytes) */
+
+	RemdeskFxTransfer* transfer = remdesk_fx_find(fx, id, sender);
+	if (transfer)
+		remdesk_fx_finish(fx, transfer, status ? status : ERROR_CANCELLED);
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_fx_process(RemdeskFx* fx, wStream* s, UINT64 arrivalNs)
+{
+	UINT32 msgType = 0;
+	UINT32 id = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, REMDESK_FX_HEADER_LENGTH))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(s, msgType); /* msgType (4 bytes) */
+	Stream_Read_UINT32(s, id);      /* transferId (4 bytes) */
+
+	switch (msgType)
+	{
+		case REMDESK_FX_MSG_OFFER:
+			return remdesk_fx_recv_offer(fx, id, s);
+		case REMDESK_FX_MSG_ACCEPT:
+			return remdesk_fx_recv_accept(fx, id);
+		case REMDESK_FX_MSG_DATA:
+			return remdesk_fx_recv_data(fx, id, s, arrivalNs);
+		case REMDESK_FX_MSG_ACK:
+			return remdesk_fx_recv_ack(fx, id, s);
+		case REMDESK_FX_MSG_CANCEL:
+			return remdesk_fx_recv_abort(fx, id, FALSE, s);
+		case REMDESK_FX_MSG_REJECT:
+			return remdesk_fx_recv_abort(fx, id, TRUE, s);
+		default:
+			WLog_ERR(TAG, "unknown RA_FX msgType %" PRIu32, msgType);
+			return ERROR_INVALID_DATA;
+	}
+}
+
+/* Runs on the strand, arg is the arrival time followed by the PDU body */
+static void remdesk_fx_receive_task(void* context, void* arg)
+{
+	RemdeskFx* fx = context;
+	wStream* s = arg;
+	UINT64 arrivalNs = 0;
+
+	WINPR_ASSERT(fx);
+	WINPR_ASSERT(s);
+
+	const size_t length = Stream_Length(s);
+	Stream_Read_UINT64(s, arrivalNs);
+
+	/* only this transfer's state is lost, the channel goes on */
+	const UINT error = remdesk_fx_process(fx, s, arrivalNs);
+	if (error)
+		WLog_ERR(TAG, "remdesk_fx_process failed with error %" PRIu32 "!", error);
+
+	Stream_Release(s);
+	(void)InterlockedExchangeAdd(&fx->queued, -(LONG)length);
+}
+
+RemdeskFx* remdesk_fx_new(const char* directory, pcRemdeskFxSend send, pcRemdeskFxDone done,
+                          void* custom)
+{
+	WINPR_ASSERT(send);
+
+	RemdeskFx* fx = calloc(1, sizeof(RemdeskFx));
+	if (!fx)
+		return NULL;
+
+	fx->send = send;
+	fx->done = done;
+	fx->custom = custom;
+	if (directory && !(fx->directory = _strdup(directory)))
+		goto fail;
+
+	fx->pool = StreamPool_New(TRUE, REMDESK_FX_CHANNEL_LENGTH + REMDESK_FX_HEADER_LENGTH + 4 +
+	                                    REMDESK_FX_DEFAULT_CHUNK_SIZE);
+	if (!fx->pool)
+		goto fail;
+
+	fx->strand = svc_strand_new(fx);
+	if (!fx->strand)
+		goto fail;
+
+	return fx;
+fail:
+	StreamPool_Free(fx->pool);
+	free(fx->directory);
+	free(fx);
+	return NULL;
+}
+
+void remdesk_fx_free(RemdeskFx* fx)
+{
+	if (!fx)
+		return;
+
+	svc_strand_free(fx->strand);
+	while (fx->transfers)
+		remdesk_fx_finish(fx, fx->transfers, ERROR_CANCELLED);
+
+	WINPR_ASSERT(fx->queued == 0);
+	StreamPool_Free(fx->pool);
+	free(fx->directory);
+	free(fx);
+}
+
+UINT remdesk_fx_send_file(RemdeskFx* fx, const char* path, UINT32 chunkSize, UINT32 window,
+                          UINT32* transferId)
+{
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(fx);
+
+	chunkSize = chunkSize ? chunkSize : REMDESK_FX_DEFAULT_CHUNK_SIZE;
+	window = window ? window : REMDESK_FX_DEFAULT_WINDOW;
+	if (!path || (chunkSize < REMDESK_FX_MIN_CHUNK_SIZE) ||
+	    (chunkSize > REMDESK_FX_MAX_CHUNK_SIZE) || (window > REMDESK_FX_MAX_WINDOW) ||
+	    (1ULL * chunkSize * window > REMDESK_FX_MAX_IN_FLIGHT))
+		return ERROR_INVALID_PARAMETER;
+
+	const char* name = path;
+	for (const char* c = path; *c; c++)
+	{
+		if ((*c == '/') || (*c == '\\'))
+			name = c + 1;
+	}
+	if (!remdesk_fx_name_valid(name) || (strlen(name) > REMDESK_FX_MAX_NAME_LENGTH))
+		return ERROR_INVALID_NAME;
+
+	RemdeskFxTransfer* transfer = calloc(1, sizeof(RemdeskFxTransfer));
+	if (!transfer)
+		return CHANNEL_RC_NO_MEMORY;
+
+	transfer->sender = TRUE;
+	transfer->chunkSize = chunkSize;
+	transfer->window = window;
+	transfer->path = _strdup(path);
+	transfer->name = _strdup(name);
+	transfer->sentNs = calloc(window, sizeof(UINT64));
+	if (!transfer->path || !transfer->name || !transfer->sentNs)
+	{
+		error = CHANNEL_RC_NO_MEMORY;
+		goto fail;
+	}
+
+	transfer->fp = winpr_fopen(path, "rb");
+	if (!transfer->fp)
+	{
+		error = ERROR_FILE_NOT_FOUND;
+		goto fail;
+	}
+
+	/* chunks are read in order, stdio buffering would only add a copy */
+	(void)setvbuf(transfer->fp, NULL, _IONBF, 0);
+	const INT64 size = (_fseeki64(transfer->fp, 0, SEEK_END) == 0) ? _ftelli64(transfer->fp) : -1;
+	if ((size < 0) || (_fseeki64(transfer->fp, 0, SEEK_SET) != 0) ||
+	    ((UINT64)size > 1ULL * UINT32_MAX * chunkSize))
+	{
+		error = ERROR_READ_FAULT;
+		goto fail;
+	}
+
+	transfer->fileSize = (UINT64)size;
+	transfer->chunks = (UINT32)((transfer->fileSize + chunkSize - 1) / chunkSize);
+	transfer->id = (UINT32)InterlockedIncrement(&fx->nextId);
+	transfer->stats.transferId = transfer->id;
+	transfer->stats.sender = TRUE;
+	transfer->stats.fileSize = transfer->fileSize;
+
+	if (transferId)
+		*transferId = transfer->id;
+	if (!svc_strand_post(fx->strand, remdesk_fx_start_task, transfer))
+	{
+		WLog_ERR(TAG, "svc_strand_post failed!");
+		error = ERROR_INTERNAL_ERROR;
+		goto fail;
+	}
+	return CHANNEL_RC_OK;
+
+fail:
+	remdesk_fx_transfer_free(transfer);
+	return error;
+}
+
+UINT remdesk_fx_receive(RemdeskFx* fx, wStream* s)
+{
+	WINPR_ASSERT(fx);
+	WINPR_ASSERT(s);
+
+	const size_t length = 8 + Stream_GetRemainingLength(s);
+	if (length > REMDESK_FX_MAX_QUEUED)
+		return ERROR_INVALID_DATA;
+
+	const LONG queued = InterlockedExchangeAdd(&fx->queued, (LONG)length);
+	if ((size_t)queued + length > REMDESK_FX_MAX_QUEUED)
+	{
+		(void)InterlockedExchangeAdd(&fx->queued, -(LONG)length);
+		WLog_ERR(TAG, "the peer sends RA_FX data beyond its window");
+		return ERROR_INVALID_DATA;
+	}
+
+	wStream* data = StreamPool_Take(fx->pool, length);
+	if (!data)
+	{
+		(void)InterlockedExchangeAdd(&fx->queued, -(LONG)length);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	Stream_Write_UINT64(data, winpr_GetTickCount64NS()); /* arrival time for the latency */
+	Stream_Write(data, Stream_ConstPointer(s), Stream_GetRemainingLength(s));
+	Stream_SealLength(data);
+	Stream_SetPosition(data, 0);
+
+	if (!svc_strand_post(fx->strand, remdesk_fx_receive_task, data))
+	{
+		WLog_ERR(TAG, "svc_strand_post failed!");
+		Stream_Release(data);
+		(void)InterlockedExchangeAdd(&fx->queued, -(LONG)length);
+		return ERROR_INTERNAL_ERROR;
+	}
+	return CHANNEL_RC_OK;
+}
@@ -0,0 +1,106 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - RA_FX file transfer
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+#include <winpr/stream.h>
+
+#include <freerdp/api.h>
+
+/*
+ * File transfer over the RA_FX sub channel. The wire format is this implementation's own, every
+ * PDU body starts with msgType and transferId (4 bytes each, little endian):
+ *
+ *   OFFER   fileSize (8), chunkSize (4), window (4), cbName (4), name (UTF-8, not terminated)
+ *   ACCEPT  -
+ *   DATA    sequence (4), chunk data (chunkSize bytes, fewer for the last chunk)
+ *   ACK     sequence (4), every chunk before it is written
+ *   CANCEL  error (4), the sender gives up
+ *   REJECT  error (4), the receiver refuses the offer or gives up
+ *
+ * The sender reads the file one chunk at a time and keeps at most window chunks unacknowledged.
+ * The receiver appends every chunk to "<name>.part" as it arrives and renames the file once the
+ * last one is written, so neither side holds more than window chunks of the file in memory. The
+ * rename never replaces a file that appeared under the final name meanwhile, the transfer fails.
+ * File I/O runs on the engine's strand, never on the thread delivering channel data.
+ */
+typedef struct s_remdesk_fx RemdeskFx;
+
+#define REMDESK_FX_MSG_OFFER 1
+#define REMDESK_FX_MSG_ACCEPT 2
+#define REMDESK_FX_MSG_DATA 3
+#define REMDESK_FX_MSG_ACK 4
+#define REMDESK_FX_MSG_CANCEL 5
+#define REMDESK_FX_MSG_REJECT 6
+
+#define REMDESK_FX_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define REMDESK_FX_DEFAULT_WINDOW 16
+#define REMDESK_FX_MIN_CHUNK_SIZE 1024
+#define REMDESK_FX_MAX_CHUNK_SIZE (1024 * 1024)
+#define REMDESK_FX_MAX_WINDOW 256
+
+/* chunkSize * window of an offer, the data a receiver may have to queue per transfer */
+#define REMDESK_FX_MAX_IN_FLIGHT (16 * 1024 * 1024)
+
+typedef struct
+{
+	UINT32 transferId;
+	BOOL sender;
+	UINT error; /* 0 once the whole file was transferred */
+	UINT64 fileSize;
+	UINT64 bytes;        /* acknowledged by the receiver, or written by it */
+	UINT64 durationNs;   /* from OFFER to the last ACK or write */
+	UINT64 chunks;       /* chunks the latencies below were measured for */
+	UINT64 latencySumNs; /* sender: DATA sent to ACK received, receiver: arrival to written */
+	UINT64 latencyMaxNs;
+} RemdeskFxStats;
+
+/* Takes ownership of the sealed PDU s (channel header included) and writes it to the channel */
+typedef UINT (*pcRemdeskFxSend)(void* custom, wStream* s);
+
+/* Called on the engine's strand once a transfer finished or failed, from remdesk_fx_free for
+ * the transfers it abandons */
+typedef void (*pcRemdeskFxDone)(void* custom, const RemdeskFxStats* stats);
+
+/**
+ * Creates an engine for one channel. Offers are accepted into directory, without one they are
+ * rejected. done is called for every finished transfer in either direction.
+ */
+FREERDP_LOCAL RemdeskFx* remdesk_fx_new(const char* directory, pcRemdeskFxSend send,
+                                        pcRemdeskFxDone done, void* custom);
+
+/* Runs the queued work and abandons the unfinished transfers, their partial files are removed.
+ * The channel must not deliver RA_FX PDUs any more. */
+FREERDP_LOCAL void remdesk_fx_free(RemdeskFx* fx);
+
+/**
+ * Offers the file at path to the peer, chunkSize and window 0 for the defaults. The transfer
+ * runs in the background, transferId identifies it in the stats.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_LOCAL UINT remdesk_fx_send_file(RemdeskFx* fx, const char* path, UINT32 chunkSize,
+                                        UINT32 window, UINT32* transferId);
+
+/**
+ * Queues one RA_FX PDU body for the engine. What the engine keeps is copied, s may be reused
+ * once this returns.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_LOCAL UINT remdesk_fx_receive(RemdeskFx* fx, wStream* s);
@@ -0,0 +1,328 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - fan-out of one session to many experts
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+#include <winpr/synch.h>
+#include <winpr/wtsapi.h>
+
+#include "remdesk_hub.h"
+#include "remdesk_main.h"
+#include "remdesk_common.h"
+
+/* initial capacity of pooled broadcast PDUs */
+#define REMDESK_HUB_PDU_DEFAULT_SIZE 4096
+
+typedef struct
+{
+	RemdeskServerHub* hub;
+	RemdeskServerContext* context;
+	SvcStrand* strand; /* writes to this viewer, one at a time */
+
+	/* protected by the hub lock */
+	size_t backlog; /* bytes of frames posted to the strand and not reported sent */
+} RemdeskHubViewer;
+
+struct s_remdesk_server_hub
+{
+	CRITICAL_SECTION lock;
+	wStreamPool* pool;
+	pcRemdeskServerHubVerify verify;
+	void* custom;
+
+	RemdeskHubViewer** viewers;
+	size_t count;
+	size_t capacity;
+
+	UINT64 frames;
+	UINT64 writes;
+	UINT64 dropped;
+	UINT64 sent;
+};
+
+/* Runs on the viewer's strand, arg is the frame with a reference for this viewer */
+static void remdesk_hub_send_task(void* ctx, void* arg)
+{
+	RemdeskHubViewer* viewer = ctx;
+	wStream* s = arg;
+	WINPR_ASSERT(viewer);
+	WINPR_ASSERT(s);
+
+	const size_t length = Stream_Length(s);
+	WINPR_ASSERT(length <= UINT32_MAX);
+	ULONG written = 0;
+	const BOOL rc = WTSVirtualChannelWrite(viewer->context->priv->ChannelHandle,
+	                                       Stream_BufferAs(s, char), (UINT32)length, &written);
+	Stream_Release(s);
+
+	if (!rc)
+		WLog_WARN(TAG, "WTSVirtualChannelWrite to a viewer failed!");
+
+	/* a written frame stays in the backlog until the connection sent it, a failed one never
+	 * will be. A report may already have taken the backlog below the frame. */
+	RemdeskServerHub* hub = viewer->hub;
+	EnterCriticalSection(&hub->lock);
+	if (rc)
+		hub->writes++;
+	else
+		viewer->backlog -= MIN(viewer->backlog, length);
+	LeaveCriticalSection(&hub->lock);
+}
+
+RemdeskServerHub* remdesk_server_hub_new(pcRemdeskServerHubVerify verify, void* custom)
+{
+	RemdeskServerHub* hub = calloc(1, sizeof(RemdeskServerHub));
+	if (!hub)
+		return NULL;
+
+	hub->verify = verify;
+	hub->custom = custom;
+	hub->pool = StreamPool_New(TRUE, REMDESK_HUB_PDU_DEFAULT_SIZE);
+	if (!hub->pool)
+	{
+		free(hub);
+		return NULL;
+	}
+
+	if (!InitializeCriticalSectionAndSpinCount(&hub->lock, 4000))
+	{
+		StreamPool_Free(hub->pool);
+		free(hub);
+		return NULL;
+	}
+
+	return hub;
+}
+
+void remdesk_server_hub_free(RemdeskServerHub* hub)
+{
+	if (!hub)
+		return;
+
+	WINPR_ASSERT(hub->count == 0);
+	free(hub->viewers);
+	StreamPool_Free(hub->pool);
+	DeleteCriticalSection(&hub->lock);
+	free(hub);
+}
+
+/**
+ * Function description
+ *
+ * The PDU is built once, every viewer gets a reference to the same buffer.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT remdesk_server_hub_broadcast(RemdeskServerHub* hub, const char* channelName,
+                                  const BYTE* data, size_t length)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+
+	WINPR_ASSERT(hub);
+	WINPR_ASSERT(data || (length == 0));
+
+	/* the UTF-16 name with terminator must fit ChannelName */
+	if (!channelName || ((strnlen(channelName, sizeof(header.ChannelName)) + 1) * 2 >
+	                     sizeof(header.ChannelName)))
+		return ERROR_INVALID_PARAMETER;
+	if (length > UINT32_MAX)
+		return ERROR_INVALID_PARAMETER;
+
+	(void)_snprintf(header.ChannelName, sizeof(header.ChannelName), "%s", channelName);
+	header.DataLength = (UINT32)length;
+
+	wStream* s = StreamPool_Take(hub->pool, REMDESK_CHANNEL_HEADER_LENGTH +
+	                                            sizeof(header.ChannelName) + length);
+	if (!s)
+		return CHANNEL_RC_NO_MEMORY;
+
+	UINT error = remdesk_write_channel_header(s, &header);
+	if (error)
+	{
+		Stream_Release(s);
+		return error;
+	}
+	Stream_Write(s, data, length);
+	Stream_SealLength(s);
+
+	const size_t frameLength = Stream_Length(s);
+
+	EnterCriticalSection(&hub->lock);
+	hub->frames++;
+	for (size_t x = 0; x < hub->count; x++)
+	{
+		RemdeskHubViewer* viewer = hub->viewers[x];
+
+		/* the viewer is behind, it skips frames until its connection caught up. A viewer with
+		 * an empty backlog always gets the frame, however large. */
+		if ((viewer->backlog > 0) && (viewer->backlog + frameLength > REMDESK_HUB_MAX_BACKLOG))
+		{
+			hub->dropped++;
+			continue;
+		}
+
+		Stream_AddRef(s);
+		if (!svc_strand_post(viewer->strand, remdesk_hub_send_task, s))
+		{
+			WLog_WARN(TAG, "svc_strand_post failed!");
+			Stream_Release(s);
+			hub->dropped++;
+			continue;
+		}
+		viewer->backlog += frameLength;
+	}
+	LeaveCriticalSection(&hub->lock);
+
+	Stream_Release(s);
+	return CHANNEL_RC_OK;
+}
+
+void remdesk_server_hub_get_stats(RemdeskServerHub* hub, RemdeskServerHubStats* stats)
+{
+	WINPR_ASSERT(hub);
+	WINPR_ASSERT(stats);
+
+	EnterCriticalSection(&hub->lock);
+	stats->frames = hub->frames;
+	stats->writes = hub->writes;
+	stats->dropped = hub->dropped;
+	stats->sent = hub->sent;
+	stats->viewers = hub->count;
+	LeaveCriticalSection(&hub->lock);
+}
+
+static BOOL remdesk_hub_find(RemdeskServerHub* hub, RemdeskServerContext* context, size_t* index)
+{
+	for (size_t x = 0; x < hub->count; x++)
+	{
+		if (hub->viewers[x]->context == context)
+		{
+			if (index)
+				*index = x;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+void remdesk_server_hub_sent(RemdeskServerHub* hub, RemdeskServerContext* context, size_t length)
+{
+	size_t index = 0;
+
+	WINPR_ASSERT(hub);
+	WINPR_ASSERT(context);
+
+	EnterCriticalSection(&hub->lock);
+	if (remdesk_hub_find(hub, context, &index))
+	{
+		RemdeskHubViewer* viewer = hub->viewers[index];
+		viewer->backlog -= MIN(viewer->backlog, length);
+		hub->sent += length;
+	}
+	LeaveCriticalSection(&hub->lock);
+}
+
+static BOOL remdesk_hub_reserve(RemdeskServerHub* hub)
+{
+	if (hub->count < hub->capacity)
+		return TRUE;
+
+	const size_t capacity = MAX(hub->capacity * 2, 8);
+	RemdeskHubViewer** viewers = realloc(hub->viewers, capacity * sizeof(RemdeskHubViewer*));
+	if (!viewers)
+		return FALSE;
+
+	hub->viewers = viewers;
+	hub->capacity = capacity;
+	return TRUE;
+}
+
+BOOL remdesk_server_hub_join(RemdeskServerHub* hub, RemdeskServerContext* context,
+                             const char* expertBlob)
+{
+	WINPR_ASSERT(hub);
+	WINPR_ASSERT(context);
+
+	/* a repeated authentication keeps the viewer, without asking verify again */
+	EnterCriticalSection(&hub->lock);
+	BOOL known = remdesk_hub_find(hub, context, NULL);
+	LeaveCriticalSection(&hub->lock);
+	if (known)
+		return TRUE;
+
+	if (hub->verify && !hub->verify(hub->custom, context, expertBlob))
+	{
+		WLog_INFO(TAG, "expert rejected by the hub");
+		return FALSE;
+	}
+
+	RemdeskHubViewer* viewer = calloc(1, sizeof(RemdeskHubViewer));
+	if (!viewer)
+		return FALSE;
+
+	viewer->hub = hub;
+	viewer->context = context;
+	viewer->strand = svc_strand_new(viewer);
+	if (!viewer->strand)
+	{
+		WLog_ERR(TAG, "svc_strand_new failed!");
+		free(viewer);
+		return FALSE;
+	}
+
+	/* checked again together with the insert, a racing join of the same context adds it once */
+	EnterCriticalSection(&hub->lock);
+	known = remdesk_hub_find(hub, context, NULL);
+	const BOOL joined = known || remdesk_hub_reserve(hub);
+	if (!known && joined)
+		hub->viewers[hub->count++] = viewer;
+	LeaveCriticalSection(&hub->lock);
+
+	if (known || !joined)
+	{
+		svc_strand_free(viewer->strand);
+		free(viewer);
+	}
+	return joined;
+}
+
+void remdesk_server_hub_leave(RemdeskServerHub* hub, RemdeskServerContext* context)
+{
+	size_t index = 0;
+	RemdeskHubViewer* viewer = NULL;
+
+	WINPR_ASSERT(hub);
+	WINPR_ASSERT(context);
+
+	EnterCriticalSection(&hub->lock);
+	if (remdesk_hub_find(hub, context, &index))
+	{
+		viewer = hub->viewers[index];
+		hub->viewers[index] = hub->viewers[--hub->count];
+	}
+	LeaveCriticalSection(&hub->lock);
+
+	if (!viewer)
+		return;
+
+	/* runs the queued send tasks, later broadcasts no longer see the viewer */
+	svc_strand_free(viewer->strand);
+	free(viewer);
+}
@@ -0,0 +1,89 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - fan-out of one session to many experts
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CHANNEL_REMDESK_SERVER_HUB_H
+#define FREERDP_CHANNEL_REMDESK_SERVER_HUB_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/api.h>
+#include <freerdp/server/remdesk.h>
+
+/* Shares the update stream of one helpee with many expert sessions. An expert joins once its
+ * handshake authenticated it (AUTHENTICATE for version 1, VERIFY_PASSWORD for version 2) and
+ * leaves when its session is stopped. Every broadcast PDU is built once into a pooled buffer and
+ * the same buffer is written to all viewers.
+ *
+ * WTSVirtualChannelWrite only copies into the queue of the viewer's connection, so it says
+ * nothing about how far behind a viewer is. Instead each viewer has a backlog: the bytes of its
+ * frames not yet reported sent with remdesk_server_hub_sent. A frame that would take the backlog
+ * past REMDESK_HUB_MAX_BACKLOG is skipped for that viewer, so slow viewers drop frames rather
+ * than queue them. */
+typedef struct s_remdesk_server_hub RemdeskServerHub;
+
+/* Bytes a viewer may have queued and not sent before it skips frames */
+#define REMDESK_HUB_MAX_BACKLOG (256 * 1024)
+
+/* Decides whether an authenticated expert may view, given the expert blob it sent */
+typedef BOOL (*pcRemdeskServerHubVerify)(void* custom, RemdeskServerContext* context,
+                                         const char* expertBlob);
+
+typedef struct
+{
+	UINT64 frames;  /* broadcast PDUs */
+	UINT64 writes;  /* channel writes, at most frames per viewer */
+	UINT64 dropped; /* frames skipped for a viewer that was behind */
+	UINT64 sent;    /* bytes reported with remdesk_server_hub_sent */
+	size_t viewers;
+} RemdeskServerHubStats;
+
+/* Without verify every authenticated expert joins */
+FREERDP_API RemdeskServerHub* remdesk_server_hub_new(pcRemdeskServerHubVerify verify,
+                                                     void* custom);
+
+/* Every session must have been stopped */
+FREERDP_API void remdesk_server_hub_free(RemdeskServerHub* hub);
+
+/**
+ * Sends data as one PDU on the named remdesk sub channel to every viewer.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_API UINT remdesk_server_hub_broadcast(RemdeskServerHub* hub, const char* channelName,
+                                              const BYTE* data, size_t length);
+
+/**
+ * Reports bytes of the session's remdesk channel its connection sent, typically from the
+ * server's SendChannelData for that channel. Every viewer needs these reports, they are what
+ * make room for further frames. Bytes of the session's own PDUs may be reported as well, the
+ * backlog does not go below zero.
+ */
+FREERDP_API void remdesk_server_hub_sent(RemdeskServerHub* hub, RemdeskServerContext* context,
+                                         size_t length);
+
+FREERDP_API void remdesk_server_hub_get_stats(RemdeskServerHub* hub,
+                                              RemdeskServerHubStats* stats);
+
+/* Called by the session, after verify adds the context as a viewer */
+FREERDP_LOCAL BOOL remdesk_server_hub_join(RemdeskServerHub* hub, RemdeskServerContext* context,
+                                           const char* expertBlob);
+
+/* Called by the session once its channel I/O stopped, writes the frame still waiting */
+FREERDP_LOCAL void remdesk_server_hub_leave(RemdeskServerHub* hub,
+                                            RemdeskServerContext* context);
+
+#endif /* FREERDP_CHANNEL_REMDESK_SERVER_HUB_H */
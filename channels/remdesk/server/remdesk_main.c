@@ -24,6 +24,7 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/stream.h>
+#include <winpr/endian.h>
 
 #include <freerdp/freerdp.h>
 
@@ -48,43 +49,47 @@ static UINT remdesk_virtual_channel_write(RemdeskServerContext* context, wStream
 /**
  * Function description
  *
+ * Writes and releases an RA_FX PDU, called on the transfer strand.
+ *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_result_pdu(RemdeskServerContext* context, UINT32 result)
+static UINT remdesk_fx_send_pdu(void* custom, wStream* s)
 {
-	wStream* s = NULL;
-	REMDESK_CTL_RESULT_PDU pdu;
-	UINT error = 0;
-	pdu.result = result;
+	RemdeskServerContext* context = (RemdeskServerContext*)custom;
 
-	if ((error = remdesk_prepare_ctl_header(&(pdu.ctlHeader), REMDESK_CTL_RESULT, 4)))
-	{
-		WLog_ERR(TAG, "remdesk_prepare_ctl_header failed with error %" PRIu32 "!", error);
-		return error;
-	}
+	WINPR_ASSERT(context);
 
-	s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + pdu.ctlHeader.ch.DataLength);
+	const UINT error = remdesk_virtual_channel_write(context, s);
+	Stream_Release(s);
+	return error;
+}
 
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
+/**
+ * Function description
+ *
+ * Writes and releases a PDU from remdesk_build_ctl_pdu. WTSVirtualChannelWrite copies the data,
+ * so the buffer goes back to the pool right away.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_send_ctl_pdu(RemdeskServerContext* context, UINT32 msgType, const BYTE* body,
+                                 size_t length)
+{
+	wStream* s = NULL;
 
-	if ((error = remdesk_write_ctl_header(s, &(pdu.ctlHeader))))
-	{
-		WLog_ERR(TAG, "remdesk_write_ctl_header failed with error %" PRIu32 "!", error);
-		goto out;
-	}
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->priv);
 
-	Stream_Write_UINT32(s, pdu.result); /* result (4 bytes) */
-	Stream_SealLength(s);
+	const REMDESK_PDU_SEGMENT segments[] = { { body, length } };
+	UINT error = remdesk_build_ctl_pdu(context->priv->PduPool, msgType, segments,
+	                                   ARRAYSIZE(segments), &s);
+	if (error)
+		return error;
 
 	if ((error = remdesk_virtual_channel_write(context, s)))
 		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
 
-out:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -93,44 +98,44 @@ out:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_send_ctl_version_info_pdu(RemdeskServerContext* context)
+static UINT remdesk_send_ctl_result_pdu(RemdeskServerContext* context, UINT32 result)
 {
-	wStream* s = NULL;
-	REMDESK_CTL_VERSION_INFO_PDU pdu;
-	UINT error = 0;
-
-	if ((error = remdesk_prepare_ctl_header(&(pdu.ctlHeader), REMDESK_CTL_VERSIONINFO, 8)))
-	{
-		WLog_ERR(TAG, "remdesk_prepare_ctl_header failed with error %" PRIu32 "!", error);
-		return error;
-	}
+	BYTE body[4] = { 0 };
 
-	pdu.versionMajor = 1;
-	pdu.versionMinor = 2;
-	s = Stream_New(NULL, REMDESK_CHANNEL_CTL_SIZE + pdu.ctlHeader.ch.DataLength);
+	winpr_Data_Write_UINT32(body, result); /* result (4 bytes) */
+	return remdesk_send_ctl_pdu(context, REMDESK_CTL_RESULT, body, sizeof(body));
+}
 
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		return CHANNEL_RC_NO_MEMORY;
-	}
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_send_ctl_version_info_pdu(RemdeskServerContext* context)
+{
+	BYTE body[8] = { 0 };
 
-	if ((error = remdesk_write_ctl_header(s, &(pdu.ctlHeader))))
-	{
-		WLog_ERR(TAG, "remdesk_write_ctl_header failed with error %" PRIu32 "!", error);
-		goto out;
-	}
+	winpr_Data_Write_UINT32(&body[0], 1); /* versionMajor (4 bytes) */
+	winpr_Data_Write_UINT32(&body[4], 2); /* versionMinor (4 bytes) */
+	return remdesk_send_ctl_pdu(context, REMDESK_CTL_VERSIONINFO, body, sizeof(body));
+}
 
-	Stream_Write_UINT32(s, pdu.versionMajor); /* versionMajor (4 bytes) */
-	Stream_Write_UINT32(s, pdu.versionMinor); /* versionMinor (4 bytes) */
-	Stream_SealLength(s);
+/**
+ * Function description
+ *
+ * Called once the expert blob of the handshake was received, lets the expert join the hub of
+ * the session if there is one.
+ *
+ * @return the RESULT for the expert, 0 if it was accepted
+ */
+static UINT32 remdesk_server_authenticated(RemdeskServerContext* context, const char* expertBlob)
+{
+	RemdeskServerPrivate* priv = context->priv;
 
-	if ((error = remdesk_virtual_channel_write(context, s)))
-		WLog_ERR(TAG, "remdesk_virtual_channel_write failed with error %" PRIu32 "!", error);
+	if (priv->Hub && !remdesk_server_hub_join(priv->Hub, context, expertBlob))
+		priv->AuthResult = REMDESK_ERROR_HELPEESAIDNO;
 
-out:
-	Stream_Free(s, TRUE);
-	return error;
+	return priv->AuthResult;
 }
 
 /**
@@ -194,7 +199,8 @@ static UINT remdesk_recv_ctl_remote_control_desktop_pdu(RemdeskServerContext* co
 	WLog_INFO(TAG, "RaConnectionString: %s", pdu.raConnectionString);
 	free(pdu.raConnectionString);
 
-	if ((error = remdesk_send_ctl_result_pdu(context, 0)))
+	/* version 1 authenticated the expert before */
+	if ((error = remdesk_send_ctl_result_pdu(context, context->priv->AuthResult)))
 		WLog_ERR(TAG, "remdesk_send_ctl_result_pdu failed with error %" PRIu32 "!", error);
 
 	return error;
@@ -205,8 +211,8 @@ static UINT remdesk_recv_ctl_remote_control_desktop_pdu(RemdeskServerContext* co
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_recv_ctl_authenticate_pdu(WINPR_ATTR_UNUSED RemdeskServerContext* context,
-                                              wStream* s, REMDESK_CHANNEL_HEADER* header)
+static UINT remdesk_recv_ctl_authenticate_pdu(RemdeskServerContext* context, wStream* s,
+                                              REMDESK_CHANNEL_HEADER* header)
 {
 	size_t cchTmpStringW = 0;
 	const WCHAR* expertBlobW = NULL;
@@ -254,6 +260,7 @@ static UINT remdesk_recv_ctl_authenticate_pdu(WINPR_ATTR_UNUSED RemdeskServerCon
 	}
 
 	WLog_INFO(TAG, "RaConnectionString: %s ExpertBlob: %s", pdu.raConnectionString, pdu.expertBlob);
+	(void)remdesk_server_authenticated(context, pdu.expertBlob);
 	free(pdu.raConnectionString);
 	free(pdu.expertBlob);
 	return CHANNEL_RC_OK;
@@ -283,13 +290,47 @@ static UINT remdesk_recv_ctl_verify_password_pdu(RemdeskServerContext* context,
 		return ERROR_INTERNAL_ERROR;
 
 	WLog_INFO(TAG, "ExpertBlob: %s", pdu.expertBlob);
-
-	// TODO: Callback?
-
+	const UINT32 result = remdesk_server_authenticated(context, pdu.expertBlob);
 	free(pdu.expertBlob);
-	return remdesk_send_ctl_result_pdu(context, 0);
+	return remdesk_send_ctl_result_pdu(context, result);
 }
 
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_recv_ctl_ignore(WINPR_ATTR_UNUSED RemdeskServerContext* context,
+                                    WINPR_ATTR_UNUSED wStream* s,
+                                    WINPR_ATTR_UNUSED REMDESK_CHANNEL_HEADER* header)
+{
+	return CHANNEL_RC_OK;
+}
+
+typedef UINT (*remdesk_ctl_handler_fn)(RemdeskServerContext* context, wStream* s,
+                                       REMDESK_CHANNEL_HEADER* header);
+
+typedef struct
+{
+	const char* name;
+	remdesk_ctl_handler_fn fkt;
+} REMDESK_CTL_HANDLER;
+
+/* Indexed by msgType, entries without a handler are unknown message types */
+static const REMDESK_CTL_HANDLER remdesk_ctl_handlers[] = {
+	[REMDESK_CTL_REMOTE_CONTROL_DESKTOP] = { "REMOTE_CONTROL_DESKTOP",
+		                                     remdesk_recv_ctl_remote_control_desktop_pdu },
+	[REMDESK_CTL_AUTHENTICATE] = { "AUTHENTICATE", remdesk_recv_ctl_authenticate_pdu },
+	[REMDESK_CTL_DISCONNECT] = { "DISCONNECT", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_VERSIONINFO] = { "VERSIONINFO", remdesk_recv_ctl_version_info_pdu },
+	[REMDESK_CTL_ISCONNECTED] = { "ISCONNECTED", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_VERIFY_PASSWORD] = { "VERIFY_PASSWORD", remdesk_recv_ctl_verify_password_pdu },
+	[REMDESK_CTL_EXPERT_ON_VISTA] = { "EXPERT_ON_VISTA", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_RANOVICE_NAME] = { "RANOVICE_NAME", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_RAEXPERT_NAME] = { "RAEXPERT_NAME", remdesk_recv_ctl_ignore },
+	[REMDESK_CTL_TOKEN] = { "TOKEN", remdesk_recv_ctl_ignore }
+};
+
 /**
  * Function description
  *
@@ -298,7 +339,6 @@ static UINT remdesk_recv_ctl_verify_password_pdu(RemdeskServerContext* context,
 static UINT remdesk_recv_ctl_pdu(RemdeskServerContext* context, wStream* s,
                                  REMDESK_CHANNEL_HEADER* header)
 {
-	UINT error = CHANNEL_RC_OK;
 	UINT32 msgType = 0;
 
 	if (!Stream_CheckAndLogRequiredLength(TAG, s, 4))
@@ -307,169 +347,205 @@ static UINT remdesk_recv_ctl_pdu(RemdeskServerContext* context, wStream* s,
 	Stream_Read_UINT32(s, msgType); /* msgType (4 bytes) */
 	WLog_INFO(TAG, "msgType: %" PRIu32 "", msgType);
 
-	switch (msgType)
+	const REMDESK_CTL_HANDLER* handler =
+	    (msgType < ARRAYSIZE(remdesk_ctl_handlers)) ? &remdesk_ctl_handlers[msgType] : NULL;
+
+	if (!handler || !handler->fkt)
 	{
-		case REMDESK_CTL_REMOTE_CONTROL_DESKTOP:
-			if ((error = remdesk_recv_ctl_remote_control_desktop_pdu(context, s, header)))
-			{
-				WLog_ERR(TAG,
-				         "remdesk_recv_ctl_remote_control_desktop_pdu failed with error %" PRIu32
-				         "!",
-				         error);
-				return error;
-			}
+		WLog_ERR(TAG, "remdesk_recv_control_pdu: unknown msgType: %" PRIu32 "", msgType);
+		return ERROR_INVALID_DATA;
+	}
 
-			break;
+	const UINT error = handler->fkt(context, s, header);
+	if (error)
+		WLog_ERR(TAG, "REMDESK_CTL_%s failed with error %" PRIu32 "!", handler->name, error);
 
-		case REMDESK_CTL_AUTHENTICATE:
-			if ((error = remdesk_recv_ctl_authenticate_pdu(context, s, header)))
-			{
-				WLog_ERR(TAG, "remdesk_recv_ctl_authenticate_pdu failed with error %" PRIu32 "!",
-				         error);
-				return error;
-			}
+	return error;
+}
 
-			break;
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_server_receive_pdu(RemdeskServerContext* context, wStream* s)
+{
+	UINT error = CHANNEL_RC_OK;
 
-		case REMDESK_CTL_DISCONNECT:
-			break;
+	/* a message may carry several PDUs back to back */
+	do
+	{
+		wStream pdu = { 0 };
+		REMDESK_CHANNEL_HEADER header;
+		REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
 
-		case REMDESK_CTL_VERSIONINFO:
-			if ((error = remdesk_recv_ctl_version_info_pdu(context, s, header)))
-			{
-				WLog_ERR(TAG, "remdesk_recv_ctl_version_info_pdu failed with error %" PRIu32 "!",
-				         error);
-				return error;
-			}
+		if ((error = remdesk_read_pdu(s, &header, &id, &pdu)))
+		{
+			WLog_ERR(TAG, "remdesk_read_pdu failed with error %" PRIu32 "!", error);
+			return error;
+		}
 
-			break;
+		switch (id)
+		{
+			case REMDESK_CHANNEL_CTL:
+				if ((error = remdesk_recv_ctl_pdu(context, &pdu, &header)))
+				{
+					WLog_ERR(TAG, "remdesk_recv_ctl_pdu failed with error %" PRIu32 "!", error);
+					return error;
+				}
+				break;
 
-		case REMDESK_CTL_ISCONNECTED:
-			break;
+			case REMDESK_CHANNEL_RA_FX:
+				if ((error = remdesk_fx_receive(context->priv->Fx, &pdu)))
+				{
+					WLog_ERR(TAG, "remdesk_fx_receive failed with error %" PRIu32 "!", error);
+					return error;
+				}
+				break;
 
-		case REMDESK_CTL_VERIFY_PASSWORD:
-			if ((error = remdesk_recv_ctl_verify_password_pdu(context, s, header)))
-			{
-				WLog_ERR(TAG, "remdesk_recv_ctl_verify_password_pdu failed with error %" PRIu32 "!",
-				         error);
-				return error;
-			}
+			case REMDESK_CHANNEL_70:
+			case REMDESK_CHANNEL_71:
+			case REMDESK_CHANNEL_DOT:
+			case REMDESK_CHANNEL_1000DOT:
+			case REMDESK_CHANNEL_UNKNOWN:
+			default:
+				break;
+		}
+	} while (Stream_GetRemainingLength(s) > 0);
 
-			break;
+	return error;
+}
 
-		case REMDESK_CTL_EXPERT_ON_VISTA:
-			break;
+static REMDESK_SERVER_STATE remdesk_server_get_state(RemdeskServerContext* context)
+{
+	return (REMDESK_SERVER_STATE)InterlockedCompareExchange(&context->priv->State, 0, 0);
+}
 
-		case REMDESK_CTL_RANOVICE_NAME:
-			break;
+static void remdesk_server_set_state(RemdeskServerContext* context, REMDESK_SERVER_STATE state)
+{
+	(void)InterlockedExchange(&context->priv->State, (LONG)state);
+}
 
-		case REMDESK_CTL_RAEXPERT_NAME:
-			break;
+/**
+ * Function description
+ *
+ * Processes every complete PDU buffered in the framer.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_server_process_frames(RemdeskServerContext* context)
+{
+	UINT error = CHANNEL_RC_OK;
+	wStream frame = { 0 };
 
-		case REMDESK_CTL_TOKEN:
-			break;
+	while ((error = svc_framer_next(context->priv->Framer, &frame)) == CHANNEL_RC_OK)
+	{
+		if ((error = remdesk_server_receive_pdu(context, &frame)))
+		{
+			WLog_ERR(TAG, "remdesk_server_receive_pdu failed with error %" PRIu32 "!", error);
+			return error;
+		}
 
-		default:
-			WLog_ERR(TAG, "remdesk_recv_control_pdu: unknown msgType: %" PRIu32 "", msgType);
-			error = ERROR_INVALID_DATA;
-			break;
+		if (remdesk_server_get_state(context) == REMDESK_SERVER_STATE_VERSION_SENT)
+			remdesk_server_set_state(context, REMDESK_SERVER_STATE_ACTIVE);
 	}
 
-	return error;
+	return (error == ERROR_NO_MORE_ITEMS) ? CHANNEL_RC_OK : error;
 }
 
 /**
  * Function description
  *
- * @return 0 on success, otherwise a Win32 error code
+ * Reads one message straight behind the buffered data, a partial PDU stays where it is, and
+ * processes the PDUs it completed.
+ *
+ * @return 0 on success, ERROR_NO_DATA if no message is queued, otherwise a Win32 error code
  */
-static UINT remdesk_server_receive_pdu(RemdeskServerContext* context, wStream* s)
+static UINT remdesk_server_read(RemdeskServerContext* context)
 {
-	UINT error = CHANNEL_RC_OK;
-	REMDESK_CHANNEL_HEADER header;
+	RemdeskServerPrivate* priv = context->priv;
+	ULONG BytesReturned = 0;
 
-	if ((error = remdesk_read_channel_header(s, &header)))
+	while (1)
 	{
-		WLog_ERR(TAG, "remdesk_read_channel_header failed with error %" PRIu32 "!", error);
-		return error;
-	}
+		size_t available = 0;
+		BYTE* data = svc_framer_reserve(priv->Framer, priv->ReadSize, &available);
+		if (!data)
+		{
+			WLog_ERR(TAG, "svc_framer_reserve failed!");
+			return CHANNEL_RC_NO_MEMORY;
+		}
 
-	if (strcmp(header.ChannelName, "RC_CTL") == 0)
-	{
-		if ((error = remdesk_recv_ctl_pdu(context, s, &header)))
+		available = MIN(available, UINT32_MAX);
+		if (WTSVirtualChannelRead(priv->ChannelHandle, 0, (PCHAR)data, (ULONG)available,
+		                          &BytesReturned))
+			break;
+
+		/* the message does not fit, BytesReturned is its length */
+		if (BytesReturned > available)
 		{
-			WLog_ERR(TAG, "remdesk_recv_ctl_pdu failed with error %" PRIu32 "!", error);
-			return error;
+			priv->ReadSize = BytesReturned;
+			continue;
 		}
+
+		if (GetLastError() == ERROR_NO_DATA)
+			return ERROR_NO_DATA;
+
+		WLog_ERR(TAG, "WTSVirtualChannelRead failed!");
+		return ERROR_INTERNAL_ERROR;
 	}
-	else if (strcmp(header.ChannelName, "70") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "71") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, ".") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "1000.") == 0)
-	{
-	}
-	else if (strcmp(header.ChannelName, "RA_FX") == 0)
-	{
-	}
-	else
+
+	if (BytesReturned == 0)
+		return ERROR_NO_DATA;
+
+	svc_framer_commit(priv->Framer, BytesReturned);
+	priv->ReadSize = REMDESK_SERVER_READ_SIZE;
+	return remdesk_server_process_frames(context);
+}
+
+static void remdesk_server_fail(RemdeskServerContext* context, UINT error, const char* where)
+{
+	remdesk_server_set_state(context, REMDESK_SERVER_STATE_FAILED);
+
+	if (context->rdpcontext)
+		setChannelError(context->rdpcontext, error, where);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_server_send_version_info(RemdeskServerContext* context)
+{
+	const UINT error = remdesk_send_ctl_version_info_pdu(context);
+	if (error)
 	{
+		WLog_ERR(TAG, "remdesk_send_ctl_version_info_pdu failed with error %" PRIu32 "!", error);
+		return error;
 	}
 
-	return error;
+	remdesk_server_set_state(context, REMDESK_SERVER_STATE_VERSION_SENT);
+	return CHANNEL_RC_OK;
 }
 
 static DWORD WINAPI remdesk_server_thread(LPVOID arg)
 {
-	void* buffer = NULL;
-	HANDLE events[8] = { 0 };
-	HANDLE ChannelEvent = NULL;
-	DWORD BytesReturned = 0;
+	HANDLE events[2] = { 0 };
 	UINT error = 0;
 	RemdeskServerContext* context = (RemdeskServerContext*)arg;
 	WINPR_ASSERT(context);
-	wStream* s = Stream_New(NULL, 4096);
-
-	if (!s)
-	{
-		WLog_ERR(TAG, "Stream_New failed!");
-		error = CHANNEL_RC_NO_MEMORY;
-		goto out;
-	}
-
-	if (WTSVirtualChannelQuery(context->priv->ChannelHandle, WTSVirtualEventHandle, &buffer,
-	                           &BytesReturned) == TRUE)
-	{
-		if (BytesReturned == sizeof(HANDLE))
-			ChannelEvent = *(HANDLE*)buffer;
 
-		WTSFreeMemory(buffer);
-	}
-	else
-	{
-		WLog_ERR(TAG, "WTSVirtualChannelQuery failed!");
-		error = ERROR_INTERNAL_ERROR;
-		goto out;
-	}
-
-	DWORD nCount = 0;
-	events[nCount++] = ChannelEvent;
-	events[nCount++] = context->priv->StopEvent;
+	/* stop first, WaitForMultipleObjects reports the lowest signaled index */
+	events[0] = context->priv->StopEvent;
+	events[1] = context->priv->ChannelEvent;
 
-	if ((error = remdesk_send_ctl_version_info_pdu(context)))
-	{
-		WLog_ERR(TAG, "remdesk_send_ctl_version_info_pdu failed with error %" PRIu32 "!", error);
+	if ((error = remdesk_server_send_version_info(context)))
 		goto out;
-	}
 
 	while (1)
 	{
-		DWORD status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		const DWORD status = WaitForMultipleObjects(ARRAYSIZE(events), events, FALSE, INFINITE);
 
 		if (status == WAIT_FAILED)
 		{
@@ -478,72 +554,90 @@ static DWORD WINAPI remdesk_server_thread(LPVOID arg)
 			break;
 		}
 
-		status = WaitForSingleObject(context->priv->StopEvent, 0);
-
-		if (status == WAIT_FAILED)
-		{
-			error = GetLastError();
-			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "", error);
+		if (status == WAIT_OBJECT_0)
 			break;
-		}
 
-		if (status == WAIT_OBJECT_0)
-		{
+		error = remdesk_server_read(context);
+		if (error == ERROR_NO_DATA)
+			error = CHANNEL_RC_OK;
+		else if (error)
 			break;
-		}
+	}
 
-		const size_t len = Stream_Capacity(s);
-		if (len > UINT32_MAX)
-		{
-			error = ERROR_INTERNAL_ERROR;
+out:
+	if (error)
+		remdesk_server_fail(context, error, "remdesk_server_thread reported an error");
+
+	ExitThread(error);
+	return error;
+}
+
+/* Reactor mode: drains the channel on the session strand and asks for the next notification */
+static void remdesk_server_read_task(void* ctx, WINPR_ATTR_UNUSED void* arg)
+{
+	RemdeskServerContext* context = (RemdeskServerContext*)ctx;
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(context);
+
+	switch (remdesk_server_get_state(context))
+	{
+		case REMDESK_SERVER_STATE_VERSION_SENT:
+		case REMDESK_SERVER_STATE_ACTIVE:
 			break;
-		}
-		if (WTSVirtualChannelRead(context->priv->ChannelHandle, 0, Stream_BufferAs(s, char),
-		                          (UINT32)len, &BytesReturned))
-		{
-			if (BytesReturned)
-				Stream_Seek(s, BytesReturned);
-		}
-		else
-		{
-			if (!Stream_EnsureRemainingCapacity(s, BytesReturned))
-			{
-				WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
-				error = CHANNEL_RC_NO_MEMORY;
-				break;
-			}
-		}
 
-		if (Stream_GetPosition(s) >= 8)
-		{
-			const UINT32* pHeader = Stream_BufferAs(s, UINT32);
-			const UINT32 PduLength = pHeader[0] + pHeader[1] + 8;
+		default:
+			return;
+	}
 
-			if (PduLength >= Stream_GetPosition(s))
-			{
-				Stream_SealLength(s);
-				Stream_SetPosition(s, 0);
+	while ((error = remdesk_server_read(context)) == CHANNEL_RC_OK)
+		;
 
-				if ((error = remdesk_server_receive_pdu(context, s)))
-				{
-					WLog_ERR(TAG, "remdesk_server_receive_pdu failed with error %" PRIu32 "!",
-					         error);
-					break;
-				}
+	if (error != ERROR_NO_DATA)
+	{
+		remdesk_server_fail(context, error, "remdesk_server_read_task reported an error");
+		return;
+	}
 
-				Stream_SetPosition(s, 0);
-			}
-		}
+	if (!svc_reactor_rearm(context->priv->Source))
+		remdesk_server_fail(context, ERROR_INTERNAL_ERROR,
+		                    "remdesk_server_read_task reported an error");
+}
+
+/* Reactor mode: sends the version info, then starts watching the channel */
+static void remdesk_server_start_task(void* ctx, WINPR_ATTR_UNUSED void* arg)
+{
+	RemdeskServerContext* context = (RemdeskServerContext*)ctx;
+	RemdeskServerPrivate* priv = NULL;
+
+	WINPR_ASSERT(context);
+	priv = context->priv;
+
+	if (remdesk_server_get_state(context) != REMDESK_SERVER_STATE_STARTING)
+		return;
+
+	const UINT error = remdesk_server_send_version_info(context);
+	if (error)
+	{
+		remdesk_server_fail(context, error, "remdesk_server_start_task reported an error");
+		return;
 	}
 
-out:
-	Stream_Free(s, TRUE);
+	priv->Source = svc_reactor_add(priv->ChannelFd, priv->Strand, remdesk_server_read_task, NULL);
+	if (!priv->Source)
+		remdesk_server_fail(context, ERROR_INTERNAL_ERROR,
+		                    "remdesk_server_start_task reported an error");
+}
 
-	if (error && context->rdpcontext)
-		setChannelError(context->rdpcontext, error, "remdesk_server_thread reported an error");
+/* Reactor mode: runs on the strand so it is ordered after every read task */
+static void remdesk_server_stop_task(void* ctx, WINPR_ATTR_UNUSED void* arg)
+{
+	RemdeskServerContext* context = (RemdeskServerContext*)ctx;
 
-	ExitThread(error);
-	return error;
+	WINPR_ASSERT(context);
+
+	svc_reactor_remove(context->priv->Source);
+	context->priv->Source = NULL;
 }
 
 /**
@@ -551,17 +645,42 @@ out:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT remdesk_server_start(RemdeskServerContext* context)
+static UINT remdesk_server_start_reactor(RemdeskServerContext* context)
 {
-	context->priv->ChannelHandle =
-	    WTSVirtualChannelOpen(context->vcm, WTS_CURRENT_SESSION, REMDESK_SVC_CHANNEL_NAME);
+	RemdeskServerPrivate* priv = context->priv;
 
-	if (!context->priv->ChannelHandle)
+	priv->ChannelFd = GetEventFileDescriptor(priv->ChannelEvent);
+	if (priv->ChannelFd < 0)
 	{
-		WLog_ERR(TAG, "WTSVirtualChannelOpen failed!");
+		WLog_ERR(TAG, "the channel event has no file descriptor");
 		return ERROR_INTERNAL_ERROR;
 	}
 
+	priv->Strand = svc_strand_new(context);
+	if (!priv->Strand)
+	{
+		WLog_ERR(TAG, "svc_strand_new failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!svc_strand_post(priv->Strand, remdesk_server_start_task, NULL))
+	{
+		WLog_ERR(TAG, "svc_strand_post failed!");
+		svc_strand_free(priv->Strand);
+		priv->Strand = NULL;
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_server_start_thread(RemdeskServerContext* context)
+{
 	if (!(context->priv->StopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
 	{
 		WLog_ERR(TAG, "CreateEvent failed!");
@@ -580,6 +699,84 @@ static UINT remdesk_server_start(RemdeskServerContext* context)
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT remdesk_server_start(RemdeskServerContext* context)
+{
+	void* buffer = NULL;
+	DWORD BytesReturned = 0;
+	UINT error = CHANNEL_RC_OK;
+	RemdeskServerPrivate* priv = context->priv;
+
+	priv->AuthResult = 0;
+	priv->ChannelHandle = WTSVirtualChannelOpen(context->vcm, WTS_CURRENT_SESSION,
+	                                            REMDESK_SVC_CHANNEL_NAME);
+
+	if (!priv->ChannelHandle)
+	{
+		WLog_ERR(TAG, "WTSVirtualChannelOpen failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	if (!WTSVirtualChannelQuery(priv->ChannelHandle, WTSVirtualEventHandle, &buffer,
+	                            &BytesReturned))
+	{
+		WLog_ERR(TAG, "WTSVirtualChannelQuery failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	if (BytesReturned == sizeof(HANDLE))
+		priv->ChannelEvent = *(HANDLE*)buffer;
+	WTSFreeMemory(buffer);
+
+	if (!priv->ChannelEvent)
+	{
+		WLog_ERR(TAG, "the channel has no event handle");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	priv->Framer = svc_framer_new(REMDESK_SERVER_READ_SIZE, REMDESK_CHANNEL_HEADER_LENGTH,
+	                              REMDESK_SERVER_MAX_PDU_LENGTH, remdesk_pdu_length);
+	if (!priv->Framer)
+	{
+		WLog_ERR(TAG, "svc_framer_new failed!");
+		return CHANNEL_RC_NO_MEMORY;
+	}
+	priv->ReadSize = REMDESK_SERVER_READ_SIZE;
+
+	priv->Fx = remdesk_fx_new(priv->FxDirectory, remdesk_fx_send_pdu, priv->FxDone, priv->FxCustom);
+	if (!priv->Fx)
+	{
+		WLog_ERR(TAG, "remdesk_fx_new failed!");
+		svc_framer_free(priv->Framer);
+		priv->Framer = NULL;
+		return CHANNEL_RC_NO_MEMORY;
+	}
+	remdesk_server_set_state(context, REMDESK_SERVER_STATE_STARTING);
+
+	if (priv->UseReactor)
+	{
+		error = remdesk_server_start_reactor(context);
+		if (!error)
+			return CHANNEL_RC_OK;
+		WLog_WARN(TAG, "reactor mode failed with error %" PRIu32 ", using a thread", error);
+	}
+
+	error = remdesk_server_start_thread(context);
+	if (error)
+	{
+		remdesk_server_set_state(context, REMDESK_SERVER_STATE_STOPPED);
+		remdesk_fx_free(priv->Fx);
+		priv->Fx = NULL;
+		svc_framer_free(priv->Framer);
+		priv->Framer = NULL;
+	}
+	return error;
+}
+
 /**
  * Function description
  *
@@ -588,20 +785,92 @@ static UINT remdesk_server_start(RemdeskServerContext* context)
 static UINT remdesk_server_stop(RemdeskServerContext* context)
 {
 	UINT error = 0;
-	(void)SetEvent(context->priv->StopEvent);
+	RemdeskServerPrivate* priv = context->priv;
+
+	remdesk_server_set_state(context, REMDESK_SERVER_STATE_STOPPING);
 
-	if (WaitForSingleObject(context->priv->Thread, INFINITE) == WAIT_FAILED)
+	if (priv->Strand)
 	{
-		error = GetLastError();
-		WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "!", error);
-		return error;
+		/* drains the queued tasks, the stop task removes the source */
+		if (!svc_strand_post(priv->Strand, remdesk_server_stop_task, NULL))
+			WLog_ERR(TAG, "svc_strand_post failed, the channel stays watched!");
+		svc_strand_free(priv->Strand);
+		priv->Strand = NULL;
+	}
+	else if (priv->Thread)
+	{
+		(void)SetEvent(priv->StopEvent);
+
+		if (WaitForSingleObject(priv->Thread, INFINITE) == WAIT_FAILED)
+		{
+			error = GetLastError();
+			WLog_ERR(TAG, "WaitForSingleObject failed with error %" PRIu32 "!", error);
+			return error;
+		}
+
+		(void)CloseHandle(priv->Thread);
+		(void)CloseHandle(priv->StopEvent);
+		priv->Thread = NULL;
+		priv->StopEvent = NULL;
 	}
 
-	(void)CloseHandle(context->priv->Thread);
-	(void)CloseHandle(context->priv->StopEvent);
+	/* no PDU is processed any more, so the session cannot join again */
+	if (priv->Hub)
+		remdesk_server_hub_leave(priv->Hub, context);
+
+	/* abandons the transfers still running, their partial downloads are removed */
+	remdesk_fx_free(priv->Fx);
+	priv->Fx = NULL;
+
+	svc_framer_free(priv->Framer);
+	priv->Framer = NULL;
+	remdesk_server_set_state(context, REMDESK_SERVER_STATE_STOPPED);
 	return CHANNEL_RC_OK;
 }
 
+void remdesk_server_context_set_reactor(RemdeskServerContext* context, BOOL enable)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->priv);
+	context->priv->UseReactor = enable;
+}
+
+void remdesk_server_context_set_hub(RemdeskServerContext* context, RemdeskServerHub* hub)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->priv);
+	context->priv->Hub = hub;
+}
+
+BOOL remdesk_server_context_set_file_transfer(RemdeskServerContext* context,
+                                              const char* directory, pcRemdeskFxDone done,
+                                              void* custom)
+{
+	char* copy = NULL;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->priv);
+
+	if (directory && !(copy = _strdup(directory)))
+		return FALSE;
+
+	free(context->priv->FxDirectory);
+	context->priv->FxDirectory = copy;
+	context->priv->FxDone = done;
+	context->priv->FxCustom = custom;
+	return TRUE;
+}
+
+UINT remdesk_server_send_file(RemdeskServerContext* context, const char* path, UINT32* transferId)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->priv);
+
+	if (!context->priv->Fx)
+		return ERROR_INVALID_STATE;
+	return remdesk_fx_send_file(context->priv->Fx, path, 0, 0, transferId);
+}
+
 RemdeskServerContext* remdesk_server_context_new(HANDLE vcm)
 {
 	RemdeskServerContext* context = NULL;
@@ -620,6 +889,16 @@ RemdeskServerContext* remdesk_server_context_new(HANDLE vcm)
 			return NULL;
 		}
 
+		context->priv->PduPool = StreamPool_New(TRUE, REMDESK_PDU_DEFAULT_SIZE);
+
+		if (!context->priv->PduPool)
+		{
+			free(context->priv);
+			free(context);
+			return NULL;
+		}
+
+		context->priv->ChannelFd = -1;
 		context->priv->Version = 1;
 	}
 
@@ -633,6 +912,8 @@ void remdesk_server_context_free(RemdeskServerContext* context)
 		if (context->priv->ChannelHandle != INVALID_HANDLE_VALUE)
 			(void)WTSVirtualChannelClose(context->priv->ChannelHandle);
 
+		StreamPool_Free(context->priv->PduPool);
+		free(context->priv->FxDirectory);
 		free(context->priv);
 		free(context);
 	}
@@ -23,19 +23,98 @@
 #include <winpr/crt.h>
 #include <winpr/synch.h>
 #include <winpr/thread.h>
+#include <winpr/stream.h>
 
 #include <freerdp/server/remdesk.h>
 #include <freerdp/channels/log.h>
 
+#include "svc_executor.h"
+#include "svc_framer.h"
+#include "svc_reactor.h"
+
+#include "remdesk_hub.h"
+#include "remdesk_fx.h"
+
 #define TAG CHANNELS_TAG("remdesk.server")
 
+/* initial capacity of pooled outgoing PDUs */
+#define REMDESK_PDU_DEFAULT_SIZE 64
+
+/* minimum free space offered to a channel read, larger messages grow the framer */
+#define REMDESK_SERVER_READ_SIZE 4096
+
+/* PDUs announcing more than this are treated as a corrupt stream */
+#define REMDESK_SERVER_MAX_PDU_LENGTH (16 * 1024 * 1024)
+
+typedef enum
+{
+	REMDESK_SERVER_STATE_STOPPED = 0,
+	REMDESK_SERVER_STATE_STARTING,     /* channel open, version info not sent yet */
+	REMDESK_SERVER_STATE_VERSION_SENT, /* waiting for the client's handshake */
+	REMDESK_SERVER_STATE_ACTIVE,       /* handshake received, control PDUs flow */
+	REMDESK_SERVER_STATE_STOPPING,     /* Stop was called, input is left alone */
+	REMDESK_SERVER_STATE_FAILED        /* a PDU failed, input is dropped until Stop */
+} REMDESK_SERVER_STATE;
+
 struct s_remdesk_server_private
 {
 	HANDLE Thread;
 	HANDLE StopEvent;
 	void* ChannelHandle;
+	HANDLE ChannelEvent; /* owned by the channel */
+	wStreamPool* PduPool;
+	SvcFramer* Framer;
+	size_t ReadSize;
+	volatile LONG State; /* REMDESK_SERVER_STATE */
+
+	/* reactor mode, see remdesk_server_context_set_reactor */
+	BOOL UseReactor;
+	SvcStrand* Strand;
+	SvcReactorSource* Source;
+	int ChannelFd;
+
+	/* fan-out, see remdesk_server_context_set_hub */
+	RemdeskServerHub* Hub;
+	UINT32 AuthResult; /* RESULT for the expert, set when the hub rejected it */
+
+	/* RA_FX, see remdesk_server_context_set_file_transfer */
+	RemdeskFx* Fx; /* from Start to Stop */
+	char* FxDirectory;
+	pcRemdeskFxDone FxDone;
+	void* FxCustom;
 
 	UINT32 Version;
 };
 
+/**
+ * Drives the channel from the shared reactor and channel executor instead of a thread per
+ * session. Must be called before Start, falls back to the thread if the platform has no reactor.
+ */
+FREERDP_API void remdesk_server_context_set_reactor(RemdeskServerContext* context, BOOL enable);
+
+/**
+ * Makes the session an expert of a hub: it becomes a viewer once its handshake authenticated it
+ * and leaves on Stop. Must be called before Start, the hub must outlive the session.
+ */
+FREERDP_API void remdesk_server_context_set_hub(RemdeskServerContext* context,
+                                                RemdeskServerHub* hub);
+
+/**
+ * Sets up RA_FX file transfer: offers from the expert are downloaded into directory, none
+ * refuses them, and done reports every finished transfer in either direction. Must be called
+ * before Start.
+ */
+FREERDP_API BOOL remdesk_server_context_set_file_transfer(RemdeskServerContext* context,
+                                                          const char* directory,
+                                                          pcRemdeskFxDone done, void* custom);
+
+/**
+ * Sends the file at path to the expert over RA_FX, chunk by chunk as the expert writes them.
+ * The session must be started, transferId identifies the transfer in the done callback.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+FREERDP_API UINT remdesk_server_send_file(RemdeskServerContext* context, const char* path,
+                                          UINT32* transferId);
+
 #endif /* FREERDP_CHANNEL_REMDESK_SERVER_MAIN_H */
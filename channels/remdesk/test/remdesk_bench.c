@@ -0,0 +1,329 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - parse / serialize benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Usage: remdesk_bench [-n iterations] [pdu files...]
+ *
+ * Replays a built in set of synthetic PDUs, plus every given file as one captured PDU (the raw
+ * bytes of a remdesk channel message), through the client plugin on a fake channel and reports
+ * ns/PDU and allocations/PDU. The serializer is measured the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/endian.h>
+#include <winpr/file.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include "remdesk_common.h"
+#include "remdesk_fake_channel.h"
+#include "remdesk_fx.h"
+
+#define BENCH_DEFAULT_ITERATIONS 100000
+
+#if defined(__GLIBC__)
+/* Counts heap allocations by interposing the glibc allocator */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static volatile LONGLONG bench_allocations = 0;
+
+void* malloc(size_t size)
+{
+	(void)InterlockedIncrement64(&bench_allocations);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	(void)InterlockedIncrement64(&bench_allocations);
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	if (!ptr)
+		(void)InterlockedIncrement64(&bench_allocations);
+	return __libc_realloc(ptr, size);
+}
+
+#define BENCH_ALLOCATIONS() ((UINT64)bench_allocations)
+#define BENCH_COUNTS_ALLOCATIONS TRUE
+#else
+#define BENCH_ALLOCATIONS() 0
+#define BENCH_COUNTS_ALLOCATIONS FALSE
+#endif
+
+typedef struct
+{
+	char name[64];
+	BYTE* data;
+	size_t length;
+	size_t chunkLength;
+} BenchPdu;
+
+typedef struct
+{
+	BenchPdu* pdus;
+	size_t count;
+} BenchCorpus;
+
+static void bench_report(const char* what, const char* name, UINT64 iterations, UINT64 ns,
+                         UINT64 allocations)
+{
+	const double n = (double)iterations;
+	if (BENCH_COUNTS_ALLOCATIONS)
+		printf("%-8s %-32s %10.1f ns/PDU %8.2f allocs/PDU\n", what, name, (double)ns / n,
+		       (double)allocations / n);
+	else
+		printf("%-8s %-32s %10.1f ns/PDU\n", what, name, (double)ns / n);
+}
+
+static BOOL corpus_add(BenchCorpus* corpus, const char* name, wStream* s, size_t chunkLength)
+{
+	WINPR_ASSERT(corpus);
+
+	if (!s)
+		return FALSE;
+
+	BenchPdu* pdus = realloc(corpus->pdus, (corpus->count + 1) * sizeof(BenchPdu));
+	if (!pdus)
+		goto fail;
+	corpus->pdus = pdus;
+
+	BenchPdu* pdu = &corpus->pdus[corpus->count];
+	pdu->length = Stream_Length(s);
+	pdu->data = malloc(pdu->length);
+	if (!pdu->data)
+		goto fail;
+	memcpy(pdu->data, Stream_Buffer(s), pdu->length);
+	(void)_snprintf(pdu->name, sizeof(pdu->name), "%s", name);
+	pdu->chunkLength = chunkLength;
+	corpus->count++;
+
+	Stream_Free(s, TRUE);
+	return TRUE;
+
+fail:
+	Stream_Free(s, TRUE);
+	return FALSE;
+}
+
+static wStream* bench_build(UINT32 msgType, const void* body, size_t length)
+{
+	wStream* s = NULL;
+	const REMDESK_PDU_SEGMENT segments[] = { { body, length } };
+
+	if (remdesk_build_ctl_pdu(NULL, msgType, segments, ARRAYSIZE(segments), &s))
+		return NULL;
+	return s;
+}
+
+static wStream* bench_build_channel(const char* name, size_t length)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	(void)_snprintf(header.ChannelName, sizeof(header.ChannelName), "%s", name);
+	header.DataLength = (UINT32)length;
+
+	wStream* s = Stream_New(NULL, 8 + 64 + length);
+	if (!s)
+		return NULL;
+	(void)remdesk_write_channel_header(s, &header);
+	Stream_Zero(s, length);
+	Stream_SealLength(s);
+	return s;
+}
+
+/* RA_FX ACK of a transfer that does not exist, handed to the transfer strand and dropped there */
+static wStream* bench_build_fx_ack(void)
+{
+	wStream* s = bench_build_channel("RA_FX", 12);
+	if (s)
+		winpr_Data_Write_UINT32(Stream_Buffer(s) + Stream_Length(s) - 12, REMDESK_FX_MSG_ACK);
+	return s;
+}
+
+static BOOL corpus_add_synthetic(BenchCorpus* corpus)
+{
+	BYTE version1[8] = { 0 };
+	BYTE version2[8] = { 0 };
+	BYTE result[4] = { 0 };
+	BYTE large[8192] = { 0 };
+
+	winpr_Data_Write_UINT32(&version1[0], 1);
+	winpr_Data_Write_UINT32(&version1[4], 1);
+	winpr_Data_Write_UINT32(&version2[0], 1);
+	winpr_Data_Write_UINT32(&version2[4], 2);
+	winpr_Data_Write_UINT32(result, 0);
+	winpr_Data_Write_UINT32(large, 0);
+
+	return corpus_add(corpus, "RC_CTL RESULT", bench_build(REMDESK_CTL_RESULT, result, 4),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "RC_CTL VERSIONINFO 1.1 (handshake)",
+	                  bench_build(REMDESK_CTL_VERSIONINFO, version1, 8),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "RC_CTL VERSIONINFO 1.2 (handshake)",
+	                  bench_build(REMDESK_CTL_VERSIONINFO, version2, 8),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "RC_CTL ISCONNECTED", bench_build(REMDESK_CTL_ISCONNECTED, NULL, 0),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "RC_CTL RESULT 8k (chunked)",
+	                  bench_build(REMDESK_CTL_RESULT, large, sizeof(large)),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "70 (ignored)", bench_build_channel("70", 64),
+	                  REMDESK_FAKE_CHUNK_LENGTH) &&
+	       corpus_add(corpus, "RA_FX ACK (no transfer)", bench_build_fx_ack(),
+	                  REMDESK_FAKE_CHUNK_LENGTH);
+}
+
+static BOOL corpus_add_file(BenchCorpus* corpus, const char* path)
+{
+	BOOL rc = FALSE;
+	FILE* fp = winpr_fopen(path, "rb");
+	if (!fp)
+	{
+		(void)fprintf(stderr, "failed to open %s\n", path);
+		return FALSE;
+	}
+
+	if (_fseeki64(fp, 0, SEEK_END) != 0)
+		goto out;
+	const INT64 size = _ftelli64(fp);
+	if ((size < 0) || (_fseeki64(fp, 0, SEEK_SET) != 0))
+		goto out;
+
+	wStream* s = Stream_New(NULL, (size_t)size + 1);
+	if (!s)
+		goto out;
+	if (fread(Stream_Buffer(s), 1, (size_t)size, fp) != (size_t)size)
+	{
+		Stream_Free(s, TRUE);
+		goto out;
+	}
+	Stream_SetLength(s, (size_t)size);
+
+	const char* name = strrchr(path, '/');
+	rc = corpus_add(corpus, name ? name + 1 : path, s, REMDESK_FAKE_CHUNK_LENGTH);
+
+out:
+	(void)fclose(fp);
+	return rc;
+}
+
+static void corpus_free(BenchCorpus* corpus)
+{
+	for (size_t x = 0; x < corpus->count; x++)
+		free(corpus->pdus[x].data);
+	free(corpus->pdus);
+}
+
+/* one connection per PDU kind, the disconnect waits for queued work so it is part of the run */
+static BOOL bench_parse(RemdeskFakeChannel* channel, const BenchPdu* pdu, UINT64 iterations)
+{
+	if (!remdesk_fake_channel_connect(channel))
+		return FALSE;
+
+	/* warm up caches and pools */
+	remdesk_fake_channel_receive(channel, pdu->data, pdu->length, pdu->chunkLength);
+
+	const UINT64 allocations = BENCH_ALLOCATIONS();
+	const UINT64 start = winpr_GetTickCount64NS();
+	for (UINT64 x = 0; x < iterations; x++)
+		remdesk_fake_channel_receive(channel, pdu->data, pdu->length, pdu->chunkLength);
+	const BOOL rc = remdesk_fake_channel_disconnect(channel);
+	const UINT64 end = winpr_GetTickCount64NS();
+
+	bench_report("parse", pdu->name, iterations, end - start, BENCH_ALLOCATIONS() - allocations);
+	return rc;
+}
+
+static BOOL bench_serialize(UINT64 iterations)
+{
+	BYTE body[8] = { 0 };
+	const REMDESK_PDU_SEGMENT segments[] = { { body, sizeof(body) } };
+
+	wStreamPool* pool = StreamPool_New(FALSE, 64);
+	if (!pool)
+		return FALSE;
+
+	const UINT64 allocations = BENCH_ALLOCATIONS();
+	const UINT64 start = winpr_GetTickCount64NS();
+	for (UINT64 x = 0; x < iterations; x++)
+	{
+		wStream* s = NULL;
+		if (remdesk_build_ctl_pdu(pool, REMDESK_CTL_VERSIONINFO, segments, ARRAYSIZE(segments),
+		                          &s))
+			break;
+		Stream_Release(s);
+	}
+	const UINT64 end = winpr_GetTickCount64NS();
+
+	bench_report("build", "RC_CTL VERSIONINFO (pooled)", iterations, end - start,
+	             BENCH_ALLOCATIONS() - allocations);
+	StreamPool_Free(pool);
+	return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = EXIT_FAILURE;
+	UINT64 iterations = BENCH_DEFAULT_ITERATIONS;
+	BenchCorpus corpus = { 0 };
+	RemdeskFakeChannel* channel = NULL;
+
+	if (!corpus_add_synthetic(&corpus))
+		goto out;
+
+	for (int x = 1; x < argc; x++)
+	{
+		if ((strcmp(argv[x], "-n") == 0) && (x + 1 < argc))
+		{
+			iterations = strtoull(argv[++x], NULL, 0);
+			if (iterations == 0)
+				goto out;
+		}
+		else if (!corpus_add_file(&corpus, argv[x]))
+			goto out;
+	}
+
+	channel = remdesk_fake_channel_new();
+	if (!channel)
+		goto out;
+
+	for (size_t x = 0; x < corpus.count; x++)
+	{
+		if (!bench_parse(channel, &corpus.pdus[x], iterations))
+			goto out;
+	}
+
+	if (!bench_serialize(iterations))
+		goto out;
+
+	printf("%" PRIu64 " channel writes, %" PRIu64 " bytes\n",
+	       remdesk_fake_channel_writes(channel), remdesk_fake_channel_bytes_written(channel));
+	rc = EXIT_SUCCESS;
+
+out:
+	remdesk_fake_channel_free(channel);
+	corpus_free(&corpus);
+	return rc;
+}
@@ -0,0 +1,242 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - in process fake channel for benchmarks and fuzzing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/settings.h>
+#include <freerdp/channels/log.h>
+
+#include "remdesk_fake_channel.h"
+
+#define TAG CHANNELS_TAG("remdesk.fake")
+
+#define REMDESK_FAKE_OPEN_HANDLE 0x72656d64
+
+/* the plugin's entry point, built in */
+extern BOOL VCAPITYPE remdesk_VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS pEntryPoints,
+                                                    PVOID pInitHandle);
+
+struct s_remdesk_fake_channel
+{
+	CHANNEL_ENTRY_POINTS_FREERDP_EX entryPoints;
+	freerdp* instance;
+
+	LPVOID userParam;
+	PCHANNEL_INIT_EVENT_EX_FN initEvent;
+	PCHANNEL_OPEN_EVENT_EX_FN openEvent;
+	BOOL connected;
+
+	volatile LONGLONG writes;
+	volatile LONGLONG bytesWritten;
+};
+
+static UINT VCAPITYPE fake_init_ex(LPVOID lpUserParam, WINPR_ATTR_UNUSED LPVOID clientContext,
+                                   LPVOID pInitHandle, WINPR_ATTR_UNUSED PCHANNEL_DEF pChannel,
+                                   WINPR_ATTR_UNUSED INT channelCount,
+                                   WINPR_ATTR_UNUSED ULONG versionRequested,
+                                   PCHANNEL_INIT_EVENT_EX_FN pChannelInitEventProcEx)
+{
+	RemdeskFakeChannel* channel = pInitHandle;
+	WINPR_ASSERT(channel);
+
+	channel->userParam = lpUserParam;
+	channel->initEvent = pChannelInitEventProcEx;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE fake_open_ex(LPVOID pInitHandle, LPDWORD pOpenHandle,
+                                   WINPR_ATTR_UNUSED PCHAR pChannelName,
+                                   PCHANNEL_OPEN_EVENT_EX_FN pChannelOpenEventProcEx)
+{
+	RemdeskFakeChannel* channel = pInitHandle;
+	WINPR_ASSERT(channel);
+	WINPR_ASSERT(pOpenHandle);
+
+	channel->openEvent = pChannelOpenEventProcEx;
+	*pOpenHandle = REMDESK_FAKE_OPEN_HANDLE;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE fake_close_ex(LPVOID pInitHandle, WINPR_ATTR_UNUSED DWORD openHandle)
+{
+	RemdeskFakeChannel* channel = pInitHandle;
+	WINPR_ASSERT(channel);
+
+	channel->openEvent = NULL;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE fake_write_ex(LPVOID pInitHandle, DWORD openHandle,
+                                    WINPR_ATTR_UNUSED LPVOID pData, ULONG dataLength,
+                                    LPVOID pUserData)
+{
+	RemdeskFakeChannel* channel = pInitHandle;
+	WINPR_ASSERT(channel);
+	WINPR_ASSERT(channel->openEvent);
+
+	(void)InterlockedIncrement64(&channel->writes);
+	(void)InterlockedExchangeAdd64(&channel->bytesWritten, dataLength);
+
+	/* the data was "sent", hand the buffer back right away */
+	channel->openEvent(channel->userParam, openHandle, CHANNEL_EVENT_WRITE_COMPLETE, pUserData,
+	                   dataLength, dataLength, 0);
+	return CHANNEL_RC_OK;
+}
+
+BOOL remdesk_fake_channel_setup_settings(rdpSettings* settings)
+{
+	WINPR_ASSERT(settings);
+
+	/* whatever the handshake PDUs need, the values themselves do not matter */
+	return freerdp_settings_set_string(settings, FreeRDP_Username, "bench") &&
+	       freerdp_settings_set_string(settings, FreeRDP_RemoteAssistancePassword, "password") &&
+	       freerdp_settings_set_string(settings, FreeRDP_RemoteAssistancePassStub, "*X_PJQ-3Bd") &&
+	       freerdp_settings_set_string(settings, FreeRDP_RemoteAssistanceRCTicket,
+	                                   "65538,1,192.168.1.200:49230;169.254.6.170:49231,*,"
+	                                   "+ULZ6ifjoCa6cGPMLQiGHRPwkg6VyJqGwxMnO6GcelwUh9a6/FBq3It5ADSndmLL,"
+	                                   "*,*,BNRjdu97DyczQSRuMRrDWoue8YA=");
+}
+
+RemdeskFakeChannel* remdesk_fake_channel_new(void)
+{
+	RemdeskFakeChannel* channel = calloc(1, sizeof(RemdeskFakeChannel));
+	if (!channel)
+		return NULL;
+
+	channel->instance = freerdp_new();
+	if (!channel->instance)
+		goto fail;
+
+	channel->instance->ContextSize = sizeof(rdpContext);
+	if (!freerdp_context_new(channel->instance))
+		goto fail;
+
+	rdpContext* context = channel->instance->context;
+	WINPR_ASSERT(context);
+	if (!remdesk_fake_channel_setup_settings(context->settings))
+		goto fail;
+
+	channel->entryPoints.cbSize = sizeof(channel->entryPoints);
+	channel->entryPoints.protocolVersion = VIRTUAL_CHANNEL_VERSION_WIN2000;
+	channel->entryPoints.pVirtualChannelInitEx = fake_init_ex;
+	channel->entryPoints.pVirtualChannelOpenEx = fake_open_ex;
+	channel->entryPoints.pVirtualChannelCloseEx = fake_close_ex;
+	channel->entryPoints.pVirtualChannelWriteEx = fake_write_ex;
+	channel->entryPoints.MagicNumber = FREERDP_CHANNEL_MAGIC_NUMBER;
+	channel->entryPoints.context = context;
+
+	if (!remdesk_VirtualChannelEntryEx((PCHANNEL_ENTRY_POINTS)&channel->entryPoints, channel))
+	{
+		WLog_ERR(TAG, "remdesk_VirtualChannelEntryEx failed");
+		goto fail;
+	}
+	WINPR_ASSERT(channel->initEvent);
+
+	if (!remdesk_fake_channel_connect(channel))
+		goto fail;
+
+	return channel;
+
+fail:
+	remdesk_fake_channel_free(channel);
+	return NULL;
+}
+
+void remdesk_fake_channel_free(RemdeskFakeChannel* channel)
+{
+	if (!channel)
+		return;
+
+	if (channel->initEvent)
+	{
+		(void)remdesk_fake_channel_disconnect(channel);
+		channel->initEvent(channel->userParam, channel, CHANNEL_EVENT_TERMINATED, NULL, 0);
+	}
+
+	if (channel->instance)
+	{
+		freerdp_context_free(channel->instance);
+		freerdp_free(channel->instance);
+	}
+	free(channel);
+}
+
+BOOL remdesk_fake_channel_connect(RemdeskFakeChannel* channel)
+{
+	WINPR_ASSERT(channel);
+	WINPR_ASSERT(channel->initEvent);
+
+	if (channel->connected)
+		return TRUE;
+
+	channel->initEvent(channel->userParam, channel, CHANNEL_EVENT_CONNECTED, NULL, 0);
+	channel->connected = channel->openEvent != NULL;
+	return channel->connected;
+}
+
+BOOL remdesk_fake_channel_disconnect(RemdeskFakeChannel* channel)
+{
+	WINPR_ASSERT(channel);
+	WINPR_ASSERT(channel->initEvent);
+
+	if (!channel->connected)
+		return TRUE;
+
+	channel->initEvent(channel->userParam, channel, CHANNEL_EVENT_DISCONNECTED, NULL, 0);
+	channel->connected = FALSE;
+	return TRUE;
+}
+
+void remdesk_fake_channel_receive(RemdeskFakeChannel* channel, const BYTE* data, size_t length,
+                                  size_t chunkLength)
+{
+	WINPR_ASSERT(channel);
+	WINPR_ASSERT(data || (length == 0));
+	WINPR_ASSERT(chunkLength > 0);
+
+	if (!channel->openEvent || (length > UINT32_MAX))
+		return;
+
+	size_t offset = 0;
+	do
+	{
+		const size_t size = MIN(chunkLength, length - offset);
+		UINT32 flags = 0;
+		if (offset == 0)
+			flags |= CHANNEL_FLAG_FIRST;
+		if (offset + size == length)
+			flags |= CHANNEL_FLAG_LAST;
+
+		channel->openEvent(channel->userParam, REMDESK_FAKE_OPEN_HANDLE,
+		                   CHANNEL_EVENT_DATA_RECEIVED, (LPVOID)&data[offset], (UINT32)size,
+		                   (UINT32)length, flags);
+		offset += size;
+	} while (offset < length);
+}
+
+UINT64 remdesk_fake_channel_writes(const RemdeskFakeChannel* channel)
+{
+	WINPR_ASSERT(channel);
+	return (UINT64)channel->writes;
+}
+
+UINT64 remdesk_fake_channel_bytes_written(const RemdeskFakeChannel* channel)
+{
+	WINPR_ASSERT(channel);
+	return (UINT64)channel->bytesWritten;
+}
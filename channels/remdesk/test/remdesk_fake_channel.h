@@ -0,0 +1,51 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - in process fake channel for benchmarks and fuzzing
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/svc.h>
+
+/* Drives the remdesk client plugin through its virtual channel entry points without a
+ * connection. Writes from the plugin are counted and completed immediately. */
+typedef struct s_remdesk_fake_channel RemdeskFakeChannel;
+
+/* Default chunk size of the static virtual channel layer */
+#define REMDESK_FAKE_CHUNK_LENGTH 1600
+
+/* Sets what the handshake PDUs of the client plugin need */
+BOOL remdesk_fake_channel_setup_settings(rdpSettings* settings);
+
+/* Loads the plugin with settings for a v1/v2 handshake and connects the channel */
+RemdeskFakeChannel* remdesk_fake_channel_new(void);
+
+/* Disconnects (which drains the plugin's queued work) and unloads the plugin */
+void remdesk_fake_channel_free(RemdeskFakeChannel* channel);
+
+BOOL remdesk_fake_channel_connect(RemdeskFakeChannel* channel);
+
+/* Waits for queued messages to be processed */
+BOOL remdesk_fake_channel_disconnect(RemdeskFakeChannel* channel);
+
+/* Delivers one PDU as CHANNEL_EVENT_DATA_RECEIVED chunks of at most chunkLength bytes */
+void remdesk_fake_channel_receive(RemdeskFakeChannel* channel, const BYTE* data, size_t length,
+                                  size_t chunkLength);
+
+UINT64 remdesk_fake_channel_writes(const RemdeskFakeChannel* channel);
+UINT64 remdesk_fake_channel_bytes_written(const RemdeskFakeChannel* channel);
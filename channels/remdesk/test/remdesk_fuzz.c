@@ -0,0 +1,57 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - libFuzzer entry point
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <winpr/stream.h>
+#include <winpr/wlog.h>
+
+#include "remdesk_common.h"
+#include "remdesk_fake_channel.h"
+
+int LLVMFuzzerInitialize(int* argc, char*** argv);
+int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size);
+
+int LLVMFuzzerInitialize(WINPR_ATTR_UNUSED int* argc, WINPR_ATTR_UNUSED char*** argv)
+{
+	/* every rejected input would be logged otherwise */
+	(void)WLog_SetLogLevel(WLog_GetRoot(), WLOG_OFF);
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size)
+{
+	wStream sbuffer = { 0 };
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+
+	wStream* s = Stream_StaticConstInit(&sbuffer, Data, Size);
+	(void)remdesk_read_channel_header(s, &header, &id);
+
+	/*
+	 * A fresh client per input, so no state left by one input decides how the next one is
+	 * parsed and every crash reproduces from its own input alone.
+	 */
+	RemdeskFakeChannel* channel = remdesk_fake_channel_new();
+	if (!channel)
+		abort();
+
+	/* a single chunk is parsed synchronously, which runs remdesk_recv_ctl_pdu for RC_CTL */
+	remdesk_fake_channel_receive(channel, Data, Size, MAX(Size, 1));
+	remdesk_fake_channel_free(channel);
+	return 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - fan-out hub unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/endian.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/wtsapi.h>
+
+#include <freerdp/server/remdesk.h>
+
+#include "remdesk_common.h"
+#include "remdesk_main.h"
+#include "test_check.h"
+
+#define TEST_TIMEOUT_MS 5000
+#define TEST_VIEWERS 3
+#define TEST_FRAMES 50
+#define TEST_LARGE_FRAME (64 * 1024)
+
+/* One expert session. Its channel handle is the viewer, written frames are checked and counted
+ * and, for a viewer with a fast connection, reported sent right away. */
+typedef struct
+{
+	RemdeskServerHub* hub;
+	RemdeskServerContext* context;
+	BOOL fast;
+	HANDLE event; /* set after every write */
+
+	volatile LONG frames;
+	volatile LONGLONG bytes;
+	volatile LONG errors;
+	LONG lastSequence;
+} TestViewer;
+
+static BYTE test_frame[TEST_LARGE_FRAME];
+
+static HANDLE WINAPI test_channel_open(HANDLE hServer, WINPR_ATTR_UNUSED DWORD SessionId,
+                                       WINPR_ATTR_UNUSED LPSTR pVirtualName)
+{
+	return hServer;
+}
+
+static BOOL WINAPI test_channel_close(WINPR_ATTR_UNUSED HANDLE hChannelHandle)
+{
+	return TRUE;
+}
+
+/* Written frames are "71" PDUs whose data starts with the broadcast sequence number */
+static BOOL test_check_frame(TestViewer* viewer, const BYTE* data, size_t length)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+	wStream sbuffer = { 0 };
+	wStream pdu = { 0 };
+
+	wStream* s = Stream_StaticConstInit(&sbuffer, data, length);
+	if ((remdesk_read_pdu(s, &header, &id, &pdu) != CHANNEL_RC_OK) ||
+	    (id != REMDESK_CHANNEL_71) || (Stream_GetRemainingLength(s) != 0) ||
+	    (Stream_Length(&pdu) < 4))
+		return FALSE;
+
+	/* frames a viewer skipped leave gaps, but the order never changes */
+	const LONG sequence = (LONG)winpr_Data_Get_UINT32(Stream_ConstPointer(&pdu));
+	if (sequence <= viewer->lastSequence)
+		return FALSE;
+	viewer->lastSequence = sequence;
+	return TRUE;
+}
+
+/* Runs on the viewer's strand, one write at a time */
+static BOOL WINAPI test_channel_write(HANDLE hChannelHandle, PCHAR Buffer, ULONG Length,
+                                      PULONG pBytesWritten)
+{
+	TestViewer* viewer = hChannelHandle;
+
+	if (!test_check_frame(viewer, (const BYTE*)Buffer, Length))
+		(void)InterlockedIncrement(&viewer->errors);
+
+	if (viewer->fast)
+		remdesk_server_hub_sent(viewer->hub, viewer->context, Length);
+
+	(void)InterlockedExchangeAdd64(&viewer->bytes, Length);
+	(void)InterlockedIncrement(&viewer->frames);
+	(void)SetEvent(viewer->event);
+
+	if (pBytesWritten)
+		*pBytesWritten = Length;
+	return TRUE;
+}
+
+static const WtsApiFunctionTable test_wts_api = { .pVirtualChannelOpen = test_channel_open,
+	                                              .pVirtualChannelClose = test_channel_close,
+	                                              .pVirtualChannelWrite = test_channel_write };
+
+static BOOL test_viewer_join(TestViewer* viewer, RemdeskServerHub* hub, BOOL fast)
+{
+	viewer->hub = hub;
+	viewer->fast = fast;
+	viewer->lastSequence = -1;
+	viewer->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	viewer->context = remdesk_server_context_new(viewer);
+	if (!viewer->event || !viewer->context)
+		return FALSE;
+
+	viewer->context->priv->ChannelHandle = viewer;
+	return remdesk_server_hub_join(hub, viewer->context, "expert");
+}
+
+static void test_viewer_leave(TestViewer* viewer)
+{
+	if (viewer->context)
+		remdesk_server_hub_leave(viewer->hub, viewer->context);
+	remdesk_server_context_free(viewer->context);
+	if (viewer->event)
+		(void)CloseHandle(viewer->event);
+	memset(viewer, 0, sizeof(TestViewer));
+}
+
+static BOOL test_wait_frames(TestViewer* viewer, LONG frames)
+{
+	while (InterlockedCompareExchange(&viewer->frames, 0, 0) < frames)
+	{
+		if (WaitForSingleObject(viewer->event, TEST_TIMEOUT_MS) != WAIT_OBJECT_0)
+			return FALSE;
+	}
+	return InterlockedCompareExchange(&viewer->frames, 0, 0) == frames;
+}
+
+static UINT test_broadcast(RemdeskServerHub* hub, UINT32 sequence, size_t length)
+{
+	winpr_Data_Write_UINT32(test_frame, sequence);
+	return remdesk_server_hub_broadcast(hub, "71", test_frame, length);
+}
+
+/* Every viewer gets every frame, in order */
+static BOOL test_fan_out(void)
+{
+	TestViewer viewers[TEST_VIEWERS] = { 0 };
+	RemdeskServerHubStats stats = { 0 };
+	BOOL rc = FALSE;
+
+	RemdeskServerHub* hub = remdesk_server_hub_new(NULL, NULL);
+	CHECK(hub);
+
+	for (size_t x = 0; x < ARRAYSIZE(viewers); x++)
+	{
+		if (!test_viewer_join(&viewers[x], hub, TRUE))
+			goto out;
+	}
+
+	for (UINT32 x = 0; x < TEST_FRAMES; x++)
+	{
+		if (test_broadcast(hub, x, 100) != CHANNEL_RC_OK)
+			goto out;
+	}
+
+	for (size_t x = 0; x < ARRAYSIZE(viewers); x++)
+	{
+		if (!test_wait_frames(&viewers[x], TEST_FRAMES) || (viewers[x].errors != 0))
+			goto out;
+	}
+
+	remdesk_server_hub_get_stats(hub, &stats);
+	rc = (stats.frames == TEST_FRAMES) && (stats.dropped == 0) &&
+	     (stats.viewers == TEST_VIEWERS);
+
+out:
+	/* leaving finishes the send tasks, which count the writes */
+	for (size_t x = 0; x < ARRAYSIZE(viewers); x++)
+		test_viewer_leave(&viewers[x]);
+	remdesk_server_hub_get_stats(hub, &stats);
+	remdesk_server_hub_free(hub);
+	CHECK(rc);
+	CHECK(stats.writes == TEST_VIEWERS * TEST_FRAMES);
+	CHECK(stats.viewers == 0);
+	return TRUE;
+}
+
+/* A viewer whose connection sends nothing drops frames once its backlog is full, the fast one
+ * misses none. What the slow connection reports sent lets frames through again. */
+static BOOL test_slow_viewer(void)
+{
+	TestViewer fast = { 0 };
+	TestViewer slow = { 0 };
+	RemdeskServerHubStats stats = { 0 };
+	BOOL rc = FALSE;
+
+	/* whole frames of 64 KiB and a header that fit a full backlog */
+	const LONG backlogFrames = REMDESK_HUB_MAX_BACKLOG / (TEST_LARGE_FRAME + 64);
+	const UINT32 frames = 10;
+
+	RemdeskServerHub* hub = remdesk_server_hub_new(NULL, NULL);
+	CHECK(hub);
+
+	if (!test_viewer_join(&fast, hub, TRUE) || !test_viewer_join(&slow, hub, FALSE))
+		goto out;
+
+	/* waiting for each write keeps the fast viewer's backlog empty at every broadcast */
+	for (UINT32 x = 0; x < frames; x++)
+	{
+		if ((test_broadcast(hub, x, sizeof(test_frame)) != CHANNEL_RC_OK) ||
+		    !test_wait_frames(&fast, (LONG)x + 1))
+			goto out;
+	}
+	if (!test_wait_frames(&slow, backlogFrames))
+		goto out;
+
+	remdesk_server_hub_get_stats(hub, &stats);
+	if ((stats.frames != frames) || (stats.dropped != frames - (UINT32)backlogFrames))
+		goto out;
+
+	/* the slow connection caught up */
+	remdesk_server_hub_sent(hub, slow.context, (size_t)slow.bytes);
+	if ((test_broadcast(hub, frames, sizeof(test_frame)) != CHANNEL_RC_OK) ||
+	    !test_wait_frames(&fast, (LONG)frames + 1) || !test_wait_frames(&slow, backlogFrames + 1))
+		goto out;
+
+	remdesk_server_hub_get_stats(hub, &stats);
+	rc = (stats.dropped == frames - (UINT32)backlogFrames) && (fast.errors == 0) &&
+	     (slow.errors == 0);
+
+out:
+	test_viewer_leave(&fast);
+	test_viewer_leave(&slow);
+	remdesk_server_hub_get_stats(hub, &stats);
+	remdesk_server_hub_free(hub);
+	CHECK(rc);
+	CHECK(stats.writes == frames + 1 + (UINT32)backlogFrames + 1);
+	return TRUE;
+}
+
+int main(void)
+{
+	if (!WTSRegisterWtsApiFunctionTable(&test_wts_api))
+		return 1;
+
+	if (!test_fan_out() || !test_slow_viewer())
+		return 1;
+	return 0;
+}
@@ -0,0 +1,766 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - in process client / server loopback
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/thread.h>
+#include <winpr/wtsapi.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/svc.h>
+#include <freerdp/server/remdesk.h>
+
+#include "remdesk_fake_channel.h"
+#include "remdesk_loopback.h"
+#include "remdesk_main.h" /* the server's, for remdesk_server_context_set_reactor */
+
+#undef TAG
+#define TAG CHANNELS_TAG("remdesk.loopback")
+
+#define REMDESK_LOOPBACK_OPEN_HANDLE 0x72656d6c
+
+/* the client plugin's entry point, built in */
+extern BOOL VCAPITYPE remdesk_VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS pEntryPoints,
+                                                    PVOID pInitHandle);
+
+typedef struct s_remdesk_loopback_message
+{
+	struct s_remdesk_loopback_message* next;
+	RemdeskLoopbackPair* pair;
+	REMDESK_LOOPBACK_DIRECTION direction;
+	UINT32 generation;
+	UINT64 due;    /* delivery time, ns */
+	size_t offset; /* bytes the server already read */
+	size_t length;
+	BYTE data[];
+} RemdeskLoopbackMessage;
+
+typedef struct
+{
+	CRITICAL_SECTION lock;
+	HANDLE event; /* set when the queue was empty and on shutdown */
+	HANDLE idle;  /* manual reset, set whenever no delivery is running */
+	HANDLE thread;
+	BOOL stop;
+	RemdeskLoopbackPair* busy; /* pair of the message being delivered */
+
+	/* ordered by due time, every message gets the same latency */
+	RemdeskLoopbackMessage* head;
+	RemdeskLoopbackMessage* tail;
+} RemdeskLoopbackWire;
+
+struct s_remdesk_loopback
+{
+	RemdeskLoopbackConfig config;
+	RemdeskLoopbackWire* wires;
+	size_t wireCount; /* initialized wires */
+	volatile LONG created;
+
+	HANDLE progress; /* set after every delivery */
+	volatile LONGLONG messages[REMDESK_LOOPBACK_DIRECTIONS];
+	volatile LONGLONG bytes[REMDESK_LOOPBACK_DIRECTIONS];
+};
+
+struct s_remdesk_loopback_pair
+{
+	RemdeskLoopback* rig;
+	RemdeskLoopbackWire* wire;
+
+	/* protects the rest, the client plugin may write while data is delivered to it */
+	CRITICAL_SECTION lock;
+	BOOL connected;
+	UINT32 generation; /* messages of earlier connections are dropped */
+
+	/* client side */
+	freerdp* instance;
+	CHANNEL_ENTRY_POINTS_FREERDP_EX entryPoints;
+	LPVOID userParam;
+	PCHANNEL_INIT_EVENT_EX_FN initEvent;
+	PCHANNEL_OPEN_EVENT_EX_FN openEvent;
+
+	/* server side */
+	RemdeskServerContext* server;
+	HANDLE serverEvent; /* set while the inbox holds data, like a real channel */
+	RemdeskLoopbackMessage* inboxHead;
+	RemdeskLoopbackMessage* inboxTail;
+};
+
+static void loopback_message_free_all(RemdeskLoopbackMessage* msg)
+{
+	while (msg)
+	{
+		RemdeskLoopbackMessage* next = msg->next;
+		free(msg);
+		msg = next;
+	}
+}
+
+static BOOL loopback_enqueue(RemdeskLoopbackPair* pair, REMDESK_LOOPBACK_DIRECTION direction,
+                             const void* data, size_t length)
+{
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(data || (length == 0));
+
+	RemdeskLoopbackMessage* msg = malloc(sizeof(RemdeskLoopbackMessage) + length);
+	if (!msg)
+		return FALSE;
+
+	msg->next = NULL;
+	msg->pair = pair;
+	msg->direction = direction;
+	msg->due = winpr_GetTickCount64NS() + 1000ULL * pair->rig->config.latencyUs;
+	msg->offset = 0;
+	msg->length = length;
+	if (length > 0)
+		memcpy(msg->data, data, length);
+
+	EnterCriticalSection(&pair->lock);
+	const BOOL connected = pair->connected;
+	if (connected)
+	{
+		RemdeskLoopbackWire* wire = pair->wire;
+
+		msg->generation = pair->generation;
+		EnterCriticalSection(&wire->lock);
+		if (wire->tail)
+			wire->tail->next = msg;
+		else
+		{
+			wire->head = msg;
+			(void)SetEvent(wire->event);
+		}
+		wire->tail = msg;
+		LeaveCriticalSection(&wire->lock);
+	}
+	LeaveCriticalSection(&pair->lock);
+
+	if (!connected)
+		free(msg);
+	return connected;
+}
+
+/* Called with the pair locked */
+static void loopback_deliver_to_client(RemdeskLoopbackPair* pair, const RemdeskLoopbackMessage* msg)
+{
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(msg);
+
+	if (!pair->openEvent || (msg->length > UINT32_MAX))
+		return;
+
+	const size_t chunkLength = pair->rig->config.chunkLength;
+	size_t offset = 0;
+	do
+	{
+		const size_t size = MIN(chunkLength, msg->length - offset);
+		UINT32 flags = 0;
+		if (offset == 0)
+			flags |= CHANNEL_FLAG_FIRST;
+		if (offset + size == msg->length)
+			flags |= CHANNEL_FLAG_LAST;
+
+		pair->openEvent(pair->userParam, REMDESK_LOOPBACK_OPEN_HANDLE,
+		                CHANNEL_EVENT_DATA_RECEIVED, (LPVOID)&msg->data[offset], (UINT32)size,
+		                (UINT32)msg->length, flags);
+		offset += size;
+	} while (offset < msg->length);
+}
+
+static void loopback_deliver(RemdeskLoopbackMessage* msg)
+{
+	WINPR_ASSERT(msg);
+
+	RemdeskLoopbackPair* pair = msg->pair;
+	RemdeskLoopback* rig = pair->rig;
+	const REMDESK_LOOPBACK_DIRECTION direction = msg->direction;
+	const size_t length = msg->length;
+	BOOL delivered = FALSE;
+
+	EnterCriticalSection(&pair->lock);
+	if (pair->connected && (msg->generation == pair->generation))
+	{
+		if (direction == REMDESK_LOOPBACK_TO_SERVER)
+		{
+			/* read in chunks by WTSVirtualChannelRead */
+			if (pair->inboxTail)
+				pair->inboxTail->next = msg;
+			else
+				pair->inboxHead = msg;
+			pair->inboxTail = msg;
+			(void)SetEvent(pair->serverEvent);
+			msg = NULL;
+		}
+		else
+			loopback_deliver_to_client(pair, msg);
+		delivered = TRUE;
+	}
+	LeaveCriticalSection(&pair->lock);
+	free(msg);
+
+	if (delivered)
+	{
+		(void)InterlockedExchangeAdd64(&rig->bytes[direction], (LONGLONG)length);
+		(void)InterlockedIncrement64(&rig->messages[direction]);
+		(void)SetEvent(rig->progress);
+	}
+}
+
+static DWORD WINAPI loopback_wire_thread(LPVOID arg)
+{
+	RemdeskLoopbackWire* wire = arg;
+	WINPR_ASSERT(wire);
+
+	EnterCriticalSection(&wire->lock);
+	while (!wire->stop)
+	{
+		RemdeskLoopbackMessage* msg = wire->head;
+		if (!msg)
+		{
+			LeaveCriticalSection(&wire->lock);
+			(void)WaitForSingleObject(wire->event, INFINITE);
+			EnterCriticalSection(&wire->lock);
+			continue;
+		}
+
+		/* the wait granularity is 1 ms, shorter latencies round up */
+		const UINT64 now = winpr_GetTickCount64NS();
+		if (msg->due > now)
+		{
+			const DWORD ms = (DWORD)((msg->due - now + 999999ULL) / 1000000ULL);
+			LeaveCriticalSection(&wire->lock);
+			(void)WaitForSingleObject(wire->event, ms);
+			EnterCriticalSection(&wire->lock);
+			continue;
+		}
+
+		wire->head = msg->next;
+		if (!wire->head)
+			wire->tail = NULL;
+		msg->next = NULL;
+		wire->busy = msg->pair;
+		(void)ResetEvent(wire->idle);
+		LeaveCriticalSection(&wire->lock);
+
+		loopback_deliver(msg);
+
+		EnterCriticalSection(&wire->lock);
+		wire->busy = NULL;
+		(void)SetEvent(wire->idle);
+	}
+	LeaveCriticalSection(&wire->lock);
+	return 0;
+}
+
+/* Drops the messages of a pair that is going away and waits for a delivery to it to finish */
+static void loopback_wire_purge(RemdeskLoopbackWire* wire, const RemdeskLoopbackPair* pair)
+{
+	WINPR_ASSERT(wire);
+
+	EnterCriticalSection(&wire->lock);
+	RemdeskLoopbackMessage** pnext = &wire->head;
+	wire->tail = NULL;
+	while (*pnext)
+	{
+		RemdeskLoopbackMessage* msg = *pnext;
+		if (msg->pair == pair)
+		{
+			*pnext = msg->next;
+			free(msg);
+		}
+		else
+		{
+			wire->tail = msg;
+			pnext = &msg->next;
+		}
+	}
+
+	/* idle is reset under the lock while busy is set, so the wait cannot miss the delivery's end */
+	while (wire->busy == pair)
+	{
+		LeaveCriticalSection(&wire->lock);
+		(void)WaitForSingleObject(wire->idle, INFINITE);
+		EnterCriticalSection(&wire->lock);
+	}
+	LeaveCriticalSection(&wire->lock);
+}
+
+static BOOL loopback_wire_init(RemdeskLoopbackWire* wire)
+{
+	WINPR_ASSERT(wire);
+
+	if (!InitializeCriticalSectionAndSpinCount(&wire->lock, 4000))
+		return FALSE;
+
+	wire->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	wire->idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (wire->event && wire->idle)
+		wire->thread = CreateThread(NULL, 0, loopback_wire_thread, wire, 0, NULL);
+
+	if (!wire->thread)
+	{
+		if (wire->event)
+			(void)CloseHandle(wire->event);
+		if (wire->idle)
+			(void)CloseHandle(wire->idle);
+		DeleteCriticalSection(&wire->lock);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void loopback_wire_uninit(RemdeskLoopbackWire* wire)
+{
+	WINPR_ASSERT(wire);
+
+	EnterCriticalSection(&wire->lock);
+	wire->stop = TRUE;
+	(void)SetEvent(wire->event);
+	LeaveCriticalSection(&wire->lock);
+
+	(void)WaitForSingleObject(wire->thread, INFINITE);
+	(void)CloseHandle(wire->thread);
+	(void)CloseHandle(wire->event);
+	(void)CloseHandle(wire->idle);
+	loopback_message_free_all(wire->head);
+	DeleteCriticalSection(&wire->lock);
+}
+
+/* The server side: the server context's vcm handle is the pair, WTSVirtualChannelOpen returns it
+ * as the channel handle */
+static HANDLE WINAPI loopback_channel_open(HANDLE hServer, WINPR_ATTR_UNUSED DWORD SessionId,
+                                           WINPR_ATTR_UNUSED LPSTR pVirtualName)
+{
+	return hServer;
+}
+
+static BOOL WINAPI loopback_channel_close(WINPR_ATTR_UNUSED HANDLE hChannelHandle)
+{
+	return TRUE;
+}
+
+static BOOL WINAPI loopback_channel_read(HANDLE hChannelHandle, WINPR_ATTR_UNUSED ULONG TimeOut,
+                                         PCHAR Buffer, ULONG BufferSize, PULONG pBytesRead)
+{
+	BOOL rc = FALSE;
+	RemdeskLoopbackPair* pair = hChannelHandle;
+
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(pBytesRead);
+
+	EnterCriticalSection(&pair->lock);
+	RemdeskLoopbackMessage* msg = pair->inboxHead;
+	if (!msg)
+	{
+		*pBytesRead = 0;
+		SetLastError(ERROR_NO_DATA);
+		goto out;
+	}
+
+	const size_t size = MIN(pair->rig->config.chunkLength, msg->length - msg->offset);
+	*pBytesRead = (ULONG)size;
+	if (BufferSize < size)
+	{
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		goto out;
+	}
+
+	if (size > 0)
+		memcpy(Buffer, &msg->data[msg->offset], size);
+	msg->offset += size;
+	if (msg->offset == msg->length)
+	{
+		pair->inboxHead = msg->next;
+		if (!pair->inboxHead)
+		{
+			pair->inboxTail = NULL;
+			(void)ResetEvent(pair->serverEvent);
+		}
+		free(msg);
+	}
+	rc = TRUE;
+
+out:
+	LeaveCriticalSection(&pair->lock);
+	return rc;
+}
+
+static BOOL WINAPI loopback_channel_write(HANDLE hChannelHandle, PCHAR Buffer, ULONG Length,
+                                          PULONG pBytesWritten)
+{
+	RemdeskLoopbackPair* pair = hChannelHandle;
+
+	if (!loopback_enqueue(pair, REMDESK_LOOPBACK_TO_CLIENT, Buffer, Length))
+		return FALSE;
+
+	if (pBytesWritten)
+		*pBytesWritten = Length;
+	return TRUE;
+}
+
+static BOOL WINAPI loopback_channel_query(HANDLE hChannelHandle, WTS_VIRTUAL_CLASS WtsVirtualClass,
+                                          PVOID* ppBuffer, DWORD* pBytesReturned)
+{
+	RemdeskLoopbackPair* pair = hChannelHandle;
+
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(ppBuffer);
+	WINPR_ASSERT(pBytesReturned);
+
+	if (WtsVirtualClass != WTSVirtualEventHandle)
+		return FALSE;
+
+	HANDLE* event = calloc(1, sizeof(HANDLE));
+	if (!event)
+		return FALSE;
+
+	*event = pair->serverEvent;
+	*ppBuffer = event;
+	*pBytesReturned = sizeof(HANDLE);
+	return TRUE;
+}
+
+static VOID WINAPI loopback_free_memory(PVOID pMemory)
+{
+	free(pMemory);
+}
+
+static const WtsApiFunctionTable loopback_wts_api = {
+	.pVirtualChannelOpen = loopback_channel_open,
+	.pVirtualChannelClose = loopback_channel_close,
+	.pVirtualChannelRead = loopback_channel_read,
+	.pVirtualChannelWrite = loopback_channel_write,
+	.pVirtualChannelQuery = loopback_channel_query,
+	.pFreeMemory = loopback_free_memory
+};
+
+/* The client side: the pair is the init handle of the plugin */
+static UINT VCAPITYPE loopback_init_ex(LPVOID lpUserParam, WINPR_ATTR_UNUSED LPVOID clientContext,
+                                       LPVOID pInitHandle, WINPR_ATTR_UNUSED PCHANNEL_DEF pChannel,
+                                       WINPR_ATTR_UNUSED INT channelCount,
+                                       WINPR_ATTR_UNUSED ULONG versionRequested,
+                                       PCHANNEL_INIT_EVENT_EX_FN pChannelInitEventProcEx)
+{
+	RemdeskLoopbackPair* pair = pInitHandle;
+	WINPR_ASSERT(pair);
+
+	pair->userParam = lpUserParam;
+	pair->initEvent = pChannelInitEventProcEx;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE loopback_open_ex(LPVOID pInitHandle, LPDWORD pOpenHandle,
+                                       WINPR_ATTR_UNUSED PCHAR pChannelName,
+                                       PCHANNEL_OPEN_EVENT_EX_FN pChannelOpenEventProcEx)
+{
+	RemdeskLoopbackPair* pair = pInitHandle;
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(pOpenHandle);
+
+	EnterCriticalSection(&pair->lock);
+	pair->openEvent = pChannelOpenEventProcEx;
+	LeaveCriticalSection(&pair->lock);
+	*pOpenHandle = REMDESK_LOOPBACK_OPEN_HANDLE;
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE loopback_close_ex(LPVOID pInitHandle, WINPR_ATTR_UNUSED DWORD openHandle)
+{
+	RemdeskLoopbackPair* pair = pInitHandle;
+	WINPR_ASSERT(pair);
+
+	EnterCriticalSection(&pair->lock);
+	pair->openEvent = NULL;
+	LeaveCriticalSection(&pair->lock);
+	return CHANNEL_RC_OK;
+}
+
+static UINT VCAPITYPE loopback_write_ex(LPVOID pInitHandle, DWORD openHandle, LPVOID pData,
+                                        ULONG dataLength, LPVOID pUserData)
+{
+	RemdeskLoopbackPair* pair = pInitHandle;
+	WINPR_ASSERT(pair);
+
+	if (!loopback_enqueue(pair, REMDESK_LOOPBACK_TO_SERVER, pData, dataLength))
+		return CHANNEL_RC_NOT_CONNECTED;
+
+	/* the data was copied, hand the buffer back right away */
+	EnterCriticalSection(&pair->lock);
+	PCHANNEL_OPEN_EVENT_EX_FN openEvent = pair->openEvent;
+	LeaveCriticalSection(&pair->lock);
+	if (openEvent)
+		openEvent(pair->userParam, openHandle, CHANNEL_EVENT_WRITE_COMPLETE, pUserData,
+		          dataLength, dataLength, 0);
+	return CHANNEL_RC_OK;
+}
+
+RemdeskLoopback* remdesk_loopback_new(const RemdeskLoopbackConfig* config)
+{
+	WINPR_ASSERT(config);
+
+	RemdeskLoopback* rig = calloc(1, sizeof(RemdeskLoopback));
+	if (!rig)
+		return NULL;
+
+	rig->config = *config;
+	if (rig->config.chunkLength == 0)
+		rig->config.chunkLength = REMDESK_FAKE_CHUNK_LENGTH;
+	if (rig->config.wires == 0)
+		rig->config.wires = 1;
+
+	rig->progress = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!rig->progress)
+		goto fail;
+
+	if (!WTSRegisterWtsApiFunctionTable(&loopback_wts_api))
+	{
+		WLog_ERR(TAG, "WTSRegisterWtsApiFunctionTable failed");
+		goto fail;
+	}
+
+	rig->wires = calloc(rig->config.wires, sizeof(RemdeskLoopbackWire));
+	if (!rig->wires)
+		goto fail;
+
+	for (; rig->wireCount < rig->config.wires; rig->wireCount++)
+	{
+		if (!loopback_wire_init(&rig->wires[rig->wireCount]))
+		{
+			WLog_ERR(TAG, "loopback_wire_init failed");
+			goto fail;
+		}
+	}
+
+	return rig;
+
+fail:
+	remdesk_loopback_free(rig);
+	return NULL;
+}
+
+void remdesk_loopback_free(RemdeskLoopback* rig)
+{
+	if (!rig)
+		return;
+
+	for (size_t x = 0; x < rig->wireCount; x++)
+		loopback_wire_uninit(&rig->wires[x]);
+	free(rig->wires);
+	if (rig->progress)
+		(void)CloseHandle(rig->progress);
+	free(rig);
+}
+
+RemdeskLoopbackPair* remdesk_loopback_pair_new(RemdeskLoopback* rig)
+{
+	WINPR_ASSERT(rig);
+
+	RemdeskLoopbackPair* pair = calloc(1, sizeof(RemdeskLoopbackPair));
+	if (!pair)
+		return NULL;
+
+	pair->rig = rig;
+	pair->wire = &rig->wires[(size_t)(InterlockedIncrement(&rig->created) - 1) % rig->wireCount];
+	if (!InitializeCriticalSectionAndSpinCount(&pair->lock, 4000))
+	{
+		free(pair);
+		return NULL;
+	}
+
+	pair->serverEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!pair->serverEvent)
+		goto fail;
+
+	pair->instance = freerdp_new();
+	if (!pair->instance)
+		goto fail;
+
+	pair->instance->ContextSize = sizeof(rdpContext);
+	if (!freerdp_context_new(pair->instance))
+		goto fail;
+
+	rdpContext* context = pair->instance->context;
+	WINPR_ASSERT(context);
+	if (!remdesk_fake_channel_setup_settings(context->settings))
+		goto fail;
+
+	pair->entryPoints.cbSize = sizeof(pair->entryPoints);
+	pair->entryPoints.protocolVersion = VIRTUAL_CHANNEL_VERSION_WIN2000;
+	pair->entryPoints.pVirtualChannelInitEx = loopback_init_ex;
+	pair->entryPoints.pVirtualChannelOpenEx = loopback_open_ex;
+	pair->entryPoints.pVirtualChannelCloseEx = loopback_close_ex;
+	pair->entryPoints.pVirtualChannelWriteEx = loopback_write_ex;
+	pair->entryPoints.MagicNumber = FREERDP_CHANNEL_MAGIC_NUMBER;
+	pair->entryPoints.context = context;
+
+	if (!remdesk_VirtualChannelEntryEx((PCHANNEL_ENTRY_POINTS)&pair->entryPoints, pair))
+	{
+		WLog_ERR(TAG, "remdesk_VirtualChannelEntryEx failed");
+		goto fail;
+	}
+	WINPR_ASSERT(pair->initEvent);
+
+	return pair;
+
+fail:
+	remdesk_loopback_pair_free(pair);
+	return NULL;
+}
+
+void remdesk_loopback_pair_free(RemdeskLoopbackPair* pair)
+{
+	if (!pair)
+		return;
+
+	remdesk_loopback_pair_disconnect(pair);
+	if (pair->initEvent)
+		pair->initEvent(pair->userParam, pair, CHANNEL_EVENT_TERMINATED, NULL, 0);
+	loopback_wire_purge(pair->wire, pair);
+
+	if (pair->instance)
+	{
+		freerdp_context_free(pair->instance);
+		freerdp_free(pair->instance);
+	}
+	if (pair->serverEvent)
+		(void)CloseHandle(pair->serverEvent);
+	DeleteCriticalSection(&pair->lock);
+	free(pair);
+}
+
+BOOL remdesk_loopback_pair_connect(RemdeskLoopbackPair* pair)
+{
+	WINPR_ASSERT(pair);
+	WINPR_ASSERT(pair->initEvent);
+
+	EnterCriticalSection(&pair->lock);
+	const BOOL connected = pair->connected;
+	pair->connected = TRUE;
+	if (!connected)
+		pair->generation++;
+	LeaveCriticalSection(&pair->lock);
+	if (connected)
+		return TRUE;
+
+	/* the client listens before the server sends its version */
+	pair->initEvent(pair->userParam, pair, CHANNEL_EVENT_CONNECTED, NULL, 0);
+	if (!pair->openEvent)
+	{
+		WLog_ERR(TAG, "the client did not open the channel");
+		goto fail;
+	}
+
+	pair->server = remdesk_server_context_new(pair);
+	if (!pair->server)
+		goto fail;
+
+	remdesk_server_context_set_reactor(pair->server, !pair->rig->config.serverThreads);
+	const BOOL fx = remdesk_server_context_set_file_transfer(
+	    pair->server, NULL, pair->rig->config.fxDone, pair->rig->config.fxCustom);
+	const UINT error = fx ? pair->server->Start(pair->server) : CHANNEL_RC_NO_MEMORY;
+	if (error != CHANNEL_RC_OK)
+	{
+		WLog_ERR(TAG, "server Start failed with error %" PRIu32 "!", error);
+		remdesk_server_context_free(pair->server);
+		pair->server = NULL;
+		goto fail;
+	}
+
+	return TRUE;
+
+fail:
+	remdesk_loopback_pair_disconnect(pair);
+	return FALSE;
+}
+
+void remdesk_loopback_pair_disconnect(RemdeskLoopbackPair* pair)
+{
+	WINPR_ASSERT(pair);
+
+	/* from here on writes fail and messages in flight are dropped */
+	EnterCriticalSection(&pair->lock);
+	const BOOL connected = pair->connected;
+	pair->connected = FALSE;
+	loopback_message_free_all(pair->inboxHead);
+	pair->inboxHead = NULL;
+	pair->inboxTail = NULL;
+	(void)ResetEvent(pair->serverEvent);
+	LeaveCriticalSection(&pair->lock);
+
+	if (!connected)
+		return;
+
+	pair->initEvent(pair->userParam, pair, CHANNEL_EVENT_DISCONNECTED, NULL, 0);
+	if (pair->server)
+	{
+		(void)pair->server->Stop(pair->server);
+		remdesk_server_context_free(pair->server);
+		pair->server = NULL;
+	}
+}
+
+BOOL remdesk_loopback_pair_send(RemdeskLoopbackPair* pair, const BYTE* data, size_t length)
+{
+	return loopback_enqueue(pair, REMDESK_LOOPBACK_TO_SERVER, data, length);
+}
+
+BOOL remdesk_loopback_pair_send_file(RemdeskLoopbackPair* pair, const char* path)
+{
+	WINPR_ASSERT(pair);
+
+	if (!pair->server)
+		return FALSE;
+
+	const UINT error = remdesk_server_send_file(pair->server, path, NULL);
+	if (error)
+		WLog_ERR(TAG, "remdesk_server_send_file failed with error %" PRIu32 "!", error);
+	return error == CHANNEL_RC_OK;
+}
+
+UINT64 remdesk_loopback_messages(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction)
+{
+	WINPR_ASSERT(rig);
+	WINPR_ASSERT(direction < REMDESK_LOOPBACK_DIRECTIONS);
+	return (UINT64)InterlockedCompareExchange64(&rig->messages[direction], 0, 0);
+}
+
+UINT64 remdesk_loopback_bytes(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction)
+{
+	WINPR_ASSERT(rig);
+	WINPR_ASSERT(direction < REMDESK_LOOPBACK_DIRECTIONS);
+	return (UINT64)InterlockedCompareExchange64(&rig->bytes[direction], 0, 0);
+}
+
+BOOL remdesk_loopback_wait(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction,
+                           UINT64 messages, DWORD timeout)
+{
+	WINPR_ASSERT(rig);
+
+	const UINT64 end = GetTickCount64() + timeout;
+	while (remdesk_loopback_messages(rig, direction) < messages)
+	{
+		const UINT64 now = GetTickCount64();
+		if (now >= end)
+			return FALSE;
+		(void)WaitForSingleObject(rig->progress, (DWORD)(end - now));
+	}
+	return TRUE;
+}
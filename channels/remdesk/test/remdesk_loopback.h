@@ -0,0 +1,77 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - in process client / server loopback
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <winpr/wtypes.h>
+
+#include "remdesk_fx.h"
+
+/* Connects remdesk client plugins to remdesk server contexts without a network. Client writes
+ * (pVirtualChannelWriteEx) are read by the server with WTSVirtualChannelRead, server writes are
+ * delivered to the client as CHANNEL_EVENT_DATA_RECEIVED chunks. Messages travel over wires, one
+ * thread each, which apply the configured latency and chunking. The rig registers a WTS API
+ * table with WinPR, so there can be only one per process. */
+typedef struct s_remdesk_loopback RemdeskLoopback;
+typedef struct s_remdesk_loopback_pair RemdeskLoopbackPair;
+
+typedef enum
+{
+	REMDESK_LOOPBACK_TO_SERVER,
+	REMDESK_LOOPBACK_TO_CLIENT,
+	REMDESK_LOOPBACK_DIRECTIONS
+} REMDESK_LOOPBACK_DIRECTION;
+
+typedef struct
+{
+	size_t chunkLength; /* largest chunk per read or DATA_RECEIVED event, 0 for 1600 bytes */
+	UINT32 latencyUs;   /* one way delay of every message */
+	size_t wires;       /* wire threads, pairs are spread over them, 0 for 1 */
+	BOOL serverThreads; /* thread per server session instead of the reactor */
+	pcRemdeskFxDone fxDone; /* reports the RA_FX transfers of every server session */
+	void* fxCustom;
+} RemdeskLoopbackConfig;
+
+RemdeskLoopback* remdesk_loopback_new(const RemdeskLoopbackConfig* config);
+
+/* All pairs must be freed before */
+void remdesk_loopback_free(RemdeskLoopback* rig);
+
+/* Loads a client plugin, the server context is created by each connect */
+RemdeskLoopbackPair* remdesk_loopback_pair_new(RemdeskLoopback* rig);
+void remdesk_loopback_pair_free(RemdeskLoopbackPair* pair);
+
+/* Connects the client channel and starts a server session, which begins the handshake */
+BOOL remdesk_loopback_pair_connect(RemdeskLoopbackPair* pair);
+
+/* Drops messages in flight, disconnects the client and stops the server session */
+void remdesk_loopback_pair_disconnect(RemdeskLoopbackPair* pair);
+
+/* Sends one message to the server as if the client plugin wrote it */
+BOOL remdesk_loopback_pair_send(RemdeskLoopbackPair* pair, const BYTE* data, size_t length);
+
+/* Sends a file from the server to the client over RA_FX, which downloads it into
+ * REMDESK_FX_DIR as of its connect */
+BOOL remdesk_loopback_pair_send_file(RemdeskLoopbackPair* pair, const char* path);
+
+/* Messages and bytes delivered in a direction, over all pairs */
+UINT64 remdesk_loopback_messages(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction);
+UINT64 remdesk_loopback_bytes(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction);
+
+/* Waits until at least that many messages were delivered in a direction. One waiter only. */
+BOOL remdesk_loopback_wait(RemdeskLoopback* rig, REMDESK_LOOPBACK_DIRECTION direction,
+                           UINT64 messages, DWORD timeout);
@@ -0,0 +1,366 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - client / server loopback benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Usage: remdesk_loopback_bench [-t] [-p pairs] [-r rounds] [-m messages] [-b bytes]
+ *                               [-c chunk length] [-l latency us] [-w wires]
+ *                               [-f file -d directory]
+ *
+ * Connects that many client plugin / server session pairs over the in process loopback. The
+ * handshake phase connects and disconnects all pairs per round and reports handshakes/s. The
+ * throughput phase sends every connected pair's server that many VERIFY_PASSWORD messages with a
+ * blob of the given size, each answered by a RESULT, and reports bytes/s in both directions.
+ * With -t the server runs a thread per session instead of the reactor. With -f the first pair's
+ * server sends the file over RA_FX, the client downloads it into the directory given with -d,
+ * and the transfer's throughput, chunk latency and the peak resident memory are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/stream.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/wlog.h>
+
+#include "remdesk_common.h"
+#include "remdesk_fake_channel.h"
+#include "remdesk_loopback.h"
+
+#define BENCH_DEFAULT_PAIRS 100
+#define BENCH_DEFAULT_ROUNDS 10
+#define BENCH_DEFAULT_MESSAGES 100
+#define BENCH_DEFAULT_BLOB_BYTES 4096
+#define BENCH_TIMEOUT 30000
+
+/* version info and the RESULT answering the verify password of a version 2 client */
+#define BENCH_HANDSHAKE_MESSAGES 2
+
+typedef struct
+{
+	RemdeskLoopback* rig;
+	RemdeskLoopbackPair** pairs;
+	size_t count;
+
+	/* RA_FX phase, written by the done callback */
+	HANDLE fxEvent;
+	RemdeskFxStats fxStats;
+} BenchRig;
+
+static BOOL bench_connect_all(BenchRig* bench)
+{
+	const UINT64 expected = remdesk_loopback_messages(bench->rig, REMDESK_LOOPBACK_TO_CLIENT) +
+	                        BENCH_HANDSHAKE_MESSAGES * bench->count;
+
+	for (size_t x = 0; x < bench->count; x++)
+	{
+		if (!remdesk_loopback_pair_connect(bench->pairs[x]))
+			return FALSE;
+	}
+
+	if (!remdesk_loopback_wait(bench->rig, REMDESK_LOOPBACK_TO_CLIENT, expected, BENCH_TIMEOUT))
+	{
+		(void)fprintf(stderr, "handshake timed out\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void bench_disconnect_all(BenchRig* bench)
+{
+	for (size_t x = 0; x < bench->count; x++)
+		remdesk_loopback_pair_disconnect(bench->pairs[x]);
+}
+
+static BOOL bench_handshakes(BenchRig* bench, size_t rounds)
+{
+	const UINT64 start = winpr_GetTickCount64NS();
+	for (size_t x = 0; x < rounds; x++)
+	{
+		const BOOL rc = bench_connect_all(bench);
+		bench_disconnect_all(bench);
+		if (!rc)
+			return FALSE;
+	}
+	const UINT64 ns = winpr_GetTickCount64NS() - start;
+	const double handshakes = (double)bench->count * (double)rounds;
+
+	printf("handshakes: %.0f in %.1f ms, %.0f handshakes/s\n", handshakes,
+	       (double)ns / 1000000.0, handshakes * 1000000000.0 / (double)ns);
+	return TRUE;
+}
+
+/* VERIFY_PASSWORD with a blob of about that many bytes, as UTF-16 with terminator */
+static wStream* bench_build_message(size_t blobBytes)
+{
+	const size_t cch = MAX(blobBytes / sizeof(WCHAR), 2);
+	WCHAR* blob = calloc(cch, sizeof(WCHAR));
+	if (!blob)
+		return NULL;
+	for (size_t x = 0; x < cch - 1; x++)
+		blob[x] = (WCHAR)('A' + (x % 26));
+
+	const REMDESK_PDU_SEGMENT segments[] = { { blob, cch * sizeof(WCHAR) } };
+	wStream* s = NULL;
+	if (remdesk_build_ctl_pdu(NULL, REMDESK_CTL_VERIFY_PASSWORD, segments, ARRAYSIZE(segments),
+	                          &s))
+		s = NULL;
+	free(blob);
+	return s;
+}
+
+static BOOL bench_throughput(BenchRig* bench, size_t messages, size_t blobBytes)
+{
+	BOOL rc = FALSE;
+	wStream* s = bench_build_message(blobBytes);
+	if (!s)
+		return FALSE;
+
+	if (!bench_connect_all(bench))
+		goto out;
+
+	const UINT64 toServer = remdesk_loopback_bytes(bench->rig, REMDESK_LOOPBACK_TO_SERVER);
+	const UINT64 toClient = remdesk_loopback_bytes(bench->rig, REMDESK_LOOPBACK_TO_CLIENT);
+	const UINT64 expected = remdesk_loopback_messages(bench->rig, REMDESK_LOOPBACK_TO_CLIENT) +
+	                        (UINT64)messages * bench->count;
+
+	const UINT64 start = winpr_GetTickCount64NS();
+	for (size_t x = 0; x < messages; x++)
+	{
+		for (size_t y = 0; y < bench->count; y++)
+		{
+			if (!remdesk_loopback_pair_send(bench->pairs[y], Stream_Buffer(s),
+			                                Stream_Length(s)))
+				goto out;
+		}
+	}
+
+	/* one RESULT per VERIFY_PASSWORD */
+	if (!remdesk_loopback_wait(bench->rig, REMDESK_LOOPBACK_TO_CLIENT, expected,
+	                           BENCH_TIMEOUT))
+	{
+		(void)fprintf(stderr, "throughput run timed out\n");
+		goto out;
+	}
+	const double seconds = (double)(winpr_GetTickCount64NS() - start) / 1000000000.0;
+	const double up =
+	    (double)(remdesk_loopback_bytes(bench->rig, REMDESK_LOOPBACK_TO_SERVER) - toServer);
+	const double down =
+	    (double)(remdesk_loopback_bytes(bench->rig, REMDESK_LOOPBACK_TO_CLIENT) - toClient);
+
+	printf("throughput: %" PRIu64 " messages of %" PRIuz " bytes in %.1f ms, %.0f messages/s\n",
+	       (UINT64)messages * bench->count, Stream_Length(s), seconds * 1000.0,
+	       (double)messages * (double)bench->count / seconds);
+	printf("            %.1f MB/s to the server, %.1f MB/s to the client\n",
+	       up / seconds / 1000000.0, down / seconds / 1000000.0);
+	rc = TRUE;
+
+out:
+	bench_disconnect_all(bench);
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+static long bench_peak_rss_kb(void)
+{
+	char line[256] = { 0 };
+	long kb = -1;
+	FILE* fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strncmp(line, "VmHWM:", 6) == 0)
+		{
+			kb = strtol(&line[6], NULL, 10);
+			break;
+		}
+	}
+	(void)fclose(fp);
+	return kb;
+}
+
+static void bench_fx_done(void* custom, const RemdeskFxStats* stats)
+{
+	BenchRig* bench = custom;
+	WINPR_ASSERT(bench);
+
+	bench->fxStats = *stats;
+	(void)SetEvent(bench->fxEvent);
+}
+
+static BOOL bench_file(BenchRig* bench, const char* path, const char* directory)
+{
+	BOOL rc = FALSE;
+	const char* name = path;
+	for (const char* c = path; *c; c++)
+	{
+		if (*c == '/')
+			name = c + 1;
+	}
+
+	char* download = GetCombinedPath(directory, name);
+	if (!download)
+		return FALSE;
+
+	const long rss = bench_peak_rss_kb();
+	(void)ResetEvent(bench->fxEvent);
+	if (!remdesk_loopback_pair_connect(bench->pairs[0]))
+		goto out;
+	if (!remdesk_loopback_pair_send_file(bench->pairs[0], path))
+		goto out;
+
+	if (WaitForSingleObject(bench->fxEvent, BENCH_TIMEOUT) != WAIT_OBJECT_0)
+	{
+		(void)fprintf(stderr, "file transfer timed out\n");
+		goto out;
+	}
+
+	const RemdeskFxStats* stats = &bench->fxStats;
+	if (stats->error)
+	{
+		(void)fprintf(stderr, "file transfer failed with error %" PRIu32 "\n", stats->error);
+		goto out;
+	}
+
+	const double seconds = (double)stats->durationNs / 1000000000.0;
+	printf("file: %" PRIu64 " bytes in %.1f ms, %.1f MB/s\n", stats->bytes, seconds * 1000.0,
+	       (seconds > 0.0) ? (double)stats->bytes / seconds / 1000000.0 : 0.0);
+	printf("      %" PRIu64 " chunks, send to ack latency avg %.1f us max %.1f us\n",
+	       stats->chunks,
+	       stats->chunks ? (double)stats->latencySumNs / (double)stats->chunks / 1000.0 : 0.0,
+	       (double)stats->latencyMaxNs / 1000.0);
+	printf("      peak RSS %ld kB before, %ld kB after\n", rss, bench_peak_rss_kb());
+	rc = TRUE;
+
+out:
+	/* the client renames the download once the last chunk is written, which the disconnect
+	 * waits for */
+	remdesk_loopback_pair_disconnect(bench->pairs[0]);
+	if (rc)
+		(void)winpr_DeleteFile(download);
+	free(download);
+	return rc;
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = EXIT_FAILURE;
+	RemdeskLoopbackConfig config = { 0 };
+	BenchRig bench = { 0 };
+	size_t pairs = BENCH_DEFAULT_PAIRS;
+	size_t rounds = BENCH_DEFAULT_ROUNDS;
+	size_t messages = BENCH_DEFAULT_MESSAGES;
+	size_t blobBytes = BENCH_DEFAULT_BLOB_BYTES;
+	const char* file = NULL;
+	const char* directory = NULL;
+
+	for (int x = 1; x < argc; x++)
+	{
+		const BOOL hasValue = (x + 1 < argc);
+
+		if (strcmp(argv[x], "-t") == 0)
+			config.serverThreads = TRUE;
+		else if ((strcmp(argv[x], "-p") == 0) && hasValue)
+			pairs = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-r") == 0) && hasValue)
+			rounds = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-m") == 0) && hasValue)
+			messages = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-b") == 0) && hasValue)
+			blobBytes = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-c") == 0) && hasValue)
+			config.chunkLength = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-l") == 0) && hasValue)
+			config.latencyUs = (UINT32)strtoul(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-w") == 0) && hasValue)
+			config.wires = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-f") == 0) && hasValue)
+			file = argv[++x];
+		else if ((strcmp(argv[x], "-d") == 0) && hasValue)
+			directory = argv[++x];
+		else
+		{
+			(void)fprintf(stderr,
+			              "usage: %s [-t] [-p pairs] [-r rounds] [-m messages] [-b bytes] "
+			              "[-c chunk length] [-l latency us] [-w wires] [-f file -d directory]\n",
+			              argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (file && !directory)
+	{
+		(void)fprintf(stderr, "-f needs a download directory, -d\n");
+		return EXIT_FAILURE;
+	}
+
+	/* read by every client plugin when it connects */
+	if (directory && (setenv("REMDESK_FX_DIR", directory, 1) != 0))
+		return EXIT_FAILURE;
+	config.fxDone = bench_fx_done;
+	config.fxCustom = &bench;
+
+	/* both sides log every PDU at info level, the client's connect handler is a stub that logs an
+	 * error on every connect */
+	(void)WLog_SetLogLevel(WLog_GetRoot(), WLOG_ERROR);
+	(void)WLog_SetLogLevel(WLog_Get("TODO"), WLOG_OFF);
+
+	if (pairs == 0)
+		goto out;
+
+	bench.fxEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	bench.rig = remdesk_loopback_new(&config);
+	bench.pairs = calloc(pairs, sizeof(RemdeskLoopbackPair*));
+	if (!bench.fxEvent || !bench.rig || !bench.pairs)
+		goto out;
+
+	for (; bench.count < pairs; bench.count++)
+	{
+		bench.pairs[bench.count] = remdesk_loopback_pair_new(bench.rig);
+		if (!bench.pairs[bench.count])
+			goto out;
+	}
+
+	printf("%s server, %" PRIuz " pairs, %" PRIuz " byte chunks, %" PRIu32 " us latency, "
+	       "%" PRIuz " wires\n",
+	       config.serverThreads ? "thread per session" : "reactor", pairs,
+	       config.chunkLength ? config.chunkLength : REMDESK_FAKE_CHUNK_LENGTH, config.latencyUs,
+	       config.wires ? config.wires : 1);
+
+	if ((rounds > 0) && !bench_handshakes(&bench, rounds))
+		goto out;
+	if ((messages > 0) && !bench_throughput(&bench, messages, blobBytes))
+		goto out;
+	if (file && !bench_file(&bench, file, directory))
+		goto out;
+	rc = EXIT_SUCCESS;
+
+out:
+	for (size_t x = 0; x < bench.count; x++)
+		remdesk_loopback_pair_free(bench.pairs[x]);
+	free(bench.pairs);
+	remdesk_loopback_free(bench.rig);
+	if (bench.fxEvent)
+		(void)CloseHandle(bench.fxEvent);
+	return rc;
+}
@@ -0,0 +1,148 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - PDU parser unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/stream.h>
+
+#include "remdesk_common.h"
+#include "test_check.h"
+
+/* ChannelNameLen, DataLen and "71" with its terminator as UTF-16 */
+static const BYTE test_pdu_71[] = { 6, 0, 0, 0, 3, 0, 0, 0, '7', 0, '1', 0, 0, 0, 'a', 'b', 'c' };
+
+/* A name no sub channel has */
+static const BYTE test_pdu_unknown[] = { 4, 0, 0, 0, 1, 0, 0, 0, 'x', 0, 0, 0, 'z' };
+
+static BOOL test_read_ctl(wStream* s, UINT32 msgType, const void* body, size_t bodyLength)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+	wStream pdu = { 0 };
+	UINT32 type = 0;
+
+	const size_t start = Stream_GetPosition(s);
+	CHECK(remdesk_pdu_length(Stream_ConstPointer(s)) ==
+	      REMDESK_CHANNEL_CTL_SIZE + 4 + bodyLength);
+	CHECK(remdesk_read_pdu(s, &header, &id, &pdu) == CHANNEL_RC_OK);
+	CHECK(Stream_GetPosition(s) - start == REMDESK_CHANNEL_CTL_SIZE + 4 + bodyLength);
+	CHECK(id == REMDESK_CHANNEL_CTL);
+	CHECK(strcmp(header.ChannelName, REMDESK_CHANNEL_CTL_NAME) == 0);
+	CHECK(header.DataLength == 4 + bodyLength);
+	CHECK(Stream_Length(&pdu) == header.DataLength);
+
+	Stream_Read_UINT32(&pdu, type);
+	CHECK(type == msgType);
+	CHECK(Stream_GetRemainingLength(&pdu) == bodyLength);
+	CHECK(memcmp(Stream_ConstPointer(&pdu), body, bodyLength) == 0);
+	return TRUE;
+}
+
+/* Two control PDUs built into one batch read back one after the other */
+static BOOL test_build_and_read(void)
+{
+	const BYTE version[] = { 1, 0, 0, 0, 2, 0, 0, 0 };
+	const BYTE result[] = { 0, 0, 0, 0 };
+	const REMDESK_PDU_SEGMENT versionSegments[] = { { version, 4 }, { &version[4], 4 } };
+	const REMDESK_PDU_SEGMENT resultSegments[] = { { result, sizeof(result) } };
+	wStream* s = NULL;
+
+	CHECK(remdesk_build_ctl_pdu(NULL, REMDESK_CTL_VERSIONINFO, versionSegments,
+	                            ARRAYSIZE(versionSegments), &s) == CHANNEL_RC_OK);
+	CHECK(s);
+	wStream* first = s;
+	CHECK(remdesk_build_ctl_pdu(NULL, REMDESK_CTL_RESULT, resultSegments,
+	                            ARRAYSIZE(resultSegments), &s) == CHANNEL_RC_OK);
+	CHECK(s == first);
+
+	Stream_SetPosition(s, 0);
+	const BOOL rc = test_read_ctl(s, REMDESK_CTL_VERSIONINFO, version, sizeof(version)) &&
+	                test_read_ctl(s, REMDESK_CTL_RESULT, result, sizeof(result)) &&
+	                (Stream_GetRemainingLength(s) == 0);
+	Stream_Free(s, TRUE);
+	return rc;
+}
+
+static BOOL test_read_other(void)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+	wStream sbuffer = { 0 };
+	wStream pdu = { 0 };
+
+	wStream* s = Stream_StaticConstInit(&sbuffer, test_pdu_71, sizeof(test_pdu_71));
+	CHECK(remdesk_pdu_length(test_pdu_71) == sizeof(test_pdu_71));
+	CHECK(remdesk_read_pdu(s, &header, &id, &pdu) == CHANNEL_RC_OK);
+	CHECK(id == REMDESK_CHANNEL_71);
+	CHECK(strcmp(header.ChannelName, "71") == 0);
+	CHECK(Stream_Length(&pdu) == 3);
+	CHECK(memcmp(Stream_ConstBuffer(&pdu), "abc", 3) == 0);
+
+	/* unknown names are no error, the caller decides */
+	s = Stream_StaticConstInit(&sbuffer, test_pdu_unknown, sizeof(test_pdu_unknown));
+	CHECK(remdesk_read_pdu(s, &header, &id, &pdu) == CHANNEL_RC_OK);
+	CHECK(id == REMDESK_CHANNEL_UNKNOWN);
+	CHECK(header.ChannelName[0] == '\0');
+	CHECK(Stream_Length(&pdu) == 1);
+	return TRUE;
+}
+
+static BOOL test_reject(const BYTE* data, size_t length)
+{
+	REMDESK_CHANNEL_HEADER header = { 0 };
+	REMDESK_CHANNEL_ID id = REMDESK_CHANNEL_UNKNOWN;
+	wStream sbuffer = { 0 };
+	wStream pdu = { 0 };
+
+	wStream* s = Stream_StaticConstInit(&sbuffer, data, length);
+	CHECK(remdesk_read_pdu(s, &header, &id, &pdu) != CHANNEL_RC_OK);
+	return TRUE;
+}
+
+static BOOL test_read_invalid(void)
+{
+	BYTE data[sizeof(test_pdu_71)] = { 0 };
+
+	/* every truncation, of the header, the name or the data */
+	for (size_t length = 0; length < sizeof(test_pdu_71); length++)
+		CHECK(test_reject(test_pdu_71, length));
+
+	/* odd name length */
+	memcpy(data, test_pdu_71, sizeof(data));
+	data[0] = 5;
+	CHECK(remdesk_pdu_length(data) == 0);
+	CHECK(test_reject(data, sizeof(data)));
+
+	/* name longer than 32 characters */
+	data[0] = 66;
+	CHECK(remdesk_pdu_length(data) == 0);
+	CHECK(test_reject(data, sizeof(data)));
+
+	/* DataLen past the end of the message */
+	memcpy(data, test_pdu_71, sizeof(data));
+	data[7] = 0x80;
+	CHECK(test_reject(data, sizeof(data)));
+	return TRUE;
+}
+
+int main(void)
+{
+	if (!test_build_and_read() || !test_read_other() || !test_read_invalid())
+		return 1;
+	return 0;
+}
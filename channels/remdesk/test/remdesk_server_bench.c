@@ -0,0 +1,325 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Remote Assistance Virtual Channel - server session scaling benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	 http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Usage: remdesk_server_bench [-t] [-s sessions] [-m messages per session]
+ *
+ * Runs that many remdesk server sessions on fake channels (a WTS API table registered with
+ * WinPR), queues the messages of a client handshake (VERSIONINFO + REMOTE_CONTROL_DESKTOP) on
+ * every session at once and waits for all answers. Reports the process thread count and the
+ * CPU time per PDU, in reactor mode or with -t in thread per session mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/resource.h>
+
+#include <winpr/assert.h>
+#include <winpr/endian.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/wlog.h>
+#include <winpr/wtsapi.h>
+
+#include <freerdp/server/remdesk.h>
+
+#include "remdesk_common.h"
+#include "remdesk_main.h"
+
+#define BENCH_DEFAULT_SESSIONS 1000
+#define BENCH_DEFAULT_MESSAGES 100
+#define BENCH_PDUS_PER_MESSAGE 2
+
+typedef struct
+{
+	CRITICAL_SECTION lock;
+	HANDLE event; /* set while messages are queued, like a real channel */
+	size_t pending;
+	RemdeskServerContext* server;
+} BenchSession;
+
+static wStream* bench_message = NULL;
+static volatile LONGLONG bench_writes = 0;
+
+static HANDLE WINAPI bench_channel_open(HANDLE hServer, WINPR_ATTR_UNUSED DWORD SessionId,
+                                        WINPR_ATTR_UNUSED LPSTR pVirtualName)
+{
+	return hServer;
+}
+
+static BOOL WINAPI bench_channel_close(WINPR_ATTR_UNUSED HANDLE hChannelHandle)
+{
+	return TRUE;
+}
+
+static BOOL WINAPI bench_channel_read(HANDLE hChannelHandle, WINPR_ATTR_UNUSED ULONG TimeOut,
+                                      PCHAR Buffer, ULONG BufferSize, PULONG pBytesRead)
+{
+	BOOL rc = FALSE;
+	BenchSession* session = hChannelHandle;
+	const size_t length = Stream_Length(bench_message);
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(pBytesRead);
+
+	EnterCriticalSection(&session->lock);
+	if (session->pending == 0)
+	{
+		*pBytesRead = 0;
+		SetLastError(ERROR_NO_DATA);
+	}
+	else if (BufferSize < length)
+	{
+		*pBytesRead = (ULONG)length;
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+	}
+	else
+	{
+		memcpy(Buffer, Stream_Buffer(bench_message), length);
+		*pBytesRead = (ULONG)length;
+		if (--session->pending == 0)
+			(void)ResetEvent(session->event);
+		rc = TRUE;
+	}
+	LeaveCriticalSection(&session->lock);
+	return rc;
+}
+
+static BOOL WINAPI bench_channel_write(WINPR_ATTR_UNUSED HANDLE hChannelHandle,
+                                       WINPR_ATTR_UNUSED PCHAR Buffer, ULONG Length,
+                                       PULONG pBytesWritten)
+{
+	(void)InterlockedIncrement64(&bench_writes);
+	if (pBytesWritten)
+		*pBytesWritten = Length;
+	return TRUE;
+}
+
+static BOOL WINAPI bench_channel_query(HANDLE hChannelHandle, WTS_VIRTUAL_CLASS WtsVirtualClass,
+                                       PVOID* ppBuffer, DWORD* pBytesReturned)
+{
+	BenchSession* session = hChannelHandle;
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(ppBuffer);
+	WINPR_ASSERT(pBytesReturned);
+
+	if (WtsVirtualClass != WTSVirtualEventHandle)
+		return FALSE;
+
+	HANDLE* event = calloc(1, sizeof(HANDLE));
+	if (!event)
+		return FALSE;
+
+	*event = session->event;
+	*ppBuffer = event;
+	*pBytesReturned = sizeof(HANDLE);
+	return TRUE;
+}
+
+static VOID WINAPI bench_free_memory(PVOID pMemory)
+{
+	free(pMemory);
+}
+
+static const WtsApiFunctionTable bench_wts_api = {
+	.pVirtualChannelOpen = bench_channel_open,
+	.pVirtualChannelClose = bench_channel_close,
+	.pVirtualChannelRead = bench_channel_read,
+	.pVirtualChannelWrite = bench_channel_write,
+	.pVirtualChannelQuery = bench_channel_query,
+	.pFreeMemory = bench_free_memory
+};
+
+/* What a version 1 client answers to the server version: version info and the RA ticket */
+static BOOL bench_build_message(void)
+{
+	BYTE version[8] = { 0 };
+	BYTE ticket[2 * 8] = { 0 };
+	const char* ticketA = "bench";
+
+	winpr_Data_Write_UINT32(&version[0], 1);
+	winpr_Data_Write_UINT32(&version[4], 2);
+	for (size_t x = 0; ticketA[x]; x++)
+		ticket[2 * x] = (BYTE)ticketA[x];
+
+	const REMDESK_PDU_SEGMENT versionSegments[] = { { version, sizeof(version) } };
+	const REMDESK_PDU_SEGMENT ticketSegments[] = { { ticket, 2 * (strlen(ticketA) + 1) } };
+
+	bench_message = Stream_New(NULL, 256);
+	if (!bench_message)
+		return FALSE;
+
+	if (remdesk_build_ctl_pdu(NULL, REMDESK_CTL_VERSIONINFO, versionSegments,
+	                          ARRAYSIZE(versionSegments), &bench_message) ||
+	    remdesk_build_ctl_pdu(NULL, REMDESK_CTL_REMOTE_CONTROL_DESKTOP, ticketSegments,
+	                          ARRAYSIZE(ticketSegments), &bench_message))
+		return FALSE;
+
+	return TRUE;
+}
+
+static long bench_thread_count(void)
+{
+	char line[256] = { 0 };
+	long threads = -1;
+	FILE* fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strncmp(line, "Threads:", 8) == 0)
+		{
+			threads = strtol(&line[8], NULL, 10);
+			break;
+		}
+	}
+	(void)fclose(fp);
+	return threads;
+}
+
+static UINT64 bench_cpu_ns(void)
+{
+	struct rusage usage = { 0 };
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	const UINT64 user = 1000000000ULL * (UINT64)usage.ru_utime.tv_sec +
+	                    1000ULL * (UINT64)usage.ru_utime.tv_usec;
+	const UINT64 sys = 1000000000ULL * (UINT64)usage.ru_stime.tv_sec +
+	                   1000ULL * (UINT64)usage.ru_stime.tv_usec;
+	return user + sys;
+}
+
+static void bench_wait_writes(LONGLONG expected)
+{
+	while (InterlockedCompareExchange64(&bench_writes, 0, 0) < expected)
+		Sleep(1);
+}
+
+static void bench_session_free(BenchSession* session)
+{
+	if (!session)
+		return;
+
+	remdesk_server_context_free(session->server);
+	if (session->event)
+		(void)CloseHandle(session->event);
+	DeleteCriticalSection(&session->lock);
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = EXIT_FAILURE;
+	BOOL threads = FALSE;
+	size_t count = BENCH_DEFAULT_SESSIONS;
+	size_t messages = BENCH_DEFAULT_MESSAGES;
+	size_t started = 0;
+	BenchSession* sessions = NULL;
+
+	for (int x = 1; x < argc; x++)
+	{
+		if (strcmp(argv[x], "-t") == 0)
+			threads = TRUE;
+		else if ((strcmp(argv[x], "-s") == 0) && (x + 1 < argc))
+			count = strtoull(argv[++x], NULL, 0);
+		else if ((strcmp(argv[x], "-m") == 0) && (x + 1 < argc))
+			messages = strtoull(argv[++x], NULL, 0);
+		else
+		{
+			(void)fprintf(stderr, "usage: %s [-t] [-s sessions] [-m messages]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* the server logs every PDU at info level */
+	(void)WLog_SetLogLevel(WLog_GetRoot(), WLOG_ERROR);
+
+	if ((count == 0) || (messages == 0) || !bench_build_message() ||
+	    !WTSRegisterWtsApiFunctionTable(&bench_wts_api))
+		goto out;
+
+	sessions = calloc(count, sizeof(BenchSession));
+	if (!sessions)
+		goto out;
+
+	for (; started < count; started++)
+	{
+		BenchSession* session = &sessions[started];
+
+		InitializeCriticalSection(&session->lock);
+		session->event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		session->server = remdesk_server_context_new(session);
+		if (!session->event || !session->server)
+		{
+			bench_session_free(session);
+			goto out;
+		}
+
+		remdesk_server_context_set_reactor(session->server, !threads);
+		if (session->server->Start(session->server) != CHANNEL_RC_OK)
+		{
+			bench_session_free(session);
+			goto out;
+		}
+	}
+
+	/* every session sent its version info */
+	bench_wait_writes((LONGLONG)count);
+	const long idleThreads = bench_thread_count();
+
+	const UINT64 cpu = bench_cpu_ns();
+	const UINT64 start = winpr_GetTickCount64NS();
+	for (size_t x = 0; x < count; x++)
+	{
+		BenchSession* session = &sessions[x];
+
+		EnterCriticalSection(&session->lock);
+		session->pending += messages;
+		(void)SetEvent(session->event);
+		LeaveCriticalSection(&session->lock);
+	}
+
+	const long busyThreads = bench_thread_count();
+
+	/* one RESULT per REMOTE_CONTROL_DESKTOP */
+	bench_wait_writes((LONGLONG)(count + count * messages));
+	const UINT64 wall = winpr_GetTickCount64NS() - start;
+	const UINT64 used = bench_cpu_ns() - cpu;
+	const double pdus = (double)count * (double)messages * BENCH_PDUS_PER_MESSAGE;
+
+	printf("%s mode, %" PRIuz " sessions, %" PRIuz " messages of %d PDUs each\n",
+	       threads ? "thread" : "reactor", count, messages, BENCH_PDUS_PER_MESSAGE);
+	printf("threads: %ld idle, %ld busy\n", idleThreads, busyThreads);
+	printf("wall: %.1f ms, cpu: %.1f ms, %.1f ns CPU/PDU\n", (double)wall / 1000000.0,
+	       (double)used / 1000000.0, (double)used / pdus);
+	rc = EXIT_SUCCESS;
+
+out:
+	for (size_t x = 0; x < started; x++)
+	{
+		(void)sessions[x].server->Stop(sessions[x].server);
+		bench_session_free(&sessions[x]);
+	}
+	free(sessions);
+	Stream_Free(bench_message, TRUE);
+	return rc;
+}
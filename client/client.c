@@ -5,6 +5,10 @@
 #include "client_hooks.h"
 #include <winpr/synch.h>
 #include "../errors/error.h"
+#include "../components/xf_channels.h"
+#include "../components/xf_cliprdr.h"
+#include "../components/xf_window.h"
+#include "../components/xf_xprof.h"
 
 
 #define TAG CLIENT_TAG("client-x11")
@@ -41,6 +45,10 @@ static BOOL client_new(freerdp* instance, rdpContext* context){
 	instance->LogonErrorInfo = logon_error_info;
 	instance->GetAccessToken = client_cli_get_access_token;
 	PubSub_SubscribeTerminate(context->pubSub, terminateEventHandler);
+
+	/* FreeRDP registered its static addin table with the context, the client's devices go on top */
+	if (!xf_channels_register_addins())
+		return FALSE;
 	return TRUE;
 }
 
@@ -54,6 +62,9 @@ static void client_free(WINPR_ATTR_UNUSED freerdp* instance, rdpContext* context
 	if (context->pubSub)
 	{
 		PubSub_UnsubscribeTerminate(context->pubSub, terminateEventHandler);
+		PubSub_UnsubscribeChannelConnected(context->pubSub, xf_OnChannelConnectedEventHandler);
+		PubSub_UnsubscribeChannelDisconnected(context->pubSub,
+		                                      xf_OnChannelDisconnectedEventHandler);
 #ifdef WITH_XRENDER
 		PubSub_UnsubscribeZoomingChange(context->pubSub, xf_ZoomingChangeEventHandler);
 		PubSub_UnsubscribePanningChange(context->pubSub, xf_PanningChangeEventHandler);
@@ -65,6 +76,39 @@ static BOOL handle_window_events(freerdp* instance){
 
     printf("handle_window_events called\n");
 
+	clientContext* clicon = (clientContext*)instance->context;
+	WINPR_ASSERT(clicon);
+
+	if (!clicon->display)
+		return TRUE;
+
+	BOOL workAreaChanged = FALSE;
+
+	while (XPending(clicon->display) > 0)
+	{
+		XEvent event = { 0 };
+		XNextEvent(clicon->display, &event);
+
+		switch (event.type)
+		{
+			case PropertyNotify:
+				if (xf_WorkAreaPropertyNotify(clicon, &event.xproperty))
+					workAreaChanged = TRUE;
+				else
+					(void)xf_cliprdr_handle_xevent(clicon->clipboard, &event);
+				break;
+
+			default:
+				/* selection traffic and the XFixes owner notification */
+				(void)xf_cliprdr_handle_xevent(clicon->clipboard, &event);
+				break;
+		}
+	}
+
+	/* refresh once per batch, the window manager usually updates both properties together */
+	if (workAreaChanged)
+		(void)xf_GetWorkArea(clicon);
+
     return TRUE;
 }
 
@@ -101,7 +145,7 @@ static DWORD WINAPI client_thread(LPVOID param){
 		goto end;
 
 	/* --authonly ? */
-	if (freerdp_settings_get_bool(settings, FreeRDP_AuthenticationOnly))
+	if (clicon->settingsSnapshot.authenticationOnly)
 	{
 		WLog_ERR(TAG, "Authentication only, exit status %d", !status);
 		goto disconnect;
@@ -188,6 +232,11 @@ static DWORD WINAPI client_thread(LPVOID param){
 
 		if (!handle_window_events(instance))
 			break;
+
+		/* one flush per dispatch cycle for everything drawn while handling it */
+		(void)xf_flush_end_cycle(clicon);
+
+		xf_xprof_dump_if_requested();
 	}
 
 	if (!exit_code)
@@ -205,6 +254,16 @@ static DWORD WINAPI client_thread(LPVOID param){
 	}
 
 disconnect:
+	{
+		XfFlushStats flushStats = { 0 };
+		xf_flush_get_stats(clicon, &flushStats);
+		WLog_INFO(TAG,
+		          "X flushes: %" PRIu64 " for %" PRIu64 " requests, syncs: %" PRIu64
+		          " (last second: %.1f flushes/s, %.1f syncs/s)",
+		          flushStats.flushes, flushStats.requests, flushStats.syncs,
+		          flushStats.flushesPerSecond, flushStats.syncsPerSecond);
+	}
+	xf_xprof_dump_final();
 	freerdp_disconnect(instance);
 
 end:
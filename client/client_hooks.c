@@ -1,9 +1,15 @@
 #include "../context/client_context.h"
 #include "client_hooks.h"
+#include <stddef.h>
 #include <winpr/sspicli.h>
 #include <X11/Xatom.h>
 #include <X11/XKBlib.h>
+#include "../components/xf_atom_cache.h"
+#include "../components/xf_channels.h"
+#include "../components/xf_cliprdr.h"
+#include "../components/xf_rdpsnd.h"
 #include "../components/xf_utils.h"
+#include "../components/xf_xprof.h"
 
 #define TAG CLIENT_TAG("hooks-x11")
 
@@ -43,6 +49,64 @@ static int error_handler_ex(Display* d, XErrorEvent* ev)
 	return error_handler(d, ev);
 }
 
+/* atoms setup_x11 stores in the context, fetched up front with a single XInternAtoms round trip.
+ * Those marked supported are only set if the window manager lists them in _NET_SUPPORTED. */
+typedef struct
+{
+	const char* name;
+	size_t offset;
+	BOOL supported;
+} SetupAtom;
+
+#define SETUP_ATOM(field, name, supported) { name, offsetof(clientContext, field), supported }
+
+static const SetupAtom setup_atoms[] = {
+	SETUP_ATOM(XWAYLAND_MAY_GRAB_KEYBOARD, "_XWAYLAND_MAY_GRAB_KEYBOARD", FALSE),
+	SETUP_ATOM(NET_WM_ICON, "_NET_WM_ICON", FALSE),
+	SETUP_ATOM(MOTIF_WM_HINTS, "_MOTIF_WM_HINTS", FALSE),
+	SETUP_ATOM(NET_NUMBER_OF_DESKTOPS, "_NET_NUMBER_OF_DESKTOPS", FALSE),
+	SETUP_ATOM(NET_CURRENT_DESKTOP, "_NET_CURRENT_DESKTOP", FALSE),
+	SETUP_ATOM(NET_WORKAREA, "_NET_WORKAREA", FALSE),
+	SETUP_ATOM(NET_WM_STATE, "_NET_WM_STATE", TRUE),
+	SETUP_ATOM(NET_WM_STATE_MODAL, "_NET_WM_STATE_MODAL", TRUE),
+	SETUP_ATOM(NET_WM_STATE_STICKY, "_NET_WM_STATE_STICKY", TRUE),
+	SETUP_ATOM(NET_WM_STATE_MAXIMIZED_HORZ, "_NET_WM_STATE_MAXIMIZED_HORZ", FALSE),
+	SETUP_ATOM(NET_WM_STATE_MAXIMIZED_VERT, "_NET_WM_STATE_MAXIMIZED_VERT", FALSE),
+	SETUP_ATOM(NET_WM_STATE_SHADED, "_NET_WM_STATE_SHADED", TRUE),
+	SETUP_ATOM(NET_WM_STATE_SKIP_TASKBAR, "_NET_WM_STATE_SKIP_TASKBAR", FALSE),
+	SETUP_ATOM(NET_WM_STATE_SKIP_PAGER, "_NET_WM_STATE_SKIP_PAGER", FALSE),
+	SETUP_ATOM(NET_WM_STATE_HIDDEN, "_NET_WM_STATE_HIDDEN", TRUE),
+	SETUP_ATOM(NET_WM_STATE_FULLSCREEN, "_NET_WM_STATE_FULLSCREEN", TRUE),
+	SETUP_ATOM(NET_WM_STATE_ABOVE, "_NET_WM_STATE_ABOVE", TRUE),
+	SETUP_ATOM(NET_WM_STATE_BELOW, "_NET_WM_STATE_BELOW", TRUE),
+	SETUP_ATOM(NET_WM_STATE_DEMANDS_ATTENTION, "_NET_WM_STATE_DEMANDS_ATTENTION", TRUE),
+	SETUP_ATOM(NET_WM_FULLSCREEN_MONITORS, "_NET_WM_FULLSCREEN_MONITORS", TRUE),
+	SETUP_ATOM(NET_WM_NAME, "_NET_WM_NAME", FALSE),
+	SETUP_ATOM(NET_WM_PID, "_NET_WM_PID", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE, "_NET_WM_WINDOW_TYPE", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_NORMAL, "_NET_WM_WINDOW_TYPE_NORMAL", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_DIALOG, "_NET_WM_WINDOW_TYPE_DIALOG", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_POPUP, "_NET_WM_WINDOW_TYPE_POPUP", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_POPUP_MENU, "_NET_WM_WINDOW_TYPE_POPUP_MENU", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_UTILITY, "_NET_WM_WINDOW_TYPE_UTILITY", FALSE),
+	SETUP_ATOM(NET_WM_WINDOW_TYPE_DROPDOWN_MENU, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU", FALSE),
+	SETUP_ATOM(NET_WM_MOVERESIZE, "_NET_WM_MOVERESIZE", FALSE),
+	SETUP_ATOM(NET_MOVERESIZE_WINDOW, "_NET_MOVERESIZE_WINDOW", FALSE),
+	SETUP_ATOM(UTF8_STRING, "UTF8_STRING", FALSE),
+	SETUP_ATOM(WM_PROTOCOLS, "WM_PROTOCOLS", FALSE),
+	SETUP_ATOM(WM_DELETE_WINDOW, "WM_DELETE_WINDOW", FALSE),
+	SETUP_ATOM(WM_STATE, "WM_STATE", FALSE),
+	SETUP_ATOM(NET_WM_ALLOWED_ACTIONS, "_NET_WM_ALLOWED_ACTIONS", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_CLOSE, "_NET_WM_ACTION_CLOSE", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_MINIMIZE, "_NET_WM_ACTION_MINIMIZE", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_MOVE, "_NET_WM_ACTION_MOVE", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_RESIZE, "_NET_WM_ACTION_RESIZE", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_MAXIMIZE_HORZ, "_NET_WM_ACTION_MAXIMIZE_HORZ", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_MAXIMIZE_VERT, "_NET_WM_ACTION_MAXIMIZE_VERT", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_FULLSCREEN, "_NET_WM_ACTION_FULLSCREEN", FALSE),
+	SETUP_ATOM(NET_WM_ACTION_CHANGE_DESKTOP, "_NET_WM_ACTION_CHANGE_DESKTOP", FALSE),
+};
+
 static Atom get_supported_atom(clientContext* clicon, const char* atomName)
 {
 	const Atom atom = Logging_XInternAtom(clicon->log, clicon->display, atomName, False);
@@ -82,6 +146,8 @@ void xf_teardown_x11(clientContext* clicon)
 		clicon->display = NULL;
 	}
 
+	xf_atom_cache_clear();
+
 	if (clicon->x11event)
 	{
 		(void)CloseHandle(clicon->x11event);
@@ -121,6 +187,17 @@ BOOL setup_x11(clientContext* clicon){
 		}
 	}
 
+	/* XF_TRACE_SAMPLE_RATE=N: while tracing, log every Nth call per X wrapper call site */
+	{
+		// NOLINTNEXTLINE(concurrency-mt-unsafe)
+		const char* rate = getenv("XF_TRACE_SAMPLE_RATE");
+		if (rate)
+			xf_utils_set_trace_sample_rate((UINT32)strtoul(rate, NULL, 0));
+	}
+
+	/* XF_XPROF=table|json: profile the X requests made through the LogDynAnd* wrappers */
+	(void)xf_xprof_init_from_env();
+
 	clicon->display = XOpenDisplay(NULL);
 
     if (!clicon->display)
@@ -130,9 +207,17 @@ BOOL setup_x11(clientContext* clicon){
 		goto fail;
 	}
 
-    //enable debug mode
-    WLog_INFO(TAG, "Enabling X11 debug mode.");
-	XSynchronize(clicon->display, TRUE);
+	/* XF_X11_SYNCHRONIZE=1: synchronous X for debugging, every request waits for its reply and
+	 * the per cycle flush coalescing has nothing left to do */
+	{
+		// NOLINTNEXTLINE(concurrency-mt-unsafe)
+		const char* sync = getenv("XF_X11_SYNCHRONIZE");
+		if (sync && (strtoul(sync, NULL, 0) != 0))
+		{
+			WLog_INFO(TAG, "Enabling X11 debug mode.");
+			XSynchronize(clicon->display, TRUE);
+		}
+	}
 
     def_error_handler = XSetErrorHandler(error_handler_ex);
 
@@ -150,6 +235,14 @@ BOOL setup_x11(clientContext* clicon){
 	clicon->invert = TRUE;
 	clicon->complex_regions = TRUE;
 
+	{
+		const char* names[ARRAYSIZE(setup_atoms)] = { 0 };
+		for (size_t x = 0; x < ARRAYSIZE(setup_atoms); x++)
+			names[x] = setup_atoms[x].name;
+		if (!xf_atom_cache_prefetch(clicon->display, names, ARRAYSIZE(names)))
+			WLog_WARN(TAG, "atom prefetch failed, interning one by one");
+	}
+
     clicon->NET_SUPPORTED = Logging_XInternAtom(clicon->log, clicon->display, "_NET_SUPPORTED", True);
 	clicon->NET_SUPPORTING_WM_CHECK = Logging_XInternAtom(clicon->log, clicon->display, "_NET_SUPPORTING_WM_CHECK", True);
 
@@ -176,88 +269,27 @@ BOOL setup_x11(clientContext* clicon){
 			XFree(data);
 	}
 
-    clicon->XWAYLAND_MAY_GRAB_KEYBOARD =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_XWAYLAND_MAY_GRAB_KEYBOARD", False);
-	clicon->NET_WM_ICON = Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ICON", False);
-	clicon->MOTIF_WM_HINTS = Logging_XInternAtom(clicon->log, clicon->display, "_MOTIF_WM_HINTS", False);
-	clicon->NET_NUMBER_OF_DESKTOPS =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_NUMBER_OF_DESKTOPS", False);
-	clicon->NET_CURRENT_DESKTOP =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_CURRENT_DESKTOP", False);
-	clicon->NET_WORKAREA = Logging_XInternAtom(clicon->log, clicon->display, "_NET_WORKAREA", False);
-	clicon->NET_WM_STATE = get_supported_atom(clicon, "_NET_WM_STATE");
-	clicon->NET_WM_STATE_MODAL = get_supported_atom(clicon, "_NET_WM_STATE_MODAL");
-	clicon->NET_WM_STATE_STICKY = get_supported_atom(clicon, "_NET_WM_STATE_STICKY");
-	clicon->NET_WM_STATE_MAXIMIZED_HORZ =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_STATE_MAXIMIZED_HORZ", False);
-	clicon->NET_WM_STATE_MAXIMIZED_VERT =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_STATE_MAXIMIZED_VERT", False);
-	clicon->NET_WM_STATE_SHADED = get_supported_atom(clicon, "_NET_WM_STATE_SHADED");
-	clicon->NET_WM_STATE_SKIP_TASKBAR = get_supported_atom(clicon, "_NET_WM_STATE_SKIP_TASKBAR");
-	clicon->NET_WM_STATE_SKIP_PAGER = get_supported_atom(clicon, "_NET_WM_STATE_SKIP_PAGER");
-	clicon->NET_WM_STATE_HIDDEN = get_supported_atom(clicon, "_NET_WM_STATE_HIDDEN");
-	clicon->NET_WM_STATE_FULLSCREEN = get_supported_atom(clicon, "_NET_WM_STATE_FULLSCREEN");
-	clicon->NET_WM_STATE_ABOVE = get_supported_atom(clicon, "_NET_WM_STATE_ABOVE");
-	clicon->NET_WM_STATE_BELOW = get_supported_atom(clicon, "_NET_WM_STATE_BELOW");
-	clicon->NET_WM_STATE_DEMANDS_ATTENTION =
-	    get_supported_atom(clicon, "_NET_WM_STATE_DEMANDS_ATTENTION");
-	clicon->NET_WM_FULLSCREEN_MONITORS = get_supported_atom(clicon, "_NET_WM_FULLSCREEN_MONITORS");
-	clicon->NET_WM_NAME = Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_NAME", False);
-	clicon->NET_WM_PID = Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_PID", False);
-	clicon->NET_WM_WINDOW_TYPE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE", False);
-	clicon->NET_WM_WINDOW_TYPE_NORMAL =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_NORMAL", False);
-	clicon->NET_WM_WINDOW_TYPE_DIALOG =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-	clicon->NET_WM_WINDOW_TYPE_POPUP =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_POPUP", False);
-	clicon->NET_WM_WINDOW_TYPE_POPUP_MENU =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_POPUP_MENU", False);
-	clicon->NET_WM_WINDOW_TYPE_UTILITY =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_UTILITY", False);
-	clicon->NET_WM_WINDOW_TYPE_DROPDOWN_MENU =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU", False);
-	clicon->NET_WM_STATE_SKIP_TASKBAR =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_STATE_SKIP_TASKBAR", False);
-	clicon->NET_WM_STATE_SKIP_PAGER =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_STATE_SKIP_PAGER", False);
-	clicon->NET_WM_MOVERESIZE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_MOVERESIZE", False);
-	clicon->NET_MOVERESIZE_WINDOW =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_MOVERESIZE_WINDOW", False);
-	clicon->UTF8_STRING = Logging_XInternAtom(clicon->log, clicon->display, "UTF8_STRING", FALSE);
-	clicon->WM_PROTOCOLS = Logging_XInternAtom(clicon->log, clicon->display, "WM_PROTOCOLS", False);
-	clicon->WM_DELETE_WINDOW = Logging_XInternAtom(clicon->log, clicon->display, "WM_DELETE_WINDOW", False);
-	clicon->WM_STATE = Logging_XInternAtom(clicon->log, clicon->display, "WM_STATE", False);
-	clicon->x11event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, clicon->xfds, WINPR_FD_READ);
-
-	clicon->NET_WM_ALLOWED_ACTIONS =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ALLOWED_ACTIONS", False);
-
-	clicon->NET_WM_ACTION_CLOSE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_CLOSE", False);
-	clicon->NET_WM_ACTION_MINIMIZE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_MINIMIZE", False);
-	clicon->NET_WM_ACTION_MOVE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_MOVE", False);
-	clicon->NET_WM_ACTION_RESIZE =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_RESIZE", False);
-	clicon->NET_WM_ACTION_MAXIMIZE_HORZ =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_MAXIMIZE_HORZ", False);
-	clicon->NET_WM_ACTION_MAXIMIZE_VERT =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_MAXIMIZE_VERT", False);
-	clicon->NET_WM_ACTION_FULLSCREEN =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_FULLSCREEN", False);
-	clicon->NET_WM_ACTION_CHANGE_DESKTOP =
-	    Logging_XInternAtom(clicon->log, clicon->display, "_NET_WM_ACTION_CHANGE_DESKTOP", False);
+	for (size_t x = 0; x < ARRAYSIZE(setup_atoms); x++)
+	{
+		const SetupAtom* setup = &setup_atoms[x];
+		Atom* atom = (Atom*)((BYTE*)clicon + setup->offset);
+		if (setup->supported)
+			*atom = get_supported_atom(clicon, setup->name);
+		else
+			*atom = Logging_XInternAtom(clicon->log, clicon->display, setup->name, False);
+	}
 
+	clicon->x11event = CreateFileDescriptorEvent(NULL, FALSE, FALSE, clicon->xfds, WINPR_FD_READ);
 	if (!clicon->x11event)
 	{
 		WLog_ERR(TAG, "Could not create xfds event");
 		goto fail;
 	}
 
+	/* the work area is cached and only refreshed when the window manager changes it */
+	clicon->workAreaCached = FALSE;
+	XSelectInput(clicon->display, RootWindowOfScreen(clicon->screen), PropertyChangeMask);
+
     check_extensions(clicon);
 
     clicon->vscreen.monitors = calloc(16, sizeof(MONITOR_INFO));
@@ -292,7 +324,12 @@ BOOL pre_connect(freerdp* instance){
     if (!freerdp_settings_set_bool(settings, FreeRDP_IgnoreCertificate, TRUE))
         return FALSE;
 
-    if (!freerdp_settings_get_bool(settings, FreeRDP_AuthenticationOnly))
+    if (!xf_settings_snapshot_update(clicon))
+        return FALSE;
+
+    const SettingsSnapshot* snapshot = &clicon->settingsSnapshot;
+
+    if (!snapshot->authenticationOnly)
 	{
 		if (!setup_x11(clicon))
 			return FALSE;
@@ -303,8 +340,11 @@ BOOL pre_connect(freerdp* instance){
 	if (!freerdp_settings_set_uint32(settings, FreeRDP_OsMinorType, OSMINORTYPE_NATIVE_XSERVER))
 		return FALSE;
 
-    // PubSub_SubscribeChannelConnected(context->pubSub, xf_OnChannelConnectedEventHandler);
-	// PubSub_SubscribeChannelDisconnected(context->pubSub, xf_OnChannelDisconnectedEventHandler);
+	if (!xf_rdpsnd_init_settings(settings))
+		return FALSE;
+
+    PubSub_SubscribeChannelConnected(context->pubSub, xf_OnChannelConnectedEventHandler);
+	PubSub_SubscribeChannelDisconnected(context->pubSub, xf_OnChannelDisconnectedEventHandler);
 
     if (!freerdp_settings_get_string(settings, FreeRDP_Username) &&
 	    !freerdp_settings_get_bool(settings, FreeRDP_CredentialsFromStdin) &&
@@ -323,7 +363,7 @@ BOOL pre_connect(freerdp* instance){
 		}
 	}
 
-    if (freerdp_settings_get_bool(settings, FreeRDP_AuthenticationOnly))
+    if (snapshot->authenticationOnly)
 	{
 		/* Check +auth-only has a username and password. */
 		if (!freerdp_settings_get_string(settings, FreeRDP_Password))
@@ -335,7 +375,7 @@ BOOL pre_connect(freerdp* instance){
 		WLog_INFO(TAG, "Authentication only. Don't connect to X.");
 	}
 
-    if (!freerdp_settings_get_bool(settings, FreeRDP_AuthenticationOnly))
+    if (!snapshot->authenticationOnly)
 	{
 		const char* KeyboardRemappingList = freerdp_settings_get_string(
 		    clicon->common.context.settings, FreeRDP_KeyboardRemappingList);
@@ -355,12 +395,14 @@ BOOL pre_connect(freerdp* instance){
         maxHeight = 768;
 	}
 
-    if (maxWidth && maxHeight && !freerdp_settings_get_bool(settings, FreeRDP_SmartSizing))
+    if (maxWidth && maxHeight && !snapshot->smartSizing)
 	{
 		if (!freerdp_settings_set_uint32(settings, FreeRDP_DesktopWidth, maxWidth))
 			return FALSE;
 		if (!freerdp_settings_set_uint32(settings, FreeRDP_DesktopHeight, maxHeight))
 			return FALSE;
+		if (!xf_settings_snapshot_update(clicon))
+			return FALSE;
 	}
 
     // clicon->fullscreen = freerdp_settings_get_bool(settings, FreeRDP_Fullscreen);
@@ -375,11 +417,31 @@ BOOL pre_connect(freerdp* instance){
 
 BOOL post_connect(freerdp* instance){
     printf("post_connect called\n");
+
+	WINPR_ASSERT(instance);
+	clientContext* clicon = (clientContext*)instance->context;
+	WINPR_ASSERT(clicon);
+
+	/* before the channels connect, the cliprdr channel attaches to it */
+	if (clicon->display &&
+	    freerdp_settings_get_bool(clicon->common.context.settings, FreeRDP_RedirectClipboard))
+	{
+		clicon->clipboard = xf_clipboard_new(clicon);
+		if (!clicon->clipboard)
+			WLog_WARN(TAG, "clipboard redirection disabled");
+	}
     return TRUE;
 }
 
 void post_disconnect(freerdp* instance){
     printf("post_disconnect called\n");
+
+	if (!instance || !instance->context)
+		return;
+
+	clientContext* clicon = (clientContext*)instance->context;
+	xf_clipboard_free(clicon->clipboard);
+	clicon->clipboard = NULL;
 }
 
 void post_final_disconnect(freerdp* instance)
@@ -0,0 +1,133 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - directory entry encoding unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/endian.h>
+#include <winpr/stream.h>
+
+#include <freerdp/channels/rdpdr.h>
+
+#include "xf_drive_entry.h"
+#include "test_check.h"
+
+/* "a" U+00E9 "b.txt", 7 UTF-16 code units */
+static const char test_name[] = "a\xC3\xA9"
+                                "b.txt";
+static const BYTE test_name_utf16[] = { 'a', 0, 0xE9, 0, 'b', 0, '.', 0, 't', 0, 'x', 0, 't', 0 };
+
+typedef struct
+{
+	UINT32 fsInformationClass;
+	size_t fileNameLengthOffset; /* offsets from the end of Length */
+	size_t fileNameOffset;
+	BOOL times; /* has CreationTime through FileAttributes */
+} TestEntryLayout;
+
+/* The fixed part of each entry as the server decodes it */
+static const TestEntryLayout test_layouts[] = {
+	{ FileDirectoryInformation, 60, 64, TRUE },
+	{ FileFullDirectoryInformation, 60, 68, TRUE },
+	{ FileBothDirectoryInformation, 60, 93, TRUE },
+	{ FileNamesInformation, 8, 12, FALSE },
+};
+
+static BOOL test_entry(const TestEntryLayout* layout)
+{
+	const XfDriveStat st = { .size = 0x123456789ull,
+		                     .allocation = 0x200000000ull,
+		                     .creationTime = 1,
+		                     .accessTime = 2,
+		                     .writeTime = 3,
+		                     .changeTime = 4,
+		                     .attributes = 0x20 };
+
+	wStream* s = Stream_New(NULL, 16);
+	CHECK(s);
+
+	const NTSTATUS status = xf_drive_write_entry(s, layout->fsInformationClass, test_name, &st);
+	const size_t written = Stream_GetPosition(s);
+	BYTE buffer[256] = { 0 };
+	if (written <= sizeof(buffer))
+		memcpy(buffer, Stream_Buffer(s), written);
+	Stream_Free(s, TRUE);
+
+	CHECK(status == STATUS_SUCCESS);
+	CHECK(written <= sizeof(buffer));
+
+	/* Length covers exactly what follows it */
+	const UINT32 length = winpr_Data_Get_UINT32(buffer);
+	CHECK(length == written - 4);
+	CHECK(length == layout->fileNameOffset + sizeof(test_name_utf16));
+
+	const BYTE* entry = &buffer[4];
+	CHECK(winpr_Data_Get_UINT32(&entry[0]) == 0); /* NextEntryOffset */
+	CHECK(winpr_Data_Get_UINT32(&entry[layout->fileNameLengthOffset]) ==
+	      sizeof(test_name_utf16));
+	CHECK(memcmp(&entry[layout->fileNameOffset], test_name_utf16, sizeof(test_name_utf16)) == 0);
+
+	if (layout->times)
+	{
+		CHECK(winpr_Data_Get_UINT64(&entry[8]) == st.creationTime);
+		CHECK(winpr_Data_Get_UINT64(&entry[16]) == st.accessTime);
+		CHECK(winpr_Data_Get_UINT64(&entry[24]) == st.writeTime);
+		CHECK(winpr_Data_Get_UINT64(&entry[32]) == st.changeTime);
+		CHECK(winpr_Data_Get_UINT64(&entry[40]) == st.size);
+		CHECK(winpr_Data_Get_UINT64(&entry[48]) == st.allocation);
+		CHECK(winpr_Data_Get_UINT32(&entry[56]) == st.attributes);
+	}
+
+	/* ShortNameLength and ShortName, empty */
+	if (layout->fsInformationClass == FileBothDirectoryInformation)
+	{
+		for (size_t x = 68; x < 93; x++)
+			CHECK(entry[x] == 0);
+	}
+	return TRUE;
+}
+
+static BOOL test_entry_invalid(void)
+{
+	const XfDriveStat st = { 0 };
+
+	wStream* s = Stream_New(NULL, 16);
+	CHECK(s);
+
+	const NTSTATUS unknownClass = xf_drive_write_entry(s, 0xFFFF, test_name, &st);
+	const NTSTATUS emptyName = xf_drive_write_entry(s, FileNamesInformation, "", &st);
+	const size_t written = Stream_GetPosition(s);
+	Stream_Free(s, TRUE);
+
+	CHECK(unknownClass != STATUS_SUCCESS);
+	CHECK(emptyName != STATUS_SUCCESS);
+	CHECK(written == 0);
+	return TRUE;
+}
+
+int main(void)
+{
+	for (size_t x = 0; x < ARRAYSIZE(test_layouts); x++)
+	{
+		if (!test_entry(&test_layouts[x]))
+			return 1;
+	}
+
+	if (!test_entry_invalid())
+		return 1;
+	return 0;
+}
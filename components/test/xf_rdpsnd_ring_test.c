@@ -0,0 +1,199 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - packet ring unit test
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#include "xf_rdpsnd_ring.h"
+#include "test_check.h"
+
+/* the smallest ring, 64 bytes */
+#define TEST_SMALL_RING 64
+#define TEST_MAX_PACKET 200
+#define TEST_THREADED_PACKETS 200000
+
+/* packet n is 1 to TEST_MAX_PACKET bytes, each derived from n */
+static size_t test_packet(UINT32 n, BYTE* data)
+{
+	const size_t size = 1 + (n * 7919u) % TEST_MAX_PACKET;
+	for (size_t x = 0; x < size; x++)
+		data[x] = (BYTE)(n + x);
+	return size;
+}
+
+static BOOL test_pop_packet(XfRdpsndRing* ring, UINT32 n)
+{
+	BYTE expected[TEST_MAX_PACKET] = { 0 };
+	BYTE data[TEST_MAX_PACKET] = { 0 };
+	size_t size = 0;
+
+	const size_t length = test_packet(n, expected);
+	CHECK(xf_rdpsnd_ring_peek(ring) == length);
+	CHECK(xf_rdpsnd_ring_pop(ring, data, sizeof(data), &size));
+	CHECK(size == length);
+	CHECK(memcmp(data, expected, length) == 0);
+	return TRUE;
+}
+
+/* An empty ring has nothing to pop, a full one refuses packets until the consumer made room */
+static BOOL test_full_empty(void)
+{
+	const BYTE packet[4] = { 1, 2, 3, 4 };
+	BYTE data[8] = { 0 };
+	size_t size = 1;
+	BOOL rc = FALSE;
+
+	XfRdpsndRing* ring = xf_rdpsnd_ring_new(TEST_SMALL_RING);
+	CHECK(ring);
+
+	if ((xf_rdpsnd_ring_peek(ring) != 0) || xf_rdpsnd_ring_pop(ring, data, sizeof(data), &size) ||
+	    (size != 0) || (xf_rdpsnd_ring_used(ring) != 0))
+		goto out;
+
+	/* empty packets and packets larger than the ring never fit */
+	BYTE large[TEST_SMALL_RING] = { 0 };
+	if (xf_rdpsnd_ring_push(ring, packet, 0) || xf_rdpsnd_ring_push(ring, large, sizeof(large)))
+		goto out;
+
+	/* 4 bytes of header and 4 of data each */
+	for (size_t x = 0; x < TEST_SMALL_RING / 8; x++)
+	{
+		if (!xf_rdpsnd_ring_push(ring, packet, sizeof(packet)))
+			goto out;
+	}
+	if (xf_rdpsnd_ring_push(ring, packet, 1) || (xf_rdpsnd_ring_used(ring) != TEST_SMALL_RING))
+		goto out;
+
+	/* a buffer too small keeps the packet queued */
+	if (xf_rdpsnd_ring_pop(ring, data, 3, &size) || (xf_rdpsnd_ring_peek(ring) != sizeof(packet)))
+		goto out;
+
+	if (!xf_rdpsnd_ring_pop(ring, data, sizeof(data), &size) || (size != sizeof(packet)) ||
+	    (memcmp(data, packet, sizeof(packet)) != 0) || !xf_rdpsnd_ring_push(ring, packet, 1) ||
+	    xf_rdpsnd_ring_push(ring, packet, 1))
+		goto out;
+
+	while (xf_rdpsnd_ring_pop(ring, data, sizeof(data), &size))
+		;
+	rc = (xf_rdpsnd_ring_used(ring) == 0) && (xf_rdpsnd_ring_peek(ring) == 0);
+
+out:
+	xf_rdpsnd_ring_free(ring);
+	CHECK(rc);
+	return TRUE;
+}
+
+/* Packets of odd sizes through a small ring wrap around its end, headers and data split */
+static BOOL test_wrap_around(void)
+{
+	BYTE data[TEST_MAX_PACKET] = { 0 };
+	BOOL rc = FALSE;
+
+	XfRdpsndRing* ring = xf_rdpsnd_ring_new(2 * TEST_MAX_PACKET);
+	CHECK(ring);
+
+	UINT32 pushed = 0;
+	UINT32 popped = 0;
+	while (popped < 1000)
+	{
+		/* fill up, then drain about half */
+		const size_t size = test_packet(pushed, data);
+		if (xf_rdpsnd_ring_push(ring, data, size))
+		{
+			pushed++;
+			continue;
+		}
+
+		if (pushed == popped)
+			goto out;
+		for (const UINT32 end = popped + (pushed - popped + 1) / 2; popped < end; popped++)
+		{
+			if (!test_pop_packet(ring, popped))
+				goto out;
+		}
+	}
+	rc = TRUE;
+
+out:
+	xf_rdpsnd_ring_free(ring);
+	CHECK(rc);
+	return TRUE;
+}
+
+static DWORD WINAPI test_producer(LPVOID arg)
+{
+	XfRdpsndRing* ring = arg;
+	BYTE data[TEST_MAX_PACKET] = { 0 };
+
+	for (UINT32 n = 0; n < TEST_THREADED_PACKETS; n++)
+	{
+		const size_t size = test_packet(n, data);
+		while (!xf_rdpsnd_ring_push(ring, data, size))
+			(void)SwitchToThread();
+	}
+	return 0;
+}
+
+/* One producer and one consumer thread, the ring is full or empty many times over */
+static BOOL test_threaded(void)
+{
+	BOOL rc = TRUE;
+
+	XfRdpsndRing* ring = xf_rdpsnd_ring_new(4 * TEST_MAX_PACKET);
+	CHECK(ring);
+
+	HANDLE thread = CreateThread(NULL, 0, test_producer, ring, 0, NULL);
+	if (!thread)
+	{
+		xf_rdpsnd_ring_free(ring);
+		CHECK(thread);
+	}
+
+	for (UINT32 n = 0; rc && (n < TEST_THREADED_PACKETS); n++)
+	{
+		while (xf_rdpsnd_ring_peek(ring) == 0)
+			(void)SwitchToThread();
+		rc = test_pop_packet(ring, n);
+	}
+
+	/* the producer ends once the consumer took everything */
+	if (rc)
+		(void)WaitForSingleObject(thread, INFINITE);
+	else
+	{
+		BYTE data[TEST_MAX_PACKET] = { 0 };
+		size_t size = 0;
+		while (WaitForSingleObject(thread, 0) != WAIT_OBJECT_0)
+			(void)xf_rdpsnd_ring_pop(ring, data, sizeof(data), &size);
+	}
+	(void)CloseHandle(thread);
+
+	rc = rc && (xf_rdpsnd_ring_used(ring) == 0);
+	xf_rdpsnd_ring_free(ring);
+	CHECK(rc);
+	return TRUE;
+}
+
+int main(void)
+{
+	if (!test_full_empty() || !test_wrap_around() || !test_threaded())
+		return 1;
+	return 0;
+}
@@ -0,0 +1,548 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 action script co-process
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <winpr/assert.h>
+#include <winpr/collections.h>
+#include <winpr/path.h>
+#include <winpr/string.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/thread.h>
+
+#include <freerdp/log.h>
+
+#include "xf_action_script.h"
+
+#define TAG CLIENT_TAG("xfreerdp.utils")
+
+/* answers larger than this are treated as a broken script */
+#define ACTION_SCRIPT_MAX_OUTPUT (64 * 1024)
+
+struct xf_action_script
+{
+	CRITICAL_SECTION lock; /* guards cache and requested */
+	wHashTable* cache;     /* "what\x1farg" -> answer */
+	wHashTable* requested; /* keys queued to the query thread and not answered yet */
+	wMessageQueue* queue;
+	HANDLE thread;
+
+	/* only touched by the query thread */
+	char* path;
+	pid_t pid; /* running co-process or 0 */
+	int fd;    /* our end of the socketpair connected to its stdin/stdout */
+	BOOL coprocessUnsupported;
+	BOOL coprocessAnswered; /* the running co-process answered at least one query */
+	char* pending;          /* bytes read past the end of the last answer */
+	size_t pendingLen;
+};
+
+/* a cache miss handed to the query thread */
+typedef struct
+{
+	char* key;
+	char* what;
+	char* arg;
+} ScriptRequest;
+
+typedef struct
+{
+	char* data;
+	size_t len;
+	size_t cap;
+} ScriptBuffer;
+
+static BOOL buffer_append(ScriptBuffer* buffer, const char* data, size_t len)
+{
+	if (buffer->len + len + 1 > ACTION_SCRIPT_MAX_OUTPUT)
+		return FALSE;
+
+	if (buffer->len + len + 1 > buffer->cap)
+	{
+		size_t cap = MAX(buffer->cap * 2, 256);
+		while (cap < buffer->len + len + 1)
+			cap *= 2;
+
+		char* tmp = realloc(buffer->data, cap);
+		if (!tmp)
+			return FALSE;
+		buffer->data = tmp;
+		buffer->cap = cap;
+	}
+
+	memcpy(&buffer->data[buffer->len], data, len);
+	buffer->len += len;
+	buffer->data[buffer->len] = '\0';
+	return TRUE;
+}
+
+static pid_t script_spawn(const char* path, const char* arg, int* fd)
+{
+	int sv[2] = { -1, -1 };
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+		return -1;
+
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		/* only async signal safe calls from here on */
+		(void)dup2(sv[1], STDIN_FILENO);
+		(void)dup2(sv[1], STDOUT_FILENO);
+		(void)execl(path, path, arg, (char*)NULL);
+		_exit(127);
+	}
+
+	(void)close(sv[1]);
+	if (pid < 0)
+	{
+		(void)close(sv[0]);
+		return -1;
+	}
+
+	*fd = sv[0];
+	return pid;
+}
+
+static void script_reap(pid_t pid, BOOL force)
+{
+	if (pid <= 0)
+		return;
+
+	if (force)
+		(void)kill(pid, SIGKILL);
+	else if (waitpid(pid, NULL, WNOHANG) == pid)
+		return;
+	else
+		(void)kill(pid, SIGKILL);
+
+	while ((waitpid(pid, NULL, 0) < 0) && (errno == EINTR))
+		;
+}
+
+static void coprocess_stop(XfActionScript* script, BOOL force)
+{
+	if (script->fd >= 0)
+		(void)close(script->fd);
+	script->fd = -1;
+	script_reap(script->pid, force);
+	script->pid = 0;
+	free(script->pending);
+	script->pending = NULL;
+	script->pendingLen = 0;
+}
+
+static BOOL coprocess_start(XfActionScript* script)
+{
+	if (script->pid > 0)
+		return TRUE;
+	if (script->coprocessUnsupported)
+		return FALSE;
+
+	script->coprocessAnswered = FALSE;
+	script->pid = script_spawn(script->path, "coprocess", &script->fd);
+	if (script->pid < 0)
+	{
+		script->pid = 0;
+		script->coprocessUnsupported = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Returns the length of the answer in buffer if it holds a complete one, i.e. one terminated by
+ * an empty line, SIZE_MAX otherwise. The trailing newline and the empty line are not counted. */
+static size_t answer_length(const ScriptBuffer* buffer, size_t* consumed)
+{
+	if ((buffer->len >= 1) && (buffer->data[0] == '\n'))
+	{
+		*consumed = 1;
+		return 0;
+	}
+
+	const char* end = buffer->len ? strstr(buffer->data, "\n\n") : NULL;
+	if (!end)
+		return SIZE_MAX;
+
+	*consumed = (size_t)(end - buffer->data) + 2;
+	return (size_t)(end - buffer->data);
+}
+
+/* Reads from fd until a complete answer is buffered (if untilEmptyLine), EOF or the deadline.
+ * Returns 1 for a complete answer, 0 on EOF and -1 on timeout or error. */
+static int read_until(int fd, ScriptBuffer* buffer, UINT64 deadline, BOOL untilEmptyLine,
+                      size_t* answerLen, size_t* consumed)
+{
+	for (;;)
+	{
+		if (untilEmptyLine)
+		{
+			*answerLen = answer_length(buffer, consumed);
+			if (*answerLen != SIZE_MAX)
+				return 1;
+		}
+
+		const UINT64 now = GetTickCount64();
+		if (now >= deadline)
+			return -1;
+
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		const int rc = poll(&pfd, 1, (int)(deadline - now));
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (rc == 0)
+			return -1;
+
+		char tmp[1024];
+		const ssize_t got = read(fd, tmp, sizeof(tmp));
+		if (got < 0)
+		{
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			return -1;
+		}
+		if (got == 0)
+			return 0;
+		if (!buffer_append(buffer, tmp, (size_t)got))
+			return -1;
+	}
+}
+
+static BOOL write_all(int fd, const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		const ssize_t rc = send(fd, data, len, MSG_NOSIGNAL);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += rc;
+		len -= (size_t)rc;
+	}
+	return TRUE;
+}
+
+/* 1: answered, 0: co-process not supported, -1: failed (timeout, crash) */
+static int coprocess_query(XfActionScript* script, const char* what, const char* arg,
+                           char** answer)
+{
+	ScriptBuffer buffer = { 0 };
+	int rc = -1;
+
+	char line[1024] = { 0 };
+	const int len = arg ? snprintf(line, sizeof(line), "%s %s\n", what, arg)
+	                    : snprintf(line, sizeof(line), "%s\n", what);
+	if ((len <= 0) || ((size_t)len >= sizeof(line)) || (strchr(line, '\n') != &line[len - 1]))
+	{
+		WLog_WARN(TAG, "[ActionScript] query '%s' not representable as a single line", what);
+		return -1;
+	}
+
+	if (!coprocess_start(script))
+		return 0;
+
+	const BOOL firstQuery = !script->coprocessAnswered;
+	if (script->pendingLen > 0)
+	{
+		if (!buffer_append(&buffer, script->pending, script->pendingLen))
+			goto fail;
+		free(script->pending);
+		script->pending = NULL;
+		script->pendingLen = 0;
+	}
+
+	if (!write_all(script->fd, line, (size_t)len))
+	{
+		/* the script already exited, it does not speak the protocol */
+		if (firstQuery)
+			rc = 0;
+		goto fail;
+	}
+
+	size_t answerLen = 0;
+	size_t consumed = 0;
+	const UINT64 deadline = GetTickCount64() + XF_ACTION_SCRIPT_TIMEOUT_MS;
+	const int status = read_until(script->fd, &buffer, deadline, TRUE, &answerLen, &consumed);
+	if (status == 0)
+	{
+		if (firstQuery)
+			rc = 0;
+		goto fail;
+	}
+	if (status < 0)
+	{
+		WLog_WARN(TAG, "[ActionScript] co-process did not answer '%s' in %u ms, restarting", what,
+		          XF_ACTION_SCRIPT_TIMEOUT_MS);
+		goto fail;
+	}
+
+	*answer = strndup(buffer.data, answerLen);
+	if (!*answer)
+		goto fail;
+	script->coprocessAnswered = TRUE;
+
+	if (buffer.len > consumed)
+	{
+		script->pendingLen = buffer.len - consumed;
+		script->pending = malloc(script->pendingLen);
+		if (!script->pending)
+			script->pendingLen = 0;
+		else
+			memcpy(script->pending, &buffer.data[consumed], script->pendingLen);
+	}
+
+	free(buffer.data);
+	return 1;
+
+fail:
+	free(buffer.data);
+	coprocess_stop(script, TRUE);
+	if (rc == 0)
+	{
+		WLog_DBG(TAG, "[ActionScript] '%s' is not a co-process, running it per query",
+		         script->path);
+		script->coprocessUnsupported = TRUE;
+	}
+	return rc;
+}
+
+static BOOL oneshot_query(XfActionScript* script, const char* what, char** answer)
+{
+	ScriptBuffer buffer = { 0 };
+	int fd = -1;
+	size_t answerLen = 0;
+	size_t consumed = 0;
+
+	const pid_t pid = script_spawn(script->path, what, &fd);
+	if (pid < 0)
+	{
+		WLog_ERR(TAG, "[ActionScript] Failed to execute '%s %s'", script->path, what);
+		return FALSE;
+	}
+
+	(void)shutdown(fd, SHUT_WR);
+
+	const UINT64 deadline = GetTickCount64() + XF_ACTION_SCRIPT_TIMEOUT_MS;
+	const int status = read_until(fd, &buffer, deadline, FALSE, &answerLen, &consumed);
+	(void)close(fd);
+	script_reap(pid, status < 0);
+
+	if (status < 0)
+	{
+		WLog_WARN(TAG, "[ActionScript] '%s %s' did not finish in %u ms", script->path, what,
+		          XF_ACTION_SCRIPT_TIMEOUT_MS);
+		free(buffer.data);
+		return FALSE;
+	}
+
+	/* keep the line oriented format of the co-process answers */
+	while ((buffer.len > 0) && (buffer.data[buffer.len - 1] == '\n'))
+		buffer.data[--buffer.len] = '\0';
+
+	*answer = buffer.data ? buffer.data : _strdup("");
+	return *answer != NULL;
+}
+
+static void script_request_free(ScriptRequest* request)
+{
+	if (!request)
+		return;
+	free(request->key);
+	free(request->what);
+	free(request->arg);
+	free(request);
+}
+
+static void script_request_message_free(void* obj)
+{
+	wMessage* msg = obj;
+	if (msg && (msg->id != WMQ_QUIT))
+		script_request_free(msg->wParam);
+}
+
+static void script_answer(XfActionScript* script, ScriptRequest* request)
+{
+	char* answer = NULL;
+
+	const int status = coprocess_query(script, request->what, request->arg, &answer);
+	if ((status == 0) && !oneshot_query(script, request->what, &answer))
+		answer = NULL;
+
+	EnterCriticalSection(&script->lock);
+	/* a failed query is asked again on the next miss */
+	if (answer && HashTable_Insert(script->cache, request->key, answer))
+		answer = NULL; /* the table took ownership */
+	(void)HashTable_Remove(script->requested, request->key);
+	LeaveCriticalSection(&script->lock);
+
+	free(answer);
+}
+
+/* Runs the queries, so a slow or hung script never holds up the thread asking */
+static DWORD WINAPI script_thread(LPVOID arg)
+{
+	XfActionScript* script = arg;
+	WINPR_ASSERT(script);
+
+	while (MessageQueue_Wait(script->queue))
+	{
+		wMessage msg = { 0 };
+		if (MessageQueue_Peek(script->queue, &msg, TRUE) <= 0)
+			continue;
+		if (msg.id == WMQ_QUIT)
+			break;
+
+		ScriptRequest* request = msg.wParam;
+		script_answer(script, request);
+		script_request_free(request);
+	}
+	return 0;
+}
+
+XfActionScript* xf_action_script_new(const char* path)
+{
+	WINPR_ASSERT(path);
+
+	/* checked once here, the co-process and the per query fallback both need the file */
+	if (!winpr_PathFileExists(path))
+	{
+		WLog_DBG(TAG, "[ActionScript] no such script '%s'", path);
+		return NULL;
+	}
+
+	XfActionScript* script = calloc(1, sizeof(XfActionScript));
+	if (!script)
+		return NULL;
+
+	script->fd = -1;
+	InitializeCriticalSection(&script->lock);
+
+	script->path = _strdup(path);
+	script->cache = HashTable_New(FALSE);
+	script->requested = HashTable_New(FALSE);
+	if (!script->path || !script->cache || !HashTable_SetupForStringData(script->cache, FALSE))
+		goto fail;
+	if (!script->requested || !HashTable_SetupForStringData(script->requested, FALSE))
+		goto fail;
+
+	wObject* obj = HashTable_ValueObject(script->cache);
+	WINPR_ASSERT(obj);
+	obj->fnObjectFree = free;
+
+	wObject callback = { 0 };
+	callback.fnObjectFree = script_request_message_free;
+	script->queue = MessageQueue_New(&callback);
+	if (!script->queue)
+		goto fail;
+
+	script->thread = CreateThread(NULL, 0, script_thread, script, 0, NULL);
+	if (!script->thread)
+		goto fail;
+
+	return script;
+
+fail:
+	xf_action_script_free(script);
+	return NULL;
+}
+
+void xf_action_script_free(XfActionScript* script)
+{
+	if (!script)
+		return;
+
+	if (script->thread)
+	{
+		/* waits for the query in progress, at most XF_ACTION_SCRIPT_TIMEOUT_MS */
+		(void)MessageQueue_PostQuit(script->queue, 0);
+		(void)WaitForSingleObject(script->thread, INFINITE);
+		(void)CloseHandle(script->thread);
+	}
+	MessageQueue_Free(script->queue);
+
+	coprocess_stop(script, FALSE);
+	HashTable_Free(script->requested);
+	HashTable_Free(script->cache);
+	free(script->path);
+	DeleteCriticalSection(&script->lock);
+	free(script);
+}
+
+BOOL xf_action_script_query(XfActionScript* script, const char* what, const char* arg,
+                            const char** output)
+{
+	BOOL rc = FALSE;
+	char key[1024] = { 0 };
+
+	WINPR_ASSERT(script);
+	WINPR_ASSERT(what);
+	WINPR_ASSERT(output);
+
+	(void)snprintf(key, sizeof(key), "%s\x1f%s", what, arg ? arg : "");
+
+	EnterCriticalSection(&script->lock);
+
+	const char* cached = HashTable_GetItemValue(script->cache, key);
+	if (cached)
+	{
+		*output = cached;
+		rc = TRUE;
+		goto out;
+	}
+
+	/* asked already, the answer is on its way */
+	if (HashTable_Contains(script->requested, key))
+		goto out;
+
+	ScriptRequest* request = calloc(1, sizeof(ScriptRequest));
+	if (!request)
+		goto out;
+	request->key = _strdup(key);
+	request->what = _strdup(what);
+	request->arg = arg ? _strdup(arg) : NULL;
+	if (!request->key || !request->what || (arg && !request->arg) ||
+	    !HashTable_Insert(script->requested, key, (void*)1))
+	{
+		script_request_free(request);
+		goto out;
+	}
+
+	if (!MessageQueue_Post(script->queue, NULL, 0, request, NULL))
+	{
+		(void)HashTable_Remove(script->requested, key);
+		script_request_free(request);
+	}
+
+out:
+	LeaveCriticalSection(&script->lock);
+	return rc;
+}
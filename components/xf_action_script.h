@@ -0,0 +1,48 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 action script co-process
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_ACTION_SCRIPT_H
+#define FREERDP_CLIENT_X11_ACTION_SCRIPT_H
+
+#include <winpr/wtypes.h>
+
+/* Upper bound for a single query, a script that takes longer is killed */
+#define XF_ACTION_SCRIPT_TIMEOUT_MS 500
+
+typedef struct xf_action_script XfActionScript;
+
+/*
+ * The script is started once as `<script> coprocess` and kept running. Each query is written as
+ * one line, `<what>\n` or `<what> <arg>\n`, and answered with zero or more lines followed by an
+ * empty line. Scripts that exit instead of answering are run once per query as
+ * `<script> <what>`, as before, with the same timeout. Answers are cached per (what, arg).
+ *
+ * The script runs on a thread of its own, a query never waits for it.
+ */
+/* Returns NULL if there is no script at path */
+XfActionScript* xf_action_script_new(const char* path);
+void xf_action_script_free(XfActionScript* script);
+
+/*
+ * On success *output holds the cached answer lines separated by '\n' and is owned by the cache.
+ * A query not answered before returns FALSE right away, the caller goes on with its default, and
+ * the script is asked in the background so a later query finds the answer.
+ */
+BOOL xf_action_script_query(XfActionScript* script, const char* what, const char* arg,
+                            const char** output);
+
+#endif /* FREERDP_CLIENT_X11_ACTION_SCRIPT_H */
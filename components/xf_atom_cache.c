@@ -0,0 +1,260 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 atom <-> name cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <winpr/assert.h>
+#include <winpr/collections.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/log.h>
+
+#include "xf_atom_cache.h"
+
+#define TAG CLIENT_TAG("x11")
+
+typedef struct
+{
+	wHashTable* byAtom; /* Atom -> name, the name is owned by atom_names */
+	wHashTable* byName; /* name -> Atom */
+} AtomCache;
+
+static AtomCache* volatile atom_cache = NULL;
+
+/* Every name handed out, never freed: xf_atom_cache_clear forgets the atom numbers, which are only
+ * valid for one X server, but a name a caller still holds must stay readable. Names are a small,
+ * fixed set in practice, so the pool does not grow with the connections made. */
+static wHashTable* volatile atom_names = NULL;
+
+static wHashTable* atom_names_get(void)
+{
+	wHashTable* names = atom_names;
+	if (names)
+		return names;
+
+	wHashTable* created = HashTable_New(TRUE);
+	if (!created || !HashTable_SetupForStringData(created, TRUE))
+	{
+		HashTable_Free(created);
+		return NULL;
+	}
+
+	names = InterlockedCompareExchangePointer((PVOID volatile*)&atom_names, created, NULL);
+	if (names)
+	{
+		HashTable_Free(created);
+		return names;
+	}
+	return created;
+}
+
+/* Returns the pooled copy of name, adding it on first use */
+static const char* atom_names_intern(const char* name)
+{
+	wHashTable* names = atom_names_get();
+	if (!names)
+		return NULL;
+
+	HashTable_Lock(names);
+	const char* pooled = HashTable_GetItemValue(names, name);
+	if (!pooled && HashTable_Insert(names, name, name))
+		pooled = HashTable_GetItemValue(names, name);
+	HashTable_Unlock(names);
+	return pooled;
+}
+
+static void* atom_key(Atom atom)
+{
+	return (void*)(uintptr_t)atom;
+}
+
+static void atom_cache_free(AtomCache* cache)
+{
+	if (!cache)
+		return;
+
+	HashTable_Free(cache->byName);
+	HashTable_Free(cache->byAtom);
+	free(cache);
+}
+
+static AtomCache* atom_cache_new(void)
+{
+	AtomCache* cache = calloc(1, sizeof(AtomCache));
+	if (!cache)
+		return NULL;
+
+	cache->byAtom = HashTable_New(TRUE);
+	cache->byName = HashTable_New(TRUE);
+	if (!cache->byAtom || !cache->byName)
+		goto fail;
+
+	if (!HashTable_SetupForStringData(cache->byName, FALSE))
+		goto fail;
+
+	return cache;
+
+fail:
+	atom_cache_free(cache);
+	return NULL;
+}
+
+static AtomCache* atom_cache_get(void)
+{
+	AtomCache* cache = atom_cache;
+	if (cache)
+		return cache;
+
+	AtomCache* created = atom_cache_new();
+	if (!created)
+	{
+		WLog_WARN(TAG, "failed to allocate atom cache");
+		return NULL;
+	}
+
+	cache = InterlockedCompareExchangePointer((PVOID volatile*)&atom_cache, created, NULL);
+	if (cache)
+	{
+		/* another thread was first */
+		atom_cache_free(created);
+		return cache;
+	}
+	return created;
+}
+
+/* Adds atom/name unless already known and returns the pooled name */
+static const char* atom_cache_add(AtomCache* cache, Atom atom, const char* name)
+{
+	WINPR_ASSERT(cache);
+
+	if ((atom == None) || !name)
+		return NULL;
+
+	HashTable_Lock(cache->byAtom);
+	const char* cached = HashTable_GetItemValue(cache->byAtom, atom_key(atom));
+	if (!cached)
+	{
+		const char* pooled = atom_names_intern(name);
+		if (pooled && HashTable_Insert(cache->byAtom, atom_key(atom), pooled))
+		{
+			cached = pooled;
+			if (!HashTable_Insert(cache->byName, name, atom_key(atom)))
+				WLog_WARN(TAG, "failed to cache atom name %s", name);
+		}
+	}
+	HashTable_Unlock(cache->byAtom);
+	return cached;
+}
+
+BOOL xf_atom_cache_prefetch(Display* display, const char* const* names, size_t count)
+{
+	BOOL rc = FALSE;
+	WINPR_ASSERT(display);
+	WINPR_ASSERT(names || (count == 0));
+
+	AtomCache* cache = atom_cache_get();
+	if (!cache)
+		return FALSE;
+
+	char** missing = calloc(count + 1, sizeof(char*));
+	Atom* atoms = calloc(count + 1, sizeof(Atom));
+	if (!missing || !atoms)
+		goto fail;
+
+	int nmissing = 0;
+	for (size_t x = 0; (x < count) && (nmissing < INT32_MAX); x++)
+	{
+		if (!HashTable_GetItemValue(cache->byName, names[x]))
+			missing[nmissing++] = (char*)names[x];
+	}
+
+	if (nmissing > 0)
+	{
+		if (!XInternAtoms(display, missing, nmissing, False, atoms))
+		{
+			WLog_WARN(TAG, "XInternAtoms failed for %d atoms", nmissing);
+			goto fail;
+		}
+
+		for (int x = 0; x < nmissing; x++)
+			(void)atom_cache_add(cache, atoms[x], missing[x]);
+	}
+
+	rc = TRUE;
+fail:
+	free(atoms);
+	free(missing);
+	return rc;
+}
+
+Atom xf_atom_cache_lookup(const char* name)
+{
+	AtomCache* cache = atom_cache;
+	if (!cache || !name)
+		return None;
+
+	return (Atom)(uintptr_t)HashTable_GetItemValue(cache->byName, name);
+}
+
+Atom xf_atom_cache_intern(Display* display, const char* name, Bool only_if_exists)
+{
+	WINPR_ASSERT(display);
+	WINPR_ASSERT(name);
+
+	AtomCache* cache = atom_cache_get();
+	if (cache)
+	{
+		const Atom atom = (Atom)(uintptr_t)HashTable_GetItemValue(cache->byName, name);
+		if (atom != None)
+			return atom;
+	}
+
+	const Atom atom = XInternAtom(display, name, only_if_exists);
+	if (cache)
+		(void)atom_cache_add(cache, atom, name);
+	return atom;
+}
+
+const char* xf_atom_cache_name(Display* display, Atom atom)
+{
+	WINPR_ASSERT(display);
+
+	if (atom == None)
+		return NULL;
+
+	AtomCache* cache = atom_cache_get();
+	if (!cache)
+		return NULL;
+
+	const char* cached = HashTable_GetItemValue(cache->byAtom, atom_key(atom));
+	if (cached)
+		return cached;
+
+	char* name = XGetAtomName(display, atom);
+	if (!name)
+		return NULL;
+
+	cached = atom_cache_add(cache, atom, name);
+	XFree(name);
+	return cached;
+}
+
+void xf_atom_cache_clear(void)
+{
+	AtomCache* cache = InterlockedExchangePointer((PVOID volatile*)&atom_cache, NULL);
+	atom_cache_free(cache);
+}
@@ -0,0 +1,44 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 atom <-> name cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_ATOM_CACHE_H
+#define FREERDP_CLIENT_X11_ATOM_CACHE_H
+
+#include <winpr/wtypes.h>
+
+#include <X11/Xlib.h>
+
+/* Atoms never change for the lifetime of an X server, so a single process wide cache serves
+ * every connection. It is created on first use and its atoms are dropped by xf_atom_cache_clear,
+ * the names it handed out stay valid. */
+
+/* Interns all names with one XInternAtoms round trip and caches the result */
+BOOL xf_atom_cache_prefetch(Display* display, const char* const* names, size_t count);
+
+/* Returns the cached atom for name, asking the server on a miss */
+Atom xf_atom_cache_intern(Display* display, const char* name, Bool only_if_exists);
+
+/* Returns the cached name of atom, asking the server on a miss. The string is owned by the cache
+ * and stays valid for the lifetime of the process. Returns NULL for unknown atoms. */
+const char* xf_atom_cache_name(Display* display, Atom atom);
+
+/* Local lookup only, no server round trip. Returns None if name was never seen. */
+Atom xf_atom_cache_lookup(const char* name);
+
+void xf_atom_cache_clear(void);
+
+#endif /* FREERDP_CLIENT_X11_ATOM_CACHE_H */
@@ -0,0 +1,98 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 client channel glue
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <winpr/assert.h>
+
+#include <freerdp/addin.h>
+#include <freerdp/client.h>
+#include <freerdp/client/channels.h>
+#include <freerdp/client/cliprdr.h>
+#include <freerdp/channels/remdesk.h>
+
+#include "xf_channels.h"
+#include "xf_cliprdr.h"
+#include "xf_drive.h"
+#include "xf_rdpsnd.h"
+#include "../context/client_context.h"
+
+void xf_OnChannelConnectedEventHandler(void* context, const ChannelConnectedEventArgs* e)
+{
+	clientContext* clicon = (clientContext*)context;
+
+	WINPR_ASSERT(clicon);
+	WINPR_ASSERT(e);
+
+	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0)
+	{
+		if (clicon->clipboard)
+			(void)xf_cliprdr_init(clicon->clipboard, (CliprdrClientContext*)e->pInterface);
+	}
+	else
+		freerdp_client_OnChannelConnectedEventHandler(context, e);
+}
+
+void xf_OnChannelDisconnectedEventHandler(void* context, const ChannelDisconnectedEventArgs* e)
+{
+	clientContext* clicon = (clientContext*)context;
+
+	WINPR_ASSERT(clicon);
+	WINPR_ASSERT(e);
+
+	if (strcmp(e->name, CLIPRDR_SVC_CHANNEL_NAME) == 0)
+	{
+		if (clicon->clipboard)
+			xf_cliprdr_uninit(clicon->clipboard, (CliprdrClientContext*)e->pInterface);
+	}
+	else
+		freerdp_client_OnChannelDisconnectedEventHandler(context, e);
+}
+
+/* The remdesk plugin of channels/remdesk, linked in from remdesk_client */
+extern BOOL VCAPITYPE remdesk_VirtualChannelEntryEx(PCHANNEL_ENTRY_POINTS pEntryPoints,
+                                                    PVOID pInitHandle);
+
+/* Named here, FreeRDP's static table has a remdesk entry of its own */
+static PVIRTUALCHANNELENTRY xf_remdesk_addin_entry(LPCSTR pszName, LPCSTR pszSubsystem,
+                                                   LPCSTR pszType, DWORD dwFlags)
+{
+	if (pszName && !pszSubsystem && !pszType && (dwFlags & FREERDP_ADDIN_CHANNEL_ENTRYEX) &&
+	    (strcmp(pszName, REMDESK_SVC_CHANNEL_NAME) == 0))
+		return WINPR_FUNC_PTR_CAST(remdesk_VirtualChannelEntryEx, PVIRTUALCHANNELENTRY);
+	return NULL;
+}
+
+/* Everything but the client's own channels goes to FreeRDP's static addin table */
+static PVIRTUALCHANNELENTRY xf_channels_addin_provider(LPCSTR pszName, LPCSTR pszSubsystem,
+                                                       LPCSTR pszType, DWORD dwFlags)
+{
+	PVIRTUALCHANNELENTRY entry = xf_rdpsnd_addin_entry(pszName, pszSubsystem, pszType);
+	if (!entry)
+		entry = xf_drive_addin_entry(pszName, pszSubsystem, pszType);
+	if (!entry)
+		entry = xf_remdesk_addin_entry(pszName, pszSubsystem, pszType, dwFlags);
+	if (entry)
+		return entry;
+
+	return freerdp_channels_load_static_addin_entry(pszName, pszSubsystem, pszType, dwFlags);
+}
+
+BOOL xf_channels_register_addins(void)
+{
+	return freerdp_register_addin_provider(xf_channels_addin_provider, 0) == 0;
+}
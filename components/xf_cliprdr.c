@@ -0,0 +1,1477 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 clipboard redirection
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/clipboard.h>
+#include <winpr/interlocked.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/user.h>
+
+#include <freerdp/log.h>
+#include <freerdp/channels/cliprdr.h>
+
+#include <X11/Xatom.h>
+#include <X11/extensions/Xfixes.h>
+
+#include "xf_cliprdr.h"
+#include "xf_cliprdr_files.h"
+#include "xf_flush.h"
+#include "xf_utils.h"
+#include "../context/client_context.h"
+
+#define TAG CLIENT_TAG("x11.cliprdr")
+
+/* selection requests waiting for the server's data, further ones are refused */
+#define XF_CLIPRDR_MAX_REQUESTS 32
+
+/* concurrent INCR transfers to local applications */
+#define XF_CLIPRDR_MAX_TRANSFERS 16
+
+/* an INCR requestor that stops deleting the property for this long is given up on */
+#define XF_CLIPRDR_INCR_TIMEOUT_MS 10000
+
+typedef struct
+{
+	const char* target;     /* X selection target */
+	UINT32 formatId;        /* standard clipboard format, 0 for formatName */
+	const char* formatName; /* registered clipboard format */
+	const char* mime;       /* wClipboard format the target's data converts through */
+	BOOL text;              /* X clients expect the data without terminating NULs */
+	BOOL files;             /* the server's files, copied by xfCliprdrFiles */
+} xfCliprdrMapping;
+
+/* In order of preference, a clipboard format is announced for the first target that has it */
+static const xfCliprdrMapping xf_cliprdr_mappings[] = {
+	{ "UTF8_STRING", CF_UNICODETEXT, NULL, "UTF8_STRING", TRUE, FALSE },
+	{ "text/plain;charset=utf-8", CF_UNICODETEXT, NULL, "UTF8_STRING", TRUE, FALSE },
+	{ "image/png", CF_DIB, NULL, "image/png", FALSE, FALSE },
+	{ "image/bmp", CF_DIB, NULL, "image/bmp", FALSE, FALSE },
+	{ "text/html", 0, "HTML Format", "text/html", TRUE, FALSE },
+	{ "text/uri-list", 0, "FileGroupDescriptorW", NULL, TRUE, TRUE },
+	{ "x-special/gnome-copied-files", 0, "FileGroupDescriptorW", NULL, TRUE, TRUE },
+};
+
+#define XF_CLIPRDR_MAPPINGS ARRAYSIZE(xf_cliprdr_mappings)
+
+/* the data of every format plus its conversion for every target */
+#define XF_CLIPRDR_MAX_CACHE (2 * XF_CLIPRDR_MAPPINGS)
+
+typedef struct
+{
+	volatile LONG refs;
+	BYTE* data;
+	size_t size;
+} xfCliprdrData;
+
+typedef struct
+{
+	UINT32 formatId; /* id in the format list of the generation */
+	Atom target;     /* None for the data in formatId, else converted for the target */
+	xfCliprdrData* data;
+} xfCliprdrCacheEntry;
+
+typedef struct
+{
+	UINT32 formatId; /* id in the format list of the generation */
+	size_t mapping;
+} xfCliprdrFormat;
+
+typedef enum
+{
+	XF_CLIPRDR_WAIT_NONE,  /* answered, possibly with a refusal */
+	XF_CLIPRDR_WAIT_DATA,  /* the format's data must be requested first */
+	XF_CLIPRDR_WAIT_FILES, /* the files are being copied */
+} xfCliprdrWait;
+
+typedef struct
+{
+	Window requestor;
+	Atom selection;
+	Atom target;
+	Atom property;
+	Time time;
+	UINT32 formatId;
+	size_t mapping;
+	xfCliprdrWait wait;
+} xfCliprdrRequest;
+
+typedef struct
+{
+	Window requestor;
+	Atom property;
+	Atom type;
+	xfCliprdrData* data;
+	size_t offset;
+	UINT64 lastActivity;
+} xfCliprdrTransfer;
+
+struct xf_clipboard
+{
+	clientContext* clicon;
+	CliprdrClientContext* context;
+	wClipboard* system;
+
+	/* everything below, taken before the display lock */
+	CRITICAL_SECTION lock;
+
+	Window window;
+	Atom clipboardAtom;
+	Atom targetsAtom;
+	Atom incrAtom;
+	Atom dataProperty;
+	Atom targetsProperty;
+	Atom targets[XF_CLIPRDR_MAPPINGS];
+	UINT32 mimeIds[XF_CLIPRDR_MAPPINGS];   /* wClipboard id of the mapping's mime */
+	UINT32 formatIds[XF_CLIPRDR_MAPPINGS]; /* wClipboard id of the mapping's clipboard format */
+	int xfixesEventBase;
+	BOOL xfixes;
+	size_t incrThreshold;
+	size_t incrChunkSize;
+
+	/* a generation starts with every change of clipboard owner */
+	UINT32 generation;
+	BOOL remote; /* the server owns the clipboard, formats are its format list */
+	BOOL owner;  /* the client window owns CLIPBOARD for the server */
+	xfCliprdrFormat formats[XF_CLIPRDR_MAPPINGS];
+	size_t numFormats;
+	xfCliprdrCacheEntry cache[XF_CLIPRDR_MAX_CACHE];
+	size_t cacheCount;
+
+	/* remote to local: selection requests waiting for a data response */
+	xfCliprdrRequest requests[XF_CLIPRDR_MAX_REQUESTS];
+	size_t numRequests;
+	BOOL dataRequested;
+	UINT32 requestedFormatId;
+	UINT32 requestedGeneration;
+	xfCliprdrTransfer transfers[XF_CLIPRDR_MAX_TRANSFERS];
+	size_t numTransfers;
+	char* fileDirectory; /* NULL if files are not copied */
+	xfCliprdrFiles* files;
+
+	/* local to remote: the TARGETS query and the conversion for the server's request */
+	BOOL targetsPending;
+	Time targetsTime; /* tells the answer for the current owner from earlier ones */
+	BOOL localPending;
+	BOOL localIncr;
+	UINT32 localGeneration;
+	UINT32 localFormatId;
+	size_t localMapping;
+	BYTE* localBuffer;
+	size_t localSize;
+	size_t localCapacity;
+};
+
+static xfCliprdrData* xf_cliprdr_data_new(BYTE* data, size_t size)
+{
+	xfCliprdrData* entry = calloc(1, sizeof(xfCliprdrData));
+	if (!entry)
+	{
+		free(data);
+		return NULL;
+	}
+
+	entry->refs = 1;
+	entry->data = data;
+	entry->size = size;
+	return entry;
+}
+
+static void xf_cliprdr_data_release(xfCliprdrData* data)
+{
+	if (!data)
+		return;
+
+	if (InterlockedDecrement(&data->refs) == 0)
+	{
+		free(data->data);
+		free(data);
+	}
+}
+
+static xfCliprdrData* xf_cliprdr_cache_find(xfClipboard* clipboard, UINT32 formatId, Atom target)
+{
+	for (size_t x = 0; x < clipboard->cacheCount; x++)
+	{
+		const xfCliprdrCacheEntry* entry = &clipboard->cache[x];
+		if ((entry->formatId == formatId) && (entry->target == target))
+			return entry->data;
+	}
+	return NULL;
+}
+
+/* Takes the caller's reference, the data stays valid until the generation ends */
+static xfCliprdrData* xf_cliprdr_cache_add(xfClipboard* clipboard, UINT32 formatId, Atom target,
+                                           xfCliprdrData* data)
+{
+	if (!data)
+		return NULL;
+
+	if (clipboard->cacheCount >= ARRAYSIZE(clipboard->cache))
+	{
+		WLog_WARN(TAG, "conversion cache full");
+		xf_cliprdr_data_release(data);
+		return NULL;
+	}
+
+	xfCliprdrCacheEntry* entry = &clipboard->cache[clipboard->cacheCount++];
+	entry->formatId = formatId;
+	entry->target = target;
+	entry->data = data;
+	return data;
+}
+
+static void xf_cliprdr_cache_clear(xfClipboard* clipboard)
+{
+	for (size_t x = 0; x < clipboard->cacheCount; x++)
+		xf_cliprdr_data_release(clipboard->cache[x].data);
+	clipboard->cacheCount = 0;
+}
+
+static xfCliprdrData* xf_cliprdr_convert(xfClipboard* clipboard, UINT32 srcId,
+                                         const xfCliprdrData* src, UINT32 dstId, BOOL text)
+{
+	UINT32 size = 0;
+
+	if (src->size > UINT32_MAX)
+		return NULL;
+
+	ClipboardLock(clipboard->system);
+	BYTE* data = NULL;
+	if (ClipboardSetData(clipboard->system, srcId, src->data, (UINT32)src->size))
+		data = ClipboardGetData(clipboard->system, dstId, &size);
+	ClipboardEmpty(clipboard->system);
+	ClipboardUnlock(clipboard->system);
+
+	if (!data)
+	{
+		WLog_DBG(TAG, "no conversion from format %" PRIu32 " to %" PRIu32, srcId, dstId);
+		return NULL;
+	}
+
+	if (text)
+	{
+		while ((size > 0) && (data[size - 1] == '\0'))
+			size--;
+	}
+	return xf_cliprdr_data_new(data, size);
+}
+
+static const xfCliprdrFormat* xf_cliprdr_find_format(xfClipboard* clipboard, UINT32 formatId)
+{
+	for (size_t x = 0; x < clipboard->numFormats; x++)
+	{
+		if (clipboard->formats[x].formatId == formatId)
+			return &clipboard->formats[x];
+	}
+	return NULL;
+}
+
+static const xfCliprdrFormat* xf_cliprdr_find_target(xfClipboard* clipboard, Atom target)
+{
+	for (size_t x = 0; x < clipboard->numFormats; x++)
+	{
+		if (clipboard->targets[clipboard->formats[x].mapping] == target)
+			return &clipboard->formats[x];
+	}
+	return NULL;
+}
+
+static void xf_cliprdr_send_notify(xfClipboard* clipboard, const xfCliprdrRequest* request,
+                                   Atom property)
+{
+	clientContext* clicon = clipboard->clicon;
+	XSelectionEvent notify = { 0 };
+
+	notify.type = SelectionNotify;
+	notify.send_event = True;
+	notify.display = clicon->display;
+	notify.requestor = request->requestor;
+	notify.selection = request->selection;
+	notify.target = request->target;
+	notify.property = property;
+	notify.time = request->time;
+	LogDynAndXSendEvent(clicon->log, clicon->display, request->requestor, False, NoEventMask,
+	                    (XEvent*)&notify);
+}
+
+static BOOL xf_cliprdr_watching(xfClipboard* clipboard, Window requestor)
+{
+	for (size_t x = 0; x < clipboard->numTransfers; x++)
+	{
+		if (clipboard->transfers[x].requestor == requestor)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void xf_cliprdr_transfer_remove(xfClipboard* clipboard, size_t index, BOOL destroyed)
+{
+	xfCliprdrTransfer* transfer = &clipboard->transfers[index];
+	const Window requestor = transfer->requestor;
+
+	xf_cliprdr_data_release(transfer->data);
+	*transfer = clipboard->transfers[--clipboard->numTransfers];
+
+	if (!destroyed && !xf_cliprdr_watching(clipboard, requestor))
+		XSelectInput(clipboard->clicon->display, requestor, NoEventMask);
+}
+
+/* Writes the next chunk once the requestor deleted the previous one, zero bytes end it */
+static void xf_cliprdr_transfer_step(xfClipboard* clipboard, size_t index)
+{
+	clientContext* clicon = clipboard->clicon;
+	xfCliprdrTransfer* transfer = &clipboard->transfers[index];
+	const size_t chunk = MIN(clipboard->incrChunkSize, transfer->data->size - transfer->offset);
+
+	LogDynAndXChangeProperty(clicon->log, clicon->display, transfer->requestor,
+	                         transfer->property, transfer->type, 8, PropModeReplace,
+	                         transfer->data->data + transfer->offset, (int)chunk);
+	transfer->offset += chunk;
+	transfer->lastActivity = GetTickCount64();
+
+	if (chunk == 0)
+		xf_cliprdr_transfer_remove(clipboard, index, FALSE);
+}
+
+static void xf_cliprdr_deliver(xfClipboard* clipboard, const xfCliprdrRequest* request,
+                               xfCliprdrData* data)
+{
+	clientContext* clicon = clipboard->clicon;
+
+	if (!data)
+	{
+		xf_cliprdr_send_notify(clipboard, request, None);
+		return;
+	}
+
+	if (data->size <= clipboard->incrThreshold)
+	{
+		LogDynAndXChangeProperty(clicon->log, clicon->display, request->requestor,
+		                         request->property, request->target, 8, PropModeReplace,
+		                         data->data, (int)data->size);
+		xf_cliprdr_send_notify(clipboard, request, request->property);
+		return;
+	}
+
+	if (clipboard->numTransfers >= ARRAYSIZE(clipboard->transfers))
+	{
+		WLog_WARN(TAG, "too many INCR transfers, refusing the request");
+		xf_cliprdr_send_notify(clipboard, request, None);
+		return;
+	}
+
+	/* ICCCM INCR: the requestor deletes the property to ask for every chunk, all chunks are
+	 * written from the shared cache entry */
+	if (!xf_cliprdr_watching(clipboard, request->requestor))
+		XSelectInput(clicon->display, request->requestor,
+		             PropertyChangeMask | StructureNotifyMask);
+
+	xfCliprdrTransfer* transfer = &clipboard->transfers[clipboard->numTransfers++];
+	transfer->requestor = request->requestor;
+	transfer->property = request->property;
+	transfer->type = request->target;
+	transfer->data = data;
+	transfer->offset = 0;
+	transfer->lastActivity = GetTickCount64();
+	InterlockedIncrement(&data->refs);
+
+	const long length = (long)MIN(data->size, (size_t)LONG_MAX);
+	LogDynAndXChangeProperty(clicon->log, clicon->display, request->requestor, request->property,
+	                         clipboard->incrAtom, 32, PropModeReplace, (const BYTE*)&length, 1);
+	xf_cliprdr_send_notify(clipboard, request, request->property);
+}
+
+static void xf_cliprdr_refuse_requests(xfClipboard* clipboard)
+{
+	for (size_t x = 0; x < clipboard->numRequests; x++)
+		xf_cliprdr_send_notify(clipboard, &clipboard->requests[x], None);
+	clipboard->numRequests = 0;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_files_request(void* custom, const CLIPRDR_FILE_CONTENTS_REQUEST* request)
+{
+	xfClipboard* clipboard = custom;
+	WINPR_ASSERT(clipboard);
+
+	if (!clipboard->context)
+		return ERROR_INVALID_STATE;
+	return clipboard->context->ClientFileContentsRequest(clipboard->context, request);
+}
+
+/* The file list of a finished copy, the copy is started by the first request for it */
+static xfCliprdrData* xf_cliprdr_remote_files(xfClipboard* clipboard, const xfCliprdrData* raw,
+                                              size_t mapping, xfCliprdrWait* wait)
+{
+	if (!clipboard->fileDirectory)
+		return NULL;
+
+	if (!clipboard->files)
+	{
+		clipboard->files = xf_cliprdr_files_new(clipboard->fileDirectory, raw->data, raw->size,
+		                                         xf_cliprdr_files_request, clipboard);
+		if (!clipboard->files)
+			return NULL;
+
+		if (xf_cliprdr_files_start(clipboard->files) != CHANNEL_RC_OK)
+			WLog_ERR(TAG, "failed to request the file contents");
+	}
+
+	switch (xf_cliprdr_files_state(clipboard->files))
+	{
+		case XF_CLIPRDR_FILES_RUNNING:
+			*wait = XF_CLIPRDR_WAIT_FILES;
+			return NULL;
+
+		case XF_CLIPRDR_FILES_DONE:
+			break;
+
+		case XF_CLIPRDR_FILES_FAILED:
+		default:
+			return NULL;
+	}
+
+	const BOOL gnome = (strcmp(xf_cliprdr_mappings[mapping].target,
+	                           "x-special/gnome-copied-files") == 0);
+	size_t length = 0;
+	char* list = xf_cliprdr_files_uri_list(clipboard->files, gnome, &length);
+	if (!list)
+		return NULL;
+	return xf_cliprdr_data_new((BYTE*)list, length);
+}
+
+/* The server's data for a target, converted from the cached format data. Sets *wait if the
+ * request cannot be answered yet. */
+static xfCliprdrData* xf_cliprdr_remote_data(xfClipboard* clipboard, UINT32 formatId,
+                                             size_t mapping, xfCliprdrWait* wait)
+{
+	const Atom target = clipboard->targets[mapping];
+
+	*wait = XF_CLIPRDR_WAIT_NONE;
+	xfCliprdrData* data = xf_cliprdr_cache_find(clipboard, formatId, target);
+	if (data)
+		return data;
+
+	const xfCliprdrData* raw = xf_cliprdr_cache_find(clipboard, formatId, None);
+	if (!raw)
+	{
+		*wait = XF_CLIPRDR_WAIT_DATA;
+		return NULL;
+	}
+
+	if (xf_cliprdr_mappings[mapping].files)
+		data = xf_cliprdr_remote_files(clipboard, raw, mapping, wait);
+	else
+		data = xf_cliprdr_convert(clipboard, clipboard->formatIds[mapping], raw,
+		                          clipboard->mimeIds[mapping], xf_cliprdr_mappings[mapping].text);
+	return xf_cliprdr_cache_add(clipboard, formatId, target, data);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_send_data_request(xfClipboard* clipboard, UINT32 formatId)
+{
+	CLIPRDR_FORMAT_DATA_REQUEST request = { 0 };
+
+	if (!clipboard->context)
+		return ERROR_INVALID_STATE;
+
+	request.common.msgType = CB_FORMAT_DATA_REQUEST;
+	request.requestedFormatId = formatId;
+	clipboard->dataRequested = TRUE;
+	clipboard->requestedFormatId = formatId;
+	clipboard->requestedGeneration = clipboard->generation;
+
+	const UINT rc = clipboard->context->ClientFormatDataRequest(clipboard->context, &request);
+	if (rc != CHANNEL_RC_OK)
+		clipboard->dataRequested = FALSE;
+	return rc;
+}
+
+/* Answers the queued requests that can be answered by now and asks the server for the data the
+ * first of the others waits for. Must hold the display lock when not called from the event
+ * thread. */
+static void xf_cliprdr_serve_requests(xfClipboard* clipboard)
+{
+	size_t kept = 0;
+	for (size_t x = 0; x < clipboard->numRequests; x++)
+	{
+		xfCliprdrRequest* request = &clipboard->requests[x];
+		xfCliprdrData* data =
+		    xf_cliprdr_remote_data(clipboard, request->formatId, request->mapping, &request->wait);
+
+		if (request->wait == XF_CLIPRDR_WAIT_NONE)
+			xf_cliprdr_deliver(clipboard, request, data);
+		else
+			clipboard->requests[kept++] = *request;
+	}
+	clipboard->numRequests = kept;
+
+	if (clipboard->dataRequested)
+		return;
+
+	for (size_t x = 0; x < clipboard->numRequests; x++)
+	{
+		if (clipboard->requests[x].wait != XF_CLIPRDR_WAIT_DATA)
+			continue;
+
+		if (xf_cliprdr_send_data_request(clipboard, clipboard->requests[x].formatId) !=
+		    CHANNEL_RC_OK)
+			xf_cliprdr_refuse_requests(clipboard);
+		break;
+	}
+}
+
+/* Refuses the queued requests for formatId, the server could not provide it */
+static void xf_cliprdr_refuse_format(xfClipboard* clipboard, UINT32 formatId)
+{
+	size_t kept = 0;
+	for (size_t x = 0; x < clipboard->numRequests; x++)
+	{
+		const xfCliprdrRequest* request = &clipboard->requests[x];
+		if (request->formatId == formatId)
+			xf_cliprdr_send_notify(clipboard, request, None);
+		else
+			clipboard->requests[kept++] = *request;
+	}
+	clipboard->numRequests = kept;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_send_data_response(xfClipboard* clipboard, const xfCliprdrData* data)
+{
+	CLIPRDR_FORMAT_DATA_RESPONSE response = { 0 };
+
+	if (!clipboard->context)
+		return ERROR_INVALID_STATE;
+
+	response.common.msgType = CB_FORMAT_DATA_RESPONSE;
+	response.common.msgFlags = CB_RESPONSE_FAIL;
+	if (data && (data->size <= UINT32_MAX))
+	{
+		response.common.msgFlags = CB_RESPONSE_OK;
+		response.common.dataLen = (UINT32)data->size;
+		response.requestedFormatData = data->data;
+	}
+
+	return clipboard->context->ClientFormatDataResponse(clipboard->context, &response);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_send_format_list(xfClipboard* clipboard)
+{
+	CLIPRDR_FORMAT formats[XF_CLIPRDR_MAPPINGS] = { 0 };
+	CLIPRDR_FORMAT_LIST formatList = { 0 };
+
+	if (!clipboard->context)
+		return ERROR_INVALID_STATE;
+
+	for (size_t x = 0; x < clipboard->numFormats; x++)
+	{
+		const xfCliprdrMapping* mapping = &xf_cliprdr_mappings[clipboard->formats[x].mapping];
+		formats[x].formatId = clipboard->formats[x].formatId;
+		formats[x].formatName = (char*)mapping->formatName;
+	}
+
+	formatList.common.msgType = CB_FORMAT_LIST;
+	formatList.numFormats = (UINT32)clipboard->numFormats;
+	formatList.formats = formats;
+	return clipboard->context->ClientFormatList(clipboard->context, &formatList);
+}
+
+static void xf_cliprdr_local_reset(xfClipboard* clipboard)
+{
+	free(clipboard->localBuffer);
+	clipboard->localBuffer = NULL;
+	clipboard->localSize = 0;
+	clipboard->localCapacity = 0;
+	clipboard->localPending = FALSE;
+	clipboard->localIncr = FALSE;
+}
+
+/* Must hold the display lock when not called from the event thread */
+static void xf_cliprdr_new_generation(xfClipboard* clipboard, BOOL remote)
+{
+	clipboard->generation++;
+	clipboard->remote = remote;
+	clipboard->numFormats = 0;
+	clipboard->targetsPending = FALSE;
+	xf_cliprdr_cache_clear(clipboard);
+	xf_cliprdr_refuse_requests(clipboard);
+
+	/* cancels a running copy, a finished one was pasted by now */
+	xf_cliprdr_files_free(clipboard->files);
+	clipboard->files = NULL;
+
+	/* the server asked for data of the previous owner */
+	if (clipboard->localPending)
+	{
+		(void)xf_cliprdr_send_data_response(clipboard, NULL);
+		xf_cliprdr_local_reset(clipboard);
+	}
+}
+
+/* A local application took CLIPBOARD, only its TARGETS are fetched for the format list */
+static void xf_cliprdr_local_owner(xfClipboard* clipboard, Window owner, Time time)
+{
+	clientContext* clicon = clipboard->clicon;
+
+	xf_cliprdr_new_generation(clipboard, FALSE);
+	clipboard->owner = FALSE;
+
+	if (owner == None)
+	{
+		(void)xf_cliprdr_send_format_list(clipboard);
+		return;
+	}
+
+	clipboard->targetsPending = TRUE;
+	clipboard->targetsTime = time;
+	LogDynAndXConvertSelection(clicon->log, clicon->display, clipboard->clipboardAtom,
+	                           clipboard->targetsAtom, clipboard->targetsProperty,
+	                           clipboard->window, time);
+}
+
+static BOOL xf_cliprdr_read_property(xfClipboard* clipboard, Atom property, Atom* type,
+                                     int* format, BYTE** data, unsigned long* nitems)
+{
+	clientContext* clicon = clipboard->clicon;
+	unsigned long after = 0;
+
+	*data = NULL;
+	const int status = LogDynAndXGetWindowProperty(
+	    clicon->log, clicon->display, clipboard->window, property, 0,
+	    XF_CLIPRDR_MAX_LOCAL_SIZE / 4, True, AnyPropertyType, type, format, nitems, &after, data);
+	if (status != Success)
+		return FALSE;
+
+	if (after > 0)
+	{
+		WLog_WARN(TAG, "selection data exceeds %d bytes", XF_CLIPRDR_MAX_LOCAL_SIZE);
+		XFree(*data);
+		*data = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void xf_cliprdr_handle_targets(xfClipboard* clipboard, const XSelectionEvent* xevent)
+{
+	Atom type = None;
+	int format = 0;
+	BYTE* data = NULL;
+	unsigned long nitems = 0;
+
+	clipboard->targetsPending = FALSE;
+	clipboard->numFormats = 0;
+
+	if ((xevent->property != None) &&
+	    xf_cliprdr_read_property(clipboard, xevent->property, &type, &format, &data, &nitems) &&
+	    (type == XA_ATOM) && (format == 32))
+	{
+		const Atom* atoms = (const Atom*)data;
+
+		for (size_t x = 0; x < XF_CLIPRDR_MAPPINGS; x++)
+		{
+			/* one target per clipboard format, the first one has precedence. Local files are
+			 * not offered to the server. */
+			if (xf_cliprdr_mappings[x].files ||
+			    xf_cliprdr_find_format(clipboard, clipboard->formatIds[x]))
+				continue;
+
+			for (unsigned long y = 0; y < nitems; y++)
+			{
+				if (atoms[y] != clipboard->targets[x])
+					continue;
+
+				xfCliprdrFormat* entry = &clipboard->formats[clipboard->numFormats++];
+				entry->formatId = clipboard->formatIds[x];
+				entry->mapping = x;
+				break;
+			}
+		}
+	}
+
+	if (data)
+		XFree(data);
+
+	WLog_DBG(TAG, "local clipboard offers %" PRIuz " formats", clipboard->numFormats);
+	(void)xf_cliprdr_send_format_list(clipboard);
+}
+
+static void xf_cliprdr_local_complete(xfClipboard* clipboard, BOOL success)
+{
+	xfCliprdrData* data = NULL;
+
+	if (success && (clipboard->localGeneration == clipboard->generation))
+	{
+		const size_t mapping = clipboard->localMapping;
+		xfCliprdrData* raw = xf_cliprdr_data_new(clipboard->localBuffer, clipboard->localSize);
+		clipboard->localBuffer = NULL;
+
+		if (raw)
+		{
+			data = xf_cliprdr_convert(clipboard, clipboard->mimeIds[mapping], raw,
+			                          clipboard->formatIds[mapping], FALSE);
+			xf_cliprdr_data_release(raw);
+			data = xf_cliprdr_cache_add(clipboard, clipboard->localFormatId, None, data);
+		}
+	}
+
+	(void)xf_cliprdr_send_data_response(clipboard, data);
+	xf_cliprdr_local_reset(clipboard);
+}
+
+static BOOL xf_cliprdr_local_append(xfClipboard* clipboard, const BYTE* data, size_t size)
+{
+	if (size > XF_CLIPRDR_MAX_LOCAL_SIZE - clipboard->localSize)
+	{
+		WLog_WARN(TAG, "selection data exceeds %d bytes", XF_CLIPRDR_MAX_LOCAL_SIZE);
+		return FALSE;
+	}
+
+	if (clipboard->localSize + size > clipboard->localCapacity)
+	{
+		const size_t capacity =
+		    MIN(MAX(clipboard->localCapacity * 2, clipboard->localSize + size),
+		        (size_t)XF_CLIPRDR_MAX_LOCAL_SIZE);
+		BYTE* buffer = realloc(clipboard->localBuffer, capacity);
+		if (!buffer)
+			return FALSE;
+
+		clipboard->localBuffer = buffer;
+		clipboard->localCapacity = capacity;
+	}
+
+	if (size > 0)
+		memcpy(clipboard->localBuffer + clipboard->localSize, data, size);
+	clipboard->localSize += size;
+	return TRUE;
+}
+
+static void xf_cliprdr_handle_local_data(xfClipboard* clipboard, const XSelectionEvent* xevent)
+{
+	Atom type = None;
+	int format = 0;
+	BYTE* data = NULL;
+	unsigned long nitems = 0;
+
+	if ((xevent->property == None) ||
+	    !xf_cliprdr_read_property(clipboard, xevent->property, &type, &format, &data, &nitems))
+	{
+		xf_cliprdr_local_complete(clipboard, FALSE);
+		return;
+	}
+
+	if (type == clipboard->incrAtom)
+	{
+		/* reading deleted the property, the owner now writes the chunks one by one */
+		clipboard->localIncr = TRUE;
+	}
+	else
+	{
+		const BOOL rc = (format == 8) && xf_cliprdr_local_append(clipboard, data, nitems);
+		xf_cliprdr_local_complete(clipboard, rc);
+	}
+
+	if (data)
+		XFree(data);
+}
+
+static void xf_cliprdr_handle_local_chunk(xfClipboard* clipboard)
+{
+	Atom type = None;
+	int format = 0;
+	BYTE* data = NULL;
+	unsigned long nitems = 0;
+
+	if (!xf_cliprdr_read_property(clipboard, clipboard->dataProperty, &type, &format, &data,
+	                              &nitems))
+	{
+		xf_cliprdr_local_complete(clipboard, FALSE);
+		return;
+	}
+
+	if (nitems == 0)
+		xf_cliprdr_local_complete(clipboard, TRUE);
+	else if ((format != 8) || !xf_cliprdr_local_append(clipboard, data, nitems))
+		xf_cliprdr_local_complete(clipboard, FALSE);
+
+	if (data)
+		XFree(data);
+}
+
+static void xf_cliprdr_handle_selection_request(xfClipboard* clipboard,
+                                                const XSelectionRequestEvent* xevent)
+{
+	clientContext* clicon = clipboard->clicon;
+	xfCliprdrRequest request = { 0 };
+
+	request.requestor = xevent->requestor;
+	request.selection = xevent->selection;
+	request.target = xevent->target;
+	request.property = (xevent->property != None) ? xevent->property : xevent->target;
+	request.time = xevent->time;
+
+	if (!clipboard->owner || !clipboard->remote || (xevent->selection != clipboard->clipboardAtom))
+	{
+		xf_cliprdr_send_notify(clipboard, &request, None);
+		return;
+	}
+
+	if (xevent->target == clipboard->targetsAtom)
+	{
+		Atom atoms[XF_CLIPRDR_MAPPINGS + 1] = { 0 };
+		int count = 0;
+
+		atoms[count++] = clipboard->targetsAtom;
+		for (size_t x = 0; x < clipboard->numFormats; x++)
+			atoms[count++] = clipboard->targets[clipboard->formats[x].mapping];
+
+		LogDynAndXChangeProperty(clicon->log, clicon->display, request.requestor,
+		                         request.property, XA_ATOM, 32, PropModeReplace,
+		                         (const BYTE*)atoms, count);
+		xf_cliprdr_send_notify(clipboard, &request, request.property);
+		return;
+	}
+
+	const xfCliprdrFormat* format = xf_cliprdr_find_target(clipboard, xevent->target);
+	if (!format)
+	{
+		xf_cliprdr_send_notify(clipboard, &request, None);
+		return;
+	}
+
+	request.formatId = format->formatId;
+	request.mapping = format->mapping;
+
+	xfCliprdrData* data = xf_cliprdr_remote_data(clipboard, format->formatId, format->mapping,
+	                                             &request.wait);
+	if (request.wait == XF_CLIPRDR_WAIT_NONE)
+	{
+		xf_cliprdr_deliver(clipboard, &request, data);
+		return;
+	}
+
+	/* first paste of the format in this generation, or its files are still being copied */
+	if (clipboard->numRequests >= ARRAYSIZE(clipboard->requests))
+	{
+		WLog_WARN(TAG, "too many pending selection requests");
+		xf_cliprdr_send_notify(clipboard, &request, None);
+		return;
+	}
+
+	clipboard->requests[clipboard->numRequests++] = request;
+	xf_cliprdr_serve_requests(clipboard);
+}
+
+static void xf_cliprdr_handle_selection_notify(xfClipboard* clipboard,
+                                               const XSelectionEvent* xevent)
+{
+	if ((xevent->requestor != clipboard->window) ||
+	    (xevent->selection != clipboard->clipboardAtom))
+		return;
+
+	if (xevent->target == clipboard->targetsAtom)
+	{
+		if (clipboard->targetsPending && !clipboard->remote &&
+		    (xevent->time == clipboard->targetsTime))
+			xf_cliprdr_handle_targets(clipboard, xevent);
+	}
+	else if (clipboard->localPending && !clipboard->localIncr &&
+	         (xevent->target == clipboard->targets[clipboard->localMapping]))
+		xf_cliprdr_handle_local_data(clipboard, xevent);
+}
+
+static void xf_cliprdr_handle_property_notify(xfClipboard* clipboard, const XPropertyEvent* xevent)
+{
+	if (xevent->state == PropertyDelete)
+	{
+		for (size_t x = 0; x < clipboard->numTransfers; x++)
+		{
+			const xfCliprdrTransfer* transfer = &clipboard->transfers[x];
+			if ((transfer->requestor == xevent->window) && (transfer->property == xevent->atom))
+			{
+				xf_cliprdr_transfer_step(clipboard, x);
+				break;
+			}
+		}
+	}
+	else if ((xevent->window == clipboard->window) && (xevent->atom == clipboard->dataProperty) &&
+	         clipboard->localPending && clipboard->localIncr)
+		xf_cliprdr_handle_local_chunk(clipboard);
+}
+
+static void xf_cliprdr_handle_destroy_notify(xfClipboard* clipboard,
+                                             const XDestroyWindowEvent* xevent)
+{
+	for (size_t x = clipboard->numTransfers; x > 0; x--)
+	{
+		if (clipboard->transfers[x - 1].requestor == xevent->window)
+			xf_cliprdr_transfer_remove(clipboard, x - 1, TRUE);
+	}
+}
+
+static void xf_cliprdr_handle_owner_change(xfClipboard* clipboard,
+                                           const XFixesSelectionNotifyEvent* xevent)
+{
+	if ((xevent->selection != clipboard->clipboardAtom) || (xevent->owner == clipboard->window))
+		return;
+
+	/* the server's clipboard was emptied and the window gave up the selection */
+	if ((xevent->owner == None) && clipboard->remote)
+		return;
+
+	xf_cliprdr_local_owner(clipboard, xevent->owner, xevent->selection_timestamp);
+}
+
+static void xf_cliprdr_expire_transfers(xfClipboard* clipboard)
+{
+	const UINT64 now = GetTickCount64();
+
+	for (size_t x = clipboard->numTransfers; x > 0; x--)
+	{
+		if (now - clipboard->transfers[x - 1].lastActivity > XF_CLIPRDR_INCR_TIMEOUT_MS)
+		{
+			WLog_WARN(TAG, "INCR requestor stopped reading, transfer dropped");
+			xf_cliprdr_transfer_remove(clipboard, x - 1, FALSE);
+		}
+	}
+}
+
+BOOL xf_cliprdr_handle_xevent(xfClipboard* clipboard, const XEvent* event)
+{
+	BOOL handled = TRUE;
+
+	if (!clipboard)
+		return FALSE;
+
+	WINPR_ASSERT(event);
+
+	EnterCriticalSection(&clipboard->lock);
+	xf_cliprdr_expire_transfers(clipboard);
+
+	switch (event->type)
+	{
+		case SelectionRequest:
+			xf_cliprdr_handle_selection_request(clipboard, &event->xselectionrequest);
+			break;
+
+		case SelectionNotify:
+			xf_cliprdr_handle_selection_notify(clipboard, &event->xselection);
+			break;
+
+		case SelectionClear:
+			if ((event->xselectionclear.window == clipboard->window) &&
+			    (event->xselectionclear.selection == clipboard->clipboardAtom))
+			{
+				clipboard->owner = FALSE;
+				xf_cliprdr_refuse_requests(clipboard);
+			}
+			break;
+
+		case PropertyNotify:
+			xf_cliprdr_handle_property_notify(clipboard, &event->xproperty);
+			break;
+
+		case DestroyNotify:
+			xf_cliprdr_handle_destroy_notify(clipboard, &event->xdestroywindow);
+			break;
+
+		default:
+			handled = clipboard->xfixes &&
+			          (event->type == clipboard->xfixesEventBase + XFixesSelectionNotify);
+			if (handled)
+				xf_cliprdr_handle_owner_change(clipboard,
+				                               (const XFixesSelectionNotifyEvent*)event);
+			break;
+	}
+
+	LeaveCriticalSection(&clipboard->lock);
+
+	if (handled)
+		xf_flush_mark_dirty(clipboard->clicon);
+	return handled;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_send_client_capabilities(xfClipboard* clipboard)
+{
+	CLIPRDR_CAPABILITIES capabilities = { 0 };
+	CLIPRDR_GENERAL_CAPABILITY_SET generalCapabilitySet = { 0 };
+
+	capabilities.common.msgType = CB_CLIP_CAPS;
+	capabilities.cCapabilitiesSets = 1;
+	capabilities.capabilitySets = (CLIPRDR_CAPABILITY_SET*)&generalCapabilitySet;
+	generalCapabilitySet.capabilitySetType = CB_CAPSTYPE_GENERAL;
+	generalCapabilitySet.capabilitySetLength = 12;
+	generalCapabilitySet.version = CB_CAPS_VERSION_2;
+	generalCapabilitySet.generalFlags = CB_USE_LONG_FORMAT_NAMES;
+	if (clipboard->fileDirectory)
+		generalCapabilitySet.generalFlags |=
+		    CB_STREAM_FILECLIP_ENABLED | CB_FILECLIP_NO_FILE_PATHS | CB_HUGE_FILE_SUPPORT_ENABLED;
+	return clipboard->context->ClientCapabilities(clipboard->context, &capabilities);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_monitor_ready(CliprdrClientContext* context,
+                                     WINPR_ATTR_UNUSED const CLIPRDR_MONITOR_READY* monitorReady)
+{
+	WINPR_ASSERT(context);
+
+	xfClipboard* clipboard = context->custom;
+	WINPR_ASSERT(clipboard);
+
+	clientContext* clicon = clipboard->clicon;
+	UINT rc = xf_cliprdr_send_client_capabilities(clipboard);
+	if (rc != CHANNEL_RC_OK)
+		return rc;
+
+	/* announce what a local application put on the clipboard before the channel was up */
+	EnterCriticalSection(&clipboard->lock);
+	XLockDisplay(clicon->display);
+	const Window owner =
+	    LogDynAndXGetSelectionOwner(clicon->log, clicon->display, clipboard->clipboardAtom);
+	xf_cliprdr_local_owner(clipboard, (owner != clipboard->window) ? owner : None, CurrentTime);
+	(void)xf_flush_now(clicon);
+	XUnlockDisplay(clicon->display);
+	LeaveCriticalSection(&clipboard->lock);
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_server_capabilities(WINPR_ATTR_UNUSED CliprdrClientContext* context,
+                                           WINPR_ATTR_UNUSED const CLIPRDR_CAPABILITIES* caps)
+{
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * Only the format list is kept, no data is fetched until a local application pastes.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_server_format_list(CliprdrClientContext* context,
+                                          const CLIPRDR_FORMAT_LIST* formatList)
+{
+	CLIPRDR_FORMAT_LIST_RESPONSE response = { 0 };
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(formatList);
+
+	xfClipboard* clipboard = context->custom;
+	WINPR_ASSERT(clipboard);
+
+	clientContext* clicon = clipboard->clicon;
+	EnterCriticalSection(&clipboard->lock);
+	XLockDisplay(clicon->display);
+
+	xf_cliprdr_new_generation(clipboard, TRUE);
+	for (size_t x = 0; x < XF_CLIPRDR_MAPPINGS; x++)
+	{
+		const xfCliprdrMapping* mapping = &xf_cliprdr_mappings[x];
+		if (mapping->files && !clipboard->fileDirectory)
+			continue;
+
+		for (UINT32 y = 0; y < formatList->numFormats; y++)
+		{
+			const CLIPRDR_FORMAT* format = &formatList->formats[y];
+			const BOOL match = mapping->formatName
+			                       ? (format->formatName &&
+			                          (strcmp(format->formatName, mapping->formatName) == 0))
+			                       : (format->formatId == mapping->formatId);
+			if (!match)
+				continue;
+
+			xfCliprdrFormat* entry = &clipboard->formats[clipboard->numFormats++];
+			entry->formatId = format->formatId;
+			entry->mapping = x;
+			break;
+		}
+	}
+
+	if (clipboard->numFormats > 0)
+	{
+		LogDynAndXSetSelectionOwner(clicon->log, clicon->display, clipboard->clipboardAtom,
+		                            clipboard->window, CurrentTime);
+		clipboard->owner = (LogDynAndXGetSelectionOwner(clicon->log, clicon->display,
+		                                                clipboard->clipboardAtom) ==
+		                    clipboard->window);
+		if (!clipboard->owner)
+			WLog_WARN(TAG, "failed to take ownership of CLIPBOARD");
+	}
+	else if (clipboard->owner)
+	{
+		LogDynAndXSetSelectionOwner(clicon->log, clicon->display, clipboard->clipboardAtom, None,
+		                            CurrentTime);
+		clipboard->owner = FALSE;
+	}
+
+	(void)xf_flush_now(clicon);
+	XUnlockDisplay(clicon->display);
+	WLog_DBG(TAG, "server offers %" PRIuz " of %" PRIu32 " formats", clipboard->numFormats,
+	         formatList->numFormats);
+	LeaveCriticalSection(&clipboard->lock);
+
+	response.common.msgType = CB_FORMAT_LIST_RESPONSE;
+	response.common.msgFlags = CB_RESPONSE_OK;
+	return context->ClientFormatListResponse(context, &response);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT
+xf_cliprdr_server_format_list_response(WINPR_ATTR_UNUSED CliprdrClientContext* context,
+                                       const CLIPRDR_FORMAT_LIST_RESPONSE* formatListResponse)
+{
+	WINPR_ASSERT(formatListResponse);
+
+	if (formatListResponse->common.msgFlags & CB_RESPONSE_FAIL)
+		WLog_WARN(TAG, "server rejected the format list");
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * The local selection is converted now, the answer is cached for the rest of the generation.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_server_format_data_request(CliprdrClientContext* context,
+                                                  const CLIPRDR_FORMAT_DATA_REQUEST* request)
+{
+	UINT rc = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(request);
+
+	xfClipboard* clipboard = context->custom;
+	WINPR_ASSERT(clipboard);
+
+	clientContext* clicon = clipboard->clicon;
+	EnterCriticalSection(&clipboard->lock);
+
+	const xfCliprdrFormat* format = xf_cliprdr_find_format(clipboard, request->requestedFormatId);
+	if (clipboard->remote || !format || clipboard->localPending)
+	{
+		rc = xf_cliprdr_send_data_response(clipboard, NULL);
+		goto out;
+	}
+
+	const xfCliprdrData* data = xf_cliprdr_cache_find(clipboard, format->formatId, None);
+	if (data)
+	{
+		rc = xf_cliprdr_send_data_response(clipboard, data);
+		goto out;
+	}
+
+	clipboard->localPending = TRUE;
+	clipboard->localIncr = FALSE;
+	clipboard->localGeneration = clipboard->generation;
+	clipboard->localFormatId = format->formatId;
+	clipboard->localMapping = format->mapping;
+
+	XLockDisplay(clicon->display);
+	LogDynAndXConvertSelection(clicon->log, clicon->display, clipboard->clipboardAtom,
+	                           clipboard->targets[format->mapping], clipboard->dataProperty,
+	                           clipboard->window, CurrentTime);
+	(void)xf_flush_now(clicon);
+	XUnlockDisplay(clicon->display);
+
+out:
+	LeaveCriticalSection(&clipboard->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ *
+ * Answers every selection request waiting for the format, then asks for the next format.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_server_format_data_response(CliprdrClientContext* context,
+                                                   const CLIPRDR_FORMAT_DATA_RESPONSE* response)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(response);
+
+	xfClipboard* clipboard = context->custom;
+	WINPR_ASSERT(clipboard);
+
+	clientContext* clicon = clipboard->clicon;
+	EnterCriticalSection(&clipboard->lock);
+	if (!clipboard->dataRequested)
+	{
+		LeaveCriticalSection(&clipboard->lock);
+		WLog_WARN(TAG, "unexpected format data response");
+		return CHANNEL_RC_OK;
+	}
+
+	const UINT32 formatId = clipboard->requestedFormatId;
+	const BOOL current = (clipboard->requestedGeneration == clipboard->generation);
+	clipboard->dataRequested = FALSE;
+
+	BOOL cached = FALSE;
+	if (current && (response->common.msgFlags & CB_RESPONSE_OK))
+	{
+		const size_t size = response->common.dataLen;
+		BYTE* copy = (size > 0) ? malloc(size) : NULL;
+		if (copy || (size == 0))
+		{
+			if (size > 0)
+				memcpy(copy, response->requestedFormatData, size);
+			cached = xf_cliprdr_cache_add(clipboard, formatId, None,
+			                              xf_cliprdr_data_new(copy, size)) != NULL;
+		}
+	}
+
+	XLockDisplay(clicon->display);
+
+	/* requests of an earlier generation were refused when it ended */
+	if (current && !cached)
+		xf_cliprdr_refuse_format(clipboard, formatId);
+	xf_cliprdr_serve_requests(clipboard);
+
+	(void)xf_flush_now(clicon);
+	XUnlockDisplay(clicon->display);
+	LeaveCriticalSection(&clipboard->lock);
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Function description
+ *
+ * The data is written to its file right here, the PDU is not kept.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT
+xf_cliprdr_server_file_contents_response(CliprdrClientContext* context,
+                                         const CLIPRDR_FILE_CONTENTS_RESPONSE* response)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(response);
+
+	xfClipboard* clipboard = context->custom;
+	WINPR_ASSERT(clipboard);
+
+	clientContext* clicon = clipboard->clicon;
+	EnterCriticalSection(&clipboard->lock);
+	if (clipboard->files &&
+	    (xf_cliprdr_files_response(clipboard->files, response) != XF_CLIPRDR_FILES_RUNNING))
+	{
+		/* the copy finished or failed, the requests waiting for it are answered */
+		XLockDisplay(clicon->display);
+		xf_cliprdr_serve_requests(clipboard);
+		(void)xf_flush_now(clicon);
+		XUnlockDisplay(clicon->display);
+	}
+	LeaveCriticalSection(&clipboard->lock);
+	return CHANNEL_RC_OK;
+}
+
+BOOL xf_cliprdr_init(xfClipboard* clipboard, CliprdrClientContext* cliprdr)
+{
+	WINPR_ASSERT(clipboard);
+	WINPR_ASSERT(cliprdr);
+
+	EnterCriticalSection(&clipboard->lock);
+	clipboard->context = cliprdr;
+	LeaveCriticalSection(&clipboard->lock);
+
+	cliprdr->custom = clipboard;
+	cliprdr->MonitorReady = xf_cliprdr_monitor_ready;
+	cliprdr->ServerCapabilities = xf_cliprdr_server_capabilities;
+	cliprdr->ServerFormatList = xf_cliprdr_server_format_list;
+	cliprdr->ServerFormatListResponse = xf_cliprdr_server_format_list_response;
+	cliprdr->ServerFormatDataRequest = xf_cliprdr_server_format_data_request;
+	cliprdr->ServerFormatDataResponse = xf_cliprdr_server_format_data_response;
+	cliprdr->ServerFileContentsResponse = xf_cliprdr_server_file_contents_response;
+	return TRUE;
+}
+
+void xf_cliprdr_uninit(xfClipboard* clipboard, CliprdrClientContext* cliprdr)
+{
+	WINPR_ASSERT(clipboard);
+	WINPR_ASSERT(cliprdr);
+
+	clientContext* clicon = clipboard->clicon;
+	EnterCriticalSection(&clipboard->lock);
+	clipboard->context = NULL;
+	clipboard->dataRequested = FALSE;
+	xf_cliprdr_local_reset(clipboard);
+	xf_cliprdr_files_free(clipboard->files);
+	clipboard->files = NULL;
+
+	XLockDisplay(clicon->display);
+	xf_cliprdr_refuse_requests(clipboard);
+	(void)xf_flush_now(clicon);
+	XUnlockDisplay(clicon->display);
+	LeaveCriticalSection(&clipboard->lock);
+
+	cliprdr->custom = NULL;
+}
+
+xfClipboard* xf_clipboard_new(clientContext* clicon)
+{
+	XSetWindowAttributes attributes = { 0 };
+	int xfixesErrorBase = 0;
+
+	WINPR_ASSERT(clicon);
+	if (!clicon->display)
+		return NULL;
+
+	xfClipboard* clipboard = calloc(1, sizeof(xfClipboard));
+	if (!clipboard)
+		return NULL;
+
+	clipboard->clicon = clicon;
+	if (!InitializeCriticalSectionAndSpinCount(&clipboard->lock, 4000))
+	{
+		free(clipboard);
+		return NULL;
+	}
+
+	clipboard->system = ClipboardCreate();
+	if (!clipboard->system)
+		goto fail;
+
+	Display* display = clicon->display;
+	clipboard->clipboardAtom = Logging_XInternAtom(clicon->log, display, "CLIPBOARD", False);
+	clipboard->targetsAtom = Logging_XInternAtom(clicon->log, display, "TARGETS", False);
+	clipboard->incrAtom = Logging_XInternAtom(clicon->log, display, "INCR", False);
+	clipboard->dataProperty = Logging_XInternAtom(clicon->log, display, "_FREERDP_CLIPRDR", False);
+	clipboard->targetsProperty =
+	    Logging_XInternAtom(clicon->log, display, "_FREERDP_CLIPRDR_TARGETS", False);
+
+	for (size_t x = 0; x < XF_CLIPRDR_MAPPINGS; x++)
+	{
+		const xfCliprdrMapping* mapping = &xf_cliprdr_mappings[x];
+
+		clipboard->targets[x] = Logging_XInternAtom(clicon->log, display, mapping->target, False);
+		clipboard->mimeIds[x] =
+		    mapping->mime ? ClipboardRegisterFormat(clipboard->system, mapping->mime) : 0;
+		clipboard->formatIds[x] = mapping->formatName
+		                              ? ClipboardRegisterFormat(clipboard->system,
+		                                                        mapping->formatName)
+		                              : mapping->formatId;
+		if ((mapping->mime && !clipboard->mimeIds[x]) || !clipboard->formatIds[x])
+			goto fail;
+	}
+
+	const UINT32 featureMask = freerdp_settings_get_uint32(clicon->common.context.settings,
+	                                                       FreeRDP_ClipboardFeatureMask);
+	if (featureMask & CLIPRDR_FLAG_REMOTE_TO_LOCAL_FILES)
+	{
+		const char* directory = getenv("XF_CLIPRDR_FILE_DIR");
+		clipboard->fileDirectory =
+		    directory ? _strdup(directory) : GetKnownPath(KNOWN_PATH_TEMP);
+		if (!clipboard->fileDirectory)
+			goto fail;
+	}
+
+	attributes.event_mask = PropertyChangeMask;
+	clipboard->window = LogDynAndXCreateWindow(
+	    clicon->log, display, RootWindowOfScreen(clicon->screen), 0, 0, 1, 1, 0, 0, InputOnly,
+	    CopyFromParent, CWEventMask, &attributes);
+	if (!clipboard->window)
+		goto fail;
+
+	if (XFixesQueryExtension(display, &clipboard->xfixesEventBase, &xfixesErrorBase))
+	{
+		XFixesSelectSelectionInput(display, clipboard->window, clipboard->clipboardAtom,
+		                           XFixesSetSelectionOwnerNotifyMask);
+		clipboard->xfixes = TRUE;
+	}
+	else
+		WLog_WARN(TAG, "XFixes not available, local clipboard changes are not forwarded");
+
+	/* a property must fit one request */
+	long maxRequest = XExtendedMaxRequestSize(display);
+	if (maxRequest == 0)
+		maxRequest = XMaxRequestSize(display);
+	const size_t maxBytes = ((size_t)maxRequest * 4) - 1024;
+	clipboard->incrThreshold = MIN(XF_CLIPRDR_INCR_THRESHOLD, maxBytes);
+	clipboard->incrChunkSize = MIN(XF_CLIPRDR_INCR_CHUNK_SIZE, maxBytes);
+	return clipboard;
+
+fail:
+	WLog_ERR(TAG, "failed to set up the clipboard");
+	xf_clipboard_free(clipboard);
+	return NULL;
+}
+
+void xf_clipboard_free(xfClipboard* clipboard)
+{
+	if (!clipboard)
+		return;
+
+	clientContext* clicon = clipboard->clicon;
+	while (clipboard->numTransfers > 0)
+		xf_cliprdr_transfer_remove(clipboard, clipboard->numTransfers - 1, FALSE);
+	xf_cliprdr_cache_clear(clipboard);
+	xf_cliprdr_local_reset(clipboard);
+	xf_cliprdr_files_free(clipboard->files);
+	free(clipboard->fileDirectory);
+
+	if (clipboard->window)
+		LogDynAndXDestroyWindow(clicon->log, clicon->display, clipboard->window);
+
+	ClipboardDestroy(clipboard->system);
+	DeleteCriticalSection(&clipboard->lock);
+	free(clipboard);
+}
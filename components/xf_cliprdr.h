@@ -0,0 +1,58 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 clipboard redirection
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_CLIPRDR_H
+#define FREERDP_CLIENT_X11_CLIPRDR_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/client/cliprdr.h>
+
+#include <X11/Xlib.h>
+
+typedef struct client_context clientContext;
+typedef struct xf_clipboard xfClipboard;
+
+/* Data above this size is handed to X clients with the INCR protocol */
+#define XF_CLIPRDR_INCR_THRESHOLD (256 * 1024)
+
+/* Bytes written to the requestor's property per INCR step */
+#define XF_CLIPRDR_INCR_CHUNK_SIZE (64 * 1024)
+
+/* Largest local selection read for the server, a data response carries it in one PDU */
+#define XF_CLIPRDR_MAX_LOCAL_SIZE (64 * 1024 * 1024)
+
+/*
+ * Both directions render lazily: a format list only advertises the formats, the data is fetched
+ * once an application on the other side pastes. Every change of clipboard owner starts a new
+ * generation. The data of a generation, as received and as converted for a target
+ * (UTF-16 <-> UTF-8, DIB <-> PNG / BMP, HTML), is cached until the next one, so repeated pastes
+ * and further targets of the same format do not go back to the peer.
+ *
+ * X events are handled on the thread that owns the display, the cliprdr callbacks come from the
+ * channel thread and take the display lock for their X requests.
+ */
+xfClipboard* xf_clipboard_new(clientContext* clicon);
+void xf_clipboard_free(xfClipboard* clipboard);
+
+BOOL xf_cliprdr_init(xfClipboard* clipboard, CliprdrClientContext* cliprdr);
+void xf_cliprdr_uninit(xfClipboard* clipboard, CliprdrClientContext* cliprdr);
+
+/* Returns TRUE if the event was for the clipboard */
+BOOL xf_cliprdr_handle_xevent(xfClipboard* clipboard, const XEvent* event);
+
+#endif /* FREERDP_CLIENT_X11_CLIPRDR_H */
@@ -0,0 +1,712 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 clipboard redirection - file copy from the server
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <winpr/assert.h>
+#include <winpr/endian.h>
+#include <winpr/interlocked.h>
+#include <winpr/shell.h>
+#include <winpr/string.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/channels/cliprdr.h>
+#include <freerdp/utils/cliprdr_utils.h>
+
+#include "xf_cliprdr_files.h"
+
+#define TAG CLIENT_TAG("x11.cliprdr")
+
+/* 100 ns intervals between 1601-01-01 and 1970-01-01 */
+#define XF_CLIPRDR_FILETIME_UNIX_OFFSET 116444736000000000ull
+
+typedef struct
+{
+	char* name; /* relative to the copy's directory, '/' separated */
+	char* path;
+	BOOL directory;
+	BOOL sizeKnown;
+	BOOL sizeRequested;
+	UINT64 size;
+	UINT64 issued;  /* bytes requested so far */
+	UINT64 written; /* bytes written so far */
+	UINT64 lastWriteTime;
+	BOOL hasWriteTime;
+	int fd;
+} xfCliprdrFile;
+
+typedef struct
+{
+	BOOL used;
+	UINT32 streamId;
+	size_t file;
+	BOOL sizeRequest;
+	UINT64 offset;
+	UINT32 length;
+} xfCliprdrFileRequest;
+
+struct xf_cliprdr_files
+{
+	pcXfCliprdrFilesRequest request;
+	void* custom;
+
+	char* directory;
+	xfCliprdrFile* files;
+	size_t count;
+	size_t cursor; /* files before it have every range requested */
+	size_t completed;
+
+	xfCliprdrFileRequest inflight[XF_CLIPRDR_FILES_MAX_INFLIGHT];
+	size_t numInflight;
+
+	XF_CLIPRDR_FILES_STATE state;
+	UINT64 bytes;
+	UINT64 start;
+};
+
+/* stream ids are unique per process, late responses of a cancelled copy never match */
+static volatile LONG xf_cliprdr_files_stream_id = 0;
+
+static BOOL xf_cliprdr_files_valid_name(char* name)
+{
+	if (!name || (*name == '\0'))
+		return FALSE;
+
+	for (char* cur = name; *cur; cur++)
+	{
+		if (*cur == '\\')
+			*cur = '/';
+		else if ((unsigned char)*cur < 0x20)
+			return FALSE;
+	}
+
+	/* every component must be a plain name, nothing may point outside the directory */
+	const char* component = name;
+	while (component)
+	{
+		const char* end = strchr(component, '/');
+		const size_t length = end ? (size_t)(end - component) : strlen(component);
+
+		if ((length == 0) || ((length == 1) && (component[0] == '.')) ||
+		    ((length == 2) && (component[0] == '.') && (component[1] == '.')))
+			return FALSE;
+
+		component = end ? end + 1 : NULL;
+	}
+	return TRUE;
+}
+
+/* Creates the parent directories of the entry, the descriptors usually list them anyway */
+static BOOL xf_cliprdr_files_make_parents(const char* path, size_t base)
+{
+	char* copy = _strdup(path);
+	if (!copy)
+		return FALSE;
+
+	BOOL rc = TRUE;
+	for (char* cur = copy + base + 1; *cur; cur++)
+	{
+		if (*cur != '/')
+			continue;
+
+		*cur = '\0';
+		if ((mkdir(copy, 0700) != 0) && (errno != EEXIST))
+			rc = FALSE;
+		*cur = '/';
+		if (!rc)
+			break;
+	}
+
+	free(copy);
+	return rc;
+}
+
+static void xf_cliprdr_files_close(xfCliprdrFile* file)
+{
+	if (file->fd < 0)
+		return;
+
+	if (file->hasWriteTime)
+	{
+		struct timespec times[2] = { { 0, UTIME_OMIT }, { 0, 0 } };
+		times[1].tv_sec = (time_t)(file->lastWriteTime / 10000000ull);
+		times[1].tv_nsec = (long)((file->lastWriteTime % 10000000ull) * 100ull);
+		(void)futimens(file->fd, times);
+	}
+
+	(void)close(file->fd);
+	file->fd = -1;
+}
+
+static BOOL xf_cliprdr_files_allocate(xfCliprdrFile* file)
+{
+	if (file->size > INT64_MAX)
+		return FALSE;
+
+	/* reserves the blocks now, a full disk fails the copy before any data is requested */
+	const int rc = posix_fallocate(file->fd, 0, (off_t)file->size);
+	if ((rc == 0) || (file->size == 0))
+		return TRUE;
+
+	if ((rc == EOPNOTSUPP) || (rc == EINVAL))
+		return ftruncate(file->fd, (off_t)file->size) == 0;
+
+	WLog_ERR(TAG, "failed to allocate %" PRIu64 " bytes for %s: %s", file->size, file->name,
+	         strerror(rc));
+	return FALSE;
+}
+
+static BOOL xf_cliprdr_files_make_directory(xfCliprdrFiles* files, xfCliprdrFile* file)
+{
+	if (!xf_cliprdr_files_make_parents(file->path, strlen(files->directory)))
+		return FALSE;
+	return (mkdir(file->path, 0700) == 0) || (errno == EEXIST);
+}
+
+/*
+ * Creates the file at its final size once the pump gets to it, so only the files being copied
+ * hold a descriptor and disk space is reserved one file at a time. The size is known by then.
+ */
+static BOOL xf_cliprdr_files_open(xfCliprdrFiles* files, xfCliprdrFile* file)
+{
+	WINPR_ASSERT(!file->directory);
+	WINPR_ASSERT(file->sizeKnown);
+	WINPR_ASSERT(file->fd < 0);
+
+	if (!xf_cliprdr_files_make_parents(file->path, strlen(files->directory)))
+		return FALSE;
+
+	file->fd = open(file->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (file->fd < 0)
+	{
+		WLog_ERR(TAG, "failed to create %s: %s", file->path, strerror(errno));
+		return FALSE;
+	}
+	return xf_cliprdr_files_allocate(file);
+}
+
+static BOOL xf_cliprdr_files_parse(xfCliprdrFiles* files, const BYTE* descriptors, size_t size)
+{
+	FILEDESCRIPTORW* array = NULL;
+	UINT32 count = 0;
+
+	if ((size > UINT32_MAX) ||
+	    (cliprdr_parse_file_list(descriptors, (UINT32)size, &array, &count) != CHANNEL_RC_OK))
+	{
+		WLog_ERR(TAG, "invalid FileGroupDescriptorW");
+		return FALSE;
+	}
+
+	BOOL rc = FALSE;
+	files->files = calloc(count, sizeof(xfCliprdrFile));
+	if (!files->files && (count > 0))
+		goto out;
+
+	for (UINT32 x = 0; x < count; x++)
+	{
+		const FILEDESCRIPTORW* descriptor = &array[x];
+		xfCliprdrFile* file = &files->files[files->count++];
+
+		file->fd = -1;
+		file->name = ConvertWCharNToUtf8Alloc(descriptor->cFileName,
+		                                      ARRAYSIZE(descriptor->cFileName), NULL);
+		if (!xf_cliprdr_files_valid_name(file->name))
+		{
+			WLog_ERR(TAG, "refusing file name %s", file->name ? file->name : "(invalid)");
+			goto out;
+		}
+
+		file->directory = (descriptor->dwFlags & FD_ATTRIBUTES) &&
+		                  (descriptor->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+		file->sizeKnown = file->directory || (descriptor->dwFlags & FD_FILESIZE);
+		if (file->sizeKnown && !file->directory)
+			file->size = ((UINT64)descriptor->nFileSizeHigh << 32) | descriptor->nFileSizeLow;
+
+		const UINT64 writeTime = ((UINT64)descriptor->ftLastWriteTime.dwHighDateTime << 32) |
+		                         descriptor->ftLastWriteTime.dwLowDateTime;
+		if ((descriptor->dwFlags & FD_WRITESTIME) &&
+		    (writeTime > XF_CLIPRDR_FILETIME_UNIX_OFFSET))
+		{
+			file->lastWriteTime = writeTime - XF_CLIPRDR_FILETIME_UNIX_OFFSET;
+			file->hasWriteTime = TRUE;
+		}
+
+		const size_t length = strlen(files->directory) + strlen(file->name) + 2;
+		file->path = malloc(length);
+		if (!file->path)
+			goto out;
+		(void)_snprintf(file->path, length, "%s/%s", files->directory, file->name);
+
+		if (file->directory && !xf_cliprdr_files_make_directory(files, file))
+			goto out;
+	}
+
+	rc = TRUE;
+out:
+	free(array);
+	return rc;
+}
+
+/* Removes the parents created for path that are empty by now */
+static void xf_cliprdr_files_remove_parents(xfCliprdrFiles* files, char* path)
+{
+	const size_t base = strlen(files->directory);
+
+	for (char* end = strrchr(path, '/'); end && ((size_t)(end - path) > base);
+	     end = strrchr(path, '/'))
+	{
+		*end = '\0';
+		if (rmdir(path) != 0)
+			break;
+	}
+}
+
+xfCliprdrFiles* xf_cliprdr_files_new(const char* base, const BYTE* descriptors, size_t size,
+                                     pcXfCliprdrFilesRequest request, void* custom)
+{
+	WINPR_ASSERT(base);
+	WINPR_ASSERT(request);
+
+	xfCliprdrFiles* files = calloc(1, sizeof(xfCliprdrFiles));
+	if (!files)
+		return NULL;
+
+	files->request = request;
+	files->custom = custom;
+	files->state = XF_CLIPRDR_FILES_RUNNING;
+
+	const size_t length = strlen(base) + 32;
+	files->directory = malloc(length);
+	if (!files->directory)
+		goto fail;
+
+	(void)_snprintf(files->directory, length, "%s/freerdp-clipboard-XXXXXX", base);
+	if (!mkdtemp(files->directory))
+	{
+		WLog_ERR(TAG, "failed to create a directory in %s: %s", base, strerror(errno));
+		free(files->directory);
+		files->directory = NULL;
+		goto fail;
+	}
+
+	if (!xf_cliprdr_files_parse(files, descriptors, size))
+		goto fail;
+
+	return files;
+
+fail:
+	xf_cliprdr_files_free(files);
+	return NULL;
+}
+
+void xf_cliprdr_files_free(xfCliprdrFiles* files)
+{
+	if (!files)
+		return;
+
+	if (files->state == XF_CLIPRDR_FILES_RUNNING)
+		WLog_INFO(TAG, "file copy cancelled after %" PRIu64 " bytes", files->bytes);
+
+	/* children before their parents */
+	for (size_t x = files->count; x > 0; x--)
+	{
+		xfCliprdrFile* file = &files->files[x - 1];
+
+		xf_cliprdr_files_close(file);
+		if (file->path)
+		{
+			if (file->directory)
+				(void)rmdir(file->path);
+			else
+				(void)unlink(file->path);
+			xf_cliprdr_files_remove_parents(files, file->path);
+		}
+		free(file->path);
+		free(file->name);
+	}
+
+	if (files->directory)
+		(void)rmdir(files->directory);
+
+	free(files->files);
+	free(files->directory);
+	free(files);
+}
+
+static void xf_cliprdr_files_fail(xfCliprdrFiles* files)
+{
+	files->state = XF_CLIPRDR_FILES_FAILED;
+	files->numInflight = 0;
+	for (size_t x = 0; x < ARRAYSIZE(files->inflight); x++)
+		files->inflight[x].used = FALSE;
+}
+
+static void xf_cliprdr_files_complete(xfCliprdrFiles* files, xfCliprdrFile* file)
+{
+	xf_cliprdr_files_close(file);
+	files->completed++;
+
+	if (files->completed < files->count)
+		return;
+
+	files->state = XF_CLIPRDR_FILES_DONE;
+
+	const UINT64 elapsed = winpr_GetTickCount64NS() - files->start;
+	const double seconds = (double)elapsed / 1000000000.0;
+	WLog_INFO(TAG, "copied %" PRIuz " files, %" PRIu64 " bytes in %.3f s (%.1f MB/s)",
+	          files->count, files->bytes, seconds,
+	          (seconds > 0) ? (double)files->bytes / seconds / 1000000.0 : 0.0);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_cliprdr_files_send(xfCliprdrFiles* files, xfCliprdrFileRequest* slot)
+{
+	CLIPRDR_FILE_CONTENTS_REQUEST request = { 0 };
+
+	slot->streamId = (UINT32)InterlockedIncrement(&xf_cliprdr_files_stream_id);
+	request.common.msgType = CB_FILECONTENTS_REQUEST;
+	request.streamId = slot->streamId;
+	request.listIndex = (UINT32)slot->file;
+	if (slot->sizeRequest)
+	{
+		request.dwFlags = FILECONTENTS_SIZE;
+		request.cbRequested = 8;
+	}
+	else
+	{
+		request.dwFlags = FILECONTENTS_RANGE;
+		request.nPositionLow = (UINT32)(slot->offset & UINT32_MAX);
+		request.nPositionHigh = (UINT32)(slot->offset >> 32);
+		request.cbRequested = slot->length;
+	}
+
+	return files->request(files->custom, &request);
+}
+
+/* Fills the free request slots, moving on to the next file once one is fully requested */
+static UINT xf_cliprdr_files_pump(xfCliprdrFiles* files)
+{
+	size_t index = files->cursor;
+
+	while ((files->numInflight < ARRAYSIZE(files->inflight)) && (index < files->count))
+	{
+		xfCliprdrFile* file = &files->files[index];
+		xfCliprdrFileRequest request = { 0 };
+
+		request.used = TRUE;
+		request.file = index;
+		if (file->directory || (file->sizeKnown && (file->issued >= file->size)))
+		{
+			/* nothing (more) to ask for, files before the cursor are all requested */
+			if (index == files->cursor)
+				files->cursor++;
+			index++;
+			continue;
+		}
+
+		if (!file->sizeKnown)
+		{
+			/* other files go ahead while the size is on its way */
+			if (file->sizeRequested)
+			{
+				index++;
+				continue;
+			}
+			file->sizeRequested = TRUE;
+			request.sizeRequest = TRUE;
+		}
+		else
+		{
+			if ((file->issued == 0) && !xf_cliprdr_files_open(files, file))
+			{
+				xf_cliprdr_files_fail(files);
+				return ERROR_OPEN_FAILED;
+			}
+			request.offset = file->issued;
+			request.length =
+			    (UINT32)MIN((UINT64)XF_CLIPRDR_FILES_CHUNK_SIZE, file->size - file->issued);
+			file->issued += request.length;
+		}
+
+		for (size_t x = 0; x < ARRAYSIZE(files->inflight); x++)
+		{
+			xfCliprdrFileRequest* slot = &files->inflight[x];
+			if (slot->used)
+				continue;
+
+			*slot = request;
+			files->numInflight++;
+
+			const UINT rc = xf_cliprdr_files_send(files, slot);
+			if (rc != CHANNEL_RC_OK)
+			{
+				xf_cliprdr_files_fail(files);
+				return rc;
+			}
+			break;
+		}
+	}
+
+	return CHANNEL_RC_OK;
+}
+
+UINT xf_cliprdr_files_start(xfCliprdrFiles* files)
+{
+	WINPR_ASSERT(files);
+
+	files->start = winpr_GetTickCount64NS();
+
+	/* directories and empty files are complete once created */
+	for (size_t x = 0; x < files->count; x++)
+	{
+		xfCliprdrFile* file = &files->files[x];
+		if (!file->directory && !(file->sizeKnown && (file->size == 0)))
+			continue;
+
+		if (!file->directory && !xf_cliprdr_files_open(files, file))
+		{
+			xf_cliprdr_files_fail(files);
+			return ERROR_OPEN_FAILED;
+		}
+		xf_cliprdr_files_complete(files, file);
+	}
+
+	if (files->count == 0)
+		files->state = XF_CLIPRDR_FILES_DONE;
+	if (files->state != XF_CLIPRDR_FILES_RUNNING)
+		return CHANNEL_RC_OK;
+
+	return xf_cliprdr_files_pump(files);
+}
+
+static BOOL xf_cliprdr_files_write(xfCliprdrFiles* files, xfCliprdrFileRequest* slot,
+                                   const BYTE* data, UINT32 length)
+{
+	xfCliprdrFile* file = &files->files[slot->file];
+
+	if ((length == 0) || (length > slot->length))
+	{
+		WLog_ERR(TAG, "%s: got %" PRIu32 " of %" PRIu32 " bytes at %" PRIu64, file->name,
+		         length, slot->length, slot->offset);
+		return FALSE;
+	}
+
+	size_t done = 0;
+	while (done < length)
+	{
+		const ssize_t rc = pwrite(file->fd, data + done, length - done,
+		                          (off_t)(slot->offset + done));
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			WLog_ERR(TAG, "failed to write %s: %s", file->name, strerror(errno));
+			return FALSE;
+		}
+		done += (size_t)rc;
+	}
+
+	file->written += length;
+	files->bytes += length;
+
+	/* a short range is asked for again from where it ended, in the same slot */
+	if (length < slot->length)
+	{
+		slot->offset += length;
+		slot->length -= length;
+		return xf_cliprdr_files_send(files, slot) == CHANNEL_RC_OK;
+	}
+
+	slot->used = FALSE;
+	files->numInflight--;
+	if (file->written == file->size)
+		xf_cliprdr_files_complete(files, file);
+	return TRUE;
+}
+
+static BOOL xf_cliprdr_files_set_size(xfCliprdrFiles* files, xfCliprdrFileRequest* slot,
+                                      const BYTE* data, UINT32 length)
+{
+	xfCliprdrFile* file = &files->files[slot->file];
+
+	slot->used = FALSE;
+	files->numInflight--;
+
+	if (length < 8)
+		return FALSE;
+
+	file->size = winpr_Data_Get_UINT64(data);
+	file->sizeKnown = TRUE;
+
+	/* opened by the pump with its first range, an empty file has none */
+	if (file->size == 0)
+	{
+		if (!xf_cliprdr_files_open(files, file))
+			return FALSE;
+		xf_cliprdr_files_complete(files, file);
+	}
+	return TRUE;
+}
+
+XF_CLIPRDR_FILES_STATE xf_cliprdr_files_response(xfCliprdrFiles* files,
+                                                 const CLIPRDR_FILE_CONTENTS_RESPONSE* response)
+{
+	WINPR_ASSERT(files);
+	WINPR_ASSERT(response);
+
+	if (files->state != XF_CLIPRDR_FILES_RUNNING)
+		return files->state;
+
+	xfCliprdrFileRequest* slot = NULL;
+	for (size_t x = 0; x < ARRAYSIZE(files->inflight); x++)
+	{
+		if (files->inflight[x].used && (files->inflight[x].streamId == response->streamId))
+		{
+			slot = &files->inflight[x];
+			break;
+		}
+	}
+
+	if (!slot)
+	{
+		WLog_DBG(TAG, "ignoring FileContents response for stream %" PRIu32, response->streamId);
+		return files->state;
+	}
+
+	if (response->common.msgFlags & CB_RESPONSE_FAIL)
+	{
+		WLog_ERR(TAG, "server failed FileContents request for %s", files->files[slot->file].name);
+		xf_cliprdr_files_fail(files);
+		return files->state;
+	}
+
+	const BOOL rc = slot->sizeRequest ? xf_cliprdr_files_set_size(files, slot,
+	                                                              response->requestedData,
+	                                                              response->cbRequested)
+	                                  : xf_cliprdr_files_write(files, slot, response->requestedData,
+	                                                           response->cbRequested);
+	if (!rc)
+	{
+		xf_cliprdr_files_fail(files);
+		return files->state;
+	}
+
+	if ((files->state == XF_CLIPRDR_FILES_RUNNING) &&
+	    (xf_cliprdr_files_pump(files) != CHANNEL_RC_OK))
+		xf_cliprdr_files_fail(files);
+	return files->state;
+}
+
+XF_CLIPRDR_FILES_STATE xf_cliprdr_files_state(const xfCliprdrFiles* files)
+{
+	WINPR_ASSERT(files);
+	return files->state;
+}
+
+static BOOL xf_cliprdr_files_append(char** buffer, size_t* length, size_t* capacity,
+                                    const char* data, size_t size)
+{
+	if (*length + size + 1 > *capacity)
+	{
+		const size_t next = MAX(*capacity * 2, *length + size + 1);
+		char* tmp = realloc(*buffer, next);
+		if (!tmp)
+			return FALSE;
+		*buffer = tmp;
+		*capacity = next;
+	}
+
+	memcpy(*buffer + *length, data, size);
+	*length += size;
+	(*buffer)[*length] = '\0';
+	return TRUE;
+}
+
+static BOOL xf_cliprdr_files_append_uri(char** buffer, size_t* length, size_t* capacity,
+                                        const char* path)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	if (!xf_cliprdr_files_append(buffer, length, capacity, "file://", 7))
+		return FALSE;
+
+	for (const char* cur = path; *cur; cur++)
+	{
+		const unsigned char c = (unsigned char)*cur;
+		const BOOL plain = ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+		                   ((c >= '0') && (c <= '9')) || strchr("/-._~", c);
+		char escaped[3] = { '%', hex[c >> 4], hex[c & 0x0F] };
+
+		if (!xf_cliprdr_files_append(buffer, length, capacity, plain ? (const char*)cur : escaped,
+		                             plain ? 1 : 3))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+char* xf_cliprdr_files_uri_list(const xfCliprdrFiles* files, BOOL gnome, size_t* length)
+{
+	char* buffer = NULL;
+	size_t capacity = 0;
+	size_t used = 0;
+
+	WINPR_ASSERT(files);
+	WINPR_ASSERT(length);
+
+	if (files->state != XF_CLIPRDR_FILES_DONE)
+		return NULL;
+
+	if (gnome && !xf_cliprdr_files_append(&buffer, &used, &capacity, "copy", 4))
+		goto fail;
+
+	for (size_t x = 0; x < files->count; x++)
+	{
+		const xfCliprdrFile* file = &files->files[x];
+
+		/* the pasting application copies directories recursively */
+		if (strchr(file->name, '/'))
+			continue;
+
+		if (gnome && !xf_cliprdr_files_append(&buffer, &used, &capacity, "\n", 1))
+			goto fail;
+		if (!xf_cliprdr_files_append_uri(&buffer, &used, &capacity, file->path))
+			goto fail;
+		if (!gnome && !xf_cliprdr_files_append(&buffer, &used, &capacity, "\r\n", 2))
+			goto fail;
+	}
+
+	if (!buffer && !xf_cliprdr_files_append(&buffer, &used, &capacity, "", 0))
+		goto fail;
+
+	*length = used;
+	return buffer;
+
+fail:
+	free(buffer);
+	return NULL;
+}
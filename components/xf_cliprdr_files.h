@@ -0,0 +1,76 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 clipboard redirection - file copy from the server
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_CLIPRDR_FILES_H
+#define FREERDP_CLIENT_X11_CLIPRDR_FILES_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/client/cliprdr.h>
+
+/* Bytes asked for with one FileContents range request */
+#define XF_CLIPRDR_FILES_CHUNK_SIZE (1024 * 1024)
+
+/* FileContents requests outstanding at once, across all files of a copy */
+#define XF_CLIPRDR_FILES_MAX_INFLIGHT 8
+
+typedef struct xf_cliprdr_files xfCliprdrFiles;
+
+typedef enum
+{
+	XF_CLIPRDR_FILES_RUNNING,
+	XF_CLIPRDR_FILES_DONE,
+	XF_CLIPRDR_FILES_FAILED
+} XF_CLIPRDR_FILES_STATE;
+
+/* Sends one FileContents request to the server */
+typedef UINT (*pcXfCliprdrFilesRequest)(void* custom,
+                                        const CLIPRDR_FILE_CONTENTS_REQUEST* request);
+
+/*
+ * Copies the files of a FileGroupDescriptorW list into a new directory below base. A file is
+ * created at its final size when its first range is requested and closed once it is complete, so
+ * only the files in flight are open. It is filled with positional writes straight from the
+ * FileContents responses, so responses may complete in any order and nothing is buffered.
+ * Up to XF_CLIPRDR_FILES_MAX_INFLIGHT range requests are outstanding at a time; once every range
+ * of a file is requested the next file is started, so small files do not stall the pipeline.
+ * The copy is driven by the caller's lock, the engine itself is not thread safe.
+ */
+xfCliprdrFiles* xf_cliprdr_files_new(const char* base, const BYTE* descriptors, size_t size,
+                                     pcXfCliprdrFilesRequest request, void* custom);
+
+/* Cancels a running copy. Removes the directory with everything copied into it. */
+void xf_cliprdr_files_free(xfCliprdrFiles* files);
+
+/**
+ * Issues the first requests.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+UINT xf_cliprdr_files_start(xfCliprdrFiles* files);
+
+/* Writes a FileContents response and requests more. Responses of other copies are ignored. */
+XF_CLIPRDR_FILES_STATE xf_cliprdr_files_response(xfCliprdrFiles* files,
+                                                 const CLIPRDR_FILE_CONTENTS_RESPONSE* response);
+
+XF_CLIPRDR_FILES_STATE xf_cliprdr_files_state(const xfCliprdrFiles* files);
+
+/* The copied top level entries as text/uri-list, or for gnome as x-special/gnome-copied-files.
+ * Only valid once the copy is done, the caller frees the string. */
+char* xf_cliprdr_files_uri_list(const xfCliprdrFiles* files, BOOL gnome, size_t* length);
+
+#endif /* FREERDP_CLIENT_X11_CLIPRDR_FILES_H */
@@ -0,0 +1,1203 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <winpr/assert.h>
+#include <winpr/cast.h>
+#include <winpr/collections.h>
+#include <winpr/file.h>
+#include <winpr/interlocked.h>
+#include <winpr/nt.h>
+#include <winpr/path.h>
+#include <winpr/stream.h>
+#include <winpr/string.h>
+
+#include <freerdp/addin.h>
+#include <freerdp/channels/rdpdr.h>
+#include <freerdp/log.h>
+
+#include "xf_drive.h"
+#include "xf_drive_cache.h"
+#include "xf_drive_entry.h"
+#include "xf_drive_io.h"
+
+#define TAG CLIENT_TAG("x11.drive")
+
+/* Label and file system the server is told about */
+#define XF_DRIVE_VOLUME_LABEL "FREERDP"
+#define XF_DRIVE_FILE_SYSTEM "FAT32"
+
+typedef struct
+{
+	volatile LONG refs;
+	UINT32 id;
+	int fd; /* -1 for directories */
+	char* path;
+	BOOL directory;
+	BOOL deleteOnClose;
+
+	/* QueryDirectory state */
+	XfDriveListing* listing;
+	char* pattern;
+	size_t cursor;
+} xfDriveFile;
+
+typedef struct
+{
+	DEVICE device;
+
+	char* base;
+	wHashTable* files;
+	UINT32 nextId;
+
+	XfDriveIo* io;
+	XfDriveCache* cache;
+	volatile LONG stopping;
+} xfDrive;
+
+/* A read or write handed to the I/O engine */
+typedef struct
+{
+	xfDrive* drive;
+	xfDriveFile* file;
+	IRP* irp;
+} xfDriveRequest;
+
+static NTSTATUS xf_drive_status(int error)
+{
+	switch (error)
+	{
+		case 0:
+			return STATUS_SUCCESS;
+		case ENOENT:
+			return STATUS_OBJECT_NAME_NOT_FOUND;
+		case ENOTDIR:
+			return STATUS_OBJECT_PATH_NOT_FOUND;
+		case EEXIST:
+			return STATUS_OBJECT_NAME_COLLISION;
+		case EACCES:
+		case EPERM:
+		case EROFS:
+			return STATUS_ACCESS_DENIED;
+		case EISDIR:
+			return STATUS_FILE_IS_A_DIRECTORY;
+		case ENOTEMPTY:
+			return STATUS_DIRECTORY_NOT_EMPTY;
+		case ENOSPC:
+		case EDQUOT:
+			return STATUS_DISK_FULL;
+		case ENAMETOOLONG:
+			return STATUS_OBJECT_NAME_INVALID;
+		case ENOMEM:
+			return STATUS_NO_MEMORY;
+		case EBUSY:
+			return STATUS_SHARING_VIOLATION;
+		default:
+			return STATUS_UNSUCCESSFUL;
+	}
+}
+
+static void xf_drive_file_release(xfDriveFile* file)
+{
+	if (!file)
+		return;
+
+	if (InterlockedDecrement(&file->refs) != 0)
+		return;
+
+	if (file->fd >= 0)
+		(void)close(file->fd);
+	xf_drive_listing_release(file->listing);
+	free(file->pattern);
+	free(file->path);
+	free(file);
+}
+
+static void xf_drive_file_free_object(void* obj)
+{
+	xf_drive_file_release(obj);
+}
+
+static xfDriveFile* xf_drive_file_get(xfDrive* drive, UINT32 id)
+{
+	return HashTable_GetItemValue(drive->files, (void*)(uintptr_t)id);
+}
+
+static char* xf_drive_full_path(const xfDrive* drive, const char* path)
+{
+	size_t size = 0;
+	char* full = NULL;
+	(void)winpr_asprintf(&full, &size, "%s%s%s", drive->base, (path[0] != '\0') ? "/" : "",
+	                     path);
+	return full;
+}
+
+/*
+ * Reads a server path, '\' separated and relative to the drive root, into a '/' separated one
+ * without leading separator. Names leaving the drive root or naming alternate data streams are
+ * refused.
+ */
+static NTSTATUS xf_drive_read_path(wStream* s, UINT32 length, char** ppath)
+{
+	WINPR_ASSERT(ppath);
+	*ppath = NULL;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, length))
+		return STATUS_INVALID_PARAMETER;
+
+	char* raw = NULL;
+	if (length >= sizeof(WCHAR))
+		raw = ConvertWCharNToUtf8Alloc(Stream_ConstPointer(s), length / sizeof(WCHAR), NULL);
+	else
+		raw = _strdup("");
+	Stream_Seek(s, length);
+	if (!raw)
+		return STATUS_OBJECT_NAME_INVALID;
+
+	char* path = calloc(strlen(raw) + 1, sizeof(char));
+	if (!path)
+	{
+		free(raw);
+		return STATUS_NO_MEMORY;
+	}
+
+	NTSTATUS status = STATUS_SUCCESS;
+	size_t used = 0;
+	char* context = NULL;
+	for (char* name = strtok_r(raw, "\\/", &context); name;
+	     name = strtok_r(NULL, "\\/", &context))
+	{
+		if (strcmp(name, ".") == 0)
+			continue;
+		if ((strcmp(name, "..") == 0) || strchr(name, ':'))
+		{
+			status = STATUS_OBJECT_NAME_INVALID;
+			break;
+		}
+
+		if (used > 0)
+			path[used++] = '/';
+		const size_t len = strlen(name);
+		memcpy(&path[used], name, len);
+		used += len;
+	}
+	free(raw);
+
+	if (status != STATUS_SUCCESS)
+	{
+		free(path);
+		return status;
+	}
+	*ppath = path;
+	return STATUS_SUCCESS;
+}
+
+static BOOL xf_drive_wants_write(UINT32 access)
+{
+	return (access & (GENERIC_WRITE | GENERIC_ALL | FILE_WRITE_DATA | FILE_APPEND_DATA)) != 0;
+}
+
+static NTSTATUS xf_drive_open(xfDrive* drive, xfDriveFile* file, UINT32 access,
+                              UINT32 disposition, UINT32 options, BYTE* information)
+{
+	XfDriveStat st = { 0 };
+	const BOOL exists = xf_drive_cache_stat(drive->cache, file->path, &st);
+	if (!exists && (errno != ENOENT))
+		return xf_drive_status(errno);
+
+	if (exists)
+	{
+		if (disposition == FILE_CREATE)
+			return STATUS_OBJECT_NAME_COLLISION;
+		if ((options & FILE_DIRECTORY_FILE) && !st.directory)
+			return STATUS_NOT_A_DIRECTORY;
+		if ((options & FILE_NON_DIRECTORY_FILE) && st.directory)
+			return STATUS_FILE_IS_A_DIRECTORY;
+	}
+	else if ((disposition == FILE_OPEN) || (disposition == FILE_OVERWRITE))
+		return STATUS_OBJECT_NAME_NOT_FOUND;
+
+	char* full = xf_drive_full_path(drive, file->path);
+	if (!full)
+		return STATUS_NO_MEMORY;
+
+	NTSTATUS status = STATUS_SUCCESS;
+	if ((options & FILE_DIRECTORY_FILE) || (exists && st.directory))
+	{
+		file->directory = TRUE;
+		if (!exists && (mkdir(full, 0755) != 0))
+			status = xf_drive_status(errno);
+		*information = exists ? FILE_OPENED : FILE_SUPERSEDED;
+	}
+	else
+	{
+		int flags = O_CLOEXEC;
+		switch (disposition)
+		{
+			case FILE_SUPERSEDE:
+			case FILE_OVERWRITE_IF:
+				flags |= O_CREAT | O_TRUNC;
+				break;
+			case FILE_CREATE:
+				flags |= O_CREAT | O_EXCL;
+				break;
+			case FILE_OPEN_IF:
+				flags |= O_CREAT;
+				break;
+			case FILE_OVERWRITE:
+				flags |= O_TRUNC;
+				break;
+			case FILE_OPEN:
+			default:
+				break;
+		}
+
+		/* a read only file opened with FILE_OPEN_IF stays readable */
+		if (xf_drive_wants_write(access) || (flags & O_TRUNC) || !exists)
+			flags |= O_RDWR;
+		else
+			flags |= O_RDONLY;
+
+		file->fd = open(full, flags, 0644);
+		if (file->fd < 0)
+			status = xf_drive_status(errno);
+
+		if (!exists)
+			*information = FILE_SUPERSEDED;
+		else if (flags & O_TRUNC)
+			*information = (disposition == FILE_SUPERSEDE) ? FILE_SUPERSEDED : FILE_OVERWRITTEN;
+		else
+			*information = FILE_OPENED;
+	}
+	free(full);
+
+	/* the next lookup must not wait for inotify to see the new or truncated file */
+	if ((status == STATUS_SUCCESS) && (!exists || (*information != FILE_OPENED)))
+		xf_drive_cache_invalidate(drive->cache, file->path);
+	return status;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_create(xfDrive* drive, IRP* irp)
+{
+	UINT32 access = 0;
+	UINT32 disposition = 0;
+	UINT32 options = 0;
+	UINT32 length = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 32))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, access);
+	Stream_Seek(irp->input, 16); /* AllocationSize, FileAttributes, SharedAccess */
+	Stream_Read_UINT32(irp->input, disposition);
+	Stream_Read_UINT32(irp->input, options);
+	Stream_Read_UINT32(irp->input, length);
+
+	BYTE information = 0;
+	UINT32 id = 0;
+	xfDriveFile* file = calloc(1, sizeof(xfDriveFile));
+	if (!file)
+	{
+		irp->IoStatus = STATUS_NO_MEMORY;
+		goto out;
+	}
+	file->refs = 1;
+	file->fd = -1;
+
+	irp->IoStatus = xf_drive_read_path(irp->input, length, &file->path);
+	if (irp->IoStatus == STATUS_SUCCESS)
+		irp->IoStatus = xf_drive_open(drive, file, access, disposition, options, &information);
+	if (irp->IoStatus != STATUS_SUCCESS)
+	{
+		xf_drive_file_release(file);
+		goto out;
+	}
+
+	file->deleteOnClose = (options & FILE_DELETE_ON_CLOSE) != 0;
+	do
+	{
+		file->id = ++drive->nextId;
+	} while ((file->id == 0) || xf_drive_file_get(drive, file->id));
+
+	if (!HashTable_Insert(drive->files, (void*)(uintptr_t)file->id, file))
+	{
+		irp->IoStatus = STATUS_NO_MEMORY;
+		xf_drive_file_release(file);
+		goto out;
+	}
+	id = file->id;
+
+out:
+	Stream_Write_UINT32(irp->output, id);
+	Stream_Write_UINT8(irp->output, information);
+	return irp->Complete(irp);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_close(xfDrive* drive, IRP* irp)
+{
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else
+	{
+		if (file->deleteOnClose)
+		{
+			char* full = xf_drive_full_path(drive, file->path);
+			if (!full)
+				irp->IoStatus = STATUS_NO_MEMORY;
+			else if ((file->directory ? rmdir(full) : unlink(full)) != 0)
+				irp->IoStatus = xf_drive_status(errno);
+			free(full);
+			xf_drive_cache_invalidate(drive->cache, file->path);
+		}
+
+		/* reads and writes in flight keep their own reference */
+		(void)HashTable_Remove(drive->files, (void*)(uintptr_t)irp->FileId);
+	}
+
+	Stream_Zero(irp->output, 5); /* Padding */
+	return irp->Complete(irp);
+}
+
+static void xf_drive_request_finish(xfDriveRequest* request)
+{
+	WINPR_ASSERT(request);
+
+	IRP* irp = request->irp;
+	UINT rc = 0;
+
+	/* the device is going away, rdpdr no longer expects an answer */
+	if (InterlockedCompareExchange(&request->drive->stopping, 0, 0))
+		rc = irp->Discard(irp);
+	else
+		rc = irp->Complete(irp);
+	if (rc != CHANNEL_RC_OK)
+		WLog_WARN(TAG, "failed to complete IRP: 0x%08" PRIx32, rc);
+
+	xf_drive_file_release(request->file);
+	free(request);
+}
+
+static void xf_drive_read_done(void* context, INT64 result)
+{
+	xfDriveRequest* request = context;
+	WINPR_ASSERT(request);
+
+	IRP* irp = request->irp;
+	if (result < 0)
+	{
+		irp->IoStatus = xf_drive_status((int)-result);
+		Stream_Write_UINT32(irp->output, 0);
+	}
+	else
+	{
+		/* the data was read in place behind the Length field */
+		Stream_Write_UINT32(irp->output, (UINT32)result);
+		Stream_Seek(irp->output, (size_t)result);
+	}
+	xf_drive_request_finish(request);
+}
+
+static void xf_drive_write_done(void* context, INT64 result)
+{
+	xfDriveRequest* request = context;
+	WINPR_ASSERT(request);
+
+	IRP* irp = request->irp;
+	if (result < 0)
+	{
+		irp->IoStatus = xf_drive_status((int)-result);
+		result = 0;
+	}
+
+	/* inotify reports the new size to the metadata cache */
+	Stream_Write_UINT32(irp->output, (UINT32)result);
+	Stream_Write_UINT8(irp->output, 0); /* Padding */
+	xf_drive_request_finish(request);
+}
+
+static xfDriveRequest* xf_drive_request_new(xfDrive* drive, xfDriveFile* file, IRP* irp)
+{
+	xfDriveRequest* request = calloc(1, sizeof(xfDriveRequest));
+	if (!request)
+		return NULL;
+
+	request->drive = drive;
+	request->file = file;
+	request->irp = irp;
+	(void)InterlockedIncrement(&file->refs);
+	return request;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_read(xfDrive* drive, IRP* irp)
+{
+	UINT32 length = 0;
+	UINT64 offset = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 12))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, length);
+	Stream_Read_UINT64(irp->input, offset);
+
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else if (file->directory)
+		irp->IoStatus = STATUS_INVALID_DEVICE_REQUEST;
+	else if (!Stream_EnsureRemainingCapacity(irp->output, 4ull + length))
+		irp->IoStatus = STATUS_NO_MEMORY;
+	else
+	{
+		xfDriveRequest* request = xf_drive_request_new(drive, file, irp);
+		if (!request)
+			irp->IoStatus = STATUS_NO_MEMORY;
+		else
+		{
+			BYTE* buffer = Stream_Pointer(irp->output);
+			if (xf_drive_io_read(drive->io, file->fd, &buffer[4], length, offset,
+			                     xf_drive_read_done, request))
+				return CHANNEL_RC_OK;
+
+			xf_drive_file_release(file);
+			free(request);
+			irp->IoStatus = STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	Stream_Write_UINT32(irp->output, 0); /* Length */
+	return irp->Complete(irp);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_write(xfDrive* drive, IRP* irp)
+{
+	UINT32 length = 0;
+	UINT64 offset = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 32))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, length);
+	Stream_Read_UINT64(irp->input, offset);
+	Stream_Seek(irp->input, 20); /* Padding */
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, length))
+		return ERROR_INVALID_DATA;
+
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else if (file->directory)
+		irp->IoStatus = STATUS_INVALID_DEVICE_REQUEST;
+	else
+	{
+		xfDriveRequest* request = xf_drive_request_new(drive, file, irp);
+		if (!request)
+			irp->IoStatus = STATUS_NO_MEMORY;
+		else
+		{
+			/* the data stays in the IRP's input until the IRP is completed */
+			if (xf_drive_io_write(drive->io, file->fd, Stream_ConstPointer(irp->input), length,
+			                      offset, xf_drive_write_done, request))
+				return CHANNEL_RC_OK;
+
+			xf_drive_file_release(file);
+			free(request);
+			irp->IoStatus = STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	Stream_Write_UINT32(irp->output, 0); /* Length */
+	Stream_Write_UINT8(irp->output, 0);  /* Padding */
+	return irp->Complete(irp);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_query_volume_information(xfDrive* drive, IRP* irp)
+{
+	UINT32 fsInformationClass = 0;
+	wStream* output = irp->output;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 4))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, fsInformationClass);
+
+	struct statvfs svfst = { 0 };
+	XfDriveStat st = { 0 };
+	if ((statvfs(drive->base, &svfst) != 0) || !xf_drive_cache_stat(drive->cache, "", &st))
+	{
+		irp->IoStatus = xf_drive_status(errno);
+		Stream_Write_UINT32(output, 0); /* Length */
+		return irp->Complete(irp);
+	}
+
+	const size_t labelSize = xf_drive_utf16_size(XF_DRIVE_VOLUME_LABEL, TRUE);
+	const size_t fsNameSize = xf_drive_utf16_size(XF_DRIVE_FILE_SYSTEM, TRUE);
+	if (!Stream_EnsureRemainingCapacity(output, 64 + MAX(labelSize, fsNameSize)))
+		return CHANNEL_RC_NO_MEMORY;
+
+	switch (fsInformationClass)
+	{
+		case FileFsVolumeInformation:
+			Stream_Write_UINT32(output, (UINT32)(17 + labelSize)); /* Length */
+			Stream_Write_UINT64(output, st.changeTime);            /* VolumeCreationTime */
+			Stream_Write_UINT32(output, (UINT32)svfst.f_fsid);     /* VolumeSerialNumber */
+			Stream_Write_UINT32(output, (UINT32)labelSize);        /* VolumeLabelLength */
+			Stream_Write_UINT8(output, 0);                         /* SupportsObjects */
+			(void)xf_drive_write_utf16(output, XF_DRIVE_VOLUME_LABEL, TRUE);
+			break;
+
+		case FileFsSizeInformation:
+			Stream_Write_UINT32(output, 24);                     /* Length */
+			Stream_Write_UINT64(output, svfst.f_blocks);         /* TotalAllocationUnits */
+			Stream_Write_UINT64(output, svfst.f_bavail);         /* AvailableAllocationUnits */
+			Stream_Write_UINT32(output, (UINT32)svfst.f_frsize); /* SectorsPerAllocationUnit */
+			Stream_Write_UINT32(output, 1);                      /* BytesPerSector */
+			break;
+
+		case FileFsAttributeInformation:
+			Stream_Write_UINT32(output, (UINT32)(12 + fsNameSize)); /* Length */
+			Stream_Write_UINT32(output, FILE_CASE_SENSITIVE_SEARCH | FILE_CASE_PRESERVED_NAMES |
+			                                FILE_UNICODE_ON_DISK); /* FileSystemAttributes */
+			Stream_Write_UINT32(output, (UINT32)svfst.f_namemax); /* MaxComponentNameLength */
+			Stream_Write_UINT32(output, (UINT32)fsNameSize);      /* FileSystemNameLength */
+			(void)xf_drive_write_utf16(output, XF_DRIVE_FILE_SYSTEM, TRUE);
+			break;
+
+		case FileFsFullSizeInformation:
+			Stream_Write_UINT32(output, 32);                     /* Length */
+			Stream_Write_UINT64(output, svfst.f_blocks);         /* TotalAllocationUnits */
+			Stream_Write_UINT64(output, svfst.f_bavail);         /* CallerAvailableUnits */
+			Stream_Write_UINT64(output, svfst.f_bfree);          /* ActualAvailableUnits */
+			Stream_Write_UINT32(output, (UINT32)svfst.f_frsize); /* SectorsPerAllocationUnit */
+			Stream_Write_UINT32(output, 1);                      /* BytesPerSector */
+			break;
+
+		case FileFsDeviceInformation:
+			Stream_Write_UINT32(output, 8);               /* Length */
+			Stream_Write_UINT32(output, FILE_DEVICE_DISK); /* DeviceType */
+			Stream_Write_UINT32(output, 0);               /* Characteristics */
+			break;
+
+		default:
+			WLog_DBG(TAG, "unhandled FsInformationClass %" PRIu32, fsInformationClass);
+			irp->IoStatus = STATUS_UNSUCCESSFUL;
+			Stream_Write_UINT32(output, 0); /* Length */
+			break;
+	}
+	return irp->Complete(irp);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_query_information(xfDrive* drive, IRP* irp)
+{
+	UINT32 fsInformationClass = 0;
+	wStream* output = irp->output;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 4))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, fsInformationClass);
+
+	XfDriveStat st = { 0 };
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else if (!xf_drive_cache_stat(drive->cache, file->path, &st))
+		irp->IoStatus = xf_drive_status(errno);
+	if (irp->IoStatus != STATUS_SUCCESS)
+	{
+		Stream_Write_UINT32(output, 0); /* Length */
+		return irp->Complete(irp);
+	}
+
+	if (!Stream_EnsureRemainingCapacity(output, 40))
+		return CHANNEL_RC_NO_MEMORY;
+
+	switch (fsInformationClass)
+	{
+		case FileBasicInformation:
+			Stream_Write_UINT32(output, 36);              /* Length */
+			Stream_Write_UINT64(output, st.creationTime); /* CreationTime */
+			Stream_Write_UINT64(output, st.accessTime);   /* LastAccessTime */
+			Stream_Write_UINT64(output, st.writeTime);    /* LastWriteTime */
+			Stream_Write_UINT64(output, st.changeTime);   /* ChangeTime */
+			Stream_Write_UINT32(output, st.attributes);   /* FileAttributes */
+			break;
+
+		case FileStandardInformation:
+			Stream_Write_UINT32(output, 22);                  /* Length */
+			Stream_Write_UINT64(output, st.allocation);       /* AllocationSize */
+			Stream_Write_UINT64(output, st.size);             /* EndOfFile */
+			Stream_Write_UINT32(output, st.links);            /* NumberOfLinks */
+			Stream_Write_UINT8(output, file->deleteOnClose ? 1 : 0); /* DeletePending */
+			Stream_Write_UINT8(output, st.directory ? 1 : 0); /* Directory */
+			break;
+
+		case FileAttributeTagInformation:
+			Stream_Write_UINT32(output, 8);             /* Length */
+			Stream_Write_UINT32(output, st.attributes); /* FileAttributes */
+			Stream_Write_UINT32(output, 0);             /* ReparseTag */
+			break;
+
+		default:
+			WLog_DBG(TAG, "unhandled FsInformationClass %" PRIu32, fsInformationClass);
+			irp->IoStatus = STATUS_UNSUCCESSFUL;
+			Stream_Write_UINT32(output, 0); /* Length */
+			break;
+	}
+	return irp->Complete(irp);
+}
+
+static struct timespec xf_drive_timespec(UINT64 filetime)
+{
+	/* 0 and -1 leave the time alone */
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = UTIME_OMIT };
+	const UINT64 offset = 116444736000000000ULL;
+	if ((filetime == 0) || (filetime == UINT64_MAX) || (filetime < offset))
+		return ts;
+
+	ts.tv_sec = (time_t)((filetime - offset) / 10000000ULL);
+	ts.tv_nsec = (long)(((filetime - offset) % 10000000ULL) * 100ULL);
+	return ts;
+}
+
+static NTSTATUS xf_drive_set_basic(xfDrive* drive, xfDriveFile* file, wStream* s)
+{
+	UINT64 accessTime = 0;
+	UINT64 writeTime = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 36))
+		return STATUS_INVALID_PARAMETER;
+
+	/* the host keeps no creation time, attributes follow from the mode */
+	Stream_Seek(s, 8); /* CreationTime */
+	Stream_Read_UINT64(s, accessTime);
+	Stream_Read_UINT64(s, writeTime);
+	Stream_Seek(s, 12); /* ChangeTime, FileAttributes */
+
+	const struct timespec times[2] = { xf_drive_timespec(accessTime),
+		                               xf_drive_timespec(writeTime) };
+	if ((times[0].tv_nsec == UTIME_OMIT) && (times[1].tv_nsec == UTIME_OMIT))
+		return STATUS_SUCCESS;
+
+	char* full = xf_drive_full_path(drive, file->path);
+	if (!full)
+		return STATUS_NO_MEMORY;
+
+	const NTSTATUS status =
+	    (utimensat(AT_FDCWD, full, times, 0) == 0) ? STATUS_SUCCESS : xf_drive_status(errno);
+	free(full);
+	xf_drive_cache_invalidate(drive->cache, file->path);
+	return status;
+}
+
+static NTSTATUS xf_drive_set_size(xfDrive* drive, xfDriveFile* file, wStream* s,
+                                  BOOL allocation)
+{
+	INT64 size = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 8))
+		return STATUS_INVALID_PARAMETER;
+
+	Stream_Read_INT64(s, size);
+	if ((size < 0) || file->directory)
+		return STATUS_INVALID_PARAMETER;
+
+	/* a larger allocation is only a hint, a smaller one cuts the file like Windows does */
+	XfDriveStat st = { 0 };
+	if (allocation && xf_drive_cache_stat(drive->cache, file->path, &st) &&
+	    ((UINT64)size >= st.size))
+		return STATUS_SUCCESS;
+
+	char* full = xf_drive_full_path(drive, file->path);
+	if (!full)
+		return STATUS_NO_MEMORY;
+
+	/* by path, the handle may have been opened read only */
+	const NTSTATUS status =
+	    (truncate(full, (off_t)size) == 0) ? STATUS_SUCCESS : xf_drive_status(errno);
+	free(full);
+	xf_drive_cache_invalidate(drive->cache, file->path);
+	return status;
+}
+
+static NTSTATUS xf_drive_set_disposition(xfDrive* drive, xfDriveFile* file, wStream* s,
+                                         UINT32 length)
+{
+	BYTE deletePending = 1;
+
+	/* an empty buffer means delete */
+	if (length > 0)
+	{
+		if (!Stream_CheckAndLogRequiredLength(TAG, s, 1))
+			return STATUS_INVALID_PARAMETER;
+		Stream_Read_UINT8(s, deletePending);
+	}
+
+	if (deletePending && file->directory)
+	{
+		XfDriveListing* listing = xf_drive_cache_list(drive->cache, file->path);
+		if (!listing)
+			return xf_drive_status(errno);
+
+		const size_t count = xf_drive_listing_count(listing);
+		xf_drive_listing_release(listing);
+		if (count > 0)
+			return STATUS_DIRECTORY_NOT_EMPTY;
+	}
+
+	file->deleteOnClose = deletePending != 0;
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS xf_drive_set_rename(xfDrive* drive, xfDriveFile* file, wStream* s)
+{
+	BYTE replace = 0;
+	UINT32 length = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, s, 6))
+		return STATUS_INVALID_PARAMETER;
+
+	Stream_Read_UINT8(s, replace);
+	Stream_Seek_UINT8(s); /* RootDirectory */
+	Stream_Read_UINT32(s, length);
+
+	char* path = NULL;
+	NTSTATUS status = xf_drive_read_path(s, length, &path);
+	if (status != STATUS_SUCCESS)
+		return status;
+
+	XfDriveStat st = { 0 };
+	char* from = xf_drive_full_path(drive, file->path);
+	char* to = xf_drive_full_path(drive, path);
+	if (!from || !to)
+		status = STATUS_NO_MEMORY;
+	else if (!replace && xf_drive_cache_stat(drive->cache, path, &st))
+		status = STATUS_OBJECT_NAME_COLLISION;
+	else if (rename(from, to) != 0)
+		status = xf_drive_status(errno);
+	free(from);
+	free(to);
+
+	if (status != STATUS_SUCCESS)
+	{
+		free(path);
+		return status;
+	}
+
+	xf_drive_cache_invalidate(drive->cache, file->path);
+	xf_drive_cache_invalidate(drive->cache, path);
+	free(file->path);
+	file->path = path;
+	return STATUS_SUCCESS;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_set_information(xfDrive* drive, IRP* irp)
+{
+	UINT32 fsInformationClass = 0;
+	UINT32 length = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 32))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, fsInformationClass);
+	Stream_Read_UINT32(irp->input, length);
+	Stream_Seek(irp->input, 24); /* Padding */
+
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else
+	{
+		switch (fsInformationClass)
+		{
+			case FileBasicInformation:
+				irp->IoStatus = xf_drive_set_basic(drive, file, irp->input);
+				break;
+			case FileEndOfFileInformation:
+				irp->IoStatus = xf_drive_set_size(drive, file, irp->input, FALSE);
+				break;
+			case FileAllocationInformation:
+				irp->IoStatus = xf_drive_set_size(drive, file, irp->input, TRUE);
+				break;
+			case FileDispositionInformation:
+				irp->IoStatus = xf_drive_set_disposition(drive, file, irp->input, length);
+				break;
+			case FileRenameInformation:
+				irp->IoStatus = xf_drive_set_rename(drive, file, irp->input);
+				break;
+			default:
+				WLog_DBG(TAG, "unhandled FsInformationClass %" PRIu32, fsInformationClass);
+				irp->IoStatus = STATUS_UNSUCCESSFUL;
+				break;
+		}
+	}
+
+	Stream_Write_UINT32(irp->output, length);
+	return irp->Complete(irp);
+}
+
+/*
+ * InitialQuery takes a new snapshot of the directory from the cache, the following queries
+ * walk it, one matching entry per IRP.
+ */
+static NTSTATUS xf_drive_query_directory(xfDrive* drive, xfDriveFile* file, IRP* irp,
+                                         UINT32 fsInformationClass, BYTE initialQuery,
+                                         UINT32 length)
+{
+	if (initialQuery)
+	{
+		char* dir = NULL;
+		const NTSTATUS status = xf_drive_read_path(irp->input, length, &dir);
+		if (status != STATUS_SUCCESS)
+			return status;
+
+		/* the last name is the pattern, usually "*" */
+		char* slash = strrchr(dir, '/');
+		free(file->pattern);
+		file->pattern = _strdup(slash ? slash + 1 : dir);
+		if (slash)
+			*slash = '\0';
+		else
+			dir[0] = '\0';
+
+		xf_drive_listing_release(file->listing);
+		file->listing = file->pattern ? xf_drive_cache_list(drive->cache, dir) : NULL;
+		const int error = file->pattern ? errno : ENOMEM;
+		file->cursor = 0;
+		free(dir);
+		if (!file->listing)
+			return (error == ENOENT) ? STATUS_NO_SUCH_FILE : xf_drive_status(error);
+	}
+	else if (!file->listing || !file->pattern)
+		return STATUS_NO_MORE_FILES;
+
+	const size_t count = xf_drive_listing_count(file->listing);
+	while (file->cursor < count)
+	{
+		const size_t index = file->cursor++;
+		const char* name = xf_drive_listing_name(file->listing, index);
+		if (!FilePatternMatchA(name, file->pattern))
+			continue;
+
+		XfDriveStat st = { 0 };
+		if (!xf_drive_cache_entry(drive->cache, file->listing, index, &st))
+			continue;
+		return xf_drive_write_entry(irp->output, fsInformationClass, name, &st);
+	}
+	return initialQuery ? STATUS_NO_SUCH_FILE : STATUS_NO_MORE_FILES;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_directory_control(xfDrive* drive, IRP* irp)
+{
+	switch (irp->MinorFunction)
+	{
+		case IRP_MN_QUERY_DIRECTORY:
+			break;
+
+		case IRP_MN_NOTIFY_CHANGE_DIRECTORY:
+			/* not supported, like FreeRDP's drive the request is left unanswered */
+			return irp->Discard(irp);
+
+		default:
+			irp->IoStatus = STATUS_NOT_SUPPORTED;
+			Stream_Write_UINT32(irp->output, 0); /* Length */
+			return irp->Complete(irp);
+	}
+
+	UINT32 fsInformationClass = 0;
+	BYTE initialQuery = 0;
+	UINT32 length = 0;
+
+	if (!Stream_CheckAndLogRequiredLength(TAG, irp->input, 32))
+		return ERROR_INVALID_DATA;
+
+	Stream_Read_UINT32(irp->input, fsInformationClass);
+	Stream_Read_UINT8(irp->input, initialQuery);
+	Stream_Read_UINT32(irp->input, length);
+	Stream_Seek(irp->input, 23); /* Padding */
+
+	xfDriveFile* file = xf_drive_file_get(drive, irp->FileId);
+	if (!file)
+		irp->IoStatus = STATUS_UNSUCCESSFUL;
+	else
+		irp->IoStatus =
+		    xf_drive_query_directory(drive, file, irp, fsInformationClass, initialQuery, length);
+
+	if (irp->IoStatus != STATUS_SUCCESS)
+	{
+		Stream_Write_UINT32(irp->output, 0); /* Length */
+		Stream_Write_UINT8(irp->output, 0);  /* Padding */
+	}
+	return irp->Complete(irp);
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_irp_request(DEVICE* device, IRP* irp)
+{
+	xfDrive* drive = (xfDrive*)device;
+
+	WINPR_ASSERT(drive);
+	WINPR_ASSERT(irp);
+
+	irp->IoStatus = STATUS_SUCCESS;
+	switch (irp->MajorFunction)
+	{
+		case IRP_MJ_CREATE:
+			return xf_drive_irp_create(drive, irp);
+
+		case IRP_MJ_CLOSE:
+			return xf_drive_irp_close(drive, irp);
+
+		case IRP_MJ_READ:
+			return xf_drive_irp_read(drive, irp);
+
+		case IRP_MJ_WRITE:
+			return xf_drive_irp_write(drive, irp);
+
+		case IRP_MJ_QUERY_VOLUME_INFORMATION:
+			return xf_drive_irp_query_volume_information(drive, irp);
+
+		case IRP_MJ_QUERY_INFORMATION:
+			return xf_drive_irp_query_information(drive, irp);
+
+		case IRP_MJ_SET_INFORMATION:
+			return xf_drive_irp_set_information(drive, irp);
+
+		case IRP_MJ_DIRECTORY_CONTROL:
+			return xf_drive_irp_directory_control(drive, irp);
+
+		case IRP_MJ_DEVICE_CONTROL:
+			Stream_Write_UINT32(irp->output, 0); /* OutputBufferLength */
+			return irp->Complete(irp);
+
+		case IRP_MJ_LOCK_CONTROL:
+			/* byte range locks are not enforced on the host */
+			Stream_Zero(irp->output, 5); /* Padding */
+			return irp->Complete(irp);
+
+		default:
+			irp->IoStatus = STATUS_NOT_SUPPORTED;
+			return irp->Complete(irp);
+	}
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_free(DEVICE* device)
+{
+	xfDrive* drive = (xfDrive*)device;
+	if (!drive)
+		return CHANNEL_RC_OK;
+
+	/* requests still in flight are discarded by their completion */
+	(void)InterlockedExchange(&drive->stopping, 1);
+	xf_drive_io_free(drive->io);
+
+	HashTable_Free(drive->files);
+	xf_drive_cache_free(drive->cache);
+	Stream_Free(drive->device.data, TRUE);
+	free(drive->base);
+	free(drive);
+	return CHANNEL_RC_OK;
+}
+
+static char* xf_drive_resolve_base(const char* path)
+{
+	char* expanded = NULL;
+	if (strcmp(path, "%") == 0)
+		expanded = GetKnownPath(KNOWN_PATH_HOME);
+	else
+		expanded = _strdup(path);
+	if (!expanded)
+		return NULL;
+
+	char* base = realpath(expanded, NULL);
+	free(expanded);
+	return base;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT xf_drive_register(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints, const char* name,
+                              const char* path)
+{
+	UINT error = CHANNEL_RC_NO_MEMORY;
+
+	xfDrive* drive = calloc(1, sizeof(xfDrive));
+	if (!drive)
+		return CHANNEL_RC_NO_MEMORY;
+
+	drive->device.type = RDPDR_DTYP_FILESYSTEM;
+	drive->device.name = name;
+	drive->device.IRPRequest = xf_drive_irp_request;
+	drive->device.Free = xf_drive_free;
+
+	drive->base = xf_drive_resolve_base(path);
+	if (!drive->base)
+	{
+		WLog_ERR(TAG, "drive %s: %s: %s", name, path, strerror(errno));
+		error = ERROR_INVALID_PARAMETER;
+		goto fail;
+	}
+
+	struct stat st = { 0 };
+	if ((stat(drive->base, &st) != 0) || !S_ISDIR(st.st_mode))
+	{
+		WLog_ERR(TAG, "drive %s: %s is not a directory", name, drive->base);
+		error = ERROR_INVALID_PARAMETER;
+		goto fail;
+	}
+
+	/* the name the server shows, without the characters device announces may not carry */
+	const size_t length = strlen(name);
+	drive->device.data = Stream_New(NULL, length + 1);
+	if (!drive->device.data)
+		goto fail;
+	for (size_t x = 0; x < length; x++)
+	{
+		const char c = strchr(":<>\"/\\| ", name[x]) ? '_' : name[x];
+		Stream_Write_UINT8(drive->device.data, (BYTE)c);
+	}
+	Stream_Write_UINT8(drive->device.data, '\0');
+
+	/* only rdpdr's thread touches the open files */
+	drive->files = HashTable_New(FALSE);
+	if (!drive->files)
+		goto fail;
+	HashTable_ValueObject(drive->files)->fnObjectFree = xf_drive_file_free_object;
+
+	drive->cache = xf_drive_cache_new(drive->base);
+	drive->io = xf_drive_io_new();
+	if (!drive->cache || !drive->io)
+		goto fail;
+
+	error = pEntryPoints->RegisterDevice(pEntryPoints->devman, &drive->device);
+	if (error != CHANNEL_RC_OK)
+	{
+		WLog_ERR(TAG, "RegisterDevice failed with error %" PRIu32 "!", error);
+		goto fail;
+	}
+
+	WLog_INFO(TAG, "drive %s: %s", name, drive->base);
+	return CHANNEL_RC_OK;
+
+fail:
+	xf_drive_free(&drive->device);
+	return error;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT VCAPITYPE xf_drive_device_entry(PDEVICE_SERVICE_ENTRY_POINTS pEntryPoints)
+{
+	WINPR_ASSERT(pEntryPoints);
+
+	const RDPDR_DRIVE* drive = (const RDPDR_DRIVE*)pEntryPoints->device;
+	WINPR_ASSERT(drive);
+
+	const char* name = drive->device.Name;
+	const char* path = drive->Path;
+	if (!name || !path)
+		return ERROR_INVALID_PARAMETER;
+
+	/* several drives behind one entry, hot plugging included */
+	if ((strcmp(path, "*") == 0) || (strcmp(path, "DynamicDrives") == 0))
+	{
+		PDEVICE_SERVICE_ENTRY entry = WINPR_FUNC_PTR_CAST(
+		    freerdp_channels_load_static_addin_entry(DRIVE_SERVICE_NAME, NULL,
+		                                             "DeviceServiceEntry", 0),
+		    PDEVICE_SERVICE_ENTRY);
+		if (!entry)
+		{
+			WLog_ERR(TAG, "drive %s: FreeRDP's drive device is not available", path);
+			return ERROR_NOT_SUPPORTED;
+		}
+		return entry(pEntryPoints);
+	}
+
+	return xf_drive_register(pEntryPoints, name, path);
+}
+
+PVIRTUALCHANNELENTRY xf_drive_addin_entry(LPCSTR pszName, LPCSTR pszSubsystem, LPCSTR pszType)
+{
+	if (pszName && !pszSubsystem && pszType && (strcmp(pszName, DRIVE_SERVICE_NAME) == 0) &&
+	    (strcmp(pszType, "DeviceServiceEntry") == 0))
+		return WINPR_FUNC_PTR_CAST(xf_drive_device_entry, PVIRTUALCHANNELENTRY);
+	return NULL;
+}
@@ -0,0 +1,39 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_DRIVE_H
+#define FREERDP_CLIENT_X11_DRIVE_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/svc.h>
+
+/*
+ * rdpdr file system device for /drive:<name>,<path>, replacing FreeRDP's own drive device.
+ * All IRPs arrive on rdpdr's thread. Reads and writes go to the asynchronous I/O engine and
+ * complete from its thread, so many of them are outstanding at once without a thread per
+ * request. Create, query and directory requests are answered right away from the metadata
+ * cache, which keeps each directory's listing until inotify reports a change in it.
+ *
+ * The "*" and "DynamicDrives" paths, which stand for several drives, are left to FreeRDP's
+ * drive device.
+ */
+
+/* Entry for the channel addin lookup, NULL unless name / type are the drive device's */
+PVIRTUALCHANNELENTRY xf_drive_addin_entry(LPCSTR pszName, LPCSTR pszSubsystem, LPCSTR pszType);
+
+#endif /* FREERDP_CLIENT_X11_DRIVE_H */
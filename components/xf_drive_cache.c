@@ -0,0 +1,648 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - directory metadata cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <winpr/assert.h>
+#include <winpr/collections.h>
+#include <winpr/file.h>
+#include <winpr/interlocked.h>
+#include <winpr/string.h>
+#include <winpr/synch.h>
+
+#include <freerdp/log.h>
+
+#include "xf_drive_cache.h"
+
+#define TAG CLIENT_TAG("x11.drive")
+
+/* membership changes drop a listing, the rest only mark the file's entry */
+#define XF_DRIVE_CACHE_MEMBERSHIP (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+#define XF_DRIVE_CACHE_SELF (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)
+#define XF_DRIVE_CACHE_EVENTS                                                             \
+	(XF_DRIVE_CACHE_MEMBERSHIP | IN_DELETE_SELF | IN_MOVE_SELF | IN_MODIFY | IN_ATTRIB | \
+	 IN_CLOSE_WRITE | IN_ONLYDIR)
+
+typedef struct
+{
+	char* name;
+	XfDriveStat stat;
+	BOOL stale;
+} xfDriveEntry;
+
+struct xf_drive_listing
+{
+	volatile LONG refs;
+	char* path;
+	int wd; /* -1 unless the listing is in the cache */
+	UINT64 lastUse;
+
+	size_t count;
+	xfDriveEntry* entries;
+};
+
+struct xf_drive_cache
+{
+	char* base;
+	int inotify;
+
+	CRITICAL_SECTION lock;
+	wHashTable* byPath;
+	wHashTable* byWatch;
+	UINT64 clock;
+
+	UINT64 hits;
+	UINT64 misses;
+	UINT64 dropped;
+};
+
+static void* xf_drive_cache_watch_key(int wd)
+{
+	/* inotify watch descriptors start at 1, 0 is no key for the table */
+	return (void*)(uintptr_t)(UINT32)wd;
+}
+
+static UINT64 xf_drive_filetime(INT64 seconds, INT64 nanoseconds)
+{
+	/* seconds between 1601-01-01 and 1970-01-01 */
+	const INT64 offset = 11644473600LL;
+	if (seconds < -offset)
+		return 0;
+	return (UINT64)(seconds + offset) * 10000000ULL + (UINT64)nanoseconds / 100ULL;
+}
+
+static void xf_drive_stat_fill(XfDriveStat* st, const struct stat* s, const char* name)
+{
+	WINPR_ASSERT(st);
+	WINPR_ASSERT(s);
+
+	*st = (XfDriveStat){ 0 };
+	st->directory = S_ISDIR(s->st_mode);
+	st->size = st->directory ? 0 : (UINT64)s->st_size;
+	st->allocation = (UINT64)s->st_blocks * 512ULL;
+	st->creationTime = xf_drive_filetime(s->st_mtim.tv_sec, s->st_mtim.tv_nsec);
+	st->accessTime = xf_drive_filetime(s->st_atim.tv_sec, s->st_atim.tv_nsec);
+	st->writeTime = xf_drive_filetime(s->st_mtim.tv_sec, s->st_mtim.tv_nsec);
+	st->changeTime = xf_drive_filetime(s->st_ctim.tv_sec, s->st_ctim.tv_nsec);
+	st->links = (UINT32)s->st_nlink;
+
+	st->attributes = st->directory ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+	if (name && (name[0] == '.'))
+		st->attributes |= FILE_ATTRIBUTE_HIDDEN;
+	if ((s->st_mode & S_IWUSR) == 0)
+		st->attributes |= FILE_ATTRIBUTE_READONLY;
+}
+
+/* stat() following links, a dangling link is reported as itself */
+static BOOL xf_drive_stat_at(int dirfd, const char* path, const char* name, XfDriveStat* st)
+{
+	struct stat s = { 0 };
+	if ((fstatat(dirfd, path, &s, 0) != 0) &&
+	    (fstatat(dirfd, path, &s, AT_SYMLINK_NOFOLLOW) != 0))
+		return FALSE;
+
+	xf_drive_stat_fill(st, &s, name);
+	return TRUE;
+}
+
+static char* xf_drive_cache_join(const char* base, const char* path, const char* name)
+{
+	size_t size = 0;
+	char* joined = NULL;
+	const char* sep1 = (path[0] != '\0') ? "/" : "";
+	const char* sep2 = (name && (name[0] != '\0')) ? "/" : "";
+
+	(void)winpr_asprintf(&joined, &size, "%s%s%s%s%s", base, sep1, path, sep2,
+	                     name ? name : "");
+	return joined;
+}
+
+static void xf_drive_listing_free(XfDriveListing* listing)
+{
+	if (!listing)
+		return;
+
+	for (size_t x = 0; x < listing->count; x++)
+		free(listing->entries[x].name);
+	free(listing->entries);
+	free(listing->path);
+	free(listing);
+}
+
+void xf_drive_listing_release(XfDriveListing* listing)
+{
+	if (!listing)
+		return;
+
+	if (InterlockedDecrement(&listing->refs) == 0)
+		xf_drive_listing_free(listing);
+}
+
+static int xf_drive_entry_compare(const void* a, const void* b)
+{
+	const xfDriveEntry* ea = a;
+	const xfDriveEntry* eb = b;
+	return strcmp(ea->name, eb->name);
+}
+
+static xfDriveEntry* xf_drive_listing_find(XfDriveListing* listing, const char* name)
+{
+	const xfDriveEntry key = { .name = (char*)name };
+	return bsearch(&key, listing->entries, listing->count, sizeof(xfDriveEntry),
+	               xf_drive_entry_compare);
+}
+
+static XfDriveListing* xf_drive_listing_read(const char* full, const char* path)
+{
+	DIR* dir = NULL;
+	XfDriveListing* listing = calloc(1, sizeof(XfDriveListing));
+	if (!listing)
+		goto fail;
+
+	listing->refs = 1;
+	listing->wd = -1;
+	listing->path = _strdup(path);
+	if (!listing->path)
+		goto fail;
+
+	dir = opendir(full);
+	if (!dir)
+		goto fail;
+
+	size_t capacity = 0;
+	struct dirent* ent = NULL;
+	while ((ent = readdir(dir)))
+	{
+		if ((strcmp(ent->d_name, ".") == 0) || (strcmp(ent->d_name, "..") == 0))
+			continue;
+
+		if (listing->count == capacity)
+		{
+			const size_t grown = (capacity > 0) ? capacity * 2 : 32;
+			xfDriveEntry* entries = realloc(listing->entries, grown * sizeof(xfDriveEntry));
+			if (!entries)
+				break;
+			listing->entries = entries;
+			capacity = grown;
+		}
+
+		xfDriveEntry* entry = &listing->entries[listing->count];
+		*entry = (xfDriveEntry){ 0 };
+		if (!xf_drive_stat_at(dirfd(dir), ent->d_name, ent->d_name, &entry->stat))
+			continue; /* gone since readdir */
+
+		entry->name = _strdup(ent->d_name);
+		if (!entry->name)
+			break;
+		listing->count++;
+	}
+
+	if (ent)
+	{
+		errno = ENOMEM;
+		goto fail;
+	}
+	(void)closedir(dir);
+
+	qsort(listing->entries, listing->count, sizeof(xfDriveEntry), xf_drive_entry_compare);
+	return listing;
+
+fail:
+	if (dir)
+	{
+		const int error = errno;
+		(void)closedir(dir);
+		errno = error;
+	}
+	xf_drive_listing_free(listing);
+	return NULL;
+}
+
+/* The cache's reference goes, snapshots handed out stay valid. Call with the lock held. */
+static void xf_drive_cache_drop(XfDriveCache* cache, XfDriveListing* listing, BOOL unwatch)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(listing);
+
+	(void)HashTable_Remove(cache->byPath, listing->path);
+	(void)HashTable_Remove(cache->byWatch, xf_drive_cache_watch_key(listing->wd));
+	if (unwatch)
+		(void)inotify_rm_watch(cache->inotify, listing->wd);
+	listing->wd = -1;
+	cache->dropped++;
+	xf_drive_listing_release(listing);
+}
+
+/* Drops the listing of path and of every directory below it. Call with the lock held. */
+static void xf_drive_cache_drop_tree(XfDriveCache* cache, const char* path)
+{
+	const size_t length = strlen(path);
+
+	/* dropping a listing only frees its own key, the others stay valid */
+	ULONG_PTR* keys = NULL;
+	const size_t count = HashTable_GetKeys(cache->byPath, &keys);
+	for (size_t x = 0; x < count; x++)
+	{
+		XfDriveListing* cur = HashTable_GetItemValue(cache->byPath, (const void*)keys[x]);
+		if (!cur)
+			continue;
+		if ((length == 0) || ((strncmp(cur->path, path, length) == 0) &&
+		                      ((cur->path[length] == '/') || (cur->path[length] == '\0'))))
+			xf_drive_cache_drop(cache, cur, TRUE);
+	}
+	free(keys);
+}
+
+static char* xf_drive_cache_child(const char* dir, const char* name)
+{
+	if (dir[0] == '\0')
+		return _strdup(name);
+	return xf_drive_cache_join(dir, name, NULL);
+}
+
+/* Applies the pending inotify events. Call with the lock held. */
+static void xf_drive_cache_drain(XfDriveCache* cache)
+{
+	if (cache->inotify < 0)
+		return;
+
+	union
+	{
+		struct inotify_event event;
+		char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+	} events;
+
+	for (;;)
+	{
+		const ssize_t rc = read(cache->inotify, events.buffer, sizeof(events.buffer));
+		if (rc <= 0)
+			return;
+
+		for (ssize_t offset = 0; offset < rc;)
+		{
+			const struct inotify_event* event = (const void*)&events.buffer[offset];
+			offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				WLog_DBG(TAG, "inotify queue overflow, dropping all listings");
+				xf_drive_cache_drop_tree(cache, "");
+				continue;
+			}
+
+			XfDriveListing* listing =
+			    HashTable_GetItemValue(cache->byWatch, xf_drive_cache_watch_key(event->wd));
+			if (!listing)
+				continue;
+
+			if (event->mask & XF_DRIVE_CACHE_SELF)
+			{
+				/* the kernel removed the watch itself for IN_IGNORED */
+				char* path = _strdup(listing->path);
+				xf_drive_cache_drop(cache, listing, (event->mask & IN_IGNORED) == 0);
+				if (path)
+					xf_drive_cache_drop_tree(cache, path);
+				free(path);
+				continue;
+			}
+
+			if (event->len == 0)
+				continue;
+
+			if (event->mask & XF_DRIVE_CACHE_MEMBERSHIP)
+			{
+				char* child = xf_drive_cache_child(listing->path, event->name);
+				xf_drive_cache_drop(cache, listing, TRUE);
+				if (child)
+					xf_drive_cache_drop_tree(cache, child);
+				free(child);
+				continue;
+			}
+
+			xfDriveEntry* entry = xf_drive_listing_find(listing, event->name);
+			if (entry)
+				entry->stale = TRUE;
+		}
+	}
+}
+
+/* Makes room for one more listing. Call with the lock held. */
+static void xf_drive_cache_evict(XfDriveCache* cache)
+{
+	if (HashTable_Count(cache->byPath) < XF_DRIVE_CACHE_MAX_DIRS)
+		return;
+
+	ULONG_PTR* keys = NULL;
+	const size_t count = HashTable_GetKeys(cache->byPath, &keys);
+	XfDriveListing* oldest = NULL;
+	for (size_t x = 0; x < count; x++)
+	{
+		XfDriveListing* cur = HashTable_GetItemValue(cache->byPath, (const void*)keys[x]);
+		if (cur && (!oldest || (cur->lastUse < oldest->lastUse)))
+			oldest = cur;
+	}
+	free(keys);
+
+	if (oldest)
+		xf_drive_cache_drop(cache, oldest, TRUE);
+}
+
+/*
+ * Cached listing of path or a freshly read one, cached if a watch could be set up. Returns a
+ * reference with errno set on failure. Call with the lock held.
+ */
+static XfDriveListing* xf_drive_cache_get(XfDriveCache* cache, const char* path)
+{
+	XfDriveListing* listing = HashTable_GetItemValue(cache->byPath, path);
+	if (listing)
+	{
+		cache->hits++;
+		listing->lastUse = ++cache->clock;
+		(void)InterlockedIncrement(&listing->refs);
+		return listing;
+	}
+
+	cache->misses++;
+	char* full = xf_drive_cache_join(cache->base, path, NULL);
+	if (!full)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* watch first, a change while reading shows up as an event and drops the listing again */
+	int wd = -1;
+	if (cache->inotify >= 0)
+	{
+		wd = inotify_add_watch(cache->inotify, full, XF_DRIVE_CACHE_EVENTS);
+		/* the same directory reached through another path shares the watch, do not cache */
+		if ((wd >= 0) && HashTable_GetItemValue(cache->byWatch, xf_drive_cache_watch_key(wd)))
+			wd = -1;
+	}
+
+	listing = xf_drive_listing_read(full, path);
+	const int error = errno;
+	free(full);
+	if (!listing)
+	{
+		if (wd >= 0)
+			(void)inotify_rm_watch(cache->inotify, wd);
+		errno = error;
+		return NULL;
+	}
+
+	if (wd < 0)
+		return listing;
+
+	xf_drive_cache_evict(cache);
+	listing->wd = wd;
+	listing->lastUse = ++cache->clock;
+	if (!HashTable_Insert(cache->byPath, listing->path, listing))
+		goto uncached;
+	if (!HashTable_Insert(cache->byWatch, xf_drive_cache_watch_key(wd), listing))
+	{
+		(void)HashTable_Remove(cache->byPath, listing->path);
+		goto uncached;
+	}
+
+	/* one reference for the cache, one for the caller */
+	(void)InterlockedIncrement(&listing->refs);
+	return listing;
+
+uncached:
+	(void)inotify_rm_watch(cache->inotify, wd);
+	listing->wd = -1;
+	return listing;
+}
+
+/* Stats the entry again if it changed. Call with the lock held. */
+static BOOL xf_drive_cache_refresh(XfDriveCache* cache, XfDriveListing* listing,
+                                   xfDriveEntry* entry)
+{
+	if (!entry->stale)
+		return TRUE;
+
+	char* full = xf_drive_cache_join(cache->base, listing->path, entry->name);
+	if (!full)
+	{
+		errno = ENOMEM;
+		return FALSE;
+	}
+
+	const BOOL rc = xf_drive_stat_at(AT_FDCWD, full, entry->name, &entry->stat);
+	free(full);
+	if (rc)
+		entry->stale = FALSE;
+	return rc;
+}
+
+XfDriveCache* xf_drive_cache_new(const char* base)
+{
+	WINPR_ASSERT(base);
+
+	XfDriveCache* cache = calloc(1, sizeof(XfDriveCache));
+	if (!cache)
+		return NULL;
+
+	cache->inotify = -1;
+	InitializeCriticalSection(&cache->lock);
+
+	cache->base = _strdup(base);
+	/* the cache's own lock covers the tables */
+	cache->byPath = HashTable_New(FALSE);
+	cache->byWatch = HashTable_New(FALSE);
+	if (!cache->base || !cache->byPath || !cache->byWatch)
+		goto fail;
+
+	if (!HashTable_SetupForStringData(cache->byPath, FALSE))
+		goto fail;
+
+	cache->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cache->inotify < 0)
+		WLog_WARN(TAG, "inotify_init1: %s, directory metadata is not cached", strerror(errno));
+	return cache;
+
+fail:
+	xf_drive_cache_free(cache);
+	return NULL;
+}
+
+void xf_drive_cache_free(XfDriveCache* cache)
+{
+	if (!cache)
+		return;
+
+	if (cache->byPath && cache->byWatch)
+		xf_drive_cache_drop_tree(cache, "");
+	WLog_DBG(TAG, "metadata cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " dropped",
+	         cache->hits, cache->misses, cache->dropped);
+
+	if (cache->inotify >= 0)
+		(void)close(cache->inotify);
+	HashTable_Free(cache->byWatch);
+	HashTable_Free(cache->byPath);
+	DeleteCriticalSection(&cache->lock);
+	free(cache->base);
+	free(cache);
+}
+
+BOOL xf_drive_cache_stat(XfDriveCache* cache, const char* path, XfDriveStat* st)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(path);
+	WINPR_ASSERT(st);
+
+	/* the root is in no listing */
+	if (path[0] == '\0')
+		return xf_drive_stat_at(AT_FDCWD, cache->base, NULL, st);
+
+	char* copy = _strdup(path);
+	if (!copy)
+	{
+		errno = ENOMEM;
+		return FALSE;
+	}
+
+	const char* dir = "";
+	const char* name = copy;
+	char* slash = strrchr(copy, '/');
+	if (slash)
+	{
+		*slash = '\0';
+		dir = copy;
+		name = slash + 1;
+	}
+
+	EnterCriticalSection(&cache->lock);
+	xf_drive_cache_drain(cache);
+
+	BOOL rc = FALSE;
+	XfDriveListing* listing = xf_drive_cache_get(cache, dir);
+	if (listing)
+	{
+		xfDriveEntry* entry = xf_drive_listing_find(listing, name);
+		if (!entry)
+			errno = ENOENT;
+		else if (xf_drive_cache_refresh(cache, listing, entry))
+		{
+			*st = entry->stat;
+			rc = TRUE;
+		}
+		xf_drive_listing_release(listing);
+	}
+	LeaveCriticalSection(&cache->lock);
+
+	const int error = errno;
+	free(copy);
+	errno = error;
+	return rc;
+}
+
+void xf_drive_cache_invalidate(XfDriveCache* cache, const char* path)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(path);
+
+	char* copy = _strdup(path);
+	if (!copy)
+		return;
+
+	const char* dir = "";
+	const char* name = copy;
+	char* slash = strrchr(copy, '/');
+	if (slash)
+	{
+		*slash = '\0';
+		dir = copy;
+		name = slash + 1;
+	}
+
+	EnterCriticalSection(&cache->lock);
+	BOOL directory = TRUE;
+	XfDriveListing* listing = HashTable_GetItemValue(cache->byPath, dir);
+	xfDriveEntry* entry = listing ? xf_drive_listing_find(listing, name) : NULL;
+	if (entry)
+	{
+		entry->stale = TRUE;
+		directory = entry->stat.directory;
+	}
+
+	/* files have no listing, spare the walk over all cached directories */
+	if (directory)
+		xf_drive_cache_drop_tree(cache, path);
+	LeaveCriticalSection(&cache->lock);
+	free(copy);
+}
+
+XfDriveListing* xf_drive_cache_list(XfDriveCache* cache, const char* path)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(path);
+
+	EnterCriticalSection(&cache->lock);
+	xf_drive_cache_drain(cache);
+	XfDriveListing* listing = xf_drive_cache_get(cache, path);
+	const int error = errno;
+	LeaveCriticalSection(&cache->lock);
+
+	errno = error;
+	return listing;
+}
+
+size_t xf_drive_listing_count(const XfDriveListing* listing)
+{
+	WINPR_ASSERT(listing);
+	return listing->count;
+}
+
+const char* xf_drive_listing_name(const XfDriveListing* listing, size_t index)
+{
+	WINPR_ASSERT(listing);
+
+	if (index >= listing->count)
+		return NULL;
+	return listing->entries[index].name;
+}
+
+BOOL xf_drive_cache_entry(XfDriveCache* cache, XfDriveListing* listing, size_t index,
+                          XfDriveStat* st)
+{
+	WINPR_ASSERT(cache);
+	WINPR_ASSERT(listing);
+	WINPR_ASSERT(st);
+
+	if (index >= listing->count)
+		return FALSE;
+
+	EnterCriticalSection(&cache->lock);
+	xf_drive_cache_drain(cache);
+	xfDriveEntry* entry = &listing->entries[index];
+
+	/* a file deleted since the snapshot is still listed with what was known about it */
+	(void)xf_drive_cache_refresh(cache, listing, entry);
+	*st = entry->stat;
+	LeaveCriticalSection(&cache->lock);
+	return TRUE;
+}
@@ -0,0 +1,77 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - directory metadata cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_DRIVE_CACHE_H
+#define FREERDP_CLIENT_X11_DRIVE_CACHE_H
+
+#include <winpr/wtypes.h>
+
+/* Directories whose listing is kept, the least recently used one goes first */
+#define XF_DRIVE_CACHE_MAX_DIRS 256
+
+typedef struct xf_drive_cache XfDriveCache;
+typedef struct xf_drive_listing XfDriveListing;
+
+/* What the rdpdr information classes report about a file, times as FILETIME */
+typedef struct
+{
+	UINT64 size;
+	UINT64 allocation;
+	UINT64 creationTime;
+	UINT64 accessTime;
+	UINT64 writeTime;
+	UINT64 changeTime;
+	UINT32 attributes;
+	UINT32 links;
+	BOOL directory;
+} XfDriveStat;
+
+/*
+ * Listings of the directories below base, each sorted by name with the metadata of every entry,
+ * so QueryDirectory and QueryInformation are answered without touching the filesystem again.
+ * A cached directory is watched with inotify: files created, deleted or renamed in it drop the
+ * whole listing, a change to one file only its entry, which is stat'ed again on its next use.
+ * Pending inotify events are read before every lookup, so a change made by the drive's own
+ * requests or by a local program is seen by the next request.
+ *
+ * Paths are relative to base, '/' separated without a leading one, "" is base itself.
+ * The cache is safe to use from several threads.
+ */
+XfDriveCache* xf_drive_cache_new(const char* base);
+void xf_drive_cache_free(XfDriveCache* cache);
+
+/* Metadata of path. Returns FALSE with errno set if it does not exist. */
+BOOL xf_drive_cache_stat(XfDriveCache* cache, const char* path, XfDriveStat* st);
+
+/* Drops what is cached about path and, if it is a directory, its listing */
+void xf_drive_cache_invalidate(XfDriveCache* cache, const char* path);
+
+/*
+ * Snapshot of the directory at path, NULL with errno set on failure. The snapshot stays valid
+ * until released, also if the directory changes meanwhile.
+ */
+XfDriveListing* xf_drive_cache_list(XfDriveCache* cache, const char* path);
+void xf_drive_listing_release(XfDriveListing* listing);
+
+size_t xf_drive_listing_count(const XfDriveListing* listing);
+const char* xf_drive_listing_name(const XfDriveListing* listing, size_t index);
+
+/* Metadata of an entry, refreshed first if the file changed since the snapshot was taken */
+BOOL xf_drive_cache_entry(XfDriveCache* cache, XfDriveListing* listing, size_t index,
+                          XfDriveStat* st);
+
+#endif /* FREERDP_CLIENT_X11_DRIVE_CACHE_H */
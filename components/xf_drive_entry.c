@@ -0,0 +1,108 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - directory entry encoding
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+
+#include <winpr/string.h>
+
+#include <freerdp/log.h>
+
+#include "xf_drive_entry.h"
+
+#define TAG CLIENT_TAG("x11.drive")
+
+BOOL xf_drive_write_utf16(wStream* s, const char* str, BOOL terminated)
+{
+	size_t len = 0;
+	WCHAR* wstr = ConvertUtf8ToWCharAlloc(str, &len);
+	if (!wstr)
+		return FALSE;
+
+	const size_t size = (len + (terminated ? 1 : 0)) * sizeof(WCHAR);
+	const BOOL rc = Stream_EnsureRemainingCapacity(s, size);
+	if (rc)
+		Stream_Write(s, wstr, size);
+	free(wstr);
+	return rc;
+}
+
+size_t xf_drive_utf16_size(const char* str, BOOL terminated)
+{
+	const SSIZE_T len = ConvertUtf8ToWChar(str, NULL, 0);
+	if (len < 0)
+		return 0;
+	return ((size_t)len + (terminated ? 1 : 0)) * sizeof(WCHAR);
+}
+
+NTSTATUS xf_drive_write_entry(wStream* s, UINT32 fsInformationClass, const char* name,
+                              const XfDriveStat* st)
+{
+	size_t nameSize = xf_drive_utf16_size(name, FALSE);
+	if (nameSize == 0)
+		return STATUS_UNSUCCESSFUL;
+
+	size_t length = 0;
+	switch (fsInformationClass)
+	{
+		case FileDirectoryInformation:
+			length = 64 + nameSize;
+			break;
+		case FileFullDirectoryInformation:
+			length = 68 + nameSize;
+			break;
+		case FileBothDirectoryInformation:
+			length = 93 + nameSize;
+			break;
+		case FileNamesInformation:
+			length = 12 + nameSize;
+			break;
+		default:
+			WLog_DBG(TAG, "unhandled FsInformationClass %" PRIu32, fsInformationClass);
+			return STATUS_UNSUCCESSFUL;
+	}
+
+	if ((length > UINT32_MAX) || !Stream_EnsureRemainingCapacity(s, 4 + length))
+		return STATUS_NO_MEMORY;
+
+	Stream_Write_UINT32(s, (UINT32)length); /* Length */
+	Stream_Write_UINT32(s, 0);              /* NextEntryOffset */
+	Stream_Write_UINT32(s, 0);              /* FileIndex */
+	if (fsInformationClass != FileNamesInformation)
+	{
+		Stream_Write_UINT64(s, st->creationTime); /* CreationTime */
+		Stream_Write_UINT64(s, st->accessTime);   /* LastAccessTime */
+		Stream_Write_UINT64(s, st->writeTime);    /* LastWriteTime */
+		Stream_Write_UINT64(s, st->changeTime);   /* ChangeTime */
+		Stream_Write_UINT64(s, st->size);         /* EndOfFile */
+		Stream_Write_UINT64(s, st->allocation);   /* AllocationSize */
+		Stream_Write_UINT32(s, st->attributes);   /* FileAttributes */
+	}
+	Stream_Write_UINT32(s, (UINT32)nameSize); /* FileNameLength */
+	if ((fsInformationClass == FileFullDirectoryInformation) ||
+	    (fsInformationClass == FileBothDirectoryInformation))
+		Stream_Write_UINT32(s, 0); /* EaSize */
+	if (fsInformationClass == FileBothDirectoryInformation)
+	{
+		/* no Reserved byte between ShortNameLength and ShortName, Length counts 93 + name */
+		Stream_Write_UINT8(s, 0); /* ShortNameLength */
+		Stream_Zero(s, 24);       /* ShortName */
+	}
+	if (!xf_drive_write_utf16(s, name, FALSE))
+		return STATUS_NO_MEMORY;
+	return STATUS_SUCCESS;
+}
@@ -0,0 +1,42 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - directory entry encoding
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef FREERDP_CLIENT_X11_DRIVE_ENTRY_H
+#define FREERDP_CLIENT_X11_DRIVE_ENTRY_H
+
+#include <winpr/wtypes.h>
+#include <winpr/nt.h>
+#include <winpr/stream.h>
+
+#include "xf_drive_cache.h"
+
+/* Appends str as UTF-16, with the terminator if terminated. FALSE if it is no valid UTF-8. */
+BOOL xf_drive_write_utf16(wStream* s, const char* str, BOOL terminated);
+
+/* Bytes xf_drive_write_utf16 writes for str, 0 if it is no valid UTF-8 */
+size_t xf_drive_utf16_size(const char* str, BOOL terminated);
+
+/*
+ * Appends the Length field and one QueryDirectory entry of fsInformationClass for name, as the
+ * rdpdr client sends it: FileDirectoryInformation, FileFullDirectoryInformation,
+ * FileBothDirectoryInformation or FileNamesInformation. Length counts the bytes that follow it.
+ */
+NTSTATUS xf_drive_write_entry(wStream* s, UINT32 fsInformationClass, const char* name,
+                              const XfDriveStat* st);
+
+#endif /* FREERDP_CLIENT_X11_DRIVE_ENTRY_H */
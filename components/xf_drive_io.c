@@ -0,0 +1,313 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - asynchronous file I/O
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#include <freerdp/log.h>
+
+#ifdef WITH_IO_URING
+#include <liburing.h>
+#endif
+
+#include "xf_drive_io.h"
+
+#define TAG CLIENT_TAG("x11.drive")
+
+typedef struct
+{
+	pcXfDriveIoDone done;
+	void* context;
+} xfDriveIoRequest;
+
+struct xf_drive_io
+{
+#ifdef WITH_IO_URING
+	struct io_uring ring;
+	BOOL ringReady;
+	HANDLE thread;
+#endif
+	volatile LONG inflight;
+
+	UINT64 queued;
+	UINT64 synchronous;
+};
+
+static INT64 xf_drive_io_pread(int fd, BYTE* buffer, UINT32 length, UINT64 offset)
+{
+	size_t done = 0;
+	while (done < length)
+	{
+		const ssize_t rc = pread(fd, &buffer[done], length - done, (off_t)(offset + done));
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (done > 0) ? (INT64)done : -errno;
+		}
+		if (rc == 0)
+			break;
+		done += (size_t)rc;
+	}
+	return (INT64)done;
+}
+
+static INT64 xf_drive_io_pwrite(int fd, const BYTE* buffer, UINT32 length, UINT64 offset)
+{
+	size_t done = 0;
+	while (done < length)
+	{
+		const ssize_t rc = pwrite(fd, &buffer[done], length - done, (off_t)(offset + done));
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (done > 0) ? (INT64)done : -errno;
+		}
+		if (rc == 0)
+			break;
+		done += (size_t)rc;
+	}
+	return (INT64)done;
+}
+
+#ifdef WITH_IO_URING
+/* data of an entry whose submit failed, it went out later as a NOP and its completion is ignored */
+static char xf_drive_io_orphan;
+
+static DWORD WINAPI xf_drive_io_thread(LPVOID arg)
+{
+	XfDriveIo* io = arg;
+	WINPR_ASSERT(io);
+
+	BOOL stopping = FALSE;
+	while (!stopping || (InterlockedCompareExchange(&io->inflight, 0, 0) > 0))
+	{
+		struct io_uring_cqe* cqe = NULL;
+		const int rc = io_uring_wait_cqe(&io->ring, &cqe);
+		if (rc < 0)
+		{
+			if (rc == -EINTR)
+				continue;
+			WLog_ERR(TAG, "io_uring_wait_cqe: %s", strerror(-rc));
+			break;
+		}
+
+		xfDriveIoRequest* request = io_uring_cqe_get_data(cqe);
+		const INT64 result = cqe->res;
+		io_uring_cqe_seen(&io->ring, cqe);
+
+		if (request == (void*)&xf_drive_io_orphan)
+			continue;
+
+		/* the wake up queued by xf_drive_io_free carries no request */
+		if (!request)
+		{
+			stopping = TRUE;
+			continue;
+		}
+
+		request->done(request->context, result);
+		free(request);
+		(void)InterlockedDecrement(&io->inflight);
+	}
+	return 0;
+}
+
+static BOOL xf_drive_io_submit(XfDriveIo* io)
+{
+	for (size_t retry = 0; retry < 100; retry++)
+	{
+		const int rc = io_uring_submit(&io->ring);
+		if (rc >= 0)
+			return TRUE;
+		if ((rc != -EINTR) && (rc != -EAGAIN) && (rc != -EBUSY))
+		{
+			WLog_ERR(TAG, "io_uring_submit: %s", strerror(-rc));
+			return FALSE;
+		}
+		/* the kernel is short on completion space, it frees up as the thread reaps */
+		Sleep(1);
+	}
+	return FALSE;
+}
+
+/* the caller preps the entry, then sets the request as its data, preps clear user_data */
+static struct io_uring_sqe* xf_drive_io_prepare(XfDriveIo* io, pcXfDriveIoDone done,
+                                                void* context, xfDriveIoRequest** prequest)
+{
+	if (!io->ringReady)
+		return NULL;
+
+	if (InterlockedCompareExchange(&io->inflight, 0, 0) >= XF_DRIVE_IO_QUEUE_DEPTH)
+		return NULL;
+
+	xfDriveIoRequest* request = calloc(1, sizeof(xfDriveIoRequest));
+	if (!request)
+		return NULL;
+
+	/* every submission is flushed right away, so a slot is free below the queue depth */
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&io->ring);
+	if (!sqe)
+	{
+		free(request);
+		return NULL;
+	}
+	request->done = done;
+	request->context = context;
+	*prequest = request;
+	return sqe;
+}
+
+/* FALSE if the request could not be submitted, the caller then does it synchronously */
+static BOOL xf_drive_io_queue(XfDriveIo* io, struct io_uring_sqe* sqe, xfDriveIoRequest* request)
+{
+	io_uring_sqe_set_data(sqe, request);
+	(void)InterlockedIncrement(&io->inflight);
+
+	if (xf_drive_io_submit(io))
+	{
+		io->queued++;
+		return TRUE;
+	}
+
+	/* the entry stays in the submission queue and goes out with the next submit, as a NOP, so
+	 * the buffer is not touched after the synchronous fallback completed the request */
+	WLog_WARN(TAG, "submit failed, doing the request synchronously");
+	io_uring_prep_nop(sqe);
+	io_uring_sqe_set_data(sqe, &xf_drive_io_orphan);
+	(void)InterlockedDecrement(&io->inflight);
+	free(request);
+	return FALSE;
+}
+#endif
+
+XfDriveIo* xf_drive_io_new(void)
+{
+	XfDriveIo* io = calloc(1, sizeof(XfDriveIo));
+	if (!io)
+		return NULL;
+
+#ifdef WITH_IO_URING
+	const int rc = io_uring_queue_init(XF_DRIVE_IO_QUEUE_DEPTH, &io->ring, 0);
+	if (rc < 0)
+	{
+		WLog_WARN(TAG, "io_uring_queue_init: %s, using synchronous I/O", strerror(-rc));
+		return io;
+	}
+
+	io->thread = CreateThread(NULL, 0, xf_drive_io_thread, io, 0, NULL);
+	if (!io->thread)
+	{
+		WLog_WARN(TAG, "CreateThread failed, using synchronous I/O");
+		io_uring_queue_exit(&io->ring);
+		return io;
+	}
+	io->ringReady = TRUE;
+#else
+	WLog_DBG(TAG, "built without io_uring, using synchronous I/O");
+#endif
+	return io;
+}
+
+void xf_drive_io_free(XfDriveIo* io)
+{
+	if (!io)
+		return;
+
+#ifdef WITH_IO_URING
+	if (io->ringReady)
+	{
+		struct io_uring_sqe* sqe = io_uring_get_sqe(&io->ring);
+		if (sqe)
+		{
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data(sqe, NULL);
+		}
+
+		if (sqe && xf_drive_io_submit(io))
+			(void)WaitForSingleObject(io->thread, INFINITE);
+		else
+			WLog_ERR(TAG, "failed to stop the completion thread");
+		(void)CloseHandle(io->thread);
+		io_uring_queue_exit(&io->ring);
+	}
+#endif
+
+	WLog_DBG(TAG, "%" PRIu64 " requests queued, %" PRIu64 " synchronous", io->queued,
+	         io->synchronous);
+	free(io);
+}
+
+BOOL xf_drive_io_read(XfDriveIo* io, int fd, BYTE* buffer, UINT32 length, UINT64 offset,
+                      pcXfDriveIoDone done, void* context)
+{
+	WINPR_ASSERT(io);
+	WINPR_ASSERT(buffer || (length == 0));
+	WINPR_ASSERT(done);
+
+	if (offset > INT64_MAX)
+		return FALSE;
+
+#ifdef WITH_IO_URING
+	xfDriveIoRequest* request = NULL;
+	struct io_uring_sqe* sqe = xf_drive_io_prepare(io, done, context, &request);
+	if (sqe)
+	{
+		io_uring_prep_read(sqe, fd, buffer, length, offset);
+		if (xf_drive_io_queue(io, sqe, request))
+			return TRUE;
+	}
+#endif
+
+	io->synchronous++;
+	done(context, xf_drive_io_pread(fd, buffer, length, offset));
+	return TRUE;
+}
+
+BOOL xf_drive_io_write(XfDriveIo* io, int fd, const BYTE* buffer, UINT32 length, UINT64 offset,
+                       pcXfDriveIoDone done, void* context)
+{
+	WINPR_ASSERT(io);
+	WINPR_ASSERT(buffer || (length == 0));
+	WINPR_ASSERT(done);
+
+	if (offset > INT64_MAX)
+		return FALSE;
+
+#ifdef WITH_IO_URING
+	xfDriveIoRequest* request = NULL;
+	struct io_uring_sqe* sqe = xf_drive_io_prepare(io, done, context, &request);
+	if (sqe)
+	{
+		io_uring_prep_write(sqe, fd, buffer, length, offset);
+		if (xf_drive_io_queue(io, sqe, request))
+			return TRUE;
+	}
+#endif
+
+	io->synchronous++;
+	done(context, xf_drive_io_pwrite(fd, buffer, length, offset));
+	return TRUE;
+}
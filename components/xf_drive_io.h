@@ -0,0 +1,52 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 drive redirection - asynchronous file I/O
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_DRIVE_IO_H
+#define FREERDP_CLIENT_X11_DRIVE_IO_H
+
+#include <winpr/wtypes.h>
+
+/* Submission queue entries, also the most reads and writes in flight at once */
+#define XF_DRIVE_IO_QUEUE_DEPTH 128
+
+typedef struct xf_drive_io XfDriveIo;
+
+/* result is the number of bytes transferred or a negative errno */
+typedef void (*pcXfDriveIoDone)(void* context, INT64 result);
+
+/*
+ * Reads and writes at an offset without a thread per request. With io_uring every request is
+ * queued to the kernel and returns at once, a single completion thread reaps the results and
+ * calls done for each, in completion order. Without io_uring support in the build or the
+ * kernel, whenever XF_DRIVE_IO_QUEUE_DEPTH requests are already in flight and when the submit
+ * fails, the request is carried out with pread / pwrite before the call returns, done is then
+ * called on the submitting thread.
+ *
+ * Submit from one thread at a time. done is called exactly once for every request that was
+ * accepted, requests that were not accepted never call it.
+ */
+XfDriveIo* xf_drive_io_new(void);
+
+/* Waits for the requests in flight, their done callbacks run before this returns */
+void xf_drive_io_free(XfDriveIo* io);
+
+BOOL xf_drive_io_read(XfDriveIo* io, int fd, BYTE* buffer, UINT32 length, UINT64 offset,
+                      pcXfDriveIoDone done, void* context);
+BOOL xf_drive_io_write(XfDriveIo* io, int fd, const BYTE* buffer, UINT32 length, UINT64 offset,
+                       pcXfDriveIoDone done, void* context);
+
+#endif /* FREERDP_CLIENT_X11_DRIVE_IO_H */
@@ -0,0 +1,126 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 per frame flush scheduling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+
+#include "xf_flush.h"
+#include "xf_utils.h"
+#include "../context/client_context.h"
+
+#define TAG CLIENT_TAG("x11")
+
+#define FLUSH_RATE_WINDOW_NS 1000000000ull
+
+static void flush_update_rates(XfFlushState* state)
+{
+	const UINT64 now = winpr_GetTickCount64NS();
+
+	if (state->windowStart == 0)
+	{
+		state->windowStart = now;
+		state->windowFlushes = state->flushes;
+		state->windowSyncs = state->syncs;
+		return;
+	}
+
+	const UINT64 elapsed = now - state->windowStart;
+	if (elapsed < FLUSH_RATE_WINDOW_NS)
+		return;
+
+	const double seconds = (double)elapsed / (double)FLUSH_RATE_WINDOW_NS;
+	state->flushesPerSecond = (double)(state->flushes - state->windowFlushes) / seconds;
+	state->syncsPerSecond = (double)(state->syncs - state->windowSyncs) / seconds;
+	state->windowStart = now;
+	state->windowFlushes = state->flushes;
+	state->windowSyncs = state->syncs;
+
+	WLog_DBG(TAG, "X flushes/s: %.1f, syncs/s: %.1f (%" PRId64 " flush requests total)",
+	         state->flushesPerSecond, state->syncsPerSecond, state->requests);
+}
+
+void xf_flush_mark_dirty(clientContext* clicon)
+{
+	WINPR_ASSERT(clicon);
+
+	XfFlushState* state = &clicon->flush;
+	(void)InterlockedIncrement64(&state->requests);
+	(void)InterlockedExchange(&state->dirty, 1);
+}
+
+BOOL xf_flush_end_cycle(clientContext* clicon)
+{
+	WINPR_ASSERT(clicon);
+
+	XfFlushState* state = &clicon->flush;
+	BOOL rc = TRUE;
+
+	if (clicon->display && (InterlockedExchange(&state->dirty, 0) != 0))
+	{
+		rc = LogDynAndXFlush(clicon->log, clicon->display) == 1;
+		(void)InterlockedIncrement64(&state->flushes);
+	}
+
+	flush_update_rates(state);
+	return rc;
+}
+
+BOOL xf_flush_now(clientContext* clicon)
+{
+	WINPR_ASSERT(clicon);
+
+	XfFlushState* state = &clicon->flush;
+	if (!clicon->display)
+		return FALSE;
+
+	/* everything marked so far goes out with this flush */
+	(void)InterlockedExchange(&state->dirty, 0);
+	const int rc = LogDynAndXFlush(clicon->log, clicon->display);
+	(void)InterlockedIncrement64(&state->flushes);
+	return rc == 1;
+}
+
+BOOL xf_flush_barrier(clientContext* clicon, BOOL discard)
+{
+	WINPR_ASSERT(clicon);
+
+	XfFlushState* state = &clicon->flush;
+	if (!clicon->display)
+		return FALSE;
+
+	/* XSync flushes the request buffer first, so nothing is left dirty */
+	(void)InterlockedExchange(&state->dirty, 0);
+	const int rc = LogDynAndXSync(clicon->log, clicon->display, discard ? True : False);
+	(void)InterlockedIncrement64(&state->syncs);
+	return rc == 1;
+}
+
+void xf_flush_get_stats(clientContext* clicon, XfFlushStats* stats)
+{
+	WINPR_ASSERT(clicon);
+	WINPR_ASSERT(stats);
+
+	const XfFlushState* state = &clicon->flush;
+	stats->requests = (UINT64)state->requests;
+	stats->flushes = (UINT64)state->flushes;
+	stats->syncs = (UINT64)state->syncs;
+	stats->flushesPerSecond = state->flushesPerSecond;
+	stats->syncsPerSecond = state->syncsPerSecond;
+}
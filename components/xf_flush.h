@@ -0,0 +1,67 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 per frame flush scheduling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_FLUSH_H
+#define FREERDP_CLIENT_X11_FLUSH_H
+
+#include <winpr/wtypes.h>
+
+typedef struct client_context clientContext;
+
+typedef struct
+{
+	volatile LONG dirty;
+	volatile LONGLONG requests; /* xf_flush_mark_dirty calls */
+	volatile LONGLONG flushes;
+	volatile LONGLONG syncs;
+
+	/* rates over the last completed one second window */
+	UINT64 windowStart;
+	LONGLONG windowFlushes;
+	LONGLONG windowSyncs;
+	double flushesPerSecond;
+	double syncsPerSecond;
+} XfFlushState;
+
+typedef struct
+{
+	UINT64 requests;
+	UINT64 flushes;
+	UINT64 syncs;
+	double flushesPerSecond;
+	double syncsPerSecond;
+} XfFlushStats;
+
+/* Drawing code calls this instead of XFlush, the request buffer is sent at the end of the
+ * current dispatch cycle. Safe to call from any thread. */
+void xf_flush_mark_dirty(clientContext* clicon);
+
+/* Called once per dispatch cycle / frame, flushes if anything was marked dirty */
+BOOL xf_flush_end_cycle(clientContext* clicon);
+
+/* Flushes right away, for threads outside the dispatch loop (channel callbacks) that have no end
+ * of cycle to wait for. The caller holds XLockDisplay. Counted like a cycle flush. */
+BOOL xf_flush_now(clientContext* clicon);
+
+/* Explicit barrier: flushes and waits until the server processed every request. Only for code
+ * that needs the round trip, e.g. before reading back server side state. This is the only
+ * place LogDynAndXSync may be called from, so every sync is counted. */
+BOOL xf_flush_barrier(clientContext* clicon, BOOL discard);
+
+void xf_flush_get_stats(clientContext* clicon, XfFlushStats* stats);
+
+#endif /* FREERDP_CLIENT_X11_FLUSH_H */
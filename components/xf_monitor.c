@@ -50,6 +50,7 @@
 #endif
 
 #include "xf_monitor.h"
+#include "xf_settings.h"
 #include "xf_utils.h"
 #include "../context/client_context.h"
 #include "xf_window.h"
@@ -120,25 +121,9 @@ int xf_list_monitors(clientContext* xfc)
 
 static BOOL xf_is_monitor_id_active(clientContext* xfc, UINT32 id)
 {
-	const rdpSettings* settings = NULL;
-
 	WINPR_ASSERT(xfc);
 
-	settings = xfc->common.context.settings;
-	WINPR_ASSERT(settings);
-
-	const UINT32 NumMonitorIds = freerdp_settings_get_uint32(settings, FreeRDP_NumMonitorIds);
-	if (NumMonitorIds == 0)
-		return TRUE;
-
-	for (UINT32 index = 0; index < NumMonitorIds; index++)
-	{
-		const UINT32* cur = freerdp_settings_get_pointer_array(settings, FreeRDP_MonitorIds, index);
-		if (cur && (*cur == id))
-			return TRUE;
-	}
-
-	return FALSE;
+	return xf_settings_snapshot_monitor_id_active(&xfc->settingsSnapshot, id);
 }
 
 BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeight)
@@ -166,16 +151,17 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 
 	rdpSettings* settings = xfc->common.context.settings;
 	VIRTUAL_SCREEN* vscreen = &xfc->vscreen;
+	const SettingsSnapshot* snapshot = &xfc->settingsSnapshot;
 
-	*pMaxWidth = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
-	*pMaxHeight = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+	*pMaxWidth = snapshot->desktopWidth;
+	*pMaxHeight = snapshot->desktopHeight;
 
-	if (freerdp_settings_get_uint64(settings, FreeRDP_ParentWindowId) > 0)
+	if (snapshot->parentWindowId > 0)
 	{
 		xfc->workArea.x = 0;
 		xfc->workArea.y = 0;
-		xfc->workArea.width = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
-		xfc->workArea.height = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+		xfc->workArea.width = snapshot->desktopWidth;
+		xfc->workArea.height = snapshot->desktopHeight;
 		return TRUE;
 	}
 
@@ -285,14 +271,12 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 	   without remote app, we force the number of monitors be 1 so later
 	   the rest of the client don't end up using more monitors than the user desires.
 	 */
-	if ((!freerdp_settings_get_bool(settings, FreeRDP_UseMultimon) &&
-	     !freerdp_settings_get_bool(settings, FreeRDP_SpanMonitors)) ||
-	    (freerdp_settings_get_bool(settings, FreeRDP_Workarea) &&
-	     !freerdp_settings_get_bool(settings, FreeRDP_RemoteApplicationMode)))
+	if ((!snapshot->useMultimon && !snapshot->spanMonitors) ||
+	    (snapshot->workarea && !snapshot->remoteApplicationMode))
 	{
 		/* If no monitors were specified on the command-line then set the current monitor as active
 		 */
-		if (freerdp_settings_get_uint32(settings, FreeRDP_NumMonitorIds) == 0)
+		if (snapshot->numMonitorIds == 0)
 		{
 			UINT32 id = current_monitor;
 			if (!freerdp_settings_set_pointer_len(settings, FreeRDP_MonitorIds, &id, 1))
@@ -305,6 +289,10 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		 */
 		if (!freerdp_settings_set_uint32(settings, FreeRDP_NumMonitorIds, 1))
 			goto fail;
+
+		/* monitor ids changed, refresh the copy the rest of this function reads */
+		if (!xf_settings_snapshot_update(xfc))
+			goto fail;
 	}
 
 	/* WORKAROUND: With Remote Application Mode - using NET_WM_WORKAREA
@@ -312,15 +300,14 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 	 * (the bottom of the window area is never updated). So, we just set
 	 * the workArea to match the full Screen width/height.
 	 */
-	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteApplicationMode) || !xf_GetWorkArea(xfc))
+	if (snapshot->remoteApplicationMode || !xf_GetWorkArea(xfc))
 	{
 		/*
 		   if only 1 monitor is enabled, use monitor area
 		   this is required in case of a screen composed of more than one monitor
 		   but user did not enable multimonitor
 		*/
-		if ((freerdp_settings_get_uint32(settings, FreeRDP_NumMonitorIds) == 1) &&
-		    (vscreen->nmonitors > current_monitor))
+		if ((snapshot->numMonitorIds == 1) && (vscreen->nmonitors > current_monitor))
 		{
 			MONITOR_INFO* monitor = vscreen->monitors + current_monitor;
 
@@ -341,17 +328,17 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		}
 	}
 
-	if (freerdp_settings_get_bool(settings, FreeRDP_Fullscreen))
+	if (snapshot->fullscreen)
 	{
 		*pMaxWidth = WINPR_ASSERTING_INT_CAST(uint32_t, WidthOfScreen(xfc->screen));
 		*pMaxHeight = WINPR_ASSERTING_INT_CAST(uint32_t, HeightOfScreen(xfc->screen));
 	}
-	else if (freerdp_settings_get_bool(settings, FreeRDP_Workarea))
+	else if (snapshot->workarea)
 	{
 		*pMaxWidth = xfc->workArea.width;
 		*pMaxHeight = xfc->workArea.height;
 	}
-	else if (freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen))
+	else if (snapshot->percentScreen)
 	{
 		/* If we have specific monitor information then limit the PercentScreen value
 		 * to only affect the current monitor vs. the entire desktop
@@ -367,50 +354,38 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 			*pMaxWidth = area->right - area->left + 1;
 			*pMaxHeight = area->bottom - area->top + 1;
 
-			if (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth))
-				*pMaxWidth = ((area->right - area->left + 1) *
-				              freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)) /
-				             100;
+			if (snapshot->percentScreenUseWidth)
+				*pMaxWidth = ((area->right - area->left + 1) * snapshot->percentScreen) / 100;
 
-			if (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseHeight))
-				*pMaxHeight = ((area->bottom - area->top + 1) *
-				               freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)) /
-				              100;
+			if (snapshot->percentScreenUseHeight)
+				*pMaxHeight = ((area->bottom - area->top + 1) * snapshot->percentScreen) / 100;
 		}
 		else
 		{
 			*pMaxWidth = xfc->workArea.width;
 			*pMaxHeight = xfc->workArea.height;
 
-			if (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth))
-				*pMaxWidth = (xfc->workArea.width *
-				              freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)) /
-				             100;
+			if (snapshot->percentScreenUseWidth)
+				*pMaxWidth = (xfc->workArea.width * snapshot->percentScreen) / 100;
 
-			if (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseHeight))
-				*pMaxHeight = (xfc->workArea.height *
-				               freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)) /
-				              100;
+			if (snapshot->percentScreenUseHeight)
+				*pMaxHeight = (xfc->workArea.height * snapshot->percentScreen) / 100;
 		}
 	}
-	else if (freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth) &&
-	         freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight))
+	else if (snapshot->desktopWidth && snapshot->desktopHeight)
 	{
-		*pMaxWidth = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
-		*pMaxHeight = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+		*pMaxWidth = snapshot->desktopWidth;
+		*pMaxHeight = snapshot->desktopHeight;
 	}
 
 	/* Create array of all active monitors by taking into account monitors requested on the
 	 * command-line */
 	size_t nmonitors = 0;
 	{
-		UINT32 nr = 0;
+		const UINT32 nr = snapshot->firstMonitorId;
+		const UINT32 psuw = snapshot->percentWidth;
+		const UINT32 psuh = snapshot->percentHeight;
 
-		{
-			const UINT32* ids = freerdp_settings_get_pointer(settings, FreeRDP_MonitorIds);
-			if (ids)
-				nr = *ids;
-		}
 		for (UINT32 i = 0; i < vscreen->nmonitors; i++)
 		{
 			MONITOR_ATTRIBUTES* attrs = NULL;
@@ -422,36 +397,14 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 				goto fail;
 
 			rdpMonitor* monitor = &rdpmonitors[nmonitors];
-			monitor->x =
-			    WINPR_ASSERTING_INT_CAST(
-			        int32_t, vscreen->monitors[i].area.left*(
-			                     freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth)
-			                         ? freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)
-			                         : 100)) /
-			    100;
-			monitor->y =
-			    WINPR_ASSERTING_INT_CAST(
-			        int32_t, vscreen->monitors[i].area.top*(
-			                     freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseHeight)
-			                         ? freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)
-			                         : 100)) /
-			    100;
+			const RECTANGLE_16* area = &vscreen->monitors[i].area;
+			monitor->x = WINPR_ASSERTING_INT_CAST(int32_t, area->left * psuw) / 100;
+			monitor->y = WINPR_ASSERTING_INT_CAST(int32_t, area->top * psuh) / 100;
 			monitor->width =
-			    WINPR_ASSERTING_INT_CAST(
-			        int32_t,
-			        (vscreen->monitors[i].area.right - vscreen->monitors[i].area.left + 1) *
-			            (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth)
-			                 ? freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)
-			                 : 100)) /
-			    100;
+			    WINPR_ASSERTING_INT_CAST(int32_t, (area->right - area->left + 1) * psuw) / 100;
+			/* height follows the width percentage, as it always has */
 			monitor->height =
-			    WINPR_ASSERTING_INT_CAST(
-			        int32_t,
-			        (vscreen->monitors[i].area.bottom - vscreen->monitors[i].area.top + 1) *
-			            (freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth)
-			                 ? freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen)
-			                 : 100)) /
-			    100;
+			    WINPR_ASSERTING_INT_CAST(int32_t, (area->bottom - area->top + 1) * psuw) / 100;
 			monitor->orig_screen = i;
 #ifdef USABLE_XRANDR
 
@@ -512,7 +465,7 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		goto fail;
 
 	/* If we have specific monitor information */
-	if (freerdp_settings_get_uint32(settings, FreeRDP_MonitorCount) > 0)
+	if (nmonitors > 0)
 	{
 		const rdpMonitor* cmonitor = &rdpmonitors[0];
 		if (!cmonitor)
@@ -532,7 +485,13 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		/* Calculate bounding rectangle around all monitors to be used AND
 		 * also set the Xinerama indices which define left/top/right/bottom monitors.
 		 */
-		for (UINT32 i = 0; i < freerdp_settings_get_uint32(settings, FreeRDP_MonitorCount); i++)
+		const UINT32 ps = snapshot->percentScreen;
+		WINPR_ASSERT(ps <= 100);
+
+		const int psuw = (int)snapshot->percentWidth;
+		const int psuh = (int)snapshot->percentHeight;
+
+		for (size_t i = 0; i < nmonitors; i++)
 		{
 			rdpMonitor* monitor = &rdpmonitors[i];
 
@@ -555,13 +514,6 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 			if (vB != destB)
 				xfc->fullscreenMonitors.bottom = orig;
 
-			const UINT32 ps = freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen);
-			WINPR_ASSERT(ps <= 100);
-
-			const int psuw =
-			    freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth) ? (int)ps : 100;
-			const int psuh =
-			    freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseHeight) ? (int)ps : 100;
 			vX = (destX * psuw) / 100;
 			vY = (destY * psuh) / 100;
 			vR = (destR * psuw) / 100;
@@ -575,7 +527,7 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		const int b = vB - vY - 1;
 		vscreen->area.bottom = WINPR_ASSERTING_INT_CAST(UINT16, b);
 
-		if (freerdp_settings_get_bool(settings, FreeRDP_Workarea))
+		if (snapshot->workarea)
 		{
 			INT64 bottom = 1LL * xfc->workArea.height + xfc->workArea.y - 1LL;
 			vscreen->area.top = WINPR_ASSERTING_INT_CAST(UINT16, xfc->workArea.y);
@@ -585,13 +537,10 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 		if (!primaryMonitorFound)
 		{
 			/* If we have a command line setting we should use it */
-			if (freerdp_settings_get_uint32(settings, FreeRDP_NumMonitorIds) > 0)
+			if (snapshot->numMonitorIds > 0)
 			{
 				/* The first monitor is the first in the setting which should be used */
-				UINT32* ids =
-				    freerdp_settings_get_pointer_array_writable(settings, FreeRDP_MonitorIds, 0);
-				if (ids)
-					monitor_index = *ids;
+				monitor_index = snapshot->firstMonitorId;
 			}
 			else
 			{
@@ -615,8 +564,7 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 			{
 				/* Lets try to see if there is a monitor with a 0,0 coordinate and use it as a
 				 * fallback*/
-				for (UINT32 i = 0; i < freerdp_settings_get_uint32(settings, FreeRDP_MonitorCount);
-				     i++)
+				for (size_t i = 0; i < nmonitors; i++)
 				{
 					rdpMonitor* monitor = &rdpmonitors[i];
 					if (!primaryMonitorFound && monitor->x == 0 && monitor->y == 0)
@@ -637,7 +585,6 @@ BOOL xf_detect_monitors(clientContext* xfc, UINT32* pMaxWidth, UINT32* pMaxHeigh
 	/* some 2008 server freeze at logon if we announce support for monitor layout PDU with
 	 * #monitors < 2. So let's announce it only if we have more than 1 monitor.
 	 */
-	nmonitors = freerdp_settings_get_uint32(settings, FreeRDP_MonitorCount);
 	if (nmonitors > 1)
 	{
 		if (!freerdp_settings_set_bool(settings, FreeRDP_SupportMonitorLayoutPdu, TRUE))
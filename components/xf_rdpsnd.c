@@ -0,0 +1,581 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/cast.h>
+#include <winpr/interlocked.h>
+#include <winpr/stream.h>
+#include <winpr/string.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/thread.h>
+
+#include <freerdp/addin.h>
+#include <freerdp/channels/rdpsnd.h>
+#include <freerdp/client/cmdline.h>
+#include <freerdp/client/rdpsnd.h>
+#include <freerdp/codec/audio.h>
+#include <freerdp/codec/dsp.h>
+#include <freerdp/log.h>
+
+#include "xf_rdpsnd.h"
+#include "xf_rdpsnd_ring.h"
+#include "xf_rdpsnd_sink.h"
+
+#define TAG CLIENT_TAG("x11.rdpsnd")
+
+/* Encoded audio the ring holds at least, one second of the format if that is more */
+#define XF_RDPSND_RING_SIZE (256 * 1024)
+
+/* Interval of the debug log of the counters, in ms */
+#define XF_RDPSND_REPORT_INTERVAL 5000
+
+typedef struct
+{
+	rdpsndDevicePlugin device;
+
+	char* sinkName;
+	char* sinkDevice;
+	volatile LONG volume; /* rdpsnd volume, left channel in the low word */
+
+	/* set up by Open, torn down by Close */
+	AUDIO_FORMAT format;
+	BOOL open;
+	XfRdpsndSink* sink;
+	XfRdpsndRing* ring;
+	FREERDP_DSP_CONTEXT* dsp; /* NULL for PCM */
+	HANDLE wake;
+	HANDLE thread;
+	volatile LONG stop;
+	size_t frameSize;
+	UINT32 minTarget;
+	UINT32 maxTarget;
+
+	/* audio thread only */
+	BYTE* packet;
+	size_t packetCapacity;
+	wStream* decoded;
+	BYTE* fifo; /* the jitter buffer, decoded frames from fifoStart to fifoEnd */
+	size_t fifoStart;
+	size_t fifoEnd;
+	size_t fifoCapacity;
+	UINT32 target;
+	BOOL playing;
+	UINT64 stableSince;
+	UINT64 lastReport;
+
+	/* counters, packets and drops are written by the channel thread, the rest by the audio one */
+	volatile LONGLONG packets;
+	volatile LONGLONG dropped;
+	volatile LONGLONG underruns;
+	volatile LONGLONG trimmed; /* ms cut from an overfull buffer */
+	volatile LONG depth;       /* ms in the jitter buffer */
+	volatile LONG maxDepth;
+	volatile LONG latency; /* ms until a packet queued now is heard */
+} xfRdpsndDevice;
+
+static UINT32 xf_rdpsnd_frames_to_ms(const xfRdpsndDevice* xf, size_t frames)
+{
+	return (UINT32)((UINT64)frames * 1000ull / xf->format.nSamplesPerSec);
+}
+
+static size_t xf_rdpsnd_ms_to_frames(const xfRdpsndDevice* xf, UINT32 ms)
+{
+	return (size_t)((UINT64)ms * xf->format.nSamplesPerSec / 1000ull);
+}
+
+static size_t xf_rdpsnd_fifo_frames(const xfRdpsndDevice* xf)
+{
+	return (xf->fifoEnd - xf->fifoStart) / xf->frameSize;
+}
+
+static void xf_rdpsnd_fifo_consume(xfRdpsndDevice* xf, size_t frames)
+{
+	xf->fifoStart += frames * xf->frameSize;
+	if (xf->fifoStart == xf->fifoEnd)
+		xf->fifoStart = xf->fifoEnd = 0;
+}
+
+static BOOL xf_rdpsnd_fifo_append(xfRdpsndDevice* xf, const BYTE* data, size_t size)
+{
+	size -= size % xf->frameSize;
+	if (size == 0)
+		return TRUE;
+
+	if (xf->fifoEnd + size > xf->fifoCapacity)
+	{
+		memmove(xf->fifo, &xf->fifo[xf->fifoStart], xf->fifoEnd - xf->fifoStart);
+		xf->fifoEnd -= xf->fifoStart;
+		xf->fifoStart = 0;
+	}
+
+	if (xf->fifoEnd + size > xf->fifoCapacity)
+	{
+		const size_t capacity = MAX(xf->fifoCapacity * 2, xf->fifoEnd + size);
+		BYTE* fifo = realloc(xf->fifo, capacity);
+		if (!fifo)
+			return FALSE;
+		xf->fifo = fifo;
+		xf->fifoCapacity = capacity;
+	}
+
+	memcpy(&xf->fifo[xf->fifoEnd], data, size);
+	xf->fifoEnd += size;
+	return TRUE;
+}
+
+/* Decodes everything the channel thread queued into the jitter buffer */
+static BOOL xf_rdpsnd_drain(xfRdpsndDevice* xf)
+{
+	size_t size = 0;
+	while ((size = xf_rdpsnd_ring_peek(xf->ring)) > 0)
+	{
+		if (size > xf->packetCapacity)
+		{
+			BYTE* packet = realloc(xf->packet, size);
+			if (!packet)
+				return FALSE;
+			xf->packet = packet;
+			xf->packetCapacity = size;
+		}
+
+		if (!xf_rdpsnd_ring_pop(xf->ring, xf->packet, xf->packetCapacity, &size))
+			return FALSE;
+
+		const BYTE* pcm = xf->packet;
+		if (xf->dsp)
+		{
+			Stream_SetPosition(xf->decoded, 0);
+			if (!freerdp_dsp_decode(xf->dsp, &xf->format, xf->packet, size, xf->decoded))
+			{
+				WLog_WARN(TAG, "failed to decode a %" PRIuz " byte packet", size);
+				continue;
+			}
+			pcm = Stream_Buffer(xf->decoded);
+			size = Stream_GetPosition(xf->decoded);
+		}
+
+		if (!xf_rdpsnd_fifo_append(xf, pcm, size))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void xf_rdpsnd_apply_volume(xfRdpsndDevice* xf, BYTE* frames, size_t count)
+{
+	const UINT32 volume = (UINT32)InterlockedCompareExchange(&xf->volume, 0, 0);
+	if (volume == UINT32_MAX)
+		return;
+
+	const INT32 gain[2] = { (INT32)(volume & 0xFFFF), (INT32)(volume >> 16) };
+	const size_t channels = xf->frameSize / 2;
+	for (size_t x = 0; x < count * channels; x++)
+	{
+		const INT16 sample = (INT16)winpr_Data_Get_UINT16(&frames[x * 2]);
+		const INT32 scaled = (sample * gain[MIN(x % channels, 1)]) / 0xFFFF;
+		winpr_Data_Write_UINT16(&frames[x * 2], (UINT16)(INT16)scaled);
+	}
+}
+
+static void xf_rdpsnd_report(xfRdpsndDevice* xf, UINT64 now, BOOL force)
+{
+	if (!force && (now - xf->lastReport < XF_RDPSND_REPORT_INTERVAL * 1000000ull))
+		return;
+
+	xf->lastReport = now;
+	WLog_Print(WLog_Get(TAG), force ? WLOG_INFO : WLOG_DEBUG,
+	           "%" PRId64 " packets, %" PRId64 " dropped, %" PRId64 " underruns, %" PRId64
+	           " ms trimmed, depth %" PRId32 " ms (max %" PRId32 " ms), target %" PRIu32 " ms",
+	           InterlockedCompareExchange64(&xf->packets, 0, 0),
+	           InterlockedCompareExchange64(&xf->dropped, 0, 0),
+	           InterlockedCompareExchange64(&xf->underruns, 0, 0),
+	           InterlockedCompareExchange64(&xf->trimmed, 0, 0),
+	           InterlockedCompareExchange(&xf->depth, 0, 0),
+	           InterlockedCompareExchange(&xf->maxDepth, 0, 0), xf->target);
+}
+
+static void xf_rdpsnd_update_depth(xfRdpsndDevice* xf)
+{
+	const LONG depth = (LONG)xf_rdpsnd_frames_to_ms(xf, xf_rdpsnd_fifo_frames(xf));
+
+	(void)InterlockedExchange(&xf->depth, depth);
+	if (depth > xf->maxDepth)
+		(void)InterlockedExchange(&xf->maxDepth, depth);
+	(void)InterlockedExchange(&xf->latency, depth + (LONG)xf->sink->delay(xf->sink));
+}
+
+/* Moves the target towards the configured latency and keeps the buffer from running away */
+static void xf_rdpsnd_adapt(xfRdpsndDevice* xf, UINT64 now)
+{
+	if ((now - xf->stableSince >= XF_RDPSND_STABLE_INTERVAL * 1000000ull) &&
+	    (xf->target > xf->minTarget))
+	{
+		xf->target = (xf->target - xf->minTarget > XF_RDPSND_LATENCY_STEP)
+		                 ? xf->target - XF_RDPSND_LATENCY_STEP
+		                 : xf->minTarget;
+		xf->stableSince = now;
+	}
+
+	const size_t frames = xf_rdpsnd_fifo_frames(xf);
+	const size_t limit = xf_rdpsnd_ms_to_frames(xf, 2 * xf->target + XF_RDPSND_PERIOD);
+	if (frames > limit)
+	{
+		const size_t excess = frames - xf_rdpsnd_ms_to_frames(xf, xf->target);
+		xf_rdpsnd_fifo_consume(xf, excess);
+		(void)InterlockedExchangeAdd64(&xf->trimmed, xf_rdpsnd_frames_to_ms(xf, excess));
+	}
+}
+
+static DWORD WINAPI xf_rdpsnd_thread(LPVOID arg)
+{
+	xfRdpsndDevice* xf = arg;
+	WINPR_ASSERT(xf);
+
+	const size_t period = MAX(1, xf_rdpsnd_ms_to_frames(xf, XF_RDPSND_PERIOD));
+
+	while (InterlockedCompareExchange(&xf->stop, 0, 0) == 0)
+	{
+		if (!xf_rdpsnd_drain(xf))
+		{
+			WLog_ERR(TAG, "out of memory, audio stopped");
+			break;
+		}
+
+		const UINT64 now = winpr_GetTickCount64NS();
+		xf_rdpsnd_update_depth(xf);
+		xf_rdpsnd_report(xf, now, FALSE);
+
+		const size_t frames = xf_rdpsnd_fifo_frames(xf);
+		if (!xf->playing)
+		{
+			if (frames < xf_rdpsnd_ms_to_frames(xf, xf->target))
+			{
+				(void)WaitForSingleObject(xf->wake, XF_RDPSND_PERIOD);
+				continue;
+			}
+
+			xf->playing = TRUE;
+			xf->stableSince = now;
+		}
+
+		if (frames == 0)
+		{
+			/* the sink still plays what it has, more may arrive before it runs dry */
+			const DWORD wait = MAX(1, xf->sink->delay(xf->sink) / 2);
+			if (WaitForSingleObject(xf->wake, wait) == WAIT_OBJECT_0)
+				continue;
+
+			(void)InterlockedIncrement64(&xf->underruns);
+			xf->playing = FALSE;
+			xf->target = MIN(xf->maxTarget, xf->target + XF_RDPSND_LATENCY_STEP);
+			continue;
+		}
+
+		const size_t count = MIN(period, frames);
+		BYTE* data = &xf->fifo[xf->fifoStart];
+		xf_rdpsnd_apply_volume(xf, data, count);
+		if (!xf->sink->write(xf->sink, data, count))
+		{
+			WLog_ERR(TAG, "audio sink %s failed, audio stopped", xf->sink->name);
+			break;
+		}
+
+		xf_rdpsnd_fifo_consume(xf, count);
+		xf_rdpsnd_adapt(xf, now);
+	}
+
+	return 0;
+}
+
+static BOOL xf_rdpsnd_format_supported(WINPR_ATTR_UNUSED rdpsndDevicePlugin* device,
+                                       const AUDIO_FORMAT* format)
+{
+	WINPR_ASSERT(format);
+
+	if ((format->nChannels < 1) || (format->nChannels > 2) || (format->nSamplesPerSec == 0))
+		return FALSE;
+
+	/* compressed formats are decoded on the audio thread instead of by rdpsnd */
+	if (format->wFormatTag == WAVE_FORMAT_PCM)
+		return format->wBitsPerSample == 16;
+	return freerdp_dsp_supports_format(format, FALSE);
+}
+
+static void xf_rdpsnd_close(rdpsndDevicePlugin* device)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	WINPR_ASSERT(xf);
+
+	if (xf->thread)
+	{
+		(void)InterlockedExchange(&xf->stop, 1);
+		(void)SetEvent(xf->wake);
+		(void)WaitForSingleObject(xf->thread, INFINITE);
+		(void)CloseHandle(xf->thread);
+		xf->thread = NULL;
+		xf_rdpsnd_report(xf, winpr_GetTickCount64NS(), TRUE);
+	}
+
+	if (xf->sink)
+	{
+		xf->sink->close(xf->sink);
+		xf_rdpsnd_sink_free(xf->sink);
+		xf->sink = NULL;
+	}
+
+	if (xf->wake)
+	{
+		(void)CloseHandle(xf->wake);
+		xf->wake = NULL;
+	}
+
+	xf_rdpsnd_ring_free(xf->ring);
+	xf->ring = NULL;
+	freerdp_dsp_context_free(xf->dsp);
+	xf->dsp = NULL;
+	Stream_Free(xf->decoded, TRUE);
+	xf->decoded = NULL;
+	free(xf->packet);
+	xf->packet = NULL;
+	xf->packetCapacity = 0;
+	free(xf->fifo);
+	xf->fifo = NULL;
+	xf->fifoStart = xf->fifoEnd = xf->fifoCapacity = 0;
+	free(xf->format.data);
+	memset(&xf->format, 0, sizeof(xf->format));
+	xf->open = FALSE;
+}
+
+static BOOL xf_rdpsnd_open(rdpsndDevicePlugin* device, const AUDIO_FORMAT* format,
+                           UINT32 latency)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	WINPR_ASSERT(xf);
+	WINPR_ASSERT(format);
+
+	if (xf->open && audio_format_compatible(&xf->format, format))
+		return TRUE;
+
+	xf_rdpsnd_close(device);
+	if (!xf_rdpsnd_format_supported(device, format) || !audio_format_copy(format, &xf->format))
+		return FALSE;
+	xf->frameSize = 2ull * format->nChannels;
+
+	if (format->wFormatTag != WAVE_FORMAT_PCM)
+	{
+		xf->dsp = freerdp_dsp_context_new(FALSE);
+		xf->decoded = Stream_New(NULL, 4096);
+		if (!xf->dsp || !xf->decoded || !freerdp_dsp_context_reset(xf->dsp, format, 0))
+			goto fail;
+	}
+
+	xf->ring = xf_rdpsnd_ring_new(MAX(XF_RDPSND_RING_SIZE, (size_t)format->nAvgBytesPerSec));
+	xf->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	xf->sink = xf_rdpsnd_sink_new(xf->sinkName, xf->sinkDevice);
+	if (!xf->ring || !xf->wake || !xf->sink)
+		goto fail;
+
+	if (!xf->sink->open(xf->sink, format->nSamplesPerSec, format->nChannels,
+	                    XF_RDPSND_SINK_LATENCY))
+		goto fail;
+
+	xf->minTarget = (latency > 0) ? latency : XF_RDPSND_DEFAULT_LATENCY;
+	xf->maxTarget = xf->minTarget + XF_RDPSND_MAX_EXTRA_LATENCY;
+	xf->target = xf->minTarget;
+	xf->playing = FALSE;
+	xf->lastReport = winpr_GetTickCount64NS();
+	(void)InterlockedExchange64(&xf->packets, 0);
+	(void)InterlockedExchange64(&xf->dropped, 0);
+	(void)InterlockedExchange64(&xf->underruns, 0);
+	(void)InterlockedExchange64(&xf->trimmed, 0);
+	(void)InterlockedExchange(&xf->depth, 0);
+	(void)InterlockedExchange(&xf->maxDepth, 0);
+	(void)InterlockedExchange(&xf->latency, (LONG)xf->minTarget);
+	(void)InterlockedExchange(&xf->stop, 0);
+
+	xf->thread = CreateThread(NULL, 0, xf_rdpsnd_thread, xf, 0, NULL);
+	if (!xf->thread)
+	{
+		WLog_ERR(TAG, "CreateThread failed");
+		goto fail;
+	}
+
+	xf->open = TRUE;
+	WLog_INFO(TAG, "playing %s %" PRIu32 " Hz %" PRIu16 " channels on %s, target %" PRIu32 " ms",
+	          audio_format_get_tag_string(format->wFormatTag), format->nSamplesPerSec,
+	          format->nChannels, xf->sink->name, xf->target);
+	return TRUE;
+
+fail:
+	WLog_ERR(TAG, "failed to open the audio output");
+	xf_rdpsnd_close(device);
+	return FALSE;
+}
+
+/* Called on the channel thread, never waits for the audio thread */
+static UINT xf_rdpsnd_play(rdpsndDevicePlugin* device, const BYTE* data, size_t size)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	WINPR_ASSERT(xf);
+
+	if (!xf->open || (size == 0))
+		return 0;
+
+	(void)InterlockedIncrement64(&xf->packets);
+	if (!xf_rdpsnd_ring_push(xf->ring, data, size))
+		(void)InterlockedIncrement64(&xf->dropped);
+	(void)SetEvent(xf->wake);
+
+	/* reported back to the server with the wave confirm */
+	return (UINT)InterlockedCompareExchange(&xf->latency, 0, 0);
+}
+
+static UINT32 xf_rdpsnd_get_volume(rdpsndDevicePlugin* device)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	WINPR_ASSERT(xf);
+
+	return (UINT32)InterlockedCompareExchange(&xf->volume, 0, 0);
+}
+
+static BOOL xf_rdpsnd_set_volume(rdpsndDevicePlugin* device, UINT32 value)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	WINPR_ASSERT(xf);
+
+	(void)InterlockedExchange(&xf->volume, (LONG)value);
+	return TRUE;
+}
+
+static void xf_rdpsnd_free(rdpsndDevicePlugin* device)
+{
+	xfRdpsndDevice* xf = (xfRdpsndDevice*)device;
+	if (!xf)
+		return;
+
+	xf_rdpsnd_close(device);
+	free(xf->sinkName);
+	free(xf->sinkDevice);
+	free(xf);
+}
+
+static BOOL xf_rdpsnd_parse_args(xfRdpsndDevice* xf, const ADDIN_ARGV* args)
+{
+	if (!args)
+		return TRUE;
+
+	for (int x = 0; x < args->argc; x++)
+	{
+		const char* arg = args->argv[x];
+		char** value = NULL;
+
+		if (strncmp(arg, "sink:", 5) == 0)
+			value = &xf->sinkName;
+		else if (strncmp(arg, "dev:", 4) == 0)
+			value = &xf->sinkDevice;
+		else
+			continue;
+
+		free(*value);
+		*value = _strdup(strchr(arg, ':') + 1);
+		if (!*value)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Function description
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT VCAPITYPE xf_rdpsnd_device_entry(PFREERDP_RDPSND_DEVICE_ENTRY_POINTS pEntryPoints)
+{
+	WINPR_ASSERT(pEntryPoints);
+
+	xfRdpsndDevice* xf = calloc(1, sizeof(xfRdpsndDevice));
+	if (!xf)
+		return CHANNEL_RC_NO_MEMORY;
+
+	xf->device.FormatSupported = xf_rdpsnd_format_supported;
+	xf->device.Open = xf_rdpsnd_open;
+	xf->device.GetVolume = xf_rdpsnd_get_volume;
+	xf->device.SetVolume = xf_rdpsnd_set_volume;
+	xf->device.Play = xf_rdpsnd_play;
+	xf->device.Close = xf_rdpsnd_close;
+	xf->device.Free = xf_rdpsnd_free;
+	xf->volume = (LONG)UINT32_MAX;
+
+	if (!xf_rdpsnd_parse_args(xf, pEntryPoints->args))
+	{
+		xf_rdpsnd_free(&xf->device);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	pEntryPoints->pRegisterRdpsndDevice(pEntryPoints->rdpsnd, &xf->device);
+	return CHANNEL_RC_OK;
+}
+
+PVIRTUALCHANNELENTRY xf_rdpsnd_addin_entry(LPCSTR pszName, LPCSTR pszSubsystem, LPCSTR pszType)
+{
+	WINPR_UNUSED(pszType);
+
+	if (pszName && pszSubsystem && (strcmp(pszName, RDPSND_CHANNEL_NAME) == 0) &&
+	    (strcmp(pszSubsystem, XF_RDPSND_SUBSYSTEM) == 0))
+		return WINPR_FUNC_PTR_CAST(xf_rdpsnd_device_entry, PVIRTUALCHANNELENTRY);
+	return NULL;
+}
+
+static BOOL xf_rdpsnd_select_device(ADDIN_ARGV* args)
+{
+	for (int x = 0; x < args->argc; x++)
+	{
+		if (strncmp(args->argv[x], "sys:", 4) == 0)
+			return TRUE;
+	}
+	return freerdp_addin_argv_add_argument(args, "sys:" XF_RDPSND_SUBSYSTEM);
+}
+
+BOOL xf_rdpsnd_init_settings(rdpSettings* settings)
+{
+	WINPR_ASSERT(settings);
+
+	if (!freerdp_settings_get_bool(settings, FreeRDP_AudioPlayback))
+		return TRUE;
+
+	/* /sound added the channel with its arguments, otherwise FreeRDP adds it when loading the
+	 * channels */
+	ADDIN_ARGV* args = freerdp_static_channel_collection_find(settings, RDPSND_CHANNEL_NAME);
+	if (args)
+	{
+		if (!xf_rdpsnd_select_device(args))
+			return FALSE;
+	}
+	else
+	{
+		const char* const params[] = { RDPSND_CHANNEL_NAME, "sys:" XF_RDPSND_SUBSYSTEM };
+		if (!freerdp_client_add_static_channel(settings, ARRAYSIZE(params), params))
+			return FALSE;
+	}
+
+	/* the dynamic audio channel is left to FreeRDP's defaults unless /sound added it */
+	args = freerdp_dynamic_channel_collection_find(settings, RDPSND_CHANNEL_NAME);
+	return !args || xf_rdpsnd_select_device(args);
+}
@@ -0,0 +1,67 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_RDPSND_H
+#define FREERDP_CLIENT_X11_RDPSND_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/settings.h>
+#include <freerdp/svc.h>
+
+/* rdpsnd device subsystem name, /sound:sys:xf */
+#define XF_RDPSND_SUBSYSTEM "xf"
+
+/* Jitter buffer target when rdpsnd passes no latency:<ms> */
+#define XF_RDPSND_DEFAULT_LATENCY 60
+
+/* How far underruns may raise the target above the configured latency, in ms */
+#define XF_RDPSND_MAX_EXTRA_LATENCY 240
+
+/* Target change per underrun, and per stable interval on the way back down, in ms */
+#define XF_RDPSND_LATENCY_STEP 20
+
+/* Playback without an underrun for this long lowers the target again, in ms */
+#define XF_RDPSND_STABLE_INTERVAL 5000
+
+/* Audio written to the sink per write, in ms */
+#define XF_RDPSND_PERIOD 10
+
+/* Audio the sink itself queues, in ms */
+#define XF_RDPSND_SINK_LATENCY 30
+
+/*
+ * rdpsnd device plugin. Play only copies the server's packet into a lock-free single producer /
+ * single consumer ring and returns, decoding (through the FreeRDP DSP for compressed formats),
+ * volume and the writes to the sink happen on the device's own audio thread. That thread keeps
+ * an adaptive jitter buffer of decoded audio: playback (re)starts once the buffer holds the
+ * target latency, every underrun raises the target by a step, and a stable stretch lowers it
+ * again towards the configured latency. A buffer grown far past the target is cut back so the
+ * latency stays bounded when the server sends bursts.
+ *
+ * Device arguments, next to rdpsnd's own: sink:<pulse|alsa|wav|null> and dev:<name>, the
+ * PulseAudio sink, ALSA device or the file the wav sink writes. latency:<ms> sets the target.
+ * Underruns, drops, buffer depth and target are logged while playing and when the device closes.
+ */
+
+/* Entry for the channel addin lookup, NULL unless name / subsystem are the device's */
+PVIRTUALCHANNELENTRY xf_rdpsnd_addin_entry(LPCSTR pszName, LPCSTR pszSubsystem, LPCSTR pszType);
+
+/* Makes rdpsnd use the device unless the command line chose a sys: */
+BOOL xf_rdpsnd_init_settings(rdpSettings* settings);
+
+#endif /* FREERDP_CLIENT_X11_RDPSND_H */
@@ -0,0 +1,163 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - ALSA sink
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <alsa/asoundlib.h>
+
+#include <winpr/assert.h>
+#include <winpr/string.h>
+
+#include <freerdp/log.h>
+
+#include "xf_rdpsnd_sink.h"
+
+#define TAG CLIENT_TAG("x11.rdpsnd")
+
+typedef struct
+{
+	XfRdpsndSink sink;
+
+	char* device;
+	snd_pcm_t* pcm;
+	UINT32 rate;
+	UINT16 channels;
+} xfRdpsndAlsaSink;
+
+static BOOL xf_rdpsnd_alsa_open(XfRdpsndSink* sink, UINT32 rate, UINT16 channels,
+                                UINT32 latency)
+{
+	xfRdpsndAlsaSink* alsa = (xfRdpsndAlsaSink*)sink;
+	WINPR_ASSERT(alsa);
+
+	const char* device = alsa->device ? alsa->device : "default";
+	int status = snd_pcm_open(&alsa->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "snd_pcm_open %s: %s", device, snd_strerror(status));
+		alsa->pcm = NULL;
+		return FALSE;
+	}
+
+	/* soft resampling, the server's rate is played as is */
+	status = snd_pcm_set_params(alsa->pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+	                            channels, rate, 1, latency * 1000);
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "snd_pcm_set_params %" PRIu32 " Hz %" PRIu16 " channels: %s", rate,
+		         channels, snd_strerror(status));
+		sink->close(sink);
+		return FALSE;
+	}
+
+	alsa->rate = rate;
+	alsa->channels = channels;
+	return TRUE;
+}
+
+static BOOL xf_rdpsnd_alsa_write(XfRdpsndSink* sink, const BYTE* frames, size_t count)
+{
+	xfRdpsndAlsaSink* alsa = (xfRdpsndAlsaSink*)sink;
+	WINPR_ASSERT(alsa);
+	WINPR_ASSERT(alsa->pcm);
+
+	while (count > 0)
+	{
+		snd_pcm_sframes_t written = snd_pcm_writei(alsa->pcm, frames, count);
+		if (written == -EAGAIN)
+			continue;
+		if (written < 0)
+		{
+			/* an xrun is counted by the jitter buffer already, start the device again */
+			const int status = snd_pcm_recover(alsa->pcm, (int)written, 1);
+			if (status < 0)
+			{
+				WLog_ERR(TAG, "snd_pcm_writei: %s", snd_strerror(status));
+				return FALSE;
+			}
+			continue;
+		}
+
+		frames += (size_t)written * alsa->channels * 2;
+		count -= (size_t)written;
+	}
+	return TRUE;
+}
+
+static UINT32 xf_rdpsnd_alsa_delay(XfRdpsndSink* sink)
+{
+	xfRdpsndAlsaSink* alsa = (xfRdpsndAlsaSink*)sink;
+	WINPR_ASSERT(alsa);
+
+	snd_pcm_sframes_t delay = 0;
+	if (!alsa->pcm || (snd_pcm_delay(alsa->pcm, &delay) < 0) || (delay < 0))
+		return 0;
+	return (UINT32)((UINT64)delay * 1000ull / alsa->rate);
+}
+
+static void xf_rdpsnd_alsa_close(XfRdpsndSink* sink)
+{
+	xfRdpsndAlsaSink* alsa = (xfRdpsndAlsaSink*)sink;
+	WINPR_ASSERT(alsa);
+
+	if (!alsa->pcm)
+		return;
+
+	(void)snd_pcm_drain(alsa->pcm);
+	(void)snd_pcm_close(alsa->pcm);
+	alsa->pcm = NULL;
+}
+
+static void xf_rdpsnd_alsa_free(XfRdpsndSink* sink)
+{
+	xfRdpsndAlsaSink* alsa = (xfRdpsndAlsaSink*)sink;
+	if (!alsa)
+		return;
+
+	if (alsa->pcm)
+	{
+		(void)snd_pcm_drop(alsa->pcm);
+		(void)snd_pcm_close(alsa->pcm);
+	}
+	free(alsa->device);
+	free(alsa);
+}
+
+XfRdpsndSink* xf_rdpsnd_sink_alsa_new(const char* device)
+{
+	xfRdpsndAlsaSink* alsa = calloc(1, sizeof(xfRdpsndAlsaSink));
+	if (!alsa)
+		return NULL;
+
+	if (device)
+	{
+		alsa->device = _strdup(device);
+		if (!alsa->device)
+		{
+			free(alsa);
+			return NULL;
+		}
+	}
+
+	alsa->sink.name = "alsa";
+	alsa->sink.open = xf_rdpsnd_alsa_open;
+	alsa->sink.write = xf_rdpsnd_alsa_write;
+	alsa->sink.delay = xf_rdpsnd_alsa_delay;
+	alsa->sink.close = xf_rdpsnd_alsa_close;
+	alsa->sink.free = xf_rdpsnd_alsa_free;
+	return &alsa->sink;
+}
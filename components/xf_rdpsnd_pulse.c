@@ -0,0 +1,158 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - PulseAudio sink
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <pulse/error.h>
+#include <pulse/simple.h>
+
+#include <winpr/assert.h>
+#include <winpr/string.h>
+
+#include <freerdp/log.h>
+
+#include "xf_rdpsnd_sink.h"
+
+#define TAG CLIENT_TAG("x11.rdpsnd")
+
+typedef struct
+{
+	XfRdpsndSink sink;
+
+	char* device;
+	pa_simple* stream;
+	UINT16 channels;
+} xfRdpsndPulseSink;
+
+static BOOL xf_rdpsnd_pulse_open(XfRdpsndSink* sink, UINT32 rate, UINT16 channels,
+                                 UINT32 latency)
+{
+	xfRdpsndPulseSink* pulse = (xfRdpsndPulseSink*)sink;
+	WINPR_ASSERT(pulse);
+
+	pa_sample_spec spec = { 0 };
+	spec.format = PA_SAMPLE_S16LE;
+	spec.rate = rate;
+	spec.channels = (uint8_t)channels;
+	if (!pa_sample_spec_valid(&spec))
+		return FALSE;
+
+	/* keep the server side buffer at the requested latency instead of PulseAudio's 2 s */
+	pa_buffer_attr attr = { 0 };
+	attr.maxlength = (uint32_t)-1;
+	attr.tlength = (uint32_t)pa_usec_to_bytes((pa_usec_t)latency * 1000, &spec);
+	attr.prebuf = (uint32_t)-1;
+	attr.minreq = (uint32_t)-1;
+	attr.fragsize = (uint32_t)-1;
+
+	int error = 0;
+	pulse->stream = pa_simple_new(NULL, "FreeRDP", PA_STREAM_PLAYBACK, pulse->device,
+	                              "Remote audio", &spec, NULL, &attr, &error);
+	if (!pulse->stream)
+	{
+		WLog_ERR(TAG, "pa_simple_new: %s", pa_strerror(error));
+		return FALSE;
+	}
+
+	pulse->channels = channels;
+	return TRUE;
+}
+
+static BOOL xf_rdpsnd_pulse_write(XfRdpsndSink* sink, const BYTE* frames, size_t count)
+{
+	xfRdpsndPulseSink* pulse = (xfRdpsndPulseSink*)sink;
+	WINPR_ASSERT(pulse);
+	WINPR_ASSERT(pulse->stream);
+
+	int error = 0;
+	if (pa_simple_write(pulse->stream, frames, count * pulse->channels * 2, &error) < 0)
+	{
+		WLog_ERR(TAG, "pa_simple_write: %s", pa_strerror(error));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static UINT32 xf_rdpsnd_pulse_delay(XfRdpsndSink* sink)
+{
+	xfRdpsndPulseSink* pulse = (xfRdpsndPulseSink*)sink;
+	WINPR_ASSERT(pulse);
+
+	int error = 0;
+	if (!pulse->stream)
+		return 0;
+
+	const pa_usec_t latency = pa_simple_get_latency(pulse->stream, &error);
+	if (latency == (pa_usec_t)-1)
+		return 0;
+	return (UINT32)(latency / 1000);
+}
+
+static void xf_rdpsnd_pulse_close(XfRdpsndSink* sink)
+{
+	xfRdpsndPulseSink* pulse = (xfRdpsndPulseSink*)sink;
+	WINPR_ASSERT(pulse);
+
+	if (!pulse->stream)
+		return;
+
+	int error = 0;
+	(void)pa_simple_drain(pulse->stream, &error);
+	pa_simple_free(pulse->stream);
+	pulse->stream = NULL;
+}
+
+static void xf_rdpsnd_pulse_free(XfRdpsndSink* sink)
+{
+	xfRdpsndPulseSink* pulse = (xfRdpsndPulseSink*)sink;
+	if (!pulse)
+		return;
+
+	if (pulse->stream)
+	{
+		int error = 0;
+		(void)pa_simple_flush(pulse->stream, &error);
+		pa_simple_free(pulse->stream);
+	}
+	free(pulse->device);
+	free(pulse);
+}
+
+XfRdpsndSink* xf_rdpsnd_sink_pulse_new(const char* device)
+{
+	xfRdpsndPulseSink* pulse = calloc(1, sizeof(xfRdpsndPulseSink));
+	if (!pulse)
+		return NULL;
+
+	if (device)
+	{
+		pulse->device = _strdup(device);
+		if (!pulse->device)
+		{
+			free(pulse);
+			return NULL;
+		}
+	}
+
+	pulse->sink.name = "pulse";
+	pulse->sink.open = xf_rdpsnd_pulse_open;
+	pulse->sink.write = xf_rdpsnd_pulse_write;
+	pulse->sink.delay = xf_rdpsnd_pulse_delay;
+	pulse->sink.close = xf_rdpsnd_pulse_close;
+	pulse->sink.free = xf_rdpsnd_pulse_free;
+	return &pulse->sink;
+}
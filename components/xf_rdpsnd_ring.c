@@ -0,0 +1,169 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - single producer / single consumer packet ring
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+
+#include "xf_rdpsnd_ring.h"
+
+/* every packet starts with its UINT32 length, packets are kept 8 byte aligned */
+#define XF_RDPSND_RING_HEADER sizeof(UINT32)
+#define XF_RDPSND_RING_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+struct xf_rdpsnd_ring
+{
+	BYTE* buffer;
+	size_t mask;
+
+	/* free running byte counts, each written by one side only */
+	volatile LONGLONG head; /* producer */
+	BYTE pad[64 - sizeof(LONGLONG)];
+	volatile LONGLONG tail; /* consumer */
+};
+
+static UINT64 xf_rdpsnd_ring_load(volatile LONGLONG* index)
+{
+	return (UINT64)InterlockedCompareExchange64(index, 0, 0);
+}
+
+static void xf_rdpsnd_ring_store(volatile LONGLONG* index, UINT64 value)
+{
+	/* full barrier, the bytes written before are visible once the index is */
+	(void)InterlockedExchange64(index, (LONGLONG)value);
+}
+
+/* copies in and out of the buffer, splitting at its end */
+static void xf_rdpsnd_ring_write(XfRdpsndRing* ring, UINT64 position, const void* data,
+                                 size_t size)
+{
+	const size_t offset = (size_t)position & ring->mask;
+	const size_t first = MIN(size, ring->mask + 1 - offset);
+
+	memcpy(&ring->buffer[offset], data, first);
+	memcpy(ring->buffer, (const BYTE*)data + first, size - first);
+}
+
+static void xf_rdpsnd_ring_read(const XfRdpsndRing* ring, UINT64 position, void* data,
+                                size_t size)
+{
+	const size_t offset = (size_t)position & ring->mask;
+	const size_t first = MIN(size, ring->mask + 1 - offset);
+
+	memcpy(data, &ring->buffer[offset], first);
+	memcpy((BYTE*)data + first, ring->buffer, size - first);
+}
+
+XfRdpsndRing* xf_rdpsnd_ring_new(size_t capacity)
+{
+	size_t size = 64;
+	while (size < capacity)
+	{
+		if (size > SIZE_MAX / 2)
+			return NULL;
+		size *= 2;
+	}
+
+	XfRdpsndRing* ring = calloc(1, sizeof(XfRdpsndRing));
+	if (!ring)
+		return NULL;
+
+	ring->buffer = malloc(size);
+	if (!ring->buffer)
+	{
+		free(ring);
+		return NULL;
+	}
+	ring->mask = size - 1;
+	return ring;
+}
+
+void xf_rdpsnd_ring_free(XfRdpsndRing* ring)
+{
+	if (!ring)
+		return;
+
+	free(ring->buffer);
+	free(ring);
+}
+
+BOOL xf_rdpsnd_ring_push(XfRdpsndRing* ring, const BYTE* data, size_t size)
+{
+	WINPR_ASSERT(ring);
+	WINPR_ASSERT(data);
+
+	if ((size == 0) || (size > UINT32_MAX - 8))
+		return FALSE;
+
+	const size_t total = XF_RDPSND_RING_ALIGN(XF_RDPSND_RING_HEADER + size);
+	const UINT64 head = xf_rdpsnd_ring_load(&ring->head);
+	const UINT64 tail = xf_rdpsnd_ring_load(&ring->tail);
+	if (total > ring->mask + 1 - (size_t)(head - tail))
+		return FALSE;
+
+	const UINT32 length = (UINT32)size;
+	xf_rdpsnd_ring_write(ring, head, &length, sizeof(length));
+	xf_rdpsnd_ring_write(ring, head + XF_RDPSND_RING_HEADER, data, size);
+	xf_rdpsnd_ring_store(&ring->head, head + total);
+	return TRUE;
+}
+
+size_t xf_rdpsnd_ring_peek(XfRdpsndRing* ring)
+{
+	WINPR_ASSERT(ring);
+
+	const UINT64 tail = xf_rdpsnd_ring_load(&ring->tail);
+	if (xf_rdpsnd_ring_load(&ring->head) == tail)
+		return 0;
+
+	UINT32 length = 0;
+	xf_rdpsnd_ring_read(ring, tail, &length, sizeof(length));
+	return length;
+}
+
+BOOL xf_rdpsnd_ring_pop(XfRdpsndRing* ring, BYTE* data, size_t capacity, size_t* size)
+{
+	WINPR_ASSERT(ring);
+	WINPR_ASSERT(size);
+
+	*size = 0;
+	const UINT64 tail = xf_rdpsnd_ring_load(&ring->tail);
+	if (xf_rdpsnd_ring_load(&ring->head) == tail)
+		return FALSE;
+
+	UINT32 length = 0;
+	xf_rdpsnd_ring_read(ring, tail, &length, sizeof(length));
+	if (length > capacity)
+		return FALSE;
+
+	xf_rdpsnd_ring_read(ring, tail + XF_RDPSND_RING_HEADER, data, length);
+	const size_t total = XF_RDPSND_RING_ALIGN(XF_RDPSND_RING_HEADER + length);
+	xf_rdpsnd_ring_store(&ring->tail, tail + total);
+	*size = length;
+	return TRUE;
+}
+
+size_t xf_rdpsnd_ring_used(XfRdpsndRing* ring)
+{
+	WINPR_ASSERT(ring);
+
+	const UINT64 tail = xf_rdpsnd_ring_load(&ring->tail);
+	const UINT64 head = xf_rdpsnd_ring_load(&ring->head);
+	return (head >= tail) ? (size_t)(head - tail) : 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - single producer / single consumer packet ring
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_RDPSND_RING_H
+#define FREERDP_CLIENT_X11_RDPSND_RING_H
+
+#include <winpr/wtypes.h>
+
+typedef struct xf_rdpsnd_ring XfRdpsndRing;
+
+/*
+ * Variable length packets handed from exactly one producer thread to exactly one consumer
+ * thread without locks. Each side only writes its own index, the other one reads it with a full
+ * barrier, so a packet is visible to the consumer once its bytes are. A full ring refuses the
+ * packet instead of blocking the producer.
+ */
+
+/* capacity is rounded up to a power of two bytes, packet headers included */
+XfRdpsndRing* xf_rdpsnd_ring_new(size_t capacity);
+void xf_rdpsnd_ring_free(XfRdpsndRing* ring);
+
+/* Producer side. Returns FALSE if the packet is empty or does not fit right now. */
+BOOL xf_rdpsnd_ring_push(XfRdpsndRing* ring, const BYTE* data, size_t size);
+
+/* Consumer side. Size of the next packet, 0 if the ring is empty. */
+size_t xf_rdpsnd_ring_peek(XfRdpsndRing* ring);
+
+/* Consumer side. Copies the next packet, which must fit into capacity bytes, and releases it. */
+BOOL xf_rdpsnd_ring_pop(XfRdpsndRing* ring, BYTE* data, size_t capacity, size_t* size);
+
+/* Bytes queued, packet headers included. Approximate when called from a third thread. */
+size_t xf_rdpsnd_ring_used(XfRdpsndRing* ring);
+
+#endif /* FREERDP_CLIENT_X11_RDPSND_RING_H */
@@ -0,0 +1,280 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - sinks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/assert.h>
+#include <winpr/endian.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+
+#include "xf_rdpsnd_sink.h"
+
+#define TAG CLIENT_TAG("x11.rdpsnd")
+
+#define XF_RDPSND_WAV_HEADER_SIZE 44
+
+/*
+ * The null and WAV sinks have no device clock, they play in real time against the monotonic
+ * clock instead so the audio thread and its jitter buffer behave as with a sound card.
+ */
+typedef struct
+{
+	XfRdpsndSink sink;
+
+	UINT32 rate;
+	UINT16 channels;
+	UINT64 latency; /* ns queued before write blocks */
+	UINT64 end;     /* when the audio written so far is played */
+
+	/* WAV only */
+	char* path;
+	FILE* file;
+	UINT64 bytes;
+} xfRdpsndClockSink;
+
+static BOOL xf_rdpsnd_clock_open(XfRdpsndSink* sink, UINT32 rate, UINT16 channels,
+                                 UINT32 latency)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+
+	if ((rate == 0) || (channels == 0))
+		return FALSE;
+
+	clock->rate = rate;
+	clock->channels = channels;
+	clock->latency = (UINT64)latency * 1000000ull;
+	clock->end = winpr_GetTickCount64NS();
+	return TRUE;
+}
+
+static void xf_rdpsnd_clock_advance(xfRdpsndClockSink* clock, size_t count)
+{
+	UINT64 now = winpr_GetTickCount64NS();
+
+	/* an idle sink starts over, it does not catch up on the silence */
+	if (clock->end < now)
+		clock->end = now;
+	clock->end += (UINT64)count * 1000000000ull / clock->rate;
+
+	while (clock->end > now + clock->latency)
+	{
+		Sleep((DWORD)MAX(1, (clock->end - now - clock->latency) / 1000000ull));
+		now = winpr_GetTickCount64NS();
+	}
+}
+
+static UINT32 xf_rdpsnd_clock_delay(XfRdpsndSink* sink)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+
+	const UINT64 now = winpr_GetTickCount64NS();
+	return (clock->end > now) ? (UINT32)((clock->end - now) / 1000000ull) : 0;
+}
+
+static BOOL xf_rdpsnd_null_write(XfRdpsndSink* sink, WINPR_ATTR_UNUSED const BYTE* frames,
+                                 size_t count)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+
+	xf_rdpsnd_clock_advance(clock, count);
+	return TRUE;
+}
+
+static void xf_rdpsnd_null_close(WINPR_ATTR_UNUSED XfRdpsndSink* sink)
+{
+}
+
+static void xf_rdpsnd_clock_free(XfRdpsndSink* sink)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	if (!clock)
+		return;
+
+	if (clock->file)
+		sink->close(sink);
+	free(clock->path);
+	free(clock);
+}
+
+XfRdpsndSink* xf_rdpsnd_sink_null_new(void)
+{
+	xfRdpsndClockSink* clock = calloc(1, sizeof(xfRdpsndClockSink));
+	if (!clock)
+		return NULL;
+
+	clock->sink.name = "null";
+	clock->sink.open = xf_rdpsnd_clock_open;
+	clock->sink.write = xf_rdpsnd_null_write;
+	clock->sink.delay = xf_rdpsnd_clock_delay;
+	clock->sink.close = xf_rdpsnd_null_close;
+	clock->sink.free = xf_rdpsnd_clock_free;
+	return &clock->sink;
+}
+
+static void xf_rdpsnd_wav_header(BYTE* header, UINT32 rate, UINT16 channels, UINT32 bytes)
+{
+	memcpy(&header[0], "RIFF", 4);
+	winpr_Data_Write_UINT32(&header[4], 36 + bytes);
+	memcpy(&header[8], "WAVEfmt ", 8);
+	winpr_Data_Write_UINT32(&header[16], 16);
+	winpr_Data_Write_UINT16(&header[20], 1); /* WAVE_FORMAT_PCM */
+	winpr_Data_Write_UINT16(&header[22], channels);
+	winpr_Data_Write_UINT32(&header[24], rate);
+	winpr_Data_Write_UINT32(&header[28], rate * channels * 2);
+	winpr_Data_Write_UINT16(&header[32], (UINT16)(channels * 2));
+	winpr_Data_Write_UINT16(&header[34], 16);
+	memcpy(&header[36], "data", 4);
+	winpr_Data_Write_UINT32(&header[40], bytes);
+}
+
+static BOOL xf_rdpsnd_wav_open(XfRdpsndSink* sink, UINT32 rate, UINT16 channels, UINT32 latency)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+
+	if (!xf_rdpsnd_clock_open(sink, rate, channels, latency))
+		return FALSE;
+
+	/* the sizes are filled in on close */
+	BYTE header[XF_RDPSND_WAV_HEADER_SIZE] = { 0 };
+	xf_rdpsnd_wav_header(header, rate, channels, 0);
+
+	clock->file = fopen(clock->path, "wb");
+	if (!clock->file)
+	{
+		WLog_ERR(TAG, "failed to create %s", clock->path);
+		return FALSE;
+	}
+
+	clock->bytes = 0;
+	if (fwrite(header, sizeof(header), 1, clock->file) != 1)
+	{
+		sink->close(sink);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static BOOL xf_rdpsnd_wav_write(XfRdpsndSink* sink, const BYTE* frames, size_t count)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+	WINPR_ASSERT(clock->file);
+
+	const size_t size = count * clock->channels * 2;
+	if ((size > 0) && (fwrite(frames, size, 1, clock->file) != 1))
+	{
+		WLog_ERR(TAG, "failed to write %s", clock->path);
+		return FALSE;
+	}
+
+	clock->bytes += size;
+	xf_rdpsnd_clock_advance(clock, count);
+	return TRUE;
+}
+
+static void xf_rdpsnd_wav_close(XfRdpsndSink* sink)
+{
+	xfRdpsndClockSink* clock = (xfRdpsndClockSink*)sink;
+	WINPR_ASSERT(clock);
+
+	if (!clock->file)
+		return;
+
+	BYTE header[XF_RDPSND_WAV_HEADER_SIZE] = { 0 };
+	xf_rdpsnd_wav_header(header, clock->rate, clock->channels,
+	                     (UINT32)MIN(clock->bytes, UINT32_MAX - 36));
+	if ((fseek(clock->file, 0, SEEK_SET) != 0) ||
+	    (fwrite(header, sizeof(header), 1, clock->file) != 1))
+		WLog_WARN(TAG, "failed to finish the header of %s", clock->path);
+
+	(void)fclose(clock->file);
+	clock->file = NULL;
+	WLog_INFO(TAG, "wrote %" PRIu64 " bytes of audio to %s", clock->bytes, clock->path);
+}
+
+XfRdpsndSink* xf_rdpsnd_sink_wav_new(const char* path)
+{
+	if (!path)
+	{
+		WLog_ERR(TAG, "the wav sink needs a file, dev:<path>");
+		return NULL;
+	}
+
+	xfRdpsndClockSink* clock = calloc(1, sizeof(xfRdpsndClockSink));
+	if (!clock)
+		return NULL;
+
+	clock->path = _strdup(path);
+	if (!clock->path)
+	{
+		free(clock);
+		return NULL;
+	}
+
+	clock->sink.name = "wav";
+	clock->sink.open = xf_rdpsnd_wav_open;
+	clock->sink.write = xf_rdpsnd_wav_write;
+	clock->sink.delay = xf_rdpsnd_clock_delay;
+	clock->sink.close = xf_rdpsnd_wav_close;
+	clock->sink.free = xf_rdpsnd_clock_free;
+	return &clock->sink;
+}
+
+XfRdpsndSink* xf_rdpsnd_sink_new(const char* name, const char* device)
+{
+	if (!name)
+	{
+#if defined(WITH_PULSE)
+		name = "pulse";
+#elif defined(WITH_ALSA)
+		name = "alsa";
+#else
+		name = "null";
+#endif
+	}
+
+#ifdef WITH_PULSE
+	if (strcmp(name, "pulse") == 0)
+		return xf_rdpsnd_sink_pulse_new(device);
+#endif
+#ifdef WITH_ALSA
+	if (strcmp(name, "alsa") == 0)
+		return xf_rdpsnd_sink_alsa_new(device);
+#endif
+	if (strcmp(name, "wav") == 0)
+		return xf_rdpsnd_sink_wav_new(device);
+	if (strcmp(name, "null") == 0)
+		return xf_rdpsnd_sink_null_new();
+
+	WLog_ERR(TAG, "audio sink %s is not built in", name);
+	return NULL;
+}
+
+void xf_rdpsnd_sink_free(XfRdpsndSink* sink)
+{
+	if (sink)
+		sink->free(sink);
+}
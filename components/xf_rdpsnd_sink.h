@@ -0,0 +1,63 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 audio output - sinks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_RDPSND_SINK_H
+#define FREERDP_CLIENT_X11_RDPSND_SINK_H
+
+#include <winpr/wtypes.h>
+
+typedef struct xf_rdpsnd_sink XfRdpsndSink;
+
+/*
+ * Where the decoded audio goes. A sink takes interleaved signed 16 bit little endian frames and
+ * is only used from the audio thread. write blocks until the frames are queued in the sink, which
+ * paces the audio thread.
+ */
+struct xf_rdpsnd_sink
+{
+	const char* name;
+
+	/* latency is the amount of audio the sink should queue itself, in ms */
+	BOOL (*open)(XfRdpsndSink* sink, UINT32 rate, UINT16 channels, UINT32 latency);
+	BOOL (*write)(XfRdpsndSink* sink, const BYTE* frames, size_t count);
+	/* ms of audio written but not played yet */
+	UINT32 (*delay)(XfRdpsndSink* sink);
+	/* plays what was written, then stops */
+	void (*close)(XfRdpsndSink* sink);
+	void (*free)(XfRdpsndSink* sink);
+};
+
+/*
+ * name is one of "pulse", "alsa", "wav" or "null". NULL picks PulseAudio, else ALSA, else the
+ * null sink, whichever is built in. device is the PulseAudio sink or ALSA device, NULL for the
+ * default, or the file the WAV sink writes to.
+ */
+XfRdpsndSink* xf_rdpsnd_sink_new(const char* name, const char* device);
+
+/* Discards the audio still queued */
+void xf_rdpsnd_sink_free(XfRdpsndSink* sink);
+
+XfRdpsndSink* xf_rdpsnd_sink_null_new(void);
+XfRdpsndSink* xf_rdpsnd_sink_wav_new(const char* path);
+#ifdef WITH_ALSA
+XfRdpsndSink* xf_rdpsnd_sink_alsa_new(const char* device);
+#endif
+#ifdef WITH_PULSE
+XfRdpsndSink* xf_rdpsnd_sink_pulse_new(const char* device);
+#endif
+
+#endif /* FREERDP_CLIENT_X11_RDPSND_SINK_H */
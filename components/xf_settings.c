@@ -0,0 +1,74 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 read-mostly settings snapshot
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/assert.h>
+
+#include <freerdp/log.h>
+
+#include "xf_settings.h"
+#include "../context/client_context.h"
+
+#define TAG CLIENT_TAG("x11")
+
+BOOL xf_settings_snapshot_update(clientContext* clicon)
+{
+	SettingsSnapshot snapshot = { 0 };
+
+	WINPR_ASSERT(clicon);
+
+	const rdpSettings* settings = clicon->common.context.settings;
+	if (!settings)
+		return FALSE;
+
+	snapshot.desktopWidth = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
+	snapshot.desktopHeight = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+	snapshot.percentScreen = freerdp_settings_get_uint32(settings, FreeRDP_PercentScreen);
+	snapshot.percentScreenUseWidth =
+	    freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseWidth);
+	snapshot.percentScreenUseHeight =
+	    freerdp_settings_get_bool(settings, FreeRDP_PercentScreenUseHeight);
+	snapshot.percentWidth = snapshot.percentScreenUseWidth ? snapshot.percentScreen : 100;
+	snapshot.percentHeight = snapshot.percentScreenUseHeight ? snapshot.percentScreen : 100;
+	snapshot.parentWindowId = freerdp_settings_get_uint64(settings, FreeRDP_ParentWindowId);
+	snapshot.useMultimon = freerdp_settings_get_bool(settings, FreeRDP_UseMultimon);
+	snapshot.spanMonitors = freerdp_settings_get_bool(settings, FreeRDP_SpanMonitors);
+	snapshot.workarea = freerdp_settings_get_bool(settings, FreeRDP_Workarea);
+	snapshot.remoteApplicationMode =
+	    freerdp_settings_get_bool(settings, FreeRDP_RemoteApplicationMode);
+	snapshot.fullscreen = freerdp_settings_get_bool(settings, FreeRDP_Fullscreen);
+	snapshot.smartSizing = freerdp_settings_get_bool(settings, FreeRDP_SmartSizing);
+	snapshot.authenticationOnly = freerdp_settings_get_bool(settings, FreeRDP_AuthenticationOnly);
+
+	snapshot.numMonitorIds = freerdp_settings_get_uint32(settings, FreeRDP_NumMonitorIds);
+	for (UINT32 index = 0; index < snapshot.numMonitorIds; index++)
+	{
+		const UINT32* cur = freerdp_settings_get_pointer_array(settings, FreeRDP_MonitorIds, index);
+		if (!cur)
+			continue;
+
+		if (index == 0)
+			snapshot.firstMonitorId = *cur;
+
+		if (*cur < XF_SETTINGS_MAX_MONITOR_IDS)
+			snapshot.monitorIdMask |= (1ull << *cur);
+		else
+			WLog_WARN(TAG, "monitor id %" PRIu32 " out of range, ignoring", *cur);
+	}
+
+	clicon->settingsSnapshot = snapshot;
+	return TRUE;
+}
@@ -0,0 +1,70 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 read-mostly settings snapshot
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_SETTINGS_H
+#define FREERDP_CLIENT_X11_SETTINGS_H
+
+#include <freerdp/api.h>
+#include <freerdp/freerdp.h>
+
+typedef struct client_context clientContext;
+
+/* monitor ids at or above this value can never match a detected monitor */
+#define XF_SETTINGS_MAX_MONITOR_IDS 64
+
+/* Typed copy of the settings read on hot paths. The generic freerdp_settings_get_* accessors
+ * do a key lookup per call, so the values are copied here once and rebuilt by
+ * xf_settings_snapshot_update whenever the client changes one of them. */
+typedef struct settings_snapshot
+{
+	UINT64 monitorIdMask; /* bit n set if monitor id n was requested */
+	UINT32 numMonitorIds;
+	UINT32 firstMonitorId;
+
+	UINT32 desktopWidth;
+	UINT32 desktopHeight;
+	UINT32 percentScreen;
+	UINT32 percentWidth;  /* percentScreen if PercentScreenUseWidth, 100 otherwise */
+	UINT32 percentHeight; /* percentScreen if PercentScreenUseHeight, 100 otherwise */
+	UINT64 parentWindowId;
+
+	BOOL percentScreenUseWidth;
+	BOOL percentScreenUseHeight;
+	BOOL useMultimon;
+	BOOL spanMonitors;
+	BOOL workarea;
+	BOOL remoteApplicationMode;
+	BOOL fullscreen;
+	BOOL smartSizing;
+	BOOL authenticationOnly;
+} SettingsSnapshot;
+
+FREERDP_API BOOL xf_settings_snapshot_update(clientContext* clicon);
+
+static inline BOOL xf_settings_snapshot_monitor_id_active(const SettingsSnapshot* snapshot,
+                                                          UINT32 id)
+{
+	if (snapshot->numMonitorIds == 0)
+		return TRUE;
+
+	if (id >= XF_SETTINGS_MAX_MONITOR_IDS)
+		return FALSE;
+
+	return (snapshot->monitorIdMask & (1ull << id)) != 0;
+}
+
+#endif /* FREERDP_CLIENT_X11_SETTINGS_H */
@@ -21,9 +21,11 @@
 #include <string.h>
 #include <winpr/assert.h>
 #include <winpr/wtypes.h>
-#include <winpr/path.h>
+#include <winpr/interlocked.h>
 
 #include "xf_utils.h"
+#include "xf_atom_cache.h"
+#include "xf_xprof.h"
 #include "../context/client_context.h"
 
 #include <freerdp/log.h>
@@ -32,6 +34,60 @@
 
 static const DWORD log_level = WLOG_TRACE;
 
+/* Per call site counters for sampled tracing. A slot is claimed by CAS on its key, the
+ * xf_call_site_key of the LogDynAnd* macro expansion, the same one the profiler uses. */
+#define TRACE_CALL_SITE_SLOTS 1024
+
+typedef struct
+{
+	volatile LONGLONG key;
+	volatile LONG count;
+} TraceCallSite;
+
+static TraceCallSite trace_call_sites[TRACE_CALL_SITE_SLOTS];
+static volatile LONG trace_sample_rate = 1;
+
+void xf_utils_set_trace_sample_rate(UINT32 rate)
+{
+	if (rate == 0)
+		rate = 1;
+	if (rate > INT32_MAX)
+		rate = INT32_MAX;
+	(void)InterlockedExchange(&trace_sample_rate, (LONG)rate);
+}
+
+/* Returns TRUE if the wrapper at file:line should log this call. The trace level check comes
+ * first, so the counters are only touched while tracing is enabled. */
+static BOOL trace_call_site(wLog* log, const char* file, size_t line)
+{
+	if (!WLog_IsLevelActive(log, log_level))
+		return FALSE;
+
+	const LONG rate = trace_sample_rate;
+	if (rate <= 1)
+		return TRUE;
+
+	const LONGLONG key = xf_call_site_key(file, line);
+	for (size_t probe = 0; probe < TRACE_CALL_SITE_SLOTS; probe++)
+	{
+		TraceCallSite* site =
+		    &trace_call_sites[((UINT64)key + probe) & (TRACE_CALL_SITE_SLOTS - 1)];
+
+		LONGLONG cur = site->key;
+		if (cur == 0)
+			cur = InterlockedCompareExchange64(&site->key, key, 0);
+
+		if ((cur == 0) || (cur == key))
+		{
+			const ULONG count = (ULONG)InterlockedIncrement(&site->count) - 1;
+			return (count % (ULONG)rate) == 0;
+		}
+	}
+
+	/* table full, log unsampled rather than drop the site */
+	return TRUE;
+}
+
 static const char* error_to_string(wLog* log, Display* display, int error, char* buffer,
                                    size_t size)
 {
@@ -116,17 +172,19 @@ static int write_result_log_ex(wLog* log, DWORD level, const char* fname, const
 	return rc;
 }
 
-char* Safe_XGetAtomNameEx(wLog* log, Display* display, Atom atom, const char* varname)
+const char* Safe_XGetAtomNameEx(wLog* log, Display* display, Atom atom, const char* varname)
 {
 	WLog_Print(log, log_level, "XGetAtomName(%s, 0x%08" PRIx32 ")", varname, atom);
 	if (atom == None)
-		return strdup("Atom_None");
-	return XGetAtomName(display, atom);
+		return "Atom_None";
+
+	const char* name = xf_atom_cache_name(display, atom);
+	return name ? name : "Atom_Unknown";
 }
 
 Atom Logging_XInternAtom(wLog* log, Display* display, _Xconst char* atom_name, Bool only_if_exists)
 {
-	Atom atom = XInternAtom(display, atom_name, only_if_exists);
+	Atom atom = xf_atom_cache_intern(display, atom_name, only_if_exists);
 	if (WLog_IsLevelActive(log, log_level))
 	{
 		WLog_Print(log, log_level, "XInternAtom(0x%08" PRIx32 ", %s, %s) -> 0x%08" PRIx32, display,
@@ -145,17 +203,18 @@ int LogDynAndXChangeProperty_ex(wLog* log, const char* file, const char* fkt, si
                                 Display* display, Window w, Atom property, Atom type, int format,
                                 int mode, const unsigned char* data, int nelements)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* propstr = Safe_XGetAtomName(log, display, property);
-		char* typestr = Safe_XGetAtomName(log, display, type);
+		const char* propstr = Safe_XGetAtomName(log, display, property);
+		const char* typestr = Safe_XGetAtomName(log, display, type);
 		write_log(log, log_level, file, fkt, line,
 		          "XChangeProperty(%p, %d, %s [%d], %s [%d], %d, %d, %p, %d)", display, w, propstr,
 		          property, typestr, type, format, mode, data, nelements);
-		XFree(propstr);
-		XFree(typestr);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XChangeProperty(display, w, property, type, format, mode, data, nelements);
+	const size_t bytes = (nelements > 0) ? (size_t)nelements * (size_t)(format / 8) : 0;
+	xf_xprof_end(prof, file, fkt, line, "XChangeProperty", bytes, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XChangeProperty",
 	                                   rc);
 }
@@ -163,14 +222,15 @@ int LogDynAndXChangeProperty_ex(wLog* log, const char* file, const char* fkt, si
 int LogDynAndXDeleteProperty_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                 Display* display, Window w, Atom property)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* propstr = Safe_XGetAtomName(log, display, property);
+		const char* propstr = Safe_XGetAtomName(log, display, property);
 		write_log(log, log_level, file, fkt, line, "XDeleteProperty(%p, %d, %s [%d])", display, w,
 		          propstr, property);
-		XFree(propstr);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XDeleteProperty(display, w, property);
+	xf_xprof_end(prof, file, fkt, line, "XDeleteProperty", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XDeleteProperty",
 	                                   rc);
 }
@@ -179,19 +239,18 @@ int LogDynAndXConvertSelection_ex(wLog* log, const char* file, const char* fkt,
                                   Display* display, Atom selection, Atom target, Atom property,
                                   Window requestor, Time time)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* selectstr = Safe_XGetAtomName(log, display, selection);
-		char* targetstr = Safe_XGetAtomName(log, display, target);
-		char* propstr = Safe_XGetAtomName(log, display, property);
+		const char* selectstr = Safe_XGetAtomName(log, display, selection);
+		const char* targetstr = Safe_XGetAtomName(log, display, target);
+		const char* propstr = Safe_XGetAtomName(log, display, property);
 		write_log(log, log_level, file, fkt, line,
 		          "XConvertSelection(%p, %s [%d], %s [%d], %s [%d], %d, %lu)", display, selectstr,
 		          selection, targetstr, target, propstr, property, requestor, time);
-		XFree(propstr);
-		XFree(targetstr);
-		XFree(selectstr);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XConvertSelection(display, selection, target, property, requestor, time);
+	xf_xprof_end(prof, file, fkt, line, "XConvertSelection", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display,
 	                                   "XConvertSelection", rc);
 }
@@ -203,21 +262,21 @@ int LogDynAndXGetWindowProperty_ex(wLog* log, const char* file, const char* fkt,
                                    unsigned long* nitems_return, unsigned long* bytes_after_return,
                                    unsigned char** prop_return)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* propstr = Safe_XGetAtomName(log, display, property);
-		char* req_type_str = Safe_XGetAtomName(log, display, req_type);
+		const char* propstr = Safe_XGetAtomName(log, display, property);
+		const char* req_type_str = Safe_XGetAtomName(log, display, req_type);
 		write_log(log, log_level, file, fkt, line,
 		          "XGetWindowProperty(%p, %d, %s [%d], %ld, %ld, %d, %s [%d], %p, %p, %p, %p, %p)",
 		          display, w, propstr, property, long_offset, long_length, delete, req_type_str,
 		          req_type, actual_type_return, actual_format_return, nitems_return,
 		          bytes_after_return, prop_return);
-		XFree(propstr);
-		XFree(req_type_str);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XGetWindowProperty(display, w, property, long_offset, long_length, delete,
 	                                  req_type, actual_type_return, actual_format_return,
 	                                  nitems_return, bytes_after_return, prop_return);
+	xf_xprof_end(prof, file, fkt, line, "XGetWindowProperty", 0, TRUE);
 	return write_result_log_expect_success(log, WLOG_WARN, file, fkt, line, display,
 	                                       "XGetWindowProperty", rc);
 }
@@ -229,68 +288,11 @@ BOOL IsGnome(void)
 	return (env != NULL && strcmp(env, "gnome") == 0);
 }
 
-BOOL run_action_script(clientContext* clicon, const char* what, const char* arg, fn_action_script_run fkt,
-                       void* user)
-{
-	BOOL rc = FALSE;
-	FILE* keyScript = NULL;
-	WINPR_ASSERT(clicon);
-
-	rdpSettings* settings = clicon->common.context.settings;
-	WINPR_ASSERT(settings);
-
-	const char* ActionScript = freerdp_settings_get_string(settings, FreeRDP_ActionScript);
-
-	clicon->actionScriptExists = winpr_PathFileExists(ActionScript);
-
-	if (!clicon->actionScriptExists)
-	{
-		WLog_DBG(TAG, "[ActionScript] no such script '%s'", ActionScript);
-		goto fail;
-	}
-
-	char command[2048] = { 0 };
-	(void)sprintf_s(command, sizeof(command), "%s %s", ActionScript, what);
-	keyScript = popen(command, "r");
-
-	if (!keyScript)
-	{
-		WLog_ERR(TAG, "[ActionScript] Failed to execute '%s'", command);
-		goto fail;
-	}
-
-	BOOL read_data = FALSE;
-	char buffer[2048] = { 0 };
-	while (fgets(buffer, sizeof(buffer), keyScript) != NULL)
-	{
-		char* context = NULL;
-		(void)strtok_s(buffer, "\n", &context);
-
-		if (fkt)
-		{
-			if (!fkt(clicon, buffer, strnlen(buffer, sizeof(buffer)), user, what, arg))
-				goto fail;
-		}
-		read_data = TRUE;
-	}
-
-	rc = read_data;
-	if (!rc)
-		WLog_ERR(TAG, "[ActionScript] No data returned from command '%s'", command);
-fail:
-	if (keyScript)
-		pclose(keyScript);
-	const BOOL res = rc || !clicon->actionScriptExists;
-	if (!rc)
-		clicon->actionScriptExists = FALSE;
-	return res;
-}
-
 int LogDynAndXCopyArea_ex(wLog* log, const char* file, const char* fkt, size_t line,
                           Display* display, Pixmap src, Window dest, GC gc, int src_x, int src_y,
                           unsigned int width, unsigned int height, int dest_x, int dest_y)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		XWindowAttributes attr = { 0 };
 		const Status rc = XGetWindowAttributes(display, dest, &attr);
@@ -312,7 +314,9 @@ int LogDynAndXCopyArea_ex(wLog* log, const char* file, const char* fkt, size_t l
 		return Success;
 	}
 
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XCopyArea(display, src, dest, gc, src_x, src_y, width, height, dest_x, dest_y);
+	xf_xprof_end(prof, file, fkt, line, "XCopyArea", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XCopyArea", rc);
 }
 
@@ -320,7 +324,7 @@ int LogDynAndXPutImage_ex(wLog* log, const char* file, const char* fkt, size_t l
                           Display* display, Drawable d, GC gc, XImage* image, int src_x, int src_y,
                           int dest_x, int dest_y, unsigned int width, unsigned int height)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line,
 		          "XPutImage(%p, d: {%lu}, gc: {%p}, image: [%p]{%d}, src_x: {%d}, src_y: {%d}, "
@@ -339,7 +343,10 @@ int LogDynAndXPutImage_ex(wLog* log, const char* file, const char* fkt, size_t l
 		return Success;
 	}
 
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XPutImage(display, d, gc, image, src_x, src_y, dest_x, dest_y, width, height);
+	const size_t bytes = image ? (size_t)height * (size_t)image->bytes_per_line : 0;
+	xf_xprof_end(prof, file, fkt, line, "XPutImage", bytes, FALSE);
 	return write_result_log_expect_success(log, WLOG_WARN, file, fkt, line, display, "XPutImage",
 	                                       rc);
 }
@@ -351,7 +358,7 @@ Status LogDynAndXSendEvent_ex(wLog* log, const char* file, const char* fkt, size
                               Display* display, Window w, int propagate, long event_mask,
                               XEvent* event_send)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line,
 		          "XSendEvent(%p, d: {%lu}, w: {%lu}, propagate: {%d}, event_mask: {%d}, "
@@ -359,42 +366,50 @@ Status LogDynAndXSendEvent_ex(wLog* log, const char* file, const char* fkt, size
 		          display, w, propagate, event_mask, event_send);
 	}
 
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSendEvent(display, w, propagate, event_mask, event_send);
+	xf_xprof_end(prof, file, fkt, line, "XSendEvent", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSendEvent", rc);
 }
 
 int LogDynAndXFlush_ex(wLog* log, const char* file, const char* fkt, size_t line, Display* display)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XFlush(%p)", display);
 	}
 
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XFlush(display);
+	xf_xprof_end(prof, file, fkt, line, "XFlush", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XFlush", rc);
 }
 
 Window LogDynAndXGetSelectionOwner_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                       Display* display, Atom selection)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* selectionstr = Safe_XGetAtomName(log, display, selection);
+		const char* selectionstr = Safe_XGetAtomName(log, display, selection);
 		write_log(log, log_level, file, fkt, line, "XGetSelectionOwner(%p, %s)", display,
 		          selectionstr);
-		XFree(selectionstr);
 	}
-	return XGetSelectionOwner(display, selection);
+	const UINT64 prof = xf_xprof_begin();
+	const Window rc = XGetSelectionOwner(display, selection);
+	xf_xprof_end(prof, file, fkt, line, "XGetSelectionOwner", 0, TRUE);
+	return rc;
 }
 
 int LogDynAndXDestroyWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                Display* display, Window window)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XDestroyWindow(%p, %lu)", display, window);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XDestroyWindow(display, window);
+	xf_xprof_end(prof, file, fkt, line, "XDestroyWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XDestroyWindow",
 	                                   rc);
 }
@@ -402,11 +417,13 @@ int LogDynAndXDestroyWindow_ex(wLog* log, const char* file, const char* fkt, siz
 int LogDynAndXSync_ex(wLog* log, const char* file, const char* fkt, size_t line, Display* display,
                       Bool discard)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSync(%p, %d)", display, discard);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSync(display, discard);
+	xf_xprof_end(prof, file, fkt, line, "XSync", 0, TRUE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSync", rc);
 }
 
@@ -414,12 +431,14 @@ int LogDynAndXChangeWindowAttributes_ex(wLog* log, const char* file, const char*
                                         Display* display, Window window, unsigned long valuemask,
                                         XSetWindowAttributes* attributes)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XChangeWindowAttributes(%p, %lu, 0x%08lu, %p)",
 		          display, window, valuemask, attributes);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XChangeWindowAttributes(display, window, valuemask, attributes);
+	xf_xprof_end(prof, file, fkt, line, "XChangeWindowAttributes", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display,
 	                                   "XChangeWindowAttributes", rc);
 }
@@ -427,12 +446,14 @@ int LogDynAndXChangeWindowAttributes_ex(wLog* log, const char* file, const char*
 int LogDynAndXSetTransientForHint_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                      Display* display, Window window, Window prop_window)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetTransientForHint(%p, %lu, %lu)", display,
 		          window, prop_window);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetTransientForHint(display, window, prop_window);
+	xf_xprof_end(prof, file, fkt, line, "XSetTransientForHint", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display,
 	                                   "XSetTransientForHint", rc);
 }
@@ -440,11 +461,13 @@ int LogDynAndXSetTransientForHint_ex(wLog* log, const char* file, const char* fk
 int LogDynAndXCloseDisplay_ex(wLog* log, const char* file, const char* fkt, size_t line,
                               Display* display)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XCloseDisplay(%p)", display);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XCloseDisplay(display);
+	xf_xprof_end(prof, file, fkt, line, "XCloseDisplay", 0, TRUE);
 	return write_result_log_expect_success(log, WLOG_WARN, file, fkt, line, display,
 	                                       "XCloseDisplay", rc);
 }
@@ -454,12 +477,15 @@ XImage* LogDynAndXCreateImage_ex(wLog* log, const char* file, const char* fkt, s
                                  int offset, char* data, unsigned int width, unsigned int height,
                                  int bitmap_pad, int bytes_per_line)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XCreateImage(%p)", display);
 	}
-	return XCreateImage(display, visual, depth, format, offset, data, width, height, bitmap_pad,
-	                    bytes_per_line);
+	const UINT64 prof = xf_xprof_begin();
+	XImage* rc = XCreateImage(display, visual, depth, format, offset, data, width, height,
+	                          bitmap_pad, bytes_per_line);
+	xf_xprof_end(prof, file, fkt, line, "XCreateImage", 0, FALSE);
+	return rc;
 }
 
 Window LogDynAndXCreateWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
@@ -468,32 +494,40 @@ Window LogDynAndXCreateWindow_ex(wLog* log, const char* file, const char* fkt, s
                                  unsigned int class, Visual* visual, unsigned long valuemask,
                                  XSetWindowAttributes* attributes)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XCreateWindow(%p)", display);
 	}
-	return XCreateWindow(display, parent, x, y, width, height, border_width, depth, class, visual,
-	                     valuemask, attributes);
+	const UINT64 prof = xf_xprof_begin();
+	const Window rc = XCreateWindow(display, parent, x, y, width, height, border_width, depth,
+	                                class, visual, valuemask, attributes);
+	xf_xprof_end(prof, file, fkt, line, "XCreateWindow", 0, FALSE);
+	return rc;
 }
 
 GC LogDynAndXCreateGC_ex(wLog* log, const char* file, const char* fkt, size_t line,
                          Display* display, Drawable d, unsigned long valuemask, XGCValues* values)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XCreateGC(%p)", display);
 	}
-	return XCreateGC(display, d, valuemask, values);
+	const UINT64 prof = xf_xprof_begin();
+	const GC rc = XCreateGC(display, d, valuemask, values);
+	xf_xprof_end(prof, file, fkt, line, "XCreateGC", 0, FALSE);
+	return rc;
 }
 
 int LogDynAndXFreeGC_ex(wLog* log, const char* file, const char* fkt, size_t line, Display* display,
                         GC gc)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XFreeGC(%p)", display);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XFreeGC(display, gc);
+	xf_xprof_end(prof, file, fkt, line, "XFreeGC", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XFreeGC", rc);
 }
 
@@ -501,36 +535,42 @@ Pixmap LogDynAndXCreatePixmap_ex(wLog* log, const char* file, const char* fkt, s
                                  Display* display, Drawable d, unsigned int width,
                                  unsigned int height, unsigned int depth)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XCreatePixmap(%p, 0x%08lu, %u, %u, %u)",
 		          display, d, width, height, depth);
 	}
-	return XCreatePixmap(display, d, width, height, depth);
+	const UINT64 prof = xf_xprof_begin();
+	const Pixmap rc = XCreatePixmap(display, d, width, height, depth);
+	xf_xprof_end(prof, file, fkt, line, "XCreatePixmap", 0, FALSE);
+	return rc;
 }
 
 int LogDynAndXFreePixmap_ex(wLog* log, const char* file, const char* fkt, size_t line,
                             Display* display, Pixmap pixmap)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XFreePixmap(%p)", display);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XFreePixmap(display, pixmap);
+	xf_xprof_end(prof, file, fkt, line, "XFreePixmap", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XFreePixmap", rc);
 }
 
 int LogDynAndXSetSelectionOwner_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                    Display* display, Atom selection, Window owner, Time time)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
-		char* selectionstr = Safe_XGetAtomName(log, display, selection);
+		const char* selectionstr = Safe_XGetAtomName(log, display, selection);
 		write_log(log, log_level, file, fkt, line, "XSetSelectionOwner(%p, %s, 0x%08lu, %lu)",
 		          display, selectionstr, owner, time);
-		XFree(selectionstr);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetSelectionOwner(display, selection, owner, time);
+	xf_xprof_end(prof, file, fkt, line, "XSetSelectionOwner", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display,
 	                                   "XSetSelectionOwner", rc);
 }
@@ -538,12 +578,14 @@ int LogDynAndXSetSelectionOwner_ex(wLog* log, const char* file, const char* fkt,
 int LogDynAndXSetForeground_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                Display* display, GC gc, unsigned long foreground)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetForeground(%p, %p, 0x%08lu)", display, gc,
 		          foreground);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetForeground(display, gc, foreground);
+	xf_xprof_end(prof, file, fkt, line, "XSetForeground", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetForeground",
 	                                   rc);
 }
@@ -551,24 +593,28 @@ int LogDynAndXSetForeground_ex(wLog* log, const char* file, const char* fkt, siz
 int LogDynAndXMoveWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                             Display* display, Window w, int x, int y)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XMoveWindow(%p, 0x%08lu, %d, %d)", display, w,
 		          x, y);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XMoveWindow(display, w, x, y);
+	xf_xprof_end(prof, file, fkt, line, "XMoveWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XMoveWindow", rc);
 }
 
 int LogDynAndXSetFillStyle_ex(wLog* log, const char* file, const char* fkt, size_t line,
                               Display* display, GC gc, int fill_style)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetFillStyle(%p, %p, %d)", display, gc,
 		          fill_style);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetFillStyle(display, gc, fill_style);
+	xf_xprof_end(prof, file, fkt, line, "XSetFillStyle", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetFillStyle",
 	                                   rc);
 }
@@ -576,12 +622,14 @@ int LogDynAndXSetFillStyle_ex(wLog* log, const char* file, const char* fkt, size
 int LogDynAndXSetFunction_ex(wLog* log, const char* file, const char* fkt, size_t line,
                              Display* display, GC gc, int function)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetFunction(%p, %p, %d)", display, gc,
 		          function);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetFunction(display, gc, function);
+	xf_xprof_end(prof, file, fkt, line, "XSetFunction", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetFunction",
 	                                   rc);
 }
@@ -589,11 +637,13 @@ int LogDynAndXSetFunction_ex(wLog* log, const char* file, const char* fkt, size_
 int LogDynAndXRaiseWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                              Display* display, Window w)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XRaiseWindow(%p, %lu)", display, w);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XRaiseWindow(display, w);
+	xf_xprof_end(prof, file, fkt, line, "XRaiseWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XRaiseWindow",
 	                                   rc);
 }
@@ -601,22 +651,26 @@ int LogDynAndXRaiseWindow_ex(wLog* log, const char* file, const char* fkt, size_
 int LogDynAndXMapWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                            Display* display, Window w)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XMapWindow(%p, %lu)", display, w);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XMapWindow(display, w);
+	xf_xprof_end(prof, file, fkt, line, "XMapWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XMapWindow", rc);
 }
 
 int LogDynAndXUnmapWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                              Display* display, Window w)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XUnmapWindow(%p, %lu)", display, w);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XUnmapWindow(display, w);
+	xf_xprof_end(prof, file, fkt, line, "XUnmapWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XUnmapWindow",
 	                                   rc);
 }
@@ -625,12 +679,14 @@ int LogDynAndXMoveResizeWindow_ex(wLog* log, const char* file, const char* fkt,
                                   Display* display, Window w, int x, int y, unsigned int width,
                                   unsigned int height)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XMoveResizeWindow(%p, %lu, %d, %d, %u, %u)",
 		          display, w, x, y, width, height);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XMoveResizeWindow(display, w, x, y, width, height);
+	xf_xprof_end(prof, file, fkt, line, "XMoveResizeWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display,
 	                                   "XMoveResizeWindow", rc);
 }
@@ -638,12 +694,14 @@ int LogDynAndXMoveResizeWindow_ex(wLog* log, const char* file, const char* fkt,
 Status LogDynAndXWithdrawWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                    Display* display, Window w, int screen_number)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XWithdrawWindow(%p, %lu, %d)", display, w,
 		          screen_number);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const Status rc = XWithdrawWindow(display, w, screen_number);
+	xf_xprof_end(prof, file, fkt, line, "XWithdrawWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XWithdrawWindow",
 	                                   rc);
 }
@@ -651,12 +709,14 @@ Status LogDynAndXWithdrawWindow_ex(wLog* log, const char* file, const char* fkt,
 int LogDynAndXResizeWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                               Display* display, Window w, unsigned int width, unsigned int height)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XResizeWindow(%p, %lu, %u, %u)", display, w,
 		          width, height);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XResizeWindow(display, w, width, height);
+	xf_xprof_end(prof, file, fkt, line, "XResizeWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XResizeWindow",
 	                                   rc);
 }
@@ -664,11 +724,13 @@ int LogDynAndXResizeWindow_ex(wLog* log, const char* file, const char* fkt, size
 int LogDynAndXClearWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                              Display* display, Window w)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XClearWindow(%p, %lu)", display, w);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XClearWindow(display, w);
+	xf_xprof_end(prof, file, fkt, line, "XClearWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XClearWindow",
 	                                   rc);
 }
@@ -676,12 +738,14 @@ int LogDynAndXClearWindow_ex(wLog* log, const char* file, const char* fkt, size_
 int LogDynAndXSetBackground_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                Display* display, GC gc, unsigned long background)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetBackground(%p, %p, %lu)", display, gc,
 		          background);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetBackground(display, gc, background);
+	xf_xprof_end(prof, file, fkt, line, "XSetBackground", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetBackground",
 	                                   rc);
 }
@@ -689,12 +753,14 @@ int LogDynAndXSetBackground_ex(wLog* log, const char* file, const char* fkt, siz
 int LogDynAndXSetClipMask_ex(wLog* log, const char* file, const char* fkt, size_t line,
                              Display* display, GC gc, Pixmap pixmap)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetClipMask(%p, %p, %lu)", display, gc,
 		          pixmap);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetClipMask(display, gc, pixmap);
+	xf_xprof_end(prof, file, fkt, line, "XSetClipMask", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetClipMask",
 	                                   rc);
 }
@@ -703,12 +769,14 @@ int LogDynAndXFillRectangle_ex(wLog* log, const char* file, const char* fkt, siz
                                Display* display, Window w, GC gc, int x, int y, unsigned int width,
                                unsigned int height)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XFillRectangle(%p, %lu, %p, %d, %d, %u, %u)",
 		          display, w, gc, x, y, width, height);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XFillRectangle(display, w, gc, x, y, width, height);
+	xf_xprof_end(prof, file, fkt, line, "XFillRectangle", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XFillRectangle",
 	                                   rc);
 }
@@ -716,23 +784,27 @@ int LogDynAndXFillRectangle_ex(wLog* log, const char* file, const char* fkt, siz
 int LogDynAndXSetRegion_ex(wLog* log, const char* file, const char* fkt, size_t line,
                            Display* display, GC gc, Region r)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XSetRegion(%p, %p, %lu)", display, gc, r);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XSetRegion(display, gc, r);
+	xf_xprof_end(prof, file, fkt, line, "XSetRegion", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XSetRegion", rc);
 }
 
 int LogDynAndXReparentWindow_ex(wLog* log, const char* file, const char* fkt, size_t line,
                                 Display* display, Window w, Window parent, int x, int y)
 {
-	if (WLog_IsLevelActive(log, log_level))
+	if (trace_call_site(log, file, line))
 	{
 		write_log(log, log_level, file, fkt, line, "XReparentWindow(%p, %lu, %lu, %d, %d)", display,
 		          w, parent, x, y);
 	}
+	const UINT64 prof = xf_xprof_begin();
 	const int rc = XReparentWindow(display, w, parent, x, y);
+	xf_xprof_end(prof, file, fkt, line, "XReparentWindow", 0, FALSE);
 	return write_result_log_expect_one(log, WLOG_WARN, file, fkt, line, display, "XReparentWindow",
 	                                   rc);
 }
@@ -31,14 +31,10 @@ const char* x11_error_to_string(clientContext* clicon, int error, char* buffer,
 #define X_GET_ATOM_VAR_NAME(x) #x
 #define Safe_XGetAtomName(log, display, atom) \
 	Safe_XGetAtomNameEx((log), (display), (atom), X_GET_ATOM_VAR_NAME(atom))
-char* Safe_XGetAtomNameEx(wLog* log, Display* display, Atom atom, const char* varname);
+/* The returned name is owned by the atom cache, do not XFree it */
+const char* Safe_XGetAtomNameEx(wLog* log, Display* display, Atom atom, const char* varname);
 Atom Logging_XInternAtom(wLog* log, Display* display, _Xconst char* atom_name, Bool only_if_exists);
 
-typedef BOOL (*fn_action_script_run)(clientContext* clicon, const char* buffer, size_t size, void* user,
-                                     const char* what, const char* arg);
-BOOL run_action_script(clientContext* clicon, const char* what, const char* arg, fn_action_script_run fkt,
-                       void* user);
-
 #define LogDynAndXCreatePixmap(log, display, d, width, height, depth)                       \
 	LogDynAndXCreatePixmap_ex((log), __FILE__, __func__, __LINE__, (display), (d), (width), \
 	                          (height), (depth))
@@ -204,6 +200,8 @@ extern Status LogDynAndXSendEvent_ex(wLog* log, const char* file, const char* fk
                                      Display* display, Window w, Bool propagate, long event_mask,
                                      XEvent* event_send);
 
+/* Reserved for xf_flush.c: everyone else goes through xf_flush_mark_dirty / xf_flush_barrier so
+ * flushes and syncs are scheduled and counted in one place. */
 #define LogDynAndXFlush(log, display) \
 	LogDynAndXFlush_ex(log, __FILE__, __func__, __LINE__, (display))
 extern Status LogDynAndXFlush_ex(wLog* log, const char* file, const char* fkt, size_t line,
@@ -289,3 +287,184 @@ extern int LogDynAndXSetFunction_ex(wLog* log, const char* file, const char* fkt
                                     Display* display, GC gc, int function);
 
 BOOL IsGnome(void);
+
+/* Log only every rate-th call per LogDynAnd* call site while WLOG_TRACE is active, 1 logs all */
+void xf_utils_set_trace_sample_rate(UINT32 rate);
+
+#if defined(WITH_X11_DIRECT_CALLS)
+/* Release builds: the wrappers compile down to plain Xlib calls, with no log lookup and no
+ * out-of-line call. log is still evaluated so callers do not get unused variable warnings. */
+
+static inline int xf_direct_XCopyArea(Display* display, Pixmap src, Window dest, GC gc, int src_x,
+                                      int src_y, unsigned int width, unsigned int height,
+                                      int dest_x, int dest_y)
+{
+	if ((width == 0) || (height == 0))
+		return Success;
+	return XCopyArea(display, src, dest, gc, src_x, src_y, width, height, dest_x, dest_y);
+}
+
+static inline int xf_direct_XPutImage(Display* display, Drawable d, GC gc, XImage* image,
+                                      int src_x, int src_y, int dest_x, int dest_y,
+                                      unsigned int width, unsigned int height)
+{
+	if ((width == 0) || (height == 0))
+		return Success;
+	return XPutImage(display, d, gc, image, src_x, src_y, dest_x, dest_y, width, height);
+}
+
+#undef LogDynAndXCreatePixmap
+#define LogDynAndXCreatePixmap(log, display, d, width, height, depth) \
+	((void)(log), XCreatePixmap((display), (d), (width), (height), (depth)))
+
+#undef LogDynAndXFreePixmap
+#define LogDynAndXFreePixmap(log, display, pixmap) ((void)(log), XFreePixmap((display), (pixmap)))
+
+#undef LogDynAndXCreateWindow
+#define LogDynAndXCreateWindow(log, display, parent, x, y, width, height, border_width, depth, \
+                               class, visual, valuemask, attributes)                           \
+	((void)(log), XCreateWindow((display), (parent), (x), (y), (width), (height),             \
+	                            (border_width), (depth), (class), (visual), (valuemask),         \
+	                            (attributes)))
+
+#undef LogDynAndXRaiseWindow
+#define LogDynAndXRaiseWindow(log, display, w) ((void)(log), XRaiseWindow((display), (w)))
+
+#undef LogDynAndXMapWindow
+#define LogDynAndXMapWindow(log, display, w) ((void)(log), XMapWindow((display), (w)))
+
+#undef LogDynAndXUnmapWindow
+#define LogDynAndXUnmapWindow(log, display, w) ((void)(log), XUnmapWindow((display), (w)))
+
+#undef LogDynAndXMoveResizeWindow
+#define LogDynAndXMoveResizeWindow(log, display, w, x, y, width, height) \
+	((void)(log), XMoveResizeWindow((display), (w), (x), (y), (width), (height)))
+
+#undef LogDynAndXWithdrawWindow
+#define LogDynAndXWithdrawWindow(log, display, w, screen_number) \
+	((void)(log), XWithdrawWindow((display), (w), (screen_number)))
+
+#undef LogDynAndXMoveWindow
+#define LogDynAndXMoveWindow(log, display, w, x, y) \
+	((void)(log), XMoveWindow((display), (w), (x), (y)))
+
+#undef LogDynAndXResizeWindow
+#define LogDynAndXResizeWindow(log, display, w, width, height) \
+	((void)(log), XResizeWindow((display), (w), (width), (height)))
+
+#undef LogDynAndXClearWindow
+#define LogDynAndXClearWindow(log, display, w) ((void)(log), XClearWindow((display), (w)))
+
+#undef LogDynAndXGetWindowProperty
+#define LogDynAndXGetWindowProperty(log, display, w, property, long_offset, long_length, delete, \
+                                    req_type, actual_type_return, actual_format_return,          \
+                                    nitems_return, bytes_after_return, prop_return)              \
+	((void)(log),                                                                                \
+	 XGetWindowProperty((display), (w), (property), (long_offset), (long_length), (delete),      \
+	                    (req_type), (actual_type_return), (actual_format_return), (nitems_return), \
+	                    (bytes_after_return), (prop_return)))
+
+#undef LogDynAndXReparentWindow
+#define LogDynAndXReparentWindow(log, display, w, parent, x, y) \
+	((void)(log), XReparentWindow((display), (w), (parent), (x), (y)))
+
+#undef LogDynAndXChangeProperty
+#define LogDynAndXChangeProperty(log, display, w, property, type, format, mode, data, nelements) \
+	((void)(log), XChangeProperty((display), (w), (property), (type), (format), (mode), (data),  \
+	                              (nelements)))
+
+#undef LogDynAndXDeleteProperty
+#define LogDynAndXDeleteProperty(log, display, w, property) \
+	((void)(log), XDeleteProperty((display), (w), (property)))
+
+#undef LogDynAndXConvertSelection
+#define LogDynAndXConvertSelection(log, display, selection, target, property, requestor, time) \
+	((void)(log),                                                                              \
+	 XConvertSelection((display), (selection), (target), (property), (requestor), (time)))
+
+#undef LogDynAndXCreateGC
+#define LogDynAndXCreateGC(log, display, d, valuemask, values) \
+	((void)(log), XCreateGC((display), (d), (valuemask), (values)))
+
+#undef LogDynAndXFreeGC
+#define LogDynAndXFreeGC(log, display, gc) ((void)(log), XFreeGC((display), (gc)))
+
+#undef LogDynAndXCreateImage
+#define LogDynAndXCreateImage(log, display, visual, depth, format, offset, data, width, height, \
+                              bitmap_pad, bytes_per_line)                                       \
+	((void)(log), XCreateImage((display), (visual), (depth), (format), (offset), (data),        \
+	                           (width), (height), (bitmap_pad), (bytes_per_line)))
+
+#undef LogDynAndXPutImage
+#define LogDynAndXPutImage(log, display, d, gc, image, src_x, src_y, dest_x, dest_y, width,      \
+                           height)                                                               \
+	((void)(log), xf_direct_XPutImage((display), (d), (gc), (image), (src_x), (src_y), (dest_x), \
+	                                  (dest_y), (width), (height)))
+
+#undef LogDynAndXCopyArea
+#define LogDynAndXCopyArea(log, display, src, dest, gc, src_x, src_y, width, height, dest_x,     \
+                           dest_y)                                                               \
+	((void)(log), xf_direct_XCopyArea((display), (src), (dest), (gc), (src_x), (src_y), (width), \
+	                                  (height), (dest_x), (dest_y)))
+
+#undef LogDynAndXSendEvent
+#define LogDynAndXSendEvent(log, display, w, propagate, event_mask, event_send) \
+	((void)(log), XSendEvent((display), (w), (propagate), (event_mask), (event_send)))
+
+#undef LogDynAndXFlush
+#define LogDynAndXFlush(log, display) ((void)(log), XFlush((display)))
+
+#undef LogDynAndXSync
+#define LogDynAndXSync(log, display, discard) ((void)(log), XSync((display), (discard)))
+
+#undef LogDynAndXGetSelectionOwner
+#define LogDynAndXGetSelectionOwner(log, display, selection) \
+	((void)(log), XGetSelectionOwner((display), (selection)))
+
+#undef LogDynAndXSetSelectionOwner
+#define LogDynAndXSetSelectionOwner(log, display, selection, owner, time) \
+	((void)(log), XSetSelectionOwner((display), (selection), (owner), (time)))
+
+#undef LogDynAndXDestroyWindow
+#define LogDynAndXDestroyWindow(log, display, window) \
+	((void)(log), XDestroyWindow((display), (window)))
+
+#undef LogDynAndXChangeWindowAttributes
+#define LogDynAndXChangeWindowAttributes(log, display, window, valuemask, attributes) \
+	((void)(log), XChangeWindowAttributes((display), (window), (valuemask), (attributes)))
+
+#undef LogDynAndXSetTransientForHint
+#define LogDynAndXSetTransientForHint(log, display, window, prop_window) \
+	((void)(log), XSetTransientForHint((display), (window), (prop_window)))
+
+#undef LogDynAndXCloseDisplay
+#define LogDynAndXCloseDisplay(log, display) ((void)(log), XCloseDisplay((display)))
+
+#undef LogDynAndXSetClipMask
+#define LogDynAndXSetClipMask(log, display, gc, pixmap) \
+	((void)(log), XSetClipMask((display), (gc), (pixmap)))
+
+#undef LogDynAndXSetRegion
+#define LogDynAndXSetRegion(log, display, gc, r) ((void)(log), XSetRegion((display), (gc), (r)))
+
+#undef LogDynAndXSetBackground
+#define LogDynAndXSetBackground(log, display, gc, background) \
+	((void)(log), XSetBackground((display), (gc), (background)))
+
+#undef LogDynAndXSetForeground
+#define LogDynAndXSetForeground(log, display, gc, foreground) \
+	((void)(log), XSetForeground((display), (gc), (foreground)))
+
+#undef LogDynAndXSetFillStyle
+#define LogDynAndXSetFillStyle(log, display, gc, fill_style) \
+	((void)(log), XSetFillStyle((display), (gc), (fill_style)))
+
+#undef LogDynAndXFillRectangle
+#define LogDynAndXFillRectangle(log, display, w, gc, x, y, width, height) \
+	((void)(log), XFillRectangle((display), (w), (gc), (x), (y), (width), (height)))
+
+#undef LogDynAndXSetFunction
+#define LogDynAndXSetFunction(log, display, gc, function) \
+	((void)(log), XSetFunction((display), (gc), (function)))
+
+#endif /* WITH_X11_DIRECT_CALLS */
@@ -1,17 +1,98 @@
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+
+#include <winpr/assert.h>
+
+#include <freerdp/log.h>
+
 #include "xf_window.h"
 
+#define TAG CLIENT_TAG("x11")
+
+/* _NET_WORKAREA holds one x, y, width, height quadruple per desktop */
+#define XF_WORKAREA_MAX_DESKTOPS 32
+
+static BOOL xf_FetchWorkArea(clientContext* clicon)
+{
+	BOOL rc = FALSE;
+
+	WINPR_ASSERT(clicon);
+
+	if (!clicon->display || (clicon->NET_CURRENT_DESKTOP == None) ||
+	    (clicon->NET_WORKAREA == None))
+		return FALSE;
+
+	xcb_connection_t* xcb = XGetXCBConnection(clicon->display);
+	const xcb_window_t root = (xcb_window_t)RootWindowOfScreen(clicon->screen);
+
+	/* Send both requests before waiting on either reply so the pair costs one round trip */
+	const xcb_get_property_cookie_t desktopCookie =
+	    xcb_get_property(xcb, 0, root, (xcb_atom_t)clicon->NET_CURRENT_DESKTOP, XCB_ATOM_CARDINAL,
+	                     0, 1);
+	const xcb_get_property_cookie_t workareaCookie =
+	    xcb_get_property(xcb, 0, root, (xcb_atom_t)clicon->NET_WORKAREA, XCB_ATOM_CARDINAL, 0,
+	                     4 * XF_WORKAREA_MAX_DESKTOPS);
+
+	xcb_get_property_reply_t* desktop = xcb_get_property_reply(xcb, desktopCookie, NULL);
+	xcb_get_property_reply_t* workarea = xcb_get_property_reply(xcb, workareaCookie, NULL);
+
+	if (!desktop || !workarea)
+		goto out;
+
+	if ((desktop->type != XCB_ATOM_CARDINAL) || (desktop->format != 32) ||
+	    (xcb_get_property_value_length(desktop) < (int)sizeof(uint32_t)))
+		goto out;
+
+	if ((workarea->type != XCB_ATOM_CARDINAL) || (workarea->format != 32))
+		goto out;
+
+	const uint32_t current = *(const uint32_t*)xcb_get_property_value(desktop);
+	const size_t nitems = (size_t)xcb_get_property_value_length(workarea) / sizeof(uint32_t);
+
+	if ((4ull * current + 3ull) >= nitems)
+	{
+		WLog_DBG(TAG, "_NET_WORKAREA has no entry for desktop %" PRIu32, current);
+		goto out;
+	}
+
+	const uint32_t* values = (const uint32_t*)xcb_get_property_value(workarea);
+	clicon->current_desktop = (int)current;
+	clicon->workArea.x = (INT32)values[current * 4 + 0];
+	clicon->workArea.y = (INT32)values[current * 4 + 1];
+	clicon->workArea.width = values[current * 4 + 2];
+	clicon->workArea.height = values[current * 4 + 3];
+	rc = TRUE;
+
+out:
+	free(desktop);
+	free(workarea);
+	return rc;
+}
+
 BOOL xf_GetWorkArea(clientContext* clicon)
 {
-    WINPR_ASSERT(clicon);
-
-    // Set dummy work area values
-    clicon->workArea.x = 0;
-    clicon->workArea.y = 0;
-    clicon->workArea.width = 1920;  // Default width
-    clicon->workArea.height = 1080; // Default height
-    
-    // Set a default desktop
-    clicon->current_desktop = 0;
-    
-    return TRUE;
-}
\ No newline at end of file
+	WINPR_ASSERT(clicon);
+
+	if (!clicon->workAreaCached)
+	{
+		clicon->workAreaAvailable = xf_FetchWorkArea(clicon);
+		clicon->workAreaCached = TRUE;
+	}
+
+	return clicon->workAreaAvailable;
+}
+
+BOOL xf_WorkAreaPropertyNotify(clientContext* clicon, const XPropertyEvent* event)
+{
+	WINPR_ASSERT(clicon);
+	WINPR_ASSERT(event);
+
+	if (!clicon->screen || (event->window != RootWindowOfScreen(clicon->screen)))
+		return FALSE;
+
+	if ((event->atom != clicon->NET_WORKAREA) && (event->atom != clicon->NET_CURRENT_DESKTOP))
+		return FALSE;
+
+	clicon->workAreaCached = FALSE;
+	return TRUE;
+}
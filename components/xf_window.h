@@ -24,6 +24,11 @@
 
 typedef struct client_context clientContext;
 
+/* Returns the cached _NET_WORKAREA of the current desktop, fetching it on first use. */
 BOOL xf_GetWorkArea(clientContext* clicon);
 
+/* Invalidates the cached work area if the root window event touches one of its properties.
+ * Returns TRUE if the cache was invalidated. */
+BOOL xf_WorkAreaPropertyNotify(clientContext* clicon, const XPropertyEvent* event);
+
 #endif /* FREERDP_CLIENT_X11_WINDOW_H */
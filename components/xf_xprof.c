@@ -0,0 +1,376 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 per call site request profiler
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <winpr/assert.h>
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/interlocked.h>
+#include <winpr/string.h>
+
+#include <freerdp/log.h>
+
+#include "xf_xprof.h"
+
+#define TAG CLIENT_TAG("x11.xprof")
+
+#define XPROF_SITE_SLOTS 512
+
+/* bucket n counts calls that took [2^n, 2^(n+1)) ns, the last one everything above */
+#define XPROF_BUCKETS 40
+
+typedef struct
+{
+	volatile LONGLONG key;
+	PVOID volatile call; /* published last, sites without it are skipped by the dump */
+	const char* file;
+	const char* fkt;
+	size_t line;
+	volatile LONG roundTrip;
+	volatile LONGLONG count;
+	volatile LONGLONG bytes;
+	volatile LONGLONG totalNs;
+	volatile LONGLONG maxNs;
+	volatile LONGLONG histogram[XPROF_BUCKETS];
+} XprofSite;
+
+/* plain copy of a site taken by the dump */
+typedef struct
+{
+	const char* call;
+	const char* file;
+	const char* fkt;
+	size_t line;
+	BOOL roundTrip;
+	UINT64 count;
+	UINT64 bytes;
+	UINT64 totalNs;
+	UINT64 maxNs;
+	UINT64 histogram[XPROF_BUCKETS];
+} XprofReport;
+
+volatile LONG xf_xprof_active = 0;
+
+static XprofSite xprof_sites[XPROF_SITE_SLOTS];
+static volatile LONG xprof_dropped = 0;
+static volatile sig_atomic_t xprof_dump_requested = 0;
+static XfXprofFormat xprof_format = XF_XPROF_FORMAT_TABLE;
+static char xprof_path[MAX_PATH] = { 0 };
+
+LONGLONG xf_call_site_key(const char* file, size_t line)
+{
+	UINT64 key = (UINT64)(uintptr_t)file ^ (line * 0x9E3779B97F4A7C15ull);
+	key ^= key >> 29;
+	return (LONGLONG)(key | 1); /* 0 marks a free slot */
+}
+
+static size_t xprof_bucket(UINT64 ns)
+{
+	size_t bucket = 0;
+	while ((ns >>= 1) != 0)
+		bucket++;
+	return MIN(bucket, XPROF_BUCKETS - 1);
+}
+
+static XprofSite* xprof_site(const char* file, const char* fkt, size_t line, const char* call)
+{
+	const LONGLONG key = xf_call_site_key(file, line);
+
+	for (size_t probe = 0; probe < XPROF_SITE_SLOTS; probe++)
+	{
+		XprofSite* site = &xprof_sites[((UINT64)key + probe) & (XPROF_SITE_SLOTS - 1)];
+
+		LONGLONG cur = site->key;
+		if (cur == key)
+			return site;
+		if (cur != 0)
+			continue;
+
+		cur = InterlockedCompareExchange64(&site->key, key, 0);
+		if (cur == 0)
+		{
+			site->file = file;
+			site->fkt = fkt;
+			site->line = line;
+			(void)InterlockedExchangePointer(&site->call, (PVOID)call);
+			return site;
+		}
+		if (cur == key)
+			return site;
+	}
+
+	return NULL;
+}
+
+void xf_xprof_record(const char* file, const char* fkt, size_t line, const char* call,
+                     UINT64 start, size_t bytes, BOOL roundTrip)
+{
+	const UINT64 end = winpr_GetTickCount64NS();
+	const UINT64 ns = (end > start) ? end - start : 0;
+
+	XprofSite* site = xprof_site(file, fkt, line, call);
+	if (!site)
+	{
+		(void)InterlockedIncrement(&xprof_dropped);
+		return;
+	}
+
+	(void)InterlockedIncrement64(&site->count);
+	(void)InterlockedExchangeAdd64(&site->bytes, (LONGLONG)bytes);
+	(void)InterlockedExchangeAdd64(&site->totalNs, (LONGLONG)ns);
+	(void)InterlockedIncrement64(&site->histogram[xprof_bucket(ns)]);
+
+	LONGLONG max = site->maxNs;
+	while ((LONGLONG)ns > max)
+	{
+		const LONGLONG prev = InterlockedCompareExchange64(&site->maxNs, (LONGLONG)ns, max);
+		if (prev == max)
+			break;
+		max = prev;
+	}
+
+	if (roundTrip && !site->roundTrip)
+		(void)InterlockedExchange(&site->roundTrip, 1);
+}
+
+static int xprof_compare(const void* a, const void* b)
+{
+	const XprofReport* ra = a;
+	const XprofReport* rb = b;
+
+	if (ra->totalNs != rb->totalNs)
+		return (ra->totalNs < rb->totalNs) ? 1 : -1;
+	if (ra->count != rb->count)
+		return (ra->count < rb->count) ? 1 : -1;
+	return 0;
+}
+
+/* upper bound of the bucket holding the q-th fraction of calls */
+static UINT64 xprof_percentile(const XprofReport* report, double q)
+{
+	const UINT64 target = (UINT64)(q * (double)report->count);
+	UINT64 seen = 0;
+
+	for (size_t x = 0; x < XPROF_BUCKETS; x++)
+	{
+		seen += report->histogram[x];
+		if ((seen > target) || (seen == report->count))
+			return MIN(1ull << (x + 1), report->maxNs);
+	}
+	return report->maxNs;
+}
+
+static size_t xprof_collect(XprofReport* reports, size_t count)
+{
+	size_t used = 0;
+
+	for (size_t x = 0; (x < XPROF_SITE_SLOTS) && (used < count); x++)
+	{
+		const XprofSite* site = &xprof_sites[x];
+		const char* call = site->call;
+		if (!call)
+			continue;
+
+		XprofReport* report = &reports[used++];
+		report->call = call;
+		report->file = site->file;
+		report->fkt = site->fkt;
+		report->line = site->line;
+		report->roundTrip = site->roundTrip != 0;
+		report->count = (UINT64)site->count;
+		report->bytes = (UINT64)site->bytes;
+		report->totalNs = (UINT64)site->totalNs;
+		report->maxNs = (UINT64)site->maxNs;
+		for (size_t y = 0; y < XPROF_BUCKETS; y++)
+			report->histogram[y] = (UINT64)site->histogram[y];
+	}
+
+	qsort(reports, used, sizeof(XprofReport), xprof_compare);
+	return used;
+}
+
+static void xprof_write_json_string(FILE* fp, const char* str)
+{
+	(void)fputc('"', fp);
+	for (const char* cur = str ? str : ""; *cur; cur++)
+	{
+		if ((*cur == '"') || (*cur == '\\'))
+			(void)fputc('\\', fp);
+		(void)fputc(*cur, fp);
+	}
+	(void)fputc('"', fp);
+}
+
+static void xprof_write_table(FILE* fp, const XprofReport* reports, size_t count)
+{
+	(void)fprintf(fp, "%-24s %10s %12s %12s %10s %10s %10s %10s  %s\n", "call", "count", "bytes",
+	              "total_ms", "avg_us", "p50_us", "p99_us", "max_us", "site (* = round trip)");
+
+	for (size_t x = 0; x < count; x++)
+	{
+		const XprofReport* r = &reports[x];
+		const double avg = r->count ? (double)r->totalNs / (double)r->count : 0.0;
+
+		(void)fprintf(fp,
+		              "%-24s %10" PRIu64 " %12" PRIu64 " %12.3f %10.1f %10.1f %10.1f %10.1f  %s%s:%" PRIuz
+		              " (%s)\n",
+		              r->call, r->count, r->bytes, (double)r->totalNs / 1000000.0, avg / 1000.0,
+		              (double)xprof_percentile(r, 0.5) / 1000.0,
+		              (double)xprof_percentile(r, 0.99) / 1000.0, (double)r->maxNs / 1000.0,
+		              r->roundTrip ? "*" : "", r->file, r->line, r->fkt);
+	}
+
+	(void)fprintf(fp, "%" PRIuz " call sites, %" PRId32 " calls dropped (table full)\n", count,
+	              xprof_dropped);
+}
+
+static void xprof_write_json(FILE* fp, const XprofReport* reports, size_t count)
+{
+	(void)fprintf(fp, "{\"dropped\":%" PRId32 ",\"sites\":[", xprof_dropped);
+
+	for (size_t x = 0; x < count; x++)
+	{
+		const XprofReport* r = &reports[x];
+
+		(void)fprintf(fp, "%s{\"call\":", (x > 0) ? "," : "");
+		xprof_write_json_string(fp, r->call);
+		(void)fprintf(fp, ",\"file\":");
+		xprof_write_json_string(fp, r->file);
+		(void)fprintf(fp, ",\"function\":");
+		xprof_write_json_string(fp, r->fkt);
+		(void)fprintf(fp,
+		              ",\"line\":%" PRIuz ",\"round_trip\":%s,\"count\":%" PRIu64
+		              ",\"bytes\":%" PRIu64 ",\"total_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64
+		              ",\"histogram_log2_ns\":[",
+		              r->line, r->roundTrip ? "true" : "false", r->count, r->bytes, r->totalNs,
+		              r->maxNs);
+
+		for (size_t y = 0; y < XPROF_BUCKETS; y++)
+			(void)fprintf(fp, "%s%" PRIu64, (y > 0) ? "," : "", r->histogram[y]);
+
+		(void)fprintf(fp, "]}");
+	}
+
+	(void)fprintf(fp, "]}\n");
+}
+
+BOOL xf_xprof_dump(FILE* fp, XfXprofFormat format)
+{
+	WINPR_ASSERT(fp);
+
+	XprofReport* reports = calloc(XPROF_SITE_SLOTS, sizeof(XprofReport));
+	if (!reports)
+		return FALSE;
+
+	const size_t count = xprof_collect(reports, XPROF_SITE_SLOTS);
+
+	switch (format)
+	{
+		case XF_XPROF_FORMAT_JSON:
+			xprof_write_json(fp, reports, count);
+			break;
+		case XF_XPROF_FORMAT_TABLE:
+		default:
+			xprof_write_table(fp, reports, count);
+			break;
+	}
+
+	(void)fflush(fp);
+	free(reports);
+	return TRUE;
+}
+
+static void xprof_dump_configured(void)
+{
+	if (xprof_path[0] == '\0')
+	{
+		(void)xf_xprof_dump(stderr, xprof_format);
+		return;
+	}
+
+	FILE* fp = winpr_fopen(xprof_path, "a");
+	if (!fp)
+	{
+		WLog_WARN(TAG, "failed to open profile output '%s'", xprof_path);
+		return;
+	}
+
+	(void)xf_xprof_dump(fp, xprof_format);
+	(void)fclose(fp);
+}
+
+static void xprof_signal_handler(int signum)
+{
+	WINPR_UNUSED(signum);
+	xprof_dump_requested = 1;
+}
+
+BOOL xf_xprof_init_from_env(void)
+{
+	// NOLINTNEXTLINE(concurrency-mt-unsafe)
+	const char* mode = getenv("XF_XPROF");
+	if (!mode)
+		return TRUE;
+
+	if (strcmp(mode, "json") == 0)
+		xprof_format = XF_XPROF_FORMAT_JSON;
+	else if (strcmp(mode, "table") == 0)
+		xprof_format = XF_XPROF_FORMAT_TABLE;
+	else
+	{
+		WLog_WARN(TAG, "XF_XPROF=%s not supported, use 'table' or 'json'", mode);
+		return FALSE;
+	}
+
+	// NOLINTNEXTLINE(concurrency-mt-unsafe)
+	const char* path = getenv("XF_XPROF_FILE");
+	if (path)
+		(void)strncpy(xprof_path, path, sizeof(xprof_path) - 1);
+
+	struct sigaction sa = { 0 };
+	sa.sa_handler = xprof_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	(void)sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) != 0)
+		WLog_WARN(TAG, "failed to install SIGUSR1 handler, profile is only written at exit");
+
+	(void)InterlockedExchange(&xf_xprof_active, 1);
+	WLog_INFO(TAG, "X request profiling enabled, send SIGUSR1 to pid %lu for a report",
+	          (unsigned long)getpid());
+	return TRUE;
+}
+
+void xf_xprof_dump_if_requested(void)
+{
+	if (!xprof_dump_requested)
+		return;
+
+	xprof_dump_requested = 0;
+	xprof_dump_configured();
+}
+
+void xf_xprof_dump_final(void)
+{
+	if (!xf_xprof_active)
+		return;
+
+	xprof_dump_configured();
+}
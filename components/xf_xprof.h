@@ -0,0 +1,68 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 per call site request profiler
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_XPROF_H
+#define FREERDP_CLIENT_X11_XPROF_H
+
+#include <stdio.h>
+
+#include <winpr/wtypes.h>
+#include <winpr/sysinfo.h>
+
+typedef enum
+{
+	XF_XPROF_FORMAT_TABLE,
+	XF_XPROF_FORMAT_JSON
+} XfXprofFormat;
+
+/* Non zero while profiling is enabled, read by the inline helpers below */
+extern volatile LONG xf_xprof_active;
+
+/* Enables profiling if XF_XPROF is set to "table" or "json" in the environment. The report goes
+ * to XF_XPROF_FILE (default stderr) on SIGUSR1 and at disconnect. */
+BOOL xf_xprof_init_from_env(void);
+
+/* Non zero hash of a LogDynAnd* call site, keys the per site tables of the profiler and tracer */
+LONGLONG xf_call_site_key(const char* file, size_t line);
+
+void xf_xprof_record(const char* file, const char* fkt, size_t line, const char* call,
+                     UINT64 start, size_t bytes, BOOL roundTrip);
+
+/* Writes the current counters, sorted by total time spent, and leaves them untouched */
+BOOL xf_xprof_dump(FILE* fp, XfXprofFormat format);
+
+/* Writes the report to the configured destination if one was requested via SIGUSR1 */
+void xf_xprof_dump_if_requested(void);
+
+/* Writes the report to the configured destination if profiling is enabled */
+void xf_xprof_dump_final(void);
+
+static inline UINT64 xf_xprof_begin(void)
+{
+	if (!xf_xprof_active)
+		return 0;
+	return winpr_GetTickCount64NS();
+}
+
+static inline void xf_xprof_end(UINT64 start, const char* file, const char* fkt, size_t line,
+                                const char* call, size_t bytes, BOOL roundTrip)
+{
+	if (start != 0)
+		xf_xprof_record(file, fkt, line, call, start, bytes, roundTrip);
+}
+
+#endif /* FREERDP_CLIENT_X11_XPROF_H */
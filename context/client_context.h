@@ -5,6 +5,9 @@
 #include <freerdp/locale/keyboard.h>
 #include <X11/Xlib.h>
 #include "../components/xf_monitor.h"
+#include "../components/xf_settings.h"
+#include "../components/xf_flush.h"
+#include "../components/xf_cliprdr.h"
 
 typedef struct vir_screen VIRTUAL_SCREEN;
 
@@ -29,8 +32,12 @@ typedef struct client_context
     
     // Add any additional fields specific to the client context here
 
-	BOOL actionScriptExists;
+	SettingsSnapshot settingsSnapshot;
 	WorkArea workArea;
+	BOOL workAreaCached;
+	BOOL workAreaAvailable;
+	XfFlushState flush;
+	xfClipboard* clipboard;
     FullscreenMonitors fullscreenMonitors;
 
 
@@ -32,6 +32,9 @@ int main(int argc, char* argv[]){
         goto out;
 	}
 
+	if (!xf_settings_snapshot_update(cli_context))
+		goto out;
+
     if (!stream_dump_register_handlers(context, CONNECTION_STATE_MCS_CREATE_REQUEST, FALSE))
 		goto out;
 